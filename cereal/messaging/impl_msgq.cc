@@ -35,6 +35,15 @@ static size_t get_size(std::string endpoint){
   return sz;
 }
 
+static size_t get_num_readers(std::string endpoint){
+  for (const auto& it : services) {
+    if (it.name == endpoint && it.num_readers > 0) {
+      return it.num_readers;
+    }
+  }
+  return DEFAULT_NUM_READERS;
+}
+
 
 MSGQContext::MSGQContext() {
 }
@@ -58,10 +67,28 @@ void MSGQMessage::takeOwnership(char * d, size_t sz) {
   data = d;
 }
 
+void MSGQMessage::borrow(msgq_queue_t * q, char * d, size_t sz) {
+  view_q = q;
+  size = sz;
+  data = d;
+}
+
+bool MSGQMessage::valid() {
+  if (view_q == NULL){
+    return true;
+  }
+
+  msgq_msg_t msg;
+  msg.data = data;
+  msg.size = size;
+  return msgq_msg_view_valid(&msg, view_q);
+}
+
 void MSGQMessage::close() {
-  if (size > 0){
+  if (size > 0 && view_q == NULL){
     delete[] data;
   }
+  view_q = NULL;
   size = 0;
 }
 
@@ -78,7 +105,7 @@ int MSGQSubSocket::connect(Context *context, std::string endpoint, std::string a
   }
 
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint));
+  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint), get_num_readers(endpoint));
   if (r != 0){
     return r;
   }
@@ -95,7 +122,7 @@ int MSGQSubSocket::connect(Context *context, std::string endpoint, std::string a
 }
 
 
-Message * MSGQSubSocket::receive(bool non_blocking){
+int MSGQSubSocket::receiveMsg(msgq_msg_t *msg, bool non_blocking, bool view){
   msgq_do_exit = 0;
 
   void (*prev_handler_sigint)(int);
@@ -105,11 +132,7 @@ Message * MSGQSubSocket::receive(bool non_blocking){
     prev_handler_sigterm = std::signal(SIGTERM, sig_handler);
   }
 
-  msgq_msg_t msg;
-
-  MSGQMessage *r = NULL;
-
-  int rc = msgq_msg_recv(&msg, q);
+  int rc = view ? msgq_msg_recv_view(msg, q) : msgq_msg_recv(msg, q);
 
   // Hack to implement blocking read with a poller. Don't use this
   while (!non_blocking && rc == 0 && msgq_do_exit == 0){
@@ -119,7 +142,7 @@ Message * MSGQSubSocket::receive(bool non_blocking){
     int t = (timeout != -1) ? timeout : 100;
 
     int n = msgq_poll(items, 1, t);
-    rc = msgq_msg_recv(&msg, q);
+    rc = view ? msgq_msg_recv_view(msg, q) : msgq_msg_recv(msg, q);
 
     // The poll indicated a message was ready, but the receive failed. Try again
     if (n == 1 && rc == 0){
@@ -139,6 +162,16 @@ Message * MSGQSubSocket::receive(bool non_blocking){
 
   errno = msgq_do_exit ? EINTR : 0;
 
+  return rc;
+}
+
+Message * MSGQSubSocket::receive(bool non_blocking){
+  msgq_msg_t msg;
+
+  MSGQMessage *r = NULL;
+
+  int rc = receiveMsg(&msg, non_blocking, false);
+
   if (rc > 0){
     if (msgq_do_exit){
       msgq_msg_close(&msg); // Free unused message on exit
@@ -151,6 +184,33 @@ Message * MSGQSubSocket::receive(bool non_blocking){
   return (Message*)r;
 }
 
+Message * MSGQSubSocket::receiveView(bool non_blocking){
+  msgq_msg_t msg;
+
+  MSGQMessage *r = NULL;
+
+  while (receiveMsg(&msg, non_blocking, true) > 0 && !msgq_do_exit){
+    r = new MSGQMessage;
+
+    if (msgq_msg_view_headroom(q) >= q->size / 4){
+      r->borrow(q, msg.data, msg.size);
+      break;
+    }
+
+    // The writer is about to lap the view, fall back to a copy
+    r->init(msg.data, msg.size);
+    if (msgq_msg_view_valid(&msg, q)){
+      msgq_msg_release_view(q);
+      break;
+    }
+
+    delete r;
+    r = NULL;
+  }
+
+  return (Message*)r;
+}
+
 void MSGQSubSocket::setTimeout(int t){
   timeout = t;
 }
@@ -170,7 +230,7 @@ int MSGQPubSocket::connect(Context *context, std::string endpoint, bool check_en
   }
 
   q = new msgq_queue_t;
-  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint));
+  int r = msgq_new_queue(q, endpoint.c_str(), get_size(endpoint), get_num_readers(endpoint));
   if (r != 0){
     return r;
   }
@@ -196,6 +256,31 @@ int MSGQPubSocket::send(char *data, size_t size){
   return msgq_msg_send(&msg, q);
 }
 
+char * MSGQPubSocket::reserve(size_t size){
+  msgq_msg_t msg;
+  msg.size = size;
+
+  if (msgq_msg_reserve(&msg, q) < 0){
+    return NULL;
+  }
+  return msg.data;
+}
+
+int MSGQPubSocket::commit(bool notify){
+  if (msgq_msg_commit(q) < 0){
+    return -1;
+  }
+
+  if (notify){
+    msgq_notify_readers(q);
+  }
+  return 0;
+}
+
+void MSGQPubSocket::notify(){
+  msgq_notify_readers(q);
+}
+
 bool MSGQPubSocket::all_readers_updated() {
   return msgq_all_readers_updated(q);
 }
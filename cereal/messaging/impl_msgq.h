@@ -19,12 +19,15 @@ class MSGQMessage : public Message {
 private:
   char * data;
   size_t size;
+  msgq_queue_t * view_q = NULL;
 public:
   void init(size_t size);
   void init(char *data, size_t size);
   void takeOwnership(char *data, size_t size);
+  void borrow(msgq_queue_t *q, char *data, size_t size);
   size_t getSize(){return size;}
   char * getData(){return data;}
+  bool valid();
   void close();
   ~MSGQMessage();
 };
@@ -33,11 +36,16 @@ class MSGQSubSocket : public SubSocket {
 private:
   msgq_queue_t * q = NULL;
   int timeout;
+  int receiveMsg(msgq_msg_t *msg, bool non_blocking, bool view);
 public:
   int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true);
   void setTimeout(int timeout);
   void * getRawSocket() {return (void*)q;}
   Message *receive(bool non_blocking=false);
+  Message *receiveView(bool non_blocking=false);
+  size_t lag() {return msgq_msg_lag(q);}
+  size_t bufferSize() {return q->size;}
+  uint64_t lapped() {return q->read_lapped;}
   ~MSGQSubSocket();
 };
 
@@ -48,6 +56,9 @@ public:
   int connect(Context *context, std::string endpoint, bool check_endpoint=true);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  char *reserve(size_t size);
+  int commit(bool notify=true);
+  void notify();
   bool all_readers_updated();
   ~MSGQPubSocket();
 };
@@ -131,6 +131,27 @@ int ZMQPubSocket::send(char *data, size_t size){
   return zmq_send(sock, data, size, ZMQ_DONTWAIT);
 }
 
+char * ZMQPubSocket::reserve(size_t size){
+  reserved.resize(size);
+  return reserved.data();
+}
+
+int ZMQPubSocket::commit(bool notify){
+  if (!notify){
+    held.push_back(reserved);
+    return reserved.size();
+  }
+  this->notify();
+  return send(reserved.data(), reserved.size());
+}
+
+void ZMQPubSocket::notify(){
+  for (auto &m : held){
+    send(m.data(), m.size());
+  }
+  held.clear();
+}
+
 bool ZMQPubSocket::all_readers_updated() {
   assert(false); // TODO not implemented
   return false;
@@ -2,6 +2,7 @@
 #include "messaging.h"
 #include <zmq.h>
 #include <string>
+#include <vector>
 
 #define MAX_POLLERS 128
 
@@ -43,10 +44,17 @@ class ZMQPubSocket : public PubSocket {
 private:
   void * sock;
   std::string full_endpoint;
+  std::vector<char> reserved;
+  // committed without notify. ZMQ can't publish a message without waking the
+  // subscribers, so they're held back and sent by notify()
+  std::vector<std::vector<char>> held;
 public:
   int connect(Context *context, std::string endpoint, bool check_endpoint=true);
   int sendMessage(Message *message);
   int send(char *data, size_t size);
+  char *reserve(size_t size);
+  int commit(bool notify=true);
+  void notify();
   bool all_readers_updated();
   ~ZMQPubSocket();
 };
@@ -1,7 +1,9 @@
 #pragma once
+#include <cassert>
 #include <cstddef>
 #include <map>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <capnp/serialize.h>
 #include "../gen/cpp/log.capnp.h"
@@ -28,6 +30,8 @@ public:
   virtual void close() = 0;
   virtual size_t getSize() = 0;
   virtual char * getData() = 0;
+  // False once the data of a borrowed message (see SubSocket::receiveView) was overwritten
+  virtual bool valid() { return true; }
   virtual ~Message(){};
 };
 
@@ -37,6 +41,14 @@ public:
   virtual int connect(Context *context, std::string endpoint, std::string address, bool conflate=false, bool check_endpoint=true) = 0;
   virtual void setTimeout(int timeout) = 0;
   virtual Message *receive(bool non_blocking=false) = 0;
+  // Like receive, but the message may point straight into the transport's buffer. The data is
+  // word aligned and usable until the next receive on this socket, check valid() after reading it.
+  virtual Message *receiveView(bool non_blocking=false) { return receive(non_blocking); }
+  // Bytes published but not received yet, out of bufferSize(). Messages are lost once the
+  // lag reaches the buffer size, lapped() counts how often that happened. 0 if the transport can't tell
+  virtual size_t lag() { return 0; }
+  virtual size_t bufferSize() { return 0; }
+  virtual uint64_t lapped() { return 0; }
   virtual void * getRawSocket() = 0;
   static SubSocket * create();
   static SubSocket * create(Context * context, std::string endpoint, std::string address="127.0.0.1", bool conflate=false, bool check_endpoint=true);
@@ -48,6 +60,13 @@ public:
   virtual int connect(Context *context, std::string endpoint, bool check_endpoint=true) = 0;
   virtual int sendMessage(Message *message) = 0;
   virtual int send(char *data, size_t size) = 0;
+  // Two step send, reserve space for size bytes, fill it in and commit. Subscribers are
+  // only woken up on commit, pass notify=false and call notify() to batch the wakeups.
+  // With msgq a message committed without notify can already be received, ZMQ only
+  // sends it on notify().
+  virtual char *reserve(size_t size) = 0;
+  virtual int commit(bool notify=true) = 0;
+  virtual void notify() = 0;
   virtual bool all_readers_updated() = 0;
   static PubSocket * create();
   static PubSocket * create(Context * context, std::string endpoint, bool check_endpoint=true);
@@ -92,9 +111,19 @@ private:
   std::map<std::string, SubMessage *> services_;
 };
 
+struct MessageArenaSegment {
+  kj::Array<capnp::word> words;
+  size_t size_hint = capnp::SUGGESTED_FIRST_SEGMENT_WORDS; // largest message built in this segment, in words
+  bool in_use = false;
+};
+
 class MessageBuilder : public capnp::MallocMessageBuilder {
 public:
   MessageBuilder() = default;
+  // Builds into a first segment from a per-thread arena, sized after the largest message built
+  // for service so far. In steady state building and sending the message doesn't allocate.
+  explicit MessageBuilder(const char *service) : MessageBuilder(arenaSegment(service)) {}
+  ~MessageBuilder();
 
   cereal::Event::Builder initEvent(bool valid = true) {
     cereal::Event::Builder event = initRoot<cereal::Event>();
@@ -111,19 +140,44 @@ public:
     return heapArray_.asBytes();
   }
 
+  size_t getSerializedSize() {
+    return capnp::computeSerializedSizeInWords(*this) * sizeof(capnp::word);
+  }
+
+  // Serializes into buffer without an intermediate copy, buffer_size must be at least getSerializedSize()
+  void serializeToBuffer(capnp::byte *buffer, size_t buffer_size) {
+    kj::ArrayOutputStream stream(kj::ArrayPtr<capnp::byte>(buffer, buffer_size));
+    capnp::writeMessage(stream, *this);
+  }
+
 private:
+  MessageBuilder(MessageArenaSegment *segment) : capnp::MallocMessageBuilder(segment->words), arena_segment_(segment) {}
+  static MessageArenaSegment *arenaSegment(const char *service);
+
   kj::Array<capnp::word> heapArray_;
+  MessageArenaSegment *arena_segment_ = nullptr;
 };
 
 class PubMaster {
 public:
   PubMaster(const std::vector<const char *> &service_list);
-  inline int send(const char *name, capnp::byte *data, size_t size) { return sockets_.at(name)->send((char *)data, size); }
+  inline int send(const char *name, capnp::byte *data, size_t size) { return socket(name)->send((char *)data, size); }
   int send(const char *name, MessageBuilder &msg);
+  // For messages written without a MessageBuilder, see PubSocket::reserve
+  inline char *reserve(const char *name, size_t size) { return socket(name)->reserve(size); }
+  inline int commit(const char *name) { return socket(name)->commit(); }
+  // Publishes all messages first, then wakes up the subscribers in a single pass
+  int send(const std::vector<std::pair<const char *, MessageBuilder *>> &msgs);
   ~PubMaster();
 
 private:
-  std::map<std::string, PubSocket *> sockets_;
+  // Looked up without creating a std::string, sending doesn't need to allocate
+  inline PubSocket *socket(const char *name) const {
+    auto it = sockets_.find(std::string_view(name));
+    assert(it != sockets_.end());
+    return it->second;
+  }
+  std::map<std::string, PubSocket *, std::less<>> sockets_;
 };
 
 class AlignedBuffer {
@@ -139,6 +193,13 @@ public:
   inline kj::ArrayPtr<const capnp::word> align(Message *m) {
     return align(m->getData(), m->getSize());
   }
+  // Reads the message in place if it's already word aligned, like a view from SubSocket::receiveView
+  inline kj::ArrayPtr<const capnp::word> view(Message *m) {
+    if ((uintptr_t)m->getData() % sizeof(capnp::word) != 0) {
+      return align(m);
+    }
+    return kj::ArrayPtr<const capnp::word>((const capnp::word *)m->getData(), m->getSize() / sizeof(capnp::word));
+  }
 private:
   kj::Array<capnp::word> aligned_buf;
   size_t words_size;
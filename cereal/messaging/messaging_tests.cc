@@ -0,0 +1,123 @@
+#include <cstdlib>
+
+#include "catch2/catch.hpp"
+#include "messaging.h"
+
+// Count heap allocations of the current thread, operator new ends up in malloc as well
+static thread_local bool count_allocations = false;
+static thread_local size_t num_allocations = 0;
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t nmemb, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+
+void *malloc(size_t size) {
+  if (count_allocations) num_allocations++;
+  return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+  if (count_allocations) num_allocations++;
+  return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+  if (count_allocations) num_allocations++;
+  return __libc_realloc(ptr, size);
+}
+}
+
+template <typename F>
+static size_t allocations(F f) {
+  num_allocations = 0;
+  count_allocations = true;
+  f();
+  count_allocations = false;
+  return num_allocations;
+}
+
+template <typename... Args>
+static size_t build_can(int num_msgs, Args... args) {
+  MessageBuilder msg(args...);
+  auto can = msg.initEvent().initCan(num_msgs);
+  for (int i = 0; i < num_msgs; i++) {
+    uint8_t dat[8] = {};
+    can[i].setAddress(i);
+    can[i].setDat(kj::arrayPtr(dat, sizeof(dat)));
+  }
+  return msg.getSerializedSize();
+}
+
+TEST_CASE("MessageBuilder") {
+  SECTION("Heap backed builder allocates") {
+    REQUIRE(allocations([]() { build_can(10); }) > 0);
+  }
+
+  SECTION("Arena backed builder produces the same message") {
+    MessageBuilder heap_msg, arena_msg("can");
+    heap_msg.initEvent().initCan(100)[50].setAddress(0x123);
+    arena_msg.initEvent().initCan(100)[50].setAddress(0x123);
+    heap_msg.getRoot<cereal::Event>().setLogMonoTime(1);
+    arena_msg.getRoot<cereal::Event>().setLogMonoTime(1);
+
+    auto heap_bytes = heap_msg.toBytes();
+    std::vector<capnp::byte> arena_bytes(arena_msg.getSerializedSize());
+    arena_msg.serializeToBuffer(arena_bytes.data(), arena_bytes.size());
+    REQUIRE(heap_bytes.size() == arena_bytes.size());
+    REQUIRE(memcmp(heap_bytes.begin(), arena_bytes.data(), arena_bytes.size()) == 0);
+  }
+
+  SECTION("Arena backed builder doesn't allocate in steady state") {
+    // The arena grows to the largest message of the service, larger than the default first segment
+    build_can(10, "can");
+    build_can(1000, "can");
+
+    std::vector<capnp::byte> buf(1024 * 1024);
+    size_t n = allocations([&]() {
+      for (int i = 0; i < 100; i++) {
+        build_can(1000, "can");
+        build_can(i, "can");
+
+        MessageBuilder msg("can");
+        msg.initEvent().initCan(100);
+        msg.serializeToBuffer(buf.data(), msg.getSerializedSize());
+      }
+    });
+    REQUIRE(n == 0);
+  }
+
+  SECTION("Builders of the same service can be alive at the same time") {
+    build_can(1, "carState");
+    MessageBuilder a("carState"), b("carState");
+    a.initEvent().initCarState().setVEgo(1.0);
+    b.initEvent().initCarState().setVEgo(2.0);
+    REQUIRE(a.getRoot<cereal::Event>().getCarState().getVEgo() == 1.0);
+    REQUIRE(b.getRoot<cereal::Event>().getCarState().getVEgo() == 2.0);
+  }
+}
+
+TEST_CASE("PubMaster sends without allocating") {
+  if (messaging_use_zmq()) return;
+
+  PubMaster pm({"liveLocationKalman"});
+  for (int i = 0; i < 2; i++) {
+    MessageBuilder msg("liveLocationKalman");
+    msg.initEvent().initLiveLocationKalman();
+    pm.send("liveLocationKalman", msg);
+  }
+
+  // Catch can allocate while recording an assertion, so check the results after counting
+  int sent[100] = {};
+  size_t n = allocations([&]() {
+    for (int i = 0; i < 100; i++) {
+      MessageBuilder msg("liveLocationKalman");
+      msg.initEvent().initLiveLocationKalman().setInputsOK(true);
+      sent[i] = pm.send("liveLocationKalman", msg);
+    }
+  });
+  REQUIRE(n == 0);
+  for (int i = 0; i < 100; i++) {
+    REQUIRE(sent[i] > 0);
+  }
+}
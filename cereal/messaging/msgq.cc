@@ -18,27 +18,139 @@
 #include <sys/syscall.h>
 #include <fcntl.h>
 #include <unistd.h>
+#ifndef __APPLE__
+#include <linux/futex.h>
+#endif
 
 #include <stdio.h>
 
 #include "msgq.h"
 
-void sigusr2_handler(int signal) {
-  assert(signal == SIGUSR2);
+static uint32_t msgq_get_tid(void){
+  #ifdef __APPLE__
+    // TODO: this doesn't work
+    return getpid();
+  #else
+    return syscall(SYS_gettid);
+  #endif
 }
 
 uint64_t msgq_get_uid(void){
   std::random_device rd("/dev/urandom");
   std::uniform_int_distribution<uint64_t> distribution(0,std::numeric_limits<uint32_t>::max());
 
+  uint64_t uid = distribution(rd) << 32 | msgq_get_tid();
+
+  return uid;
+}
+
+static msgq_waiter_t *msgq_waiters(){
+  // Mapped once per process
+  static msgq_waiter_t *waiters = [](){
+    const size_t size = NUM_WAITERS * sizeof(msgq_waiter_t);
+    int fd = open("/dev/shm/msgq_waiters", O_RDWR | O_CREAT, 0777);
+    assert(fd >= 0);
+    int rc = ftruncate(fd, size);
+    assert(rc == 0);
+    char * mem = (char*)mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    assert(mem != MAP_FAILED);
+    return (msgq_waiter_t *)mem;
+  }();
+  return waiters;
+}
+
+static std::atomic<uint64_t> *msgq_waiter_owner(int id){
+  return reinterpret_cast<std::atomic<uint64_t>*>(&msgq_waiters()[id].owner_uid);
+}
+
+static std::atomic<uint32_t> *msgq_waiter_futex(int id){
+  return reinterpret_cast<std::atomic<uint32_t>*>(&msgq_waiters()[id].futex);
+}
+
+static std::atomic<uint32_t> *msgq_waiter_wait_value(int id){
+  return reinterpret_cast<std::atomic<uint32_t>*>(&msgq_waiters()[id].wait_value);
+}
+
+static bool msgq_tid_alive(uint32_t tid){
+  return kill(tid, 0) == 0 || errno != ESRCH;
+}
+
+// Owns a waiter for the lifetime of the polling thread
+struct msgq_waiter_handle {
+  int id = -1;
+  uint64_t uid = 0;
+
+  // A child process forked after a poll inherits the handle of the parent thread
+  bool owned(){
+    return id >= 0 && (uid & 0xFFFFFFFF) == msgq_get_tid();
+  }
+
+  ~msgq_waiter_handle(){
+    if (owned()){
+      std::atomic_compare_exchange_strong(msgq_waiter_owner(id), &uid, (uint64_t)0);
+    }
+  }
+};
+
+static int msgq_get_waiter(){
+  static thread_local msgq_waiter_handle handle;
+  if (handle.owned()){
+    return handle.id;
+  }
+
+  uint64_t uid = msgq_get_uid();
+
+  // Take a free waiter, or reclaim one from a thread that died without releasing it
+  for (int reclaim = 0; reclaim < 2; reclaim++){
+    for (int i = 0; i < NUM_WAITERS; i++){
+      uint64_t owner = *msgq_waiter_owner(i);
+      bool available = reclaim ? !msgq_tid_alive(owner & 0xFFFFFFFF) : owner == 0;
+      if (available && std::atomic_compare_exchange_strong(msgq_waiter_owner(i), &owner, uid)){
+        handle.id = i;
+        handle.uid = uid;
+        return handle.id;
+      }
+    }
+  }
+
+  return -1;
+}
+
+static void msgq_wake_waiter(uint64_t wake){
+  assert(wake > 0 && wake <= NUM_WAITERS);
+  std::atomic<uint32_t> *futex = msgq_waiter_futex(wake - 1);
+  uint32_t value = (*futex)++;
+
+  // Only the first wake after the waiter sampled the futex needs the syscall,
+  // this makes publishing to several queues polled by the same thread cheap
+  if (value != *msgq_waiter_wait_value(wake - 1)){
+    return;
+  }
+
+  #ifndef __APPLE__
+    syscall(SYS_futex, futex, FUTEX_WAKE, 1, NULL, NULL, 0);
+  #endif
+}
+
+static void msgq_wait_waiter(int id, uint32_t value, int ms){
   #ifdef __APPLE__
-    // TODO: this doesn't work
-    uint64_t uid = distribution(rd) << 32 | getpid();
-  #else
-    uint64_t uid = distribution(rd) << 32 | syscall(SYS_gettid);
+    // TODO: no futex, fall back to polling
+    id = -1;
   #endif
 
-  return uid;
+  // Without a waiter nobody will wake us up, poll instead
+  if (id < 0){
+    usleep(std::min(ms, 1) * 1000);
+    return;
+  }
+
+  #ifndef __APPLE__
+    struct timespec ts;
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (ms % 1000) * 1000 * 1000;
+    syscall(SYS_futex, msgq_waiter_futex(id), FUTEX_WAIT, value, &ts, NULL, 0);
+  #endif
 }
 
 int msgq_msg_init_size(msgq_msg_t * msg, size_t size){
@@ -69,8 +181,29 @@ int msgq_msg_close(msgq_msg_t * msg){
 
 void msgq_reset_reader(msgq_queue_t * q){
   int id = q->reader_id;
-  q->read_valids[id]->store(true);
-  q->read_pointers[id]->store(*q->write_pointer);
+  q->view_pending = false;
+  q->read_view_ends[id].store(0);
+  q->read_valids[id].store(true);
+  q->read_pointers[id].store(*q->write_pointer);
+}
+
+// The writer invalidated this reader. Only what it overwrote is gone, everything
+// published since the writer last wrapped around is intact and unread, so resume
+// at the start of its current cycle
+static void msgq_reader_lapped(msgq_queue_t * q){
+  q->read_lapped++;
+
+  int id = q->reader_id;
+  q->view_pending = false;
+  q->read_view_ends[id].store(0);
+
+  uint64_t write_pointer, read_pointer;
+  do {
+    write_pointer = *q->write_pointer;
+    PACK64(read_pointer, write_pointer >> 32, 0);
+    q->read_pointers[id].store(read_pointer);
+    q->read_valids[id].store(true);
+  } while ((*q->write_pointer >> 32) != (write_pointer >> 32)); // wrapped again meanwhile
 }
 
 void msgq_wait_for_subscriber(msgq_queue_t *q){
@@ -82,9 +215,25 @@ void msgq_wait_for_subscriber(msgq_queue_t *q){
 }
 
 
-int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
+static char *msgq_map_queue(int fd, size_t size, size_t max_readers){
+  size_t total_size = MSGQ_HEADER_SIZE(max_readers) + size;
+
+  // Only ever grow the file, other processes might already have it mapped
+  struct stat st;
+  if (fstat(fd, &st) < 0){
+    return NULL;
+  }
+  if ((size_t)st.st_size < total_size && ftruncate(fd, total_size) < 0){
+    return NULL;
+  }
+
+  char * mem = (char*)mmap(NULL, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  return (mem == MAP_FAILED) ? NULL : mem;
+}
+
+int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size, size_t num_readers){
   assert(size < 0xFFFFFFFF); // Buffer must be smaller than 2^32 bytes
-  std::signal(SIGUSR2, sigusr2_handler);
+  assert(num_readers > 0 && num_readers <= MAX_NUM_READERS);
 
   const char * prefix = "/dev/shm/";
   char * full_path = new char[strlen(path) + strlen(prefix) + 1];
@@ -99,12 +248,22 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
   }
   delete[] full_path;
 
-  int rc = ftruncate(fd, size + sizeof(msgq_header_t));
-  if (rc < 0){
+  char * mem = msgq_map_queue(fd, size, num_readers);
+  if (mem == NULL){
     close(fd);
     return -1;
   }
-  char * mem = (char*)mmap(NULL, size + sizeof(msgq_header_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  // The first one to open the queue decides the number of reader slots
+  msgq_header_t *header = (msgq_header_t *)mem;
+  uint64_t max_readers = 0;
+  std::atomic<uint64_t> *header_max_readers = reinterpret_cast<std::atomic<uint64_t>*>(&header->max_readers);
+  if (!std::atomic_compare_exchange_strong(header_max_readers, &max_readers, (uint64_t)num_readers) && max_readers != num_readers){
+    assert(max_readers <= MAX_NUM_READERS);
+    munmap(mem, MSGQ_HEADER_SIZE(num_readers) + size);
+    mem = msgq_map_queue(fd, size, max_readers);
+    num_readers = max_readers;
+  }
   close(fd);
 
   if (mem == NULL){
@@ -112,32 +271,44 @@ int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size){
   }
   q->mmap_p = mem;
 
-  msgq_header_t *header = (msgq_header_t *)mem;
+  header = (msgq_header_t *)mem;
 
   // Setup pointers to header segment
   q->num_readers = reinterpret_cast<std::atomic<uint64_t>*>(&header->num_readers);
   q->write_pointer = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_pointer);
   q->write_uid = reinterpret_cast<std::atomic<uint64_t>*>(&header->write_uid);
 
-  for (size_t i = 0; i < NUM_READERS; i++){
-    q->read_pointers[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_pointers[i]);
-    q->read_valids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_valids[i]);
-    q->read_uids[i] = reinterpret_cast<std::atomic<uint64_t>*>(&header->read_uids[i]);
-  }
+  // Reader table
+  std::atomic<uint64_t> *readers = reinterpret_cast<std::atomic<uint64_t>*>(mem + sizeof(msgq_header_t));
+  q->read_pointers = readers;
+  q->read_valids = readers + num_readers;
+  q->read_uids = readers + 2 * num_readers;
+  q->read_wakes = readers + 3 * num_readers;
+  q->read_view_ends = readers + 4 * num_readers;
+  q->max_readers = num_readers;
 
-  q->data = mem + sizeof(msgq_header_t);
+  q->data = mem + MSGQ_HEADER_SIZE(num_readers);
   q->size = size;
   q->reader_id = -1;
+  q->read_lapped = 0;
 
   q->endpoint = path;
   q->read_conflate = false;
+  q->view_pending = false;
+  q->write_pending = false;
 
   return 0;
 }
 
 void msgq_close_queue(msgq_queue_t *q){
   if (q->mmap_p != NULL){
-    munmap(q->mmap_p, q->size + sizeof(msgq_header_t));
+    // Give the reader slot back
+    if (q->reader_id >= 0){
+      uint64_t uid = q->read_uid_local;
+      q->read_valids[q->reader_id] = false;
+      std::atomic_compare_exchange_strong(&q->read_uids[q->reader_id], &uid, (uint64_t)0);
+    }
+    munmap(q->mmap_p, MSGQ_HEADER_SIZE(q->max_readers) + q->size);
   }
 }
 
@@ -149,66 +320,69 @@ void msgq_init_publisher(msgq_queue_t * q) {
   *q->write_uid = uid;
   *q->num_readers = 0;
 
-  for (size_t i = 0; i < NUM_READERS; i++){
-    *q->read_valids[i] = false;
-    *q->read_uids[i] = 0;
+  for (size_t i = 0; i < q->max_readers; i++){
+    q->read_valids[i] = false;
+    q->read_uids[i] = 0;
+    q->read_wakes[i] = 0;
+    q->read_view_ends[i] = 0;
   }
 
   q->write_uid_local = uid;
 }
 
-static void thread_signal(uint32_t tid) {
-  #ifndef SYS_tkill
-    // TODO: this won't work for multithreaded programs
-    kill(tid, SIGUSR2);
-  #else
-    syscall(SYS_tkill, tid, SIGUSR2);
-  #endif
+static bool msgq_claim_reader(msgq_queue_t * q, uint64_t uid, bool reclaim){
+  for (size_t i = 0; i < q->max_readers; i++){
+    uint64_t cur_uid = q->read_uids[i];
+
+    // Free slots, or slots of processes that died without closing the queue
+    bool available = reclaim ? (cur_uid != 0 && !msgq_tid_alive(cur_uid & 0xFFFFFFFF)) : (cur_uid == 0);
+
+    // Use atomic compare and swap to handle race condition
+    // where two subscribers start at the same time
+    if (available && std::atomic_compare_exchange_strong(&q->read_uids[i], &cur_uid, uid)){
+      q->reader_id = i;
+      q->read_uid_local = uid;
+
+      // We start with read_valid = false,
+      // on the first read the read pointer will be synchronized with the write pointer
+      q->read_valids[i] = false;
+      q->read_pointers[i] = 0;
+      q->read_wakes[i] = 0;
+      q->read_view_ends[i] = 0;
+
+      // Make the slot visible to the writer
+      uint64_t cur_num_readers = *q->num_readers;
+      while (cur_num_readers < i + 1 && !std::atomic_compare_exchange_weak(q->num_readers, &cur_num_readers, (uint64_t)(i + 1))){
+        ;
+      }
+      return true;
+    }
+  }
+  return false;
 }
 
 void msgq_init_subscriber(msgq_queue_t * q) {
   assert(q != NULL);
   assert(q->num_readers != NULL);
 
-  uint64_t uid = msgq_get_uid();
+  // Reader slots are owned by the process, so they can be reclaimed once it is gone
+  uint64_t uid = (msgq_get_uid() & 0xFFFFFFFF00000000) | getpid();
 
   // Get reader id
-  while (true){
-    uint64_t cur_num_readers = *q->num_readers;
-    uint64_t new_num_readers = cur_num_readers + 1;
-
+  while (!msgq_claim_reader(q, uid, false) && !msgq_claim_reader(q, uid, true)){
     // No more slots available. Reset all subscribers to kick out inactive ones
-    if (new_num_readers > NUM_READERS){
-      std::cout << "Warning, evicting all subscribers!" << std::endl;
-      *q->num_readers = 0;
+    std::cout << "Warning, evicting all subscribers!" << std::endl;
+    *q->num_readers = 0;
 
-      for (size_t i = 0; i < NUM_READERS; i++){
-        *q->read_valids[i] = false;
+    for (size_t i = 0; i < q->max_readers; i++){
+      q->read_valids[i] = false;
+      q->read_uids[i] = 0;
 
-        uint64_t old_uid = *q->read_uids[i];
-        *q->read_uids[i] = 0;
-
-        // Wake up reader in case they are in a poll
-        thread_signal(old_uid & 0xFFFFFFFF);
+      // Wake up reader in case they are in a poll
+      uint64_t wake = q->read_wakes[i].exchange(0);
+      if (wake){
+        msgq_wake_waiter(wake);
       }
-
-      continue;
-    }
-
-    // Use atomic compare and swap to handle race condition
-    // where two subscribers start at the same time
-    if (std::atomic_compare_exchange_strong(q->num_readers,
-                                            &cur_num_readers,
-                                            new_num_readers)){
-      q->reader_id = cur_num_readers;
-      q->read_uid_local = uid;
-
-      // We start with read_valid = false,
-      // on the first read the read pointer will be synchronized with the write pointer
-      *q->read_valids[cur_num_readers] = false;
-      *q->read_pointers[cur_num_readers] = 0;
-      *q->read_uids[cur_num_readers] = uid;
-      break;
     }
   }
 
@@ -216,7 +390,9 @@ void msgq_init_subscriber(msgq_queue_t * q) {
   msgq_reset_reader(q);
 }
 
-int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
+int msgq_msg_reserve(msgq_msg_t * msg, msgq_queue_t *q){
+  assert(!q->write_pending); // Only one message can be reserved at a time
+
   // Die if we are no longer the active publisher
   if (q->write_uid_local != *q->write_uid){
     std::cout << "Killing old publisher: " << q->endpoint << std::endl;
@@ -247,12 +423,12 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
     // Invalidate all readers that are beyond the write pointer
     // TODO: should we handle the case where a new reader shows up while this is running?
     for (uint64_t i = 0; i < num_readers; i++){
-      uint64_t read_pointer = *q->read_pointers[i];
+      uint64_t read_pointer = q->read_pointers[i];
       uint64_t read_cycles = read_pointer >> 32;
       read_pointer &= 0xFFFFFFFF;
 
       if ((read_pointer > write_pointer) && (read_cycles != write_cycles)) {
-        *q->read_valids[i] = false;
+        q->read_valids[i] = false;
       }
     }
 
@@ -271,10 +447,10 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
 
   for (uint64_t i = 0; i < num_readers; i++){
     uint32_t read_cycles, read_pointer;
-    UNPACK64(read_cycles, read_pointer, *q->read_pointers[i]);
+    UNPACK64(read_cycles, read_pointer, q->read_pointers[i]);
 
     if ((read_pointer >= start) && (read_pointer < end) && (read_cycles != write_cycles)) {
-      *q->read_valids[i] = false;
+      q->read_valids[i] = false;
     }
   }
 
@@ -283,19 +459,60 @@ int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
   std::atomic<int64_t> *size_p = reinterpret_cast<std::atomic<int64_t>*>(p);
   *size_p = msg->size;
 
-  // Copy data
-  memcpy(p + sizeof(int64_t), msg->data, msg->size);
+  // The data is filled in by the caller, and becomes visible to readers on commit
+  msg->data = p + sizeof(int64_t);
+
+  uint32_t new_ptr = ALIGN(write_pointer + msg->size + sizeof(int64_t));
+  PACK64(q->write_commit_pointer, write_cycles, new_ptr);
+  q->write_pending = true;
+
+  return msg->size;
+}
+
+int msgq_msg_commit(msgq_queue_t *q){
+  assert(q->write_pending);
+  q->write_pending = false;
+
+  if (q->write_uid_local != *q->write_uid){
+    std::cout << "Killing old publisher: " << q->endpoint << std::endl;
+    errno = EADDRINUSE;
+    return -1;
+  }
+
   __sync_synchronize();
 
   // Update write pointer
-  uint32_t new_ptr = ALIGN(write_pointer + msg->size + sizeof(int64_t));
-  PACK64(*q->write_pointer, write_cycles, new_ptr);
+  *q->write_pointer = q->write_commit_pointer;
+
+  return 0;
+}
+
+void msgq_notify_readers(msgq_queue_t *q){
+  uint64_t num_readers = *q->num_readers;
 
-  // Notify readers
+  // Notify readers that are blocked in a poll
   for (uint64_t i = 0; i < num_readers; i++){
-    uint64_t reader_uid = *q->read_uids[i];
-    thread_signal(reader_uid & 0xFFFFFFFF);
+    uint64_t wake = q->read_wakes[i];
+    if (wake){
+      msgq_wake_waiter(wake);
+    }
   }
+}
+
+int msgq_msg_send(msgq_msg_t * msg, msgq_queue_t *q){
+  msgq_msg_t reserved;
+  reserved.size = msg->size;
+  if (msgq_msg_reserve(&reserved, q) < 0){
+    return -1;
+  }
+
+  // Copy data
+  memcpy(reserved.data, msg->data, msg->size);
+
+  if (msgq_msg_commit(q) < 0){
+    return -1;
+  }
+  msgq_notify_readers(q);
 
   return msg->size;
 }
@@ -306,20 +523,21 @@ int msgq_msg_ready(msgq_queue_t * q){
   int id = q->reader_id;
   assert(id >= 0); // Make sure subscriber is initialized
 
-  if (q->read_uid_local != *q->read_uids[id]){
+  if (q->read_uid_local != q->read_uids[id]){
     std::cout << q->endpoint << ": Reader was evicted, reconnecting" << std::endl;
     msgq_init_subscriber(q);
     goto start;
   }
 
   // Check valid
-  if (!*q->read_valids[id]){
-    msgq_reset_reader(q);
+  if (!q->read_valids[id]){
+    msgq_reader_lapped(q);
     goto start;
   }
 
+  // The shared read pointer is parked on an outstanding view, look past it
   uint32_t read_cycles, read_pointer;
-  UNPACK64(read_cycles, read_pointer, *q->read_pointers[id]);
+  UNPACK64(read_cycles, read_pointer, q->view_pending ? q->view_next_read_pointer : (uint64_t)q->read_pointers[id]);
 
   uint32_t write_cycles, write_pointer;
   UNPACK64(write_cycles, write_pointer, *q->write_pointer);
@@ -328,25 +546,52 @@ int msgq_msg_ready(msgq_queue_t * q){
   return (read_pointer != write_pointer);
 }
 
-int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+uint64_t msgq_msg_lag(msgq_queue_t * q){
+  // Bytes published that this reader hasn't read yet. q->size means the next
+  // message may lap it, or already did
+  int id = q->reader_id;
+  assert(id >= 0); // Make sure subscriber is initialized
+
+  if (q->read_uid_local != q->read_uids[id] || !q->read_valids[id]){
+    return q->size;
+  }
+
+  uint32_t read_cycles, read_pointer;
+  UNPACK64(read_cycles, read_pointer, q->read_pointers[id]);
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  if (write_cycles == read_cycles){
+    return write_pointer - read_pointer;
+  } else if (write_cycles == read_cycles + 1){
+    return std::min<uint64_t>(q->size - read_pointer + write_pointer, q->size);
+  }
+  return q->size;
+}
+
+static int msgq_msg_recv_internal(msgq_msg_t * msg, msgq_queue_t * q, bool view){
+  // Receiving always ends the previous view
+  msgq_msg_release_view(q);
+
  start:
   int id = q->reader_id;
   assert(id >= 0); // Make sure subscriber is initialized
 
-  if (q->read_uid_local != *q->read_uids[id]){
+  if (q->read_uid_local != q->read_uids[id]){
     std::cout << q->endpoint << ": Reader was evicted, reconnecting" << std::endl;
     msgq_init_subscriber(q);
     goto start;
   }
 
   // Check valid
-  if (!*q->read_valids[id]){
-    msgq_reset_reader(q);
+  if (!q->read_valids[id]){
+    msgq_reader_lapped(q);
     goto start;
   }
 
   uint32_t read_cycles, read_pointer;
-  UNPACK64(read_cycles, read_pointer, *q->read_pointers[id]);
+  UNPACK64(read_cycles, read_pointer, q->read_pointers[id]);
 
   uint32_t write_cycles, write_pointer;
   UNPACK64(write_cycles, write_pointer, *q->write_pointer);
@@ -364,15 +609,15 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
   std::int64_t size = *size_p;
 
   // Check if the size that was read is valid
-  if (!*q->read_valids[id]){
-    msgq_reset_reader(q);
+  if (!q->read_valids[id]){
+    msgq_reader_lapped(q);
     goto start;
   }
 
   // If size is -1 the buffer was full, and we need to wrap around
   if (size == -1){
     read_cycles++;
-    PACK64(*q->read_pointers[id], read_cycles, 0);
+    PACK64(q->read_pointers[id], read_cycles, 0);
     goto start;
   }
 
@@ -387,11 +632,31 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
   if (q->read_conflate){
     if (new_read_pointer != write_pointer){
       // Update read pointer
-      PACK64(*q->read_pointers[id], read_cycles, new_read_pointer);
+      PACK64(q->read_pointers[id], read_cycles, new_read_pointer);
       goto start;
     }
   }
 
+  if (view){
+    // Leave the shared read pointer on the message, so the writer
+    // will invalidate this reader before it overwrites the data
+    msg->size = size;
+    msg->data = p + sizeof(int64_t);
+
+    q->view_pending = true;
+    PACK64(q->view_read_pointer, read_cycles, read_pointer);
+    PACK64(q->view_next_read_pointer, read_cycles, new_read_pointer);
+    q->read_view_ends[id].store(q->view_next_read_pointer);
+
+    __sync_synchronize();
+    if (!q->read_valids[id]){
+      msgq_reader_lapped(q);
+      goto start;
+    }
+
+    return msg->size;
+  }
+
   // Copy message
   if (msgq_msg_init_size(msg, size) < 0)
     return -1;
@@ -401,12 +666,12 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
   __sync_synchronize();
 
   // Update read pointer
-  PACK64(*q->read_pointers[id], read_cycles, new_read_pointer);
+  PACK64(q->read_pointers[id], read_cycles, new_read_pointer);
 
   // Check if the actual data that was copied is valid
-  if (!*q->read_valids[id]){
+  if (!q->read_valids[id]){
     msgq_msg_close(msg);
-    msgq_reset_reader(q);
+    msgq_reader_lapped(q);
     goto start;
   }
 
@@ -414,7 +679,74 @@ int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
   return msg->size;
 }
 
+int msgq_msg_recv(msgq_msg_t * msg, msgq_queue_t * q){
+  return msgq_msg_recv_internal(msg, q, false);
+}
+
+int msgq_msg_recv_view(msgq_msg_t * msg, msgq_queue_t * q){
+  // msg points into the shared segment and must not be closed. The view stays
+  // usable until the next receive on q or msgq_msg_release_view, but the writer can
+  // still lap the reader, so check msgq_msg_view_valid after using the data.
+  return msgq_msg_recv_internal(msg, q, true);
+}
+
+bool msgq_msg_view_valid(msgq_msg_t * msg, msgq_queue_t * q){
+  __sync_synchronize();
+
+  uint32_t view_cycles, view_pointer;
+  UNPACK64(view_cycles, view_pointer, q->view_read_pointer);
+
+  // Make sure msg is the outstanding view
+  if (!q->view_pending || msg->data != q->data + view_pointer + sizeof(int64_t)){
+    return false;
+  }
+
+  int id = q->reader_id;
+  if (q->read_uid_local != q->read_uids[id] || !q->read_valids[id]){
+    return false;
+  }
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
+
+  // The writer is still ahead of the view in the same cycle,
+  // or already wrapped around but did not reach the view yet
+  return (write_cycles == view_cycles) || (write_cycles == view_cycles + 1 && write_pointer <= view_pointer);
+}
+
+uint64_t msgq_msg_view_headroom(msgq_queue_t * q){
+  // Number of bytes the writer can publish before it reaches the outstanding view
+  if (!q->view_pending){
+    return 0;
+  }
+
+  uint32_t view_cycles, view_pointer;
+  UNPACK64(view_cycles, view_pointer, q->view_read_pointer);
+
+  uint32_t write_cycles, write_pointer;
+  UNPACK64(write_cycles, write_pointer, *q->write_pointer);
 
+  if (write_cycles == view_cycles){
+    return q->size - write_pointer + view_pointer;
+  } else if (write_cycles == view_cycles + 1 && write_pointer <= view_pointer){
+    return view_pointer - write_pointer;
+  }
+  return 0;
+}
+
+void msgq_msg_release_view(msgq_queue_t * q){
+  if (!q->view_pending){
+    return;
+  }
+  q->view_pending = false;
+
+  // Don't touch the read pointer if the slot was taken over by another reader
+  int id = q->reader_id;
+  if (q->read_uid_local == q->read_uids[id] && q->read_valids[id]){
+    q->read_pointers[id] = q->view_next_read_pointer;
+    q->read_view_ends[id] = 0;
+  }
+}
 
 int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
   int num = 0;
@@ -425,27 +757,51 @@ int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
     if (items[i].revents) num++;
   }
 
-  int ms = (timeout == -1) ? 100 : timeout;
-  struct timespec ts;
-  ts.tv_sec = ms / 1000;
-  ts.tv_nsec = (ms % 1000) * 1000 * 1000;
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout);
 
+  int waiter_id = msgq_get_waiter();
+  uint64_t wake = waiter_id + 1;
 
   while (num == 0) {
-    int ret;
-
-    ret = nanosleep(&ts, &ts);
+    uint32_t futex_value = 0;
+    if (waiter_id >= 0){
+      futex_value = *msgq_waiter_futex(waiter_id);
+      *msgq_waiter_wait_value(waiter_id) = futex_value;
+    }
 
-    // Check if messages ready
+    // Register with every queue before checking it again,
+    // any message sent after this point wakes us up
     for (size_t i = 0; i < nitems; i++) {
-      if (items[i].revents == 0 && msgq_msg_ready(items[i].q)){
-        num += 1;
-        items[i].revents = 1;
+      int id;
+      do {
+        id = items[i].q->reader_id;
+        if (waiter_id >= 0){
+          items[i].q->read_wakes[id] = wake;
+        }
+        items[i].revents = msgq_msg_ready(items[i].q);
+      } while (id != items[i].q->reader_id); // reader was evicted and got a new slot
+      if (items[i].revents) num++;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    bool timed_out = (timeout != -1) && (now >= deadline);
+
+    if (num == 0 && !timed_out){
+      int ms = 100;
+      if (timeout != -1){
+        ms = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+      }
+      msgq_wait_waiter(waiter_id, futex_value, std::max(ms, 1));
+    }
+
+    if (waiter_id >= 0){
+      for (size_t i = 0; i < nitems; i++) {
+        uint64_t expected = wake;
+        std::atomic_compare_exchange_strong(&items[i].q->read_wakes[items[i].q->reader_id], &expected, (uint64_t)0);
       }
     }
 
-    // exit if we had a timeout and the sleep finished
-    if (timeout != -1 && ret == 0){
+    if (timed_out){
       break;
     }
   }
@@ -456,7 +812,9 @@ int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout){
 bool msgq_all_readers_updated(msgq_queue_t *q) {
   uint64_t num_readers = *q->num_readers;
   for (uint64_t i = 0; i < num_readers; i++) {
-    if (*q->read_valids[i] && *q->write_pointer != *q->read_pointers[i]) {
+    // A reader parked on a view of the last message has received it
+    uint64_t write_pointer = *q->write_pointer;
+    if (q->read_valids[i] && write_pointer != q->read_pointers[i] && write_pointer != q->read_view_ends[i]) {
       return false;
     }
   }
@@ -5,37 +5,66 @@
 #include <atomic>
 
 #define DEFAULT_SEGMENT_SIZE (10 * 1024 * 1024)
-#define NUM_READERS 10
+#define DEFAULT_NUM_READERS 16
+#define MAX_NUM_READERS 256
+#define NUM_WAITERS 1024
 #define ALIGN(n) ((n + (8 - 1)) & -8)
 
 #define UNPACK64(higher, lower, input) do {uint64_t tmp = input; higher = tmp >> 32; lower = tmp & 0xFFFFFFFF;} while (0)
 #define PACK64(output, higher, lower) output = ((uint64_t)higher << 32 ) | ((uint64_t)lower & 0xFFFFFFFF)
 
+// The header is followed by the reader table, read_pointers, read_valids, read_uids and
+// read_wakes with max_readers entries each, and then the data segment. The number of
+// reader slots is fixed by whoever creates the queue.
 struct  msgq_header_t {
-  uint64_t num_readers;
+  uint64_t num_readers; // high water mark of claimed reader slots
   uint64_t write_pointer;
   uint64_t write_uid;
-  uint64_t read_pointers[NUM_READERS];
-  uint64_t read_valids[NUM_READERS];
-  uint64_t read_uids[NUM_READERS];
+  uint64_t max_readers;
+};
+
+#define MSGQ_HEADER_SIZE(max_readers) (sizeof(msgq_header_t) + 5 * (max_readers) * sizeof(uint64_t))
+
+// Shared by all queues in /dev/shm/msgq_waiters. A thread blocked in msgq_poll sleeps
+// on the futex word of its waiter, and registers the waiter in the reader slot of every
+// queue it polls, so one futex covers any number of queues.
+struct msgq_waiter_t {
+  uint64_t owner_uid;
+  uint32_t futex;
+  uint32_t wait_value; // futex value the waiter sleeps on, wakes from older values are redundant
 };
 
 struct msgq_queue_t {
   std::atomic<uint64_t> *num_readers;
   std::atomic<uint64_t> *write_pointer;
   std::atomic<uint64_t> *write_uid;
-  std::atomic<uint64_t> *read_pointers[NUM_READERS];
-  std::atomic<uint64_t> *read_valids[NUM_READERS];
-  std::atomic<uint64_t> *read_uids[NUM_READERS];
+  std::atomic<uint64_t> *read_pointers;
+  std::atomic<uint64_t> *read_valids;
+  std::atomic<uint64_t> *read_uids;
+  std::atomic<uint64_t> *read_wakes; // waiter id + 1 of a reader blocked in msgq_poll, 0 if not waiting
+  std::atomic<uint64_t> *read_view_ends; // read pointer past the view a reader is parked on, 0 if none
+  size_t max_readers;
   char * mmap_p;
   char * data;
   size_t size;
   int reader_id;
   uint64_t read_uid_local;
   uint64_t write_uid_local;
+  uint64_t read_lapped; // times the writer overwrote messages this reader hadn't read
 
   bool read_conflate;
   std::string endpoint;
+
+  // Borrowed view state. While a view is outstanding the shared read pointer stays
+  // parked at the start of the viewed message, so the writer invalidates this reader
+  // before overwriting it.
+  bool view_pending;
+  uint64_t view_read_pointer;
+  uint64_t view_next_read_pointer;
+
+  // Write pointer after the reserved message, published on commit
+  bool write_pending;
+  uint64_t write_commit_pointer;
 };
 
 struct msgq_msg_t {
@@ -55,14 +84,22 @@ int msgq_msg_init_size(msgq_msg_t *msg, size_t size);
 int msgq_msg_init_data(msgq_msg_t *msg, char * data, size_t size);
 int msgq_msg_close(msgq_msg_t *msg);
 
-int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size);
+int msgq_new_queue(msgq_queue_t * q, const char * path, size_t size, size_t num_readers=DEFAULT_NUM_READERS);
 void msgq_close_queue(msgq_queue_t *q);
 void msgq_init_publisher(msgq_queue_t * q);
 void msgq_init_subscriber(msgq_queue_t * q);
 
 int msgq_msg_send(msgq_msg_t *msg, msgq_queue_t *q);
+int msgq_msg_reserve(msgq_msg_t *msg, msgq_queue_t *q);
+int msgq_msg_commit(msgq_queue_t *q);
+void msgq_notify_readers(msgq_queue_t *q);
 int msgq_msg_recv(msgq_msg_t *msg, msgq_queue_t *q);
+int msgq_msg_recv_view(msgq_msg_t *msg, msgq_queue_t *q);
+bool msgq_msg_view_valid(msgq_msg_t *msg, msgq_queue_t *q);
+uint64_t msgq_msg_view_headroom(msgq_queue_t *q);
+void msgq_msg_release_view(msgq_queue_t *q);
 int msgq_msg_ready(msgq_queue_t * q);
+uint64_t msgq_msg_lag(msgq_queue_t *q);
 int msgq_poll(msgq_pollitem_t * items, size_t nitems, int timeout);
 
 bool msgq_all_readers_updated(msgq_queue_t *q);
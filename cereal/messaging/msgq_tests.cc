@@ -0,0 +1,604 @@
+#include <thread>
+#include <memory>
+#include <numeric>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include "catch2/catch.hpp"
+#include "msgq.h"
+
+static void new_queue(msgq_queue_t *q, size_t size){
+  remove("/dev/shm/test_queue");
+  REQUIRE(msgq_new_queue(q, "test_queue", size) == 0);
+}
+
+static void send_bytes(msgq_queue_t *q, char c, size_t size){
+  msgq_msg_t msg;
+  msgq_msg_init_size(&msg, size);
+  memset(msg.data, c, size);
+  REQUIRE(msgq_msg_send(&msg, q) == (int)size);
+  msgq_msg_close(&msg);
+}
+
+TEST_CASE("ALIGN"){
+  REQUIRE(ALIGN(0) == 0);
+  REQUIRE(ALIGN(1) == 8);
+  REQUIRE(ALIGN(7) == 8);
+  REQUIRE(ALIGN(8) == 8);
+  REQUIRE(ALIGN(99999) == 100000);
+}
+
+TEST_CASE("msgq_msg_init_data"){
+  const size_t msg_size = 30;
+  char * data = new char[msg_size];
+  for (size_t i = 0; i < msg_size; i++){
+    data[i] = i;
+  }
+
+  msgq_msg_t msg;
+  msgq_msg_init_data(&msg, data, msg_size);
+
+  REQUIRE(msg.size == msg_size);
+  REQUIRE(memcmp(msg.data, data, msg_size) == 0);
+
+  delete[] data;
+  msgq_msg_close(&msg);
+}
+
+TEST_CASE("Send and receive"){
+  msgq_queue_t writer, reader;
+  new_queue(&writer, 1024);
+  REQUIRE(msgq_new_queue(&reader, "test_queue", 1024) == 0);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  send_bytes(&writer, 'a', 100);
+
+  msgq_msg_t msg;
+  REQUIRE(msgq_msg_recv(&msg, &reader) == 100);
+  REQUIRE(msg.data[0] == 'a');
+  msgq_msg_close(&msg);
+
+  REQUIRE(msgq_msg_recv(&msg, &reader) == 0);
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("Receive view"){
+  msgq_queue_t writer, reader;
+  new_queue(&writer, 1024);
+  REQUIRE(msgq_new_queue(&reader, "test_queue", 1024) == 0);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  send_bytes(&writer, 'a', 100);
+  send_bytes(&writer, 'b', 100);
+
+  SECTION("View points into the segment and is word aligned"){
+    msgq_msg_t msg;
+    REQUIRE(msgq_msg_recv_view(&msg, &reader) == 100);
+    REQUIRE(msg.data > reader.data);
+    REQUIRE(msg.data < reader.data + reader.size);
+    REQUIRE((uintptr_t)msg.data % 8 == 0);
+    REQUIRE(msg.data[0] == 'a');
+    REQUIRE(msgq_msg_view_valid(&msg, &reader));
+
+    // Read pointer stays parked on the view, but the next message is reported as ready
+    REQUIRE_FALSE(msgq_all_readers_updated(&writer));
+    REQUIRE(msgq_msg_ready(&reader));
+
+    msgq_msg_t msg2;
+    REQUIRE(msgq_msg_recv_view(&msg2, &reader) == 100);
+    REQUIRE(msg2.data[0] == 'b');
+    REQUIRE_FALSE(msgq_msg_view_valid(&msg, &reader));
+    REQUIRE(msgq_msg_view_valid(&msg2, &reader));
+    REQUIRE_FALSE(msgq_msg_ready(&reader));
+
+    // Parked on a view of the last message counts as updated
+    REQUIRE(msgq_all_readers_updated(&writer));
+
+    msgq_msg_release_view(&reader);
+    REQUIRE(msgq_all_readers_updated(&writer));
+    REQUIRE(msgq_msg_recv_view(&msg, &reader) == 0);
+  }
+
+  SECTION("Mixing copies and views"){
+    msgq_msg_t view, copy;
+    REQUIRE(msgq_msg_recv_view(&view, &reader) == 100);
+    REQUIRE(msgq_msg_recv(&copy, &reader) == 100);
+    REQUIRE(copy.data[0] == 'b');
+    REQUIRE_FALSE(msgq_msg_view_valid(&view, &reader));
+    msgq_msg_close(&copy);
+  }
+
+  SECTION("Conflate returns a view of the latest message"){
+    reader.read_conflate = true;
+    msgq_msg_t msg;
+    REQUIRE(msgq_msg_recv_view(&msg, &reader) == 100);
+    REQUIRE(msg.data[0] == 'b');
+  }
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("Receive view is invalidated when the writer laps the reader"){
+  msgq_queue_t writer, reader;
+  new_queue(&writer, 1024);
+  REQUIRE(msgq_new_queue(&reader, "test_queue", 1024) == 0);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  send_bytes(&writer, 'a', 100);
+
+  msgq_msg_t msg;
+  REQUIRE(msgq_msg_recv_view(&msg, &reader) == 100);
+  uint64_t headroom = msgq_msg_view_headroom(&reader);
+  REQUIRE(headroom == 1024 - ALIGN(100 + sizeof(int64_t)));
+
+  // Fill the rest of the segment, the view is still intact
+  send_bytes(&writer, 'b', 200);
+  send_bytes(&writer, 'c', 200);
+  REQUIRE(msgq_msg_view_valid(&msg, &reader));
+  REQUIRE(msgq_msg_view_headroom(&reader) < headroom);
+  REQUIRE(msg.data[0] == 'a');
+
+  // Keep writing until the writer wraps onto the view
+  for (int i = 0; i < 4; i++){
+    send_bytes(&writer, 'd', 200);
+  }
+  REQUIRE_FALSE(msgq_msg_view_valid(&msg, &reader));
+  REQUIRE(msgq_msg_view_headroom(&reader) == 0);
+
+  // The reader recovers on the next receive, with what the writer published since it wrapped
+  for (int i = 0; i < 2; i++){
+    REQUIRE(msgq_msg_recv_view(&msg, &reader) == 200);
+    REQUIRE(msg.data[0] == 'd');
+  }
+  REQUIRE(reader.read_lapped == 1);
+  REQUIRE(msgq_msg_recv_view(&msg, &reader) == 0);
+  send_bytes(&writer, 'e', 100);
+  REQUIRE(msgq_msg_recv_view(&msg, &reader) == 100);
+  REQUIRE(msg.data[0] == 'e');
+  REQUIRE(msgq_msg_view_valid(&msg, &reader));
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("Reader lag and laps"){
+  msgq_queue_t writer, reader;
+  new_queue(&writer, 1024);
+  REQUIRE(msgq_new_queue(&reader, "test_queue", 1024) == 0);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+  REQUIRE(msgq_msg_lag(&reader) == 0);
+
+  const uint64_t msg_size = ALIGN(100 + sizeof(int64_t));
+  for (int i = 0; i < 5; i++){
+    send_bytes(&writer, 'a', 100);
+  }
+  REQUIRE(msgq_msg_lag(&reader) == 5 * msg_size);
+
+  msgq_msg_t msg;
+  REQUIRE(msgq_msg_recv(&msg, &reader) == 100);
+  msgq_msg_close(&msg);
+  REQUIRE(msgq_msg_lag(&reader) == 4 * msg_size);
+
+  // Across the end of the segment
+  for (int i = 0; i < 4; i++){
+    send_bytes(&writer, 'b', 100);
+  }
+  REQUIRE(msgq_msg_lag(&reader) > 4 * msg_size);
+  REQUIRE(msgq_msg_lag(&reader) < 1024);
+  REQUIRE(reader.read_lapped == 0);
+
+  // Overwrite what the reader hasn't read
+  for (int i = 0; i < 4; i++){
+    send_bytes(&writer, 'c', 100);
+  }
+  REQUIRE(msgq_msg_lag(&reader) == 1024);
+
+  // Only the overwritten messages are lost, the reader picks up at the first one after the wraparound
+  for (int i = 0; i < 4; i++){
+    REQUIRE(msgq_msg_recv(&msg, &reader) == 100);
+    REQUIRE(msg.data[0] == 'c');
+    msgq_msg_close(&msg);
+    REQUIRE(msgq_msg_lag(&reader) == (3 - i) * msg_size);
+  }
+  REQUIRE(reader.read_lapped == 1);
+  REQUIRE(msgq_msg_recv(&msg, &reader) == 0);
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("Poll wakes up on a message in any queue"){
+  remove("/dev/shm/test_queue_a");
+  remove("/dev/shm/test_queue_b");
+  msgq_queue_t writer_a, writer_b, reader_a, reader_b;
+  REQUIRE(msgq_new_queue(&writer_a, "test_queue_a", 1024) == 0);
+  REQUIRE(msgq_new_queue(&writer_b, "test_queue_b", 1024) == 0);
+  REQUIRE(msgq_new_queue(&reader_a, "test_queue_a", 1024) == 0);
+  REQUIRE(msgq_new_queue(&reader_b, "test_queue_b", 1024) == 0);
+
+  msgq_init_publisher(&writer_a);
+  msgq_init_publisher(&writer_b);
+  msgq_init_subscriber(&reader_a);
+  msgq_init_subscriber(&reader_b);
+
+  msgq_pollitem_t items[2] = {{.q = &reader_a}, {.q = &reader_b}};
+  REQUIRE(msgq_poll(items, 2, 0) == 0);
+
+  std::thread sender([&](){
+    usleep(100 * 1000);
+    send_bytes(&writer_b, 'b', 100);
+  });
+
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE(msgq_poll(items, 2, 5000) == 1);
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  sender.join();
+
+  REQUIRE(items[0].revents == 0);
+  REQUIRE(items[1].revents == 1);
+  REQUIRE(elapsed < std::chrono::milliseconds(1000));
+
+  // Waiter is unregistered after the poll
+  REQUIRE(reader_a.read_wakes[reader_a.reader_id] == 0);
+  REQUIRE(reader_b.read_wakes[reader_b.reader_id] == 0);
+
+  msgq_close_queue(&writer_a);
+  msgq_close_queue(&writer_b);
+  msgq_close_queue(&reader_a);
+  msgq_close_queue(&reader_b);
+}
+
+TEST_CASE("Reserve and commit"){
+  msgq_queue_t writer, reader;
+  new_queue(&writer, 1024);
+  REQUIRE(msgq_new_queue(&reader, "test_queue", 1024) == 0);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  msgq_msg_t reserved;
+  reserved.size = 100;
+  REQUIRE(msgq_msg_reserve(&reserved, &writer) == 100);
+  REQUIRE((uintptr_t)reserved.data % 8 == 0);
+  memset(reserved.data, 'a', reserved.size);
+
+  // Nothing is visible until the message is committed
+  REQUIRE_FALSE(msgq_msg_ready(&reader));
+  REQUIRE(msgq_msg_commit(&writer) == 0);
+  REQUIRE(msgq_msg_ready(&reader));
+
+  msgq_msg_t msg;
+  REQUIRE(msgq_msg_recv(&msg, &reader) == 100);
+  REQUIRE(msg.data[0] == 'a');
+  REQUIRE(msg.data[99] == 'a');
+  msgq_msg_close(&msg);
+
+  // A publisher that was replaced can't commit
+  REQUIRE(msgq_msg_reserve(&reserved, &writer) == 100);
+  msgq_init_publisher(&reader);
+  REQUIRE(msgq_msg_commit(&writer) == -1);
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("Reader slots are chosen by the queue creator"){
+  msgq_queue_t writer, reader;
+  new_queue(&writer, 1024);
+  REQUIRE(writer.max_readers == DEFAULT_NUM_READERS);
+
+  REQUIRE(msgq_new_queue(&reader, "test_queue", 1024, 64) == 0);
+  REQUIRE(reader.max_readers == DEFAULT_NUM_READERS);
+  REQUIRE(reader.data == writer.data - writer.mmap_p + reader.mmap_p);
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+TEST_CASE("Reader slots are given back"){
+  const size_t num_readers = 2;
+  msgq_queue_t writer, readers[num_readers];
+  new_queue(&writer, 1024);
+  msgq_init_publisher(&writer);
+
+  SECTION("On close"){
+    msgq_queue_t closed;
+    REQUIRE(msgq_new_queue(&closed, "test_queue", 1024) == 0);
+    msgq_init_subscriber(&closed);
+    msgq_close_queue(&closed);
+  }
+
+  SECTION("When the process dies"){
+    pid_t pid = fork();
+    if (pid == 0){
+      msgq_queue_t dead;
+      msgq_new_queue(&dead, "test_queue", 1024);
+      msgq_init_subscriber(&dead);
+      _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    REQUIRE(*writer.num_readers == 1);
+  }
+
+  // Fill up all slots, without evicting anybody
+  for (size_t i = 0; i < num_readers; i++){
+    REQUIRE(msgq_new_queue(&readers[i], "test_queue", 1024, num_readers) == 0);
+  }
+  for (size_t i = 0; i < num_readers; i++){
+    msgq_init_subscriber(&readers[i]);
+  }
+  for (size_t i = 0; i < num_readers; i++){
+    REQUIRE(readers[i].read_uids[readers[i].reader_id] == readers[i].read_uid_local);
+    msgq_close_queue(&readers[i]);
+  }
+  msgq_close_queue(&writer);
+}
+
+TEST_CASE("64 readers in separate processes"){
+  const int num_readers = 64;
+  const uint64_t num_msgs = 1000;
+
+  msgq_queue_t writer;
+  remove("/dev/shm/test_queue");
+  REQUIRE(msgq_new_queue(&writer, "test_queue", 1024 * 1024, num_readers) == 0);
+  msgq_init_publisher(&writer);
+
+  std::vector<pid_t> pids;
+  for (int i = 0; i < num_readers; i++){
+    pid_t pid = fork();
+    if (pid == 0){
+      msgq_queue_t q;
+      msgq_new_queue(&q, "test_queue", 1024 * 1024, num_readers);
+      msgq_init_subscriber(&q);
+
+      // Every reader has to see every message in order
+      uint64_t expected = 0;
+      while (expected < num_msgs){
+        msgq_pollitem_t item = {.q = &q};
+        if (msgq_poll(&item, 1, 5000) == 0){
+          _exit(1);
+        }
+
+        msgq_msg_t msg;
+        while (msgq_msg_recv(&msg, &q) > 0){
+          if (*(uint64_t*)msg.data != expected++){
+            _exit(2);
+          }
+          msgq_msg_close(&msg);
+        }
+      }
+      msgq_close_queue(&q);
+      _exit(0);
+    }
+    pids.push_back(pid);
+  }
+
+  // Wait for all readers to subscribe
+  auto subscribed = [&](){
+    for (int i = 0; i < num_readers; i++){
+      if (writer.read_uids[i] == 0 || !writer.read_valids[i]) return false;
+    }
+    return true;
+  };
+  while (!subscribed()){
+    usleep(1000);
+  }
+  REQUIRE(*writer.num_readers == num_readers);
+
+  for (uint64_t i = 0; i < num_msgs; i++){
+    msgq_msg_t msg = {.size = sizeof(i), .data = (char*)&i};
+    REQUIRE(msgq_msg_send(&msg, &writer) == sizeof(i));
+    if (i % 100 == 0){
+      usleep(1000);
+    }
+  }
+
+  for (pid_t pid : pids){
+    int status;
+    waitpid(pid, &status, 0);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+  }
+
+  // All slots were given back
+  for (int i = 0; i < num_readers; i++){
+    REQUIRE(writer.read_uids[i] == 0);
+  }
+  msgq_close_queue(&writer);
+}
+
+TEST_CASE("Receive benchmark", "[.][benchmark]"){
+  msgq_queue_t writer, reader;
+  new_queue(&writer, DEFAULT_SEGMENT_SIZE);
+  REQUIRE(msgq_new_queue(&reader, "test_queue", DEFAULT_SEGMENT_SIZE) == 0);
+
+  msgq_init_publisher(&writer);
+  msgq_init_subscriber(&reader);
+
+  // Roughly the size of a can or sensorEvents message, and a large one
+  const size_t msg_size = GENERATE(512, 4096, 65536);
+  send_bytes(&writer, 'a', msg_size);
+
+  // Rewind the reader to receive the same message over and over
+  std::atomic<uint64_t> *read_pointer = &reader.read_pointers[reader.reader_id];
+  const uint64_t start = *read_pointer;
+
+  BENCHMARK("msgq_msg_recv " + std::to_string(msg_size)){
+    *read_pointer = start;
+    msgq_msg_t msg;
+    int r = msgq_msg_recv(&msg, &reader);
+    msgq_msg_close(&msg);
+    return r;
+  };
+
+  BENCHMARK("msgq_msg_recv_view " + std::to_string(msg_size)){
+    reader.view_pending = false;
+    *read_pointer = start;
+    msgq_msg_t msg;
+    int r = msgq_msg_recv_view(&msg, &reader);
+    return r + msgq_msg_view_valid(&msg, &reader);
+  };
+
+  msgq_close_queue(&writer);
+  msgq_close_queue(&reader);
+}
+
+static uint64_t nanos_since_boot(clockid_t clk = CLOCK_BOOTTIME){
+  struct timespec t;
+  clock_gettime(clk, &t);
+  return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+TEST_CASE("Batched publish benchmark", "[.][benchmark]"){
+  // A controlsd-like cycle, publishing several topics to a subscriber that polls all of them
+  const std::vector<size_t> sizes = {1024, 512, 1536, 256, 128};
+  const size_t num_topics = sizes.size();
+
+  std::vector<msgq_queue_t> writers(num_topics), readers(num_topics);
+  for (size_t i = 0; i < num_topics; i++){
+    std::string path = "test_queue_" + std::to_string(i);
+    remove(("/dev/shm/" + path).c_str());
+    REQUIRE(msgq_new_queue(&writers[i], path.c_str(), DEFAULT_SEGMENT_SIZE) == 0);
+    REQUIRE(msgq_new_queue(&readers[i], path.c_str(), DEFAULT_SEGMENT_SIZE) == 0);
+    msgq_init_publisher(&writers[i]);
+    msgq_init_subscriber(&readers[i]);
+  }
+
+  std::atomic<bool> exit(false);
+  std::thread subscriber([&](){
+    std::vector<msgq_pollitem_t> items(num_topics);
+    for (size_t i = 0; i < num_topics; i++) items[i].q = &readers[i];
+    while (!exit){
+      msgq_poll(items.data(), num_topics, 10);
+      for (size_t i = 0; i < num_topics; i++){
+        msgq_msg_t msg;
+        while (msgq_msg_recv_view(&msg, &readers[i]) > 0);
+      }
+    }
+  });
+
+  std::vector<char> data(*std::max_element(sizes.begin(), sizes.end()));
+
+  BENCHMARK("msgq_msg_send per topic"){
+    for (size_t i = 0; i < num_topics; i++){
+      msgq_msg_t msg = {.size = sizes[i], .data = data.data()};
+      msgq_msg_send(&msg, &writers[i]);
+    }
+  };
+
+  // what PubMaster::send did before reserve/commit: messageToFlatArray into a
+  // heap array, then msgq_msg_send copies it into the ring
+  BENCHMARK("heap array, msgq_msg_send per topic"){
+    for (size_t i = 0; i < num_topics; i++){
+      std::unique_ptr<char[]> flat(new char[sizes[i]]);
+      memcpy(flat.get(), data.data(), sizes[i]);
+      msgq_msg_t msg = {.size = sizes[i], .data = flat.get()};
+      msgq_msg_send(&msg, &writers[i]);
+    }
+  };
+
+  BENCHMARK("reserve, commit per topic"){
+    for (size_t i = 0; i < num_topics; i++){
+      msgq_msg_t msg = {.size = sizes[i]};
+      msgq_msg_reserve(&msg, &writers[i]);
+      memcpy(msg.data, data.data(), sizes[i]);
+      msgq_msg_commit(&writers[i]);
+      msgq_notify_readers(&writers[i]);
+    }
+  };
+
+  BENCHMARK("reserve, commit all, notify once"){
+    for (size_t i = 0; i < num_topics; i++){
+      msgq_msg_t msg = {.size = sizes[i]};
+      msgq_msg_reserve(&msg, &writers[i]);
+      memcpy(msg.data, data.data(), sizes[i]);
+      msgq_msg_commit(&writers[i]);
+    }
+    for (size_t i = 0; i < num_topics; i++){
+      msgq_notify_readers(&writers[i]);
+    }
+  };
+
+  exit = true;
+  subscriber.join();
+  for (size_t i = 0; i < num_topics; i++){
+    msgq_close_queue(&writers[i]);
+    msgq_close_queue(&readers[i]);
+  }
+}
+
+TEST_CASE("Wakeup latency benchmark", "[.][benchmark]"){
+  const int rate = GENERATE(100, 1000);
+  const int num_readers = 4;
+  const int num_msgs = rate * 2;
+
+  msgq_queue_t writer;
+  new_queue(&writer, DEFAULT_SEGMENT_SIZE);
+  msgq_init_publisher(&writer);
+
+  std::atomic<int> ready(0);
+  std::vector<std::vector<uint64_t>> latencies(num_readers);
+  std::vector<uint64_t> cpu_times(num_readers);
+  std::vector<std::thread> readers;
+  for (int i = 0; i < num_readers; i++){
+    readers.emplace_back([&, i](){
+      msgq_queue_t q;
+      msgq_new_queue(&q, "test_queue", DEFAULT_SEGMENT_SIZE);
+      msgq_init_subscriber(&q);
+      ready++;
+
+      uint64_t cpu_start = nanos_since_boot(CLOCK_THREAD_CPUTIME_ID);
+      while (latencies[i].size() < (size_t)num_msgs){
+        msgq_pollitem_t item = {.q = &q};
+        if (msgq_poll(&item, 1, 100) == 0) continue;
+
+        msgq_msg_t msg;
+        while (msgq_msg_recv(&msg, &q) > 0){
+          latencies[i].push_back(nanos_since_boot() - *(uint64_t*)msg.data);
+          msgq_msg_close(&msg);
+        }
+      }
+      cpu_times[i] = nanos_since_boot(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+      msgq_close_queue(&q);
+    });
+  }
+  while (ready < num_readers) usleep(1000);
+
+  uint64_t writer_cpu = 0;
+  for (int i = 0; i < num_msgs; i++){
+    uint64_t cpu_start = nanos_since_boot(CLOCK_THREAD_CPUTIME_ID);
+    uint64_t ts = nanos_since_boot();
+    msgq_msg_t msg = {.size = sizeof(ts), .data = (char*)&ts};
+    msgq_msg_send(&msg, &writer);
+    writer_cpu += nanos_since_boot(CLOCK_THREAD_CPUTIME_ID) - cpu_start;
+    usleep(1000000 / rate);
+  }
+
+  for (auto &t : readers) t.join();
+
+  std::vector<uint64_t> all;
+  for (auto &l : latencies) all.insert(all.end(), l.begin(), l.end());
+  std::sort(all.begin(), all.end());
+  uint64_t reader_cpu = 0;
+  for (auto t : cpu_times) reader_cpu += t;
+
+  printf("%d Hz, %d readers: latency mean %.1f us, p99 %.1f us, cpu per msg: writer %.2f us, readers %.2f us\n",
+         rate, num_readers,
+         std::accumulate(all.begin(), all.end(), 0.0) / all.size() / 1e3, all[all.size() * 99 / 100] / 1e3,
+         writer_cpu / 1e3 / num_msgs, reader_cpu / 1e3 / num_msgs);
+
+  msgq_close_queue(&writer);
+}
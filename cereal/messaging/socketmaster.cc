@@ -2,7 +2,10 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string>
+#include <string_view>
 #include <mutex>
+#include <memory>
+#include <algorithm>
 
 #include "services.h"
 #include "messaging.h"
@@ -143,7 +146,7 @@ void SubMaster::drain() {
       break;
 
     for (auto sock : polls) {
-      Message *msg = sock->receive(true);
+      Message *msg = sock->receiveView(true);
       delete msg;
     }
   }
@@ -184,6 +187,45 @@ SubMaster::~SubMaster() {
   }
 }
 
+MessageArenaSegment *MessageBuilder::arenaSegment(const char *service) {
+  // Segments are kept per service, several builders of the same service can be alive at once
+  static thread_local std::map<std::string, std::vector<std::unique_ptr<MessageArenaSegment>>, std::less<>> arena;
+  auto it = arena.find(std::string_view(service));
+  if (it == arena.end()) {
+    it = arena.emplace(service, std::vector<std::unique_ptr<MessageArenaSegment>>()).first;
+  }
+
+  MessageArenaSegment *segment = nullptr;
+  for (auto &s : it->second) {
+    if (!s->in_use) {
+      segment = s.get();
+      break;
+    }
+  }
+  if (segment == nullptr) {
+    it->second.push_back(std::make_unique<MessageArenaSegment>());
+    segment = it->second.back().get();
+  }
+
+  // Grow to fit the largest message seen so far. MallocMessageBuilder
+  // expects a zeroed first segment, and zeroes it again when it's done.
+  if (segment->words.size() < segment->size_hint) {
+    segment->words = kj::heapArray<capnp::word>(segment->size_hint);
+    memset(segment->words.begin(), 0, segment->words.asBytes().size());
+  }
+  segment->in_use = true;
+  return segment;
+}
+
+MessageBuilder::~MessageBuilder() {
+  if (arena_segment_ == nullptr) return;
+
+  size_t total_words = 0;
+  for (auto &s : getSegmentsForOutput()) total_words += s.size();
+  arena_segment_->size_hint = std::max(arena_segment_->size_hint, total_words);
+  arena_segment_->in_use = false;
+}
+
 PubMaster::PubMaster(const std::vector<const char *> &service_list) {
   for (auto name : service_list) {
     assert(get_service(name) != nullptr);
@@ -194,8 +236,35 @@ PubMaster::PubMaster(const std::vector<const char *> &service_list) {
 }
 
 int PubMaster::send(const char *name, MessageBuilder &msg) {
-  auto bytes = msg.toBytes();
-  return send(name, bytes.begin(), bytes.size());
+  // Serialize straight into the queue
+  PubSocket *sock = socket(name);
+  size_t size = msg.getSerializedSize();
+  char *buf = sock->reserve(size);
+  if (buf == nullptr) return -1;
+
+  msg.serializeToBuffer((capnp::byte *)buf, size);
+  return sock->commit() < 0 ? -1 : size;
+}
+
+int PubMaster::send(const std::vector<std::pair<const char *, MessageBuilder *>> &msgs) {
+  int ret = 0;
+  for (auto &[name, msg] : msgs) {
+    PubSocket *sock = socket(name);
+    size_t size = msg->getSerializedSize();
+    char *buf = sock->reserve(size);
+    if (buf == nullptr) {
+      ret = -1;
+      continue;
+    }
+
+    msg->serializeToBuffer((capnp::byte *)buf, size);
+    if (sock->commit(false) < 0) ret = -1;
+  }
+
+  for (auto &[name, msg] : msgs) {
+    socket(name)->notify();
+  }
+  return ret;
 }
 
 PubMaster::~PubMaster() {
@@ -13,11 +13,13 @@ def new_port(port: int):
 
 
 class Service:
-  def __init__(self, port: int, should_log: bool, frequency: float, decimation: Optional[int] = None):
+  def __init__(self, port: int, should_log: bool, frequency: float, decimation: Optional[int] = None,
+               num_readers: Optional[int] = None):
     self.port = port
     self.should_log = should_log
     self.frequency = frequency
     self.decimation = decimation
+    self.num_readers = num_readers
 
 DCAM_FREQ = 10. if not TICI else 20.
 
@@ -62,8 +64,18 @@ services = {
   "managerState": (True, 2., 1),
   "uploaderState": (True, 0., 1),
   "liveMapData": (False, 0.),
+  "loggerdStats": (True, 1., 1),
 }
-service_list = {name: Service(new_port(idx), *vals) for  # type: ignore
+# msgq reader slots for services with many subscribers, the others get DEFAULT_NUM_READERS from msgq.h
+num_readers = {
+  "can": 32,
+  "carState": 32,
+  "controlsState": 32,
+  "deviceState": 32,
+  "modelV2": 32,
+}
+
+service_list = {name: Service(new_port(idx), *vals, num_readers=num_readers.get(name)) for  # type: ignore
                 idx, (name, vals) in enumerate(services.items())}
 
 
@@ -72,13 +84,14 @@ def build_header():
   h += "/* THIS IS AN AUTOGENERATED FILE, PLEASE EDIT services.py */\n"
   h += "#ifndef __SERVICES_H\n"
   h += "#define __SERVICES_H\n"
-  h += "struct service { char name[0x100]; int port; bool should_log; int frequency; int decimation; };\n"
+  h += "struct service { char name[0x100]; int port; bool should_log; int frequency; int decimation; int num_readers; };\n"
   h += "static struct service services[] = {\n"
   for k, v in service_list.items():
     should_log = "true" if v.should_log else "false"
     decimation = -1 if v.decimation is None else v.decimation
-    h += '  { "%s", %d, %s, %d, %d },\n' % \
-         (k, v.port, should_log, v.frequency, decimation)
+    readers = -1 if v.num_readers is None else v.num_readers
+    h += '  { "%s", %d, %s, %d, %d, %d },\n' % \
+         (k, v.port, should_log, v.frequency, decimation, readers)
   h += "};\n"
   h += "#endif\n"
   return h
@@ -0,0 +1,78 @@
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <unistd.h>
+
+#include "visionipc/visionipc_client.h"
+#include "visionipc/visionipc_server.h"
+
+// Prints, once a second, what happened to the frames of each stream of a
+// VisionIpc server: per client, frames received, skipped and overwritten
+// before they were read, latency from send to recv and how long they held
+// buffers. Counts are since the last print
+// usage: vipc_stats [server name, camerad by default]
+
+struct Snapshot {
+  uint64_t t = 0;
+  uint64_t published = 0;
+  std::map<int, VisionIpcClientStats> clients; // by pid
+};
+
+static double ms(uint64_t ns, uint64_t n) {
+  return n ? ns / 1e6 / n : 0.;
+}
+
+int main(int argc, char *argv[]) {
+  std::string name = argc > 1 ? argv[1] : "camerad";
+  std::map<VisionStreamType, Snapshot> last;
+
+  while (true) {
+    printf("\n%s\n", name.c_str());
+    for (int t = 0; t < VISION_STREAM_MAX; t++) {
+      VisionStreamType type = (VisionStreamType)t;
+
+      // only the lease table is mapped, it's the last one
+      VisionBuf bufs[VISIONIPC_MAX_FDS];
+      int num_fds = visionipc_request_buffers(name, type, bufs, false);
+      if (num_fds == 0) continue;
+      for (int i = 0; i < num_fds - 1; i++) {
+        close(bufs[i].fd);
+      }
+      VisionBuf &lease_buf = bufs[num_fds - 1];
+      lease_buf.import();
+      VisionIpcLeaseTable *table = (VisionIpcLeaseTable*)lease_buf.addr;
+
+      Snapshot cur = {.t = visionipc_nanos(), .published = table->published};
+      for (auto &c : get_client_stats(table)) {
+        cur.clients[c.pid] = c;
+      }
+      Snapshot &prev = last[type];
+      // the server restarted if it published less
+      if (cur.published < prev.published) prev = {};
+      double dt = prev.t ? (cur.t - prev.t) / 1e9 : 1.;
+      printf("  stream %d: %d buffers, %.1f fps published, %lu overruns\n", t, num_fds - 1,
+             (cur.published - prev.published) / dt, (unsigned long)table->overruns);
+
+      for (auto &[pid, c] : cur.clients) {
+        VisionIpcClientStats p = prev.clients.count(pid) ? prev.clients[pid] : VisionIpcClientStats{};
+        // counters restart when a client reconnects
+        if (c.received < p.received || c.leases < p.leases) p = {};
+        uint64_t received = c.received - p.received, leases = c.leases - p.leases;
+        printf("    pid %6d: %5.1f fps received, %lu skipped, %lu overwritten, latency %.2f ms (max %.2f), "
+               "hold %.2f ms (max %.2f, now %.2f)\n",
+               pid, received / dt, (unsigned long)(c.skipped - p.skipped), (unsigned long)(c.overwritten - p.overwritten),
+               ms(c.latency_ns_total - p.latency_ns_total, received), c.latency_ns_max / 1e6,
+               ms(c.hold_ns_total - p.hold_ns_total, leases), c.hold_ns_max / 1e6, c.holding_ns / 1e6);
+      }
+
+      prev = std::move(cur);
+      lease_buf.free();
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+  }
+  return 0;
+}
@@ -1,18 +1,77 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <cstdint>
 #include <cstddef>
 
 constexpr int VISIONIPC_MAX_FDS = 128;
+// clients of one stream that can lease buffers, one bit each in a holders mask
+constexpr int VISIONIPC_MAX_CLIENTS = 32;
 
 struct VisionIpcBufExtra {
   uint32_t frame_id;
   uint64_t timestamp_sof;
   uint64_t timestamp_eof;
+  bool dropped; // set by VisionIpcClient::recv when the frame was overwritten before it got to it
 };
 
 struct VisionIpcPacket {
   uint64_t server_id;
   size_t idx;
+  uint64_t generation;
+  uint64_t seq;     // frames of the stream sent before, counting this one
+  uint64_t sent_at; // visionipc_nanos
   struct VisionIpcBufExtra extra;
 };
+
+// A client's slot in the lease table. Only the client writes the counters
+struct VisionIpcLeaseClient {
+  std::atomic<bool> in_use;
+  std::atomic<int32_t> pid;
+  std::atomic<uint64_t> start_time; // of the process with pid, see process_start_time
+  std::atomic<uint64_t> leased_at; // steady clock ns of the lease held now, 0 if none
+  std::atomic<uint64_t> leases;    // leases given back
+  std::atomic<uint64_t> hold_ns_total;
+  std::atomic<uint64_t> hold_ns_max;
+
+  // since connecting
+  std::atomic<uint64_t> received;
+  std::atomic<uint64_t> skipped;     // sent, but never got to the client (conflated, or the queue was full)
+  std::atomic<uint64_t> overwritten; // got to the client after their buffer was reused, dropped
+  std::atomic<uint64_t> latency_ns_total; // send to recv, of the frames received
+  std::atomic<uint64_t> latency_ns_max;
+};
+
+// Shared by the server and the clients of a stream, in a VisionBuf of its own.
+// A client holds the last buffer recv returned until its next recv, and the
+// server doesn't hand out buffers that are held. The server bumps a buffer's
+// generation before it reuses it, so a client that gets to a frame after that
+// drops it instead of reading it while it's being overwritten.
+// The clients also count what happened to the frames there, see vipc_stats.
+struct VisionIpcLeaseTable {
+  std::atomic<uint32_t> holders[VISIONIPC_MAX_FDS];
+  std::atomic<uint64_t> generation[VISIONIPC_MAX_FDS];
+  std::atomic<uint64_t> overruns; // buffers overwritten while held, with every buffer held
+  std::atomic<uint64_t> published;
+  VisionIpcLeaseClient clients[VISIONIPC_MAX_CLIENTS];
+};
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "lease table atomics must be lock free to share them");
+
+// steady clock, the same in every process
+inline uint64_t visionipc_nanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct VisionIpcClientStats {
+  int pid;
+  uint64_t leases;
+  uint64_t hold_ns_total;
+  uint64_t hold_ns_max;
+  uint64_t holding_ns; // how long the current lease has been held, 0 if none
+  uint64_t received;
+  uint64_t skipped;
+  uint64_t overwritten;
+  uint64_t latency_ns_total;
+  uint64_t latency_ns_max;
+};
@@ -15,16 +15,7 @@ VisionIpcClient::VisionIpcClient(std::string name, VisionStreamType type, bool c
   poller->registerSocket(sock);
 }
 
-// Connect is not thread safe. Do not use the buffers while calling connect
-bool VisionIpcClient::connect(bool blocking){
-  connected = false;
-
-  // Cleanup old buffers on reconnect
-  for (size_t i = 0; i < num_buffers; i++){
-    buffers[i].free();
-  }
-  num_buffers = 0;
-
+int visionipc_request_buffers(std::string name, VisionStreamType type, VisionBuf bufs[VISIONIPC_MAX_FDS], bool blocking){
   // Connect to server socket and ask for all FDs of type
   std::string path = "/tmp/visionipc_" + name;
 
@@ -37,7 +28,7 @@ bool VisionIpcClient::connect(bool blocking){
         std::cout << "VisionIpcClient connecting" << std::endl;
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
       } else {
-        return false;
+        return 0;
       }
     }
   }
@@ -48,16 +39,42 @@ bool VisionIpcClient::connect(bool blocking){
 
   // Get FDs
   int fds[VISIONIPC_MAX_FDS];
+  int num_fds = 0;
+  r = ipc_sendrecv_with_fds(false, socket_fd, bufs, sizeof(VisionBuf) * VISIONIPC_MAX_FDS, fds, VISIONIPC_MAX_FDS, &num_fds);
+  close(socket_fd);
+
+  // the server closes the connection for types it doesn't have
+  if (r <= 0) {
+    return 0;
+  }
+  assert(r == sizeof(VisionBuf) * num_fds);
+
+  for (int i = 0; i < num_fds; i++) {
+    bufs[i].fd = fds[i];
+  }
+  return num_fds;
+}
+
+// Connect is not thread safe. Do not use the buffers while calling connect
+bool VisionIpcClient::connect(bool blocking){
+  connected = false;
+
+  // Cleanup old buffers on reconnect
+  disconnect();
+
   VisionBuf bufs[VISIONIPC_MAX_FDS];
-  r = ipc_sendrecv_with_fds(false, socket_fd, &bufs, sizeof(bufs), fds, VISIONIPC_MAX_FDS, &num_buffers);
+  int num_fds = visionipc_request_buffers(name, type, bufs, blocking);
+  if (num_fds == 0) {
+    return false;
+  }
 
+  // the last one is the lease table
+  num_buffers = num_fds - 1;
   assert(num_buffers > 0);
-  assert(r == sizeof(VisionBuf) * num_buffers);
 
   // Import buffers
   for (size_t i = 0; i < num_buffers; i++){
     buffers[i] = bufs[i];
-    buffers[i].fd = fds[i];
     buffers[i].import();
     if (buffers[i].rgb) {
       buffers[i].init_rgb(buffers[i].width, buffers[i].height, buffers[i].stride);
@@ -68,11 +85,115 @@ bool VisionIpcClient::connect(bool blocking){
     if (device_id) buffers[i].init_cl(device_id, ctx);
   }
 
+  lease_buf = bufs[num_buffers];
+  lease_buf.import();
+  leases = (VisionIpcLeaseTable*)lease_buf.addr;
+
+  for (int i = 0; i < VISIONIPC_MAX_CLIENTS; i++) {
+    bool in_use = false;
+    VisionIpcLeaseClient &c = leases->clients[i];
+    if (c.in_use.compare_exchange_strong(in_use, true)) {
+      c.leased_at = 0;
+      c.leases = 0;
+      c.hold_ns_total = 0;
+      c.hold_ns_max = 0;
+      c.received = 0;
+      c.skipped = 0;
+      c.overwritten = 0;
+      c.latency_ns_total = 0;
+      c.latency_ns_max = 0;
+      c.start_time = process_start_time(getpid());
+      c.pid = getpid();
+      lease_slot = i;
+      break;
+    }
+  }
+  if (lease_slot < 0) {
+    std::cout << "VisionIpcClient no free lease slot, frames aren't leased" << std::endl;
+  }
+
   connected = true;
   return true;
 }
 
+void VisionIpcClient::release(){
+  if (leased == nullptr) return;
+
+  VisionIpcLeaseClient &c = leases->clients[lease_slot];
+  uint64_t held = visionipc_nanos() - leased_at;
+  c.leases++;
+  c.hold_ns_total += held;
+  if (held > c.hold_ns_max) c.hold_ns_max = held;
+  c.leased_at = 0;
+
+  leases->holders[leased->idx] &= ~(1u << lease_slot);
+  leased = nullptr;
+}
+
+bool VisionIpcClient::lease(VisionBuf * buf, uint64_t generation){
+  if (lease_slot < 0) return true;
+
+  // the server bumps the generation before checking the holders, see VisionIpcServer::get_buffer
+  leases->holders[buf->idx] |= 1u << lease_slot;
+  if (leases->generation[buf->idx] != generation) {
+    leases->holders[buf->idx] &= ~(1u << lease_slot);
+    return false;
+  }
+
+  leased = buf;
+  leased_at = visionipc_nanos();
+  leases->clients[lease_slot].leased_at = leased_at;
+  return true;
+}
+
+void VisionIpcClient::count(const VisionIpcPacket * packet, bool overwritten){
+  if (lease_slot < 0) return;
+
+  VisionIpcLeaseClient &c = leases->clients[lease_slot];
+  // sent since the last one, counting from the first one after connecting
+  if (last_seq && packet->seq > last_seq + 1) {
+    c.skipped += packet->seq - last_seq - 1;
+  }
+  last_seq = packet->seq;
+
+  if (overwritten) {
+    c.overwritten++;
+    return;
+  }
+
+  uint64_t now = visionipc_nanos();
+  uint64_t latency = now > packet->sent_at ? now - packet->sent_at : 0;
+  c.received++;
+  c.latency_ns_total += latency;
+  if (latency > c.latency_ns_max) c.latency_ns_max = latency;
+}
+
+void VisionIpcClient::disconnect(){
+  release();
+  if (leases) {
+    if (lease_slot >= 0) {
+      leases->clients[lease_slot].pid = 0;
+      leases->clients[lease_slot].start_time = 0;
+      leases->clients[lease_slot].in_use = false;
+    }
+    lease_buf.free();
+    leases = nullptr;
+  }
+  lease_slot = -1;
+  last_seq = 0;
+
+  for (size_t i = 0; i < num_buffers; i++){
+    buffers[i].free();
+  }
+  num_buffers = 0;
+}
+
 VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_ms){
+  release();
+  if (extra) {
+    extra->dropped = false;
+  }
+
   auto p = poller->poll(timeout_ms);
 
   if (!p.size()){
@@ -97,8 +218,15 @@ VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_m
     return nullptr;
   }
 
+  bool ok = lease(buf, packet->generation);
+  count(packet, !ok);
   if (extra) {
     *extra = packet->extra;
+    extra->dropped = !ok;
+  }
+  if (!ok){
+    delete r;
+    return nullptr;
   }
 
   buf->sync(VISIONBUF_SYNC_TO_DEVICE);
@@ -109,9 +237,7 @@ VisionBuf * VisionIpcClient::recv(VisionIpcBufExtra * extra, const int timeout_m
 
 
 VisionIpcClient::~VisionIpcClient(){
-  for (size_t i = 0; i < num_buffers; i++){
-    buffers[i].free();
-  }
+  disconnect();
 
   delete sock;
   delete poller;
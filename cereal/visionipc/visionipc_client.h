@@ -7,6 +7,11 @@
 #include "visionipc/visionipc.h"
 #include "visionipc/visionbuf.h"
 
+// Asks the server for the buffers of type, the frame buffers and then the lease
+// table, with their fds but not imported. Returns how many, 0 if there's no
+// server (without blocking) or it has no such buffers
+int visionipc_request_buffers(std::string name, VisionStreamType type, VisionBuf bufs[VISIONIPC_MAX_FDS], bool blocking);
+
 class VisionIpcClient {
 private:
   std::string name;
@@ -19,7 +24,18 @@ private:
   cl_device_id device_id = nullptr;
   cl_context ctx = nullptr;
 
+  // lease table shared with the server, see visionipc.h
+  VisionBuf lease_buf;
+  VisionIpcLeaseTable * leases = nullptr;
+  int lease_slot = -1;
+  VisionBuf * leased = nullptr;
+  uint64_t leased_at = 0;
+  uint64_t last_seq = 0;
+
   void init_msgq(bool conflate);
+  bool lease(VisionBuf * buf, uint64_t generation);
+  void count(const VisionIpcPacket * packet, bool overwritten);
+  void disconnect();
 
 public:
   bool connected = false;
@@ -27,6 +43,10 @@ public:
   VisionBuf buffers[VISIONIPC_MAX_FDS];
   VisionIpcClient(std::string name, VisionStreamType type, bool conflate, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
   ~VisionIpcClient();
+  // The buffer returned is leased until the next recv or release, the server
+  // doesn't write to it until then. Frames overwritten before they were
+  // received are dropped, nullptr is returned with extra->dropped set
   VisionBuf * recv(VisionIpcBufExtra * extra=nullptr, const int timeout_ms=100);
+  void release();
   bool connect(bool blocking=true);
 };
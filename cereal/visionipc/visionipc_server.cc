@@ -1,9 +1,12 @@
 #include <iostream>
 #include <chrono>
 #include <cassert>
+#include <fstream>
 #include <random>
+#include <sstream>
 
 #include <poll.h>
+#include <signal.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
@@ -20,6 +23,45 @@ std::string get_endpoint_name(std::string name, VisionStreamType type){
   }
 }
 
+std::vector<VisionIpcClientStats> get_client_stats(VisionIpcLeaseTable * table){
+  const uint64_t now = visionipc_nanos();
+
+  std::vector<VisionIpcClientStats> stats;
+  for (int i = 0; i < VISIONIPC_MAX_CLIENTS; i++) {
+    VisionIpcLeaseClient &c = table->clients[i];
+    if (!c.in_use || c.pid <= 0) continue;
+
+    uint64_t leased_at = c.leased_at;
+    stats.push_back({
+      .pid = c.pid,
+      .leases = c.leases,
+      .hold_ns_total = c.hold_ns_total,
+      .hold_ns_max = c.hold_ns_max,
+      .holding_ns = leased_at && now > leased_at ? now - leased_at : 0,
+      .received = c.received,
+      .skipped = c.skipped,
+      .overwritten = c.overwritten,
+      .latency_ns_total = c.latency_ns_total,
+      .latency_ns_max = c.latency_ns_max,
+    });
+  }
+  return stats;
+}
+
+uint64_t process_start_time(int pid){
+  std::ifstream f("/proc/" + std::to_string(pid) + "/stat");
+  std::string stat;
+  std::getline(f, stat);
+
+  // the name in parentheses can have spaces, the start time is the 20th field after it
+  size_t end = stat.rfind(')');
+  if (end == std::string::npos) return 0;
+  std::istringstream fields(stat.substr(end + 1));
+  std::string field;
+  for (int i = 0; i < 20 && fields >> field; i++) {}
+  return fields ? std::strtoull(field.c_str(), nullptr, 10) : 0;
+}
+
 VisionIpcServer::VisionIpcServer(std::string name, cl_device_id device_id, cl_context ctx) : name(name), device_id(device_id), ctx(ctx) {
   msg_ctx = Context::create();
 
@@ -30,7 +72,8 @@ VisionIpcServer::VisionIpcServer(std::string name, cl_device_id device_id, cl_co
 
 void VisionIpcServer::create_buffers(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height){
   // TODO: assert that this type is not created yet
-  assert(num_buffers < VISIONIPC_MAX_FDS);
+  // the lease table is sent as one more buffer
+  assert(num_buffers + 1 <= VISIONIPC_MAX_FDS);
   int aligned_w = 0, aligned_h = 0;
 
   size_t size = 0;
@@ -59,6 +102,13 @@ void VisionIpcServer::create_buffers(VisionStreamType type, size_t num_buffers,
     buffers[type].push_back(buf);
   }
 
+  // zeroed, nothing leased
+  VisionBuf* lease_buf = new VisionBuf();
+  lease_buf->allocate(sizeof(VisionIpcLeaseTable));
+  lease_buf->idx = num_buffers;
+  lease_buf->type = type;
+  lease_bufs[type] = lease_buf;
+
   cur_idx[type] = 0;
 
   // Create msgq publisher for each of the `name` + type combos
@@ -85,6 +135,8 @@ void VisionIpcServer::listener(){
     polls[0].fd = sock;
     polls[0].events = POLLIN;
 
+    reap_clients();
+
     int ret = poll(polls, 1, 100);
     if (ret < 0) {
       if (errno == EINTR || errno == EAGAIN) continue;
@@ -110,13 +162,18 @@ void VisionIpcServer::listener(){
       continue;
     }
 
+    // the buffers, then the lease table
+    std::vector<VisionBuf*> shared = buffers[type];
+    shared.push_back(lease_bufs[type]);
+
     int fds[VISIONIPC_MAX_FDS];
-    int num_fds = buffers[type].size();
+    int num_fds = shared.size();
+    assert(num_fds <= VISIONIPC_MAX_FDS);
     VisionBuf bufs[VISIONIPC_MAX_FDS];
 
     for (int i = 0; i < num_fds; i++){
-      fds[i] = buffers[type][i]->fd;
-      bufs[i] = *buffers[type][i];
+      fds[i] = shared[i]->fd;
+      bufs[i] = *shared[i];
 
       // Remove some private openCL/ion metadata
       bufs[i].buf_cl = 0;
@@ -138,11 +195,71 @@ void VisionIpcServer::listener(){
 
 
 
+VisionIpcLeaseTable * VisionIpcServer::lease_table(VisionStreamType type){
+  assert(lease_bufs.count(type));
+  return (VisionIpcLeaseTable*)lease_bufs[type]->addr;
+}
+
+// Frees the leases of clients that died without giving them back
+void VisionIpcServer::reap_clients(){
+  for (auto const& [type, lease_buf] : lease_bufs) {
+    VisionIpcLeaseTable *table = (VisionIpcLeaseTable*)lease_buf->addr;
+    for (int i = 0; i < VISIONIPC_MAX_CLIENTS; i++) {
+      VisionIpcLeaseClient &c = table->clients[i];
+      int pid = c.pid;
+      if (!c.in_use || pid <= 0) continue;
+      // the pid can belong to another process by now
+      bool alive = kill(pid, 0) == 0 || errno != ESRCH;
+      uint64_t start_time = c.start_time;
+      if (alive && (start_time == 0 || process_start_time(pid) == start_time)) continue;
+
+      std::cout << "freeing leases of dead client " << pid << " of " << name << " " << type << std::endl;
+      for (size_t j = 0; j < buffers[type].size(); j++) {
+        table->holders[j] &= ~(1u << i);
+      }
+      c.leased_at = 0;
+      c.pid = 0;
+      c.start_time = 0;
+      c.in_use = false;
+    }
+  }
+}
+
 VisionBuf * VisionIpcServer::get_buffer(VisionStreamType type){
-  // Do we want to keep track if the buffer has been sent out yet and warn user?
   assert(buffers.count(type));
-  auto b = buffers[type];
-  return b[cur_idx[type]++ % b.size()];
+  auto &b = buffers[type];
+  VisionIpcLeaseTable *table = lease_table(type);
+
+  // The next buffer in round-robin order no client holds. The generation is
+  // bumped before checking the holders again: a client leasing it at the same
+  // time either is seen here, or sees the new generation and gives it back
+  for (size_t i = 0; i < b.size(); i++) {
+    size_t idx = cur_idx[type]++ % b.size();
+    if (table->holders[idx]) continue;
+
+    table->generation[idx]++;
+    if (!table->holders[idx]) return b[idx];
+  }
+
+  // every buffer is held, overwrite one anyway rather than stall the camera
+  if (table->overruns++ % 100 == 0) {
+    std::cout << "all " << name << " " << type << " buffers are leased, overwriting a held one" << std::endl;
+  }
+  size_t idx = cur_idx[type]++ % b.size();
+  table->generation[idx]++;
+  return b[idx];
+}
+
+std::vector<VisionIpcClientStats> VisionIpcServer::client_stats(VisionStreamType type){
+  return get_client_stats(lease_table(type));
+}
+
+uint64_t VisionIpcServer::overruns(VisionStreamType type){
+  return lease_table(type)->overruns;
+}
+
+uint64_t VisionIpcServer::published(VisionStreamType type){
+  return lease_table(type)->published;
 }
 
 void VisionIpcServer::send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync){
@@ -154,6 +271,10 @@ void VisionIpcServer::send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync
   VisionIpcPacket packet = {0};
   packet.server_id = server_id;
   packet.idx = buf->idx;
+  VisionIpcLeaseTable *table = lease_table(buf->type);
+  packet.generation = table->generation[buf->idx];
+  packet.seq = ++table->published;
+  packet.sent_at = visionipc_nanos();
   packet.extra = *extra;
 
   sockets[buf->type]->send((char*)&packet, sizeof(packet));
@@ -170,6 +291,10 @@ VisionIpcServer::~VisionIpcServer(){
       delete b;
     }
   }
+  for( auto const& [type, b] : lease_bufs ) {
+    b->free();
+    delete b;
+  }
 
   // Messaging cleanup
   for( auto const& [type, sock] : sockets ) {
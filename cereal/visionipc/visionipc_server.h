@@ -10,6 +10,10 @@
 #include "visionipc/visionbuf.h"
 
 std::string get_endpoint_name(std::string name, VisionStreamType type);
+std::vector<VisionIpcClientStats> get_client_stats(VisionIpcLeaseTable * table);
+// in clock ticks since boot, 0 if there's no such process. Tells a pid apart
+// from the same one reused by another process
+uint64_t process_start_time(int pid);
 
 class VisionIpcServer {
  private:
@@ -24,11 +28,14 @@ class VisionIpcServer {
   std::map<VisionStreamType, std::atomic<size_t> > cur_idx;
   std::map<VisionStreamType, std::vector<VisionBuf*> > buffers;
   std::map<VisionStreamType, std::map<VisionBuf*, size_t> > idxs;
+  std::map<VisionStreamType, VisionBuf*> lease_bufs;
 
   Context * msg_ctx;
   std::map<VisionStreamType, PubSocket*> sockets;
 
   void listener(void);
+  VisionIpcLeaseTable * lease_table(VisionStreamType type);
+  void reap_clients();
 
  public:
   VisionIpcServer(std::string name, cl_device_id device_id=nullptr, cl_context ctx=nullptr);
@@ -39,4 +46,9 @@ class VisionIpcServer {
   void create_buffers(VisionStreamType type, size_t num_buffers, bool rgb, size_t width, size_t height);
   void send(VisionBuf * buf, VisionIpcBufExtra * extra, bool sync=true);
   void start_listener();
+
+  // hold times and frame counters of the clients of type
+  std::vector<VisionIpcClientStats> client_stats(VisionStreamType type);
+  uint64_t overruns(VisionStreamType type);
+  uint64_t published(VisionStreamType type);
 };
@@ -1,5 +1,11 @@
-#include <thread>
+#include <atomic>
 #include <chrono>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "catch2/catch.hpp"
 #include "visionipc_server.h"
@@ -133,3 +139,244 @@ TEST_CASE("Test conflate"){
   recv_buf = client.recv(&extra_recv);
   REQUIRE(recv_buf == nullptr);
 }
+
+TEST_CASE("Leased buffers aren't handed out"){
+  size_t num_buffers = 3;
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, num_buffers, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_YUV_BACK);
+  VisionIpcBufExtra extra = {0};
+  server.send(buf, &extra);
+
+  VisionBuf * recv_buf = client.recv();
+  REQUIRE(recv_buf != nullptr);
+  REQUIRE(recv_buf->idx == buf->idx);
+
+  for (int i = 0; i < 10; i++) {
+    REQUIRE(server.get_buffer(VISION_STREAM_YUV_BACK) != buf);
+  }
+  auto stats = server.client_stats(VISION_STREAM_YUV_BACK);
+  REQUIRE(stats.size() == 1);
+  REQUIRE(stats[0].pid == getpid());
+  REQUIRE(stats[0].leases == 0);
+
+  // the next recv gives it back
+  REQUIRE(client.recv(nullptr, 0) == nullptr);
+  bool handed_out = false;
+  for (int i = 0; i < num_buffers; i++) {
+    handed_out |= server.get_buffer(VISION_STREAM_YUV_BACK) == buf;
+  }
+  REQUIRE(handed_out);
+
+  stats = server.client_stats(VISION_STREAM_YUV_BACK);
+  REQUIRE(stats[0].leases == 1);
+  REQUIRE(stats[0].holding_ns == 0);
+  REQUIRE(stats[0].hold_ns_max > 0);
+  REQUIRE(server.overruns(VISION_STREAM_YUV_BACK) == 0);
+}
+
+TEST_CASE("Overwritten frames are dropped"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 2, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  // the third frame reuses the first one's buffer before the client got to it
+  VisionIpcBufExtra extra = {0};
+  for (int i = 1; i <= 3; i++) {
+    extra.frame_id = i;
+    server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
+  }
+
+  VisionIpcBufExtra extra_recv = {0};
+  REQUIRE(client.recv(&extra_recv) == nullptr);
+  REQUIRE(extra_recv.dropped);
+  REQUIRE(extra_recv.frame_id == 1);
+  REQUIRE(client.recv(&extra_recv) != nullptr);
+  REQUIRE(!extra_recv.dropped);
+  REQUIRE(extra_recv.frame_id == 2);
+  REQUIRE(client.recv(&extra_recv) != nullptr);
+  REQUIRE(extra_recv.frame_id == 3);
+}
+
+TEST_CASE("No torn frames with slow consumers"){
+  const size_t num_buffers = 4, num_clients = 2, num_frames = 300;
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, num_buffers, false, 320, 240);
+  server.start_listener();
+
+  // Catch2 isn't thread safe, the consumers only count and the checks are done here
+  std::atomic<bool> done = false;
+  std::atomic<int> torn = 0, received = 0, connected = 0;
+  std::vector<std::thread> consumers;
+  for (int c = 0; c < num_clients; c++) {
+    consumers.emplace_back([&]() {
+      VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, true);
+      if (!client.connect()) return;
+      connected++;
+      while (!done) {
+        VisionIpcBufExtra extra = {0};
+        VisionBuf * buf = client.recv(&extra, 10);
+        if (buf == nullptr) continue;
+
+        // the whole frame is its frame id, the server can't change it while it's read
+        const uint8_t *data = (const uint8_t *)buf->addr;
+        for (int pass = 0; pass < 2; pass++) {
+          for (size_t i = 0; i < buf->len; i++) {
+            if (data[i] != (uint8_t)extra.frame_id) {
+              torn++;
+              break;
+            }
+          }
+          std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+        received++;
+      }
+    });
+  }
+  zmq_sleep();
+  for (int i = 0; i < 1000 && server.client_stats(VISION_STREAM_YUV_BACK).size() < num_clients; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  for (uint32_t frame_id = 0; frame_id < num_frames; frame_id++) {
+    VisionBuf * buf = server.get_buffer(VISION_STREAM_YUV_BACK);
+    memset(buf->addr, (uint8_t)frame_id, buf->len);
+    VisionIpcBufExtra extra = {.frame_id = frame_id};
+    server.send(buf, &extra);
+    std::this_thread::sleep_for(std::chrono::microseconds(200));
+  }
+  done = true;
+  for (auto &t : consumers) t.join();
+
+  REQUIRE(connected == num_clients);
+  REQUIRE(torn == 0);
+  REQUIRE(received > 0);
+  REQUIRE(server.overruns(VISION_STREAM_YUV_BACK) == 0);
+}
+
+TEST_CASE("Leases of dead clients are freed"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 2, false, 100, 100);
+  server.start_listener();
+
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_YUV_BACK);
+  VisionIpcBufExtra extra = {0};
+
+  int fds[2];
+  REQUIRE(pipe(fds) == 0);
+  pid_t pid = fork();
+  if (pid == 0) {
+    VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+    client.connect();
+    char c = 0;
+    write(fds[1], &c, 1);
+    while (client.recv() == nullptr) {}
+    // exit holding the lease
+    _exit(0);
+  }
+
+  char c;
+  REQUIRE(read(fds[0], &c, 1) == 1);
+  zmq_sleep();
+  server.send(buf, &extra);
+
+  int status;
+  REQUIRE(waitpid(pid, &status, 0) == pid);
+  // the listener frees them within a poll
+  for (int i = 0; i < 50 && server.client_stats(VISION_STREAM_YUV_BACK).size() > 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  REQUIRE(server.client_stats(VISION_STREAM_YUV_BACK).empty());
+  REQUIRE((server.get_buffer(VISION_STREAM_YUV_BACK) == buf || server.get_buffer(VISION_STREAM_YUV_BACK) == buf));
+}
+
+TEST_CASE("Leases of a reused pid are freed"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 2, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  REQUIRE(client.connect());
+  zmq_sleep();
+
+  VisionBuf * buf = server.get_buffer(VISION_STREAM_YUV_BACK);
+  VisionIpcBufExtra extra = {0};
+  server.send(buf, &extra);
+  VisionBuf * recv_buf = client.recv();
+  REQUIRE(recv_buf != nullptr);
+  REQUIRE(recv_buf->idx == buf->idx);
+  // the client's pid is alive, but the slot says it belongs to a process that started at another time
+  REQUIRE(server.client_stats(VISION_STREAM_YUV_BACK).size() == 1);
+
+  VisionBuf bufs[VISIONIPC_MAX_FDS];
+  int num_fds = visionipc_request_buffers("camerad", VISION_STREAM_YUV_BACK, bufs, false);
+  REQUIRE(num_fds == 3);
+  VisionBuf lease_buf = bufs[num_fds - 1];
+  lease_buf.import();
+  VisionIpcLeaseTable * table = (VisionIpcLeaseTable*)lease_buf.addr;
+  REQUIRE(table->clients[0].start_time == process_start_time(getpid()));
+  table->clients[0].start_time += 1;
+
+  for (int i = 0; i < 50 && server.client_stats(VISION_STREAM_YUV_BACK).size() > 0; i++) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  REQUIRE(server.client_stats(VISION_STREAM_YUV_BACK).empty());
+  REQUIRE((server.get_buffer(VISION_STREAM_YUV_BACK) == buf || server.get_buffer(VISION_STREAM_YUV_BACK) == buf));
+  for (int i = 0; i < num_fds - 1; i++) {
+    close(bufs[i].fd);
+  }
+  lease_buf.free();
+}
+
+TEST_CASE("Frame counters"){
+  VisionIpcServer server("camerad");
+  server.create_buffers(VISION_STREAM_YUV_BACK, 2, false, 100, 100);
+  server.start_listener();
+
+  VisionIpcClient client = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, false);
+  VisionIpcClient client_conflate = VisionIpcClient("camerad", VISION_STREAM_YUV_BACK, true);
+  REQUIRE(client.connect());
+  REQUIRE(client_conflate.connect());
+  zmq_sleep();
+
+  VisionIpcBufExtra extra = {0};
+  server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
+  REQUIRE(client_conflate.recv() != nullptr);
+
+  // the conflating client only gets the last one, the other one gets to the
+  // first one after its buffer was reused
+  for (int i = 0; i < 3; i++) {
+    server.send(server.get_buffer(VISION_STREAM_YUV_BACK), &extra);
+  }
+  REQUIRE(client_conflate.recv() != nullptr);
+  client_conflate.release();
+  for (int i = 0; i < 4; i++) {
+    client.recv();
+  }
+  client.release();
+  REQUIRE(server.published(VISION_STREAM_YUV_BACK) == 4);
+
+  auto stats = server.client_stats(VISION_STREAM_YUV_BACK);
+  REQUIRE(stats.size() == 2);
+  for (auto &s : stats) {
+    REQUIRE(s.latency_ns_max > 0);
+    REQUIRE(s.latency_ns_total >= s.latency_ns_max);
+  }
+  // in the order they connected
+  REQUIRE(stats[0].received == 2);
+  REQUIRE(stats[0].overwritten == 2);
+  REQUIRE(stats[0].skipped == 0);
+  REQUIRE(stats[1].received == 2);
+  REQUIRE(stats[1].overwritten == 0);
+  REQUIRE(stats[1].skipped == 2);
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <array>
 #include <vector>
 #include <map>
 #include <unordered_map>
@@ -13,6 +14,8 @@
 #endif
 
 #define MAX_BAD_COUNTER 5
+#define CAN_STD_ADDRESSES 0x800
+#define CANFD_MAX_DLC 64
 
 // Helper functions
 unsigned int honda_checksum(unsigned int address, uint64_t d, int l);
@@ -25,6 +28,47 @@ unsigned int pedal_checksum(uint64_t d, int l);
 uint64_t read_u64_be(const uint8_t* v);
 uint64_t read_u64_le(const uint8_t* v);
 
+// A checksum algorithm and how to feed it a classic frame: as read_u64_le or
+// read_u64_be of the payload, plus the frame length. calc_batch computes the
+// checksums of n frames of the same family at once. See checksum.cc
+struct ChecksumFamily {
+  SignalType type;
+  const char *name; // for the FAIL log line
+  bool little_endian;
+  unsigned int (*calc)(uint32_t address, uint64_t d, int l);
+  void (*calc_batch)(size_t n, const uint32_t *address, const uint64_t *d, const uint8_t *l, uint8_t *out);
+};
+
+// nullptr if type isn't a checksum
+const ChecksumFamily *checksum_family(SignalType type);
+
+// Signals of a message compiled into flat arrays. Little endian signals come
+// first so both groups decode with the same shift/mask/sign-extend sequence.
+// Classic frames shift the whole 8 byte payload, CAN FD frames read a 64-bit
+// window at byte[i] and or in one spill byte for fields that straddle it.
+struct SignalDecodePlan {
+  bool fd = false;
+  // a CAN FD message with a checksum, which none of the algorithms can check
+  // on FD payloads. Its frames are all dropped rather than trusted unchecked
+  bool unchecked_checksum = false;
+  size_t num_le = 0;
+  std::vector<uint64_t> shift;
+  std::vector<uint64_t> mask;
+  std::vector<uint64_t> sign; // sign bit for signed signals, 0 otherwise
+  std::vector<double> factor;
+  std::vector<double> offset;
+
+  // CAN FD only
+  std::vector<uint32_t> byte;
+  std::vector<uint32_t> spill_byte; // points into the zero padding when unused
+  std::vector<uint64_t> spill_shift;
+};
+
+struct SignalCheck {
+  const ChecksumFamily *checksum; // nullptr for counters
+  uint32_t idx; // index into parse_sigs
+};
+
 class MessageState {
 public:
   uint32_t address;
@@ -43,17 +87,57 @@ public:
   bool ignore_checksum = false;
   bool ignore_counter = false;
 
-  bool parse(uint64_t sec, uint16_t ts_, uint8_t * dat);
+  // checksums and counters to validate before any value is updated
+  std::vector<SignalCheck> checks;
+  SignalDecodePlan plan;
+
+  // change tracking for CANParser::query_changes
+  uint32_t sig_base = 0; // index of parse_sigs[0] in CANParser::signals()
+  std::vector<uint8_t> changed;
+  bool updated = false;
+
+  void compile();
+  bool parse(uint64_t sec, uint16_t ts_, const uint8_t *data, size_t len);
+  int64_t raw_value(uint32_t i, const uint8_t *dat, uint64_t dat_le, uint64_t dat_be) const;
   bool update_counter_generic(int64_t v, int cnt_size);
 };
 
+// Signals whose value changed and messages that were received since the last
+// CANParser::query_changes call. Arrays are sized once, only the first
+// num_values/num_messages entries are valid.
+struct SignalChanges {
+  size_t num_values = 0;
+  std::vector<uint32_t> address;
+  std::vector<uint32_t> sig_index; // index into CANParser::signals()
+  std::vector<double> value;
+  std::vector<uint16_t> ts;
+
+  size_t num_messages = 0;
+  std::vector<uint32_t> msg_address;
+  std::vector<uint16_t> msg_ts;
+};
+
 class CANParser {
 private:
   const int bus;
   kj::Array<capnp::word> aligned_buf;
 
   const DBC *dbc = NULL;
-  std::unordered_map<uint32_t, MessageState> message_states;
+
+  // states are stored contiguously, sorted by address. standard IDs index
+  // them through a direct table, extended IDs through a sorted table
+  static constexpr uint16_t NO_STATE = 0xFFFF;
+  std::vector<MessageState> message_states;
+  std::array<uint16_t, CAN_STD_ADDRESSES> std_index;
+  std::vector<std::pair<uint32_t, uint16_t>> ext_index;
+
+  std::vector<SignalInfo> signal_infos;
+  SignalChanges changes;
+
+  void build_index(std::map<uint32_t, MessageState> &states);
+  MessageState *find_state(uint32_t address);
+
+  friend class CANParserGroup;
 
 public:
   bool can_valid = false;
@@ -70,6 +154,51 @@ public:
   void UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cans);
   void UpdateValid(uint64_t sec);
   std::vector<SignalValue> query_latest();
+  const SignalChanges &query_changes();
+  const std::vector<SignalInfo> &signals() const { return signal_infos; }
+};
+
+// Parsers for several buses fed from one can event. The event is copied and
+// deserialized once, and each frame goes only to the parsers of its bus.
+class CANParserGroup {
+private:
+  kj::Array<capnp::word> aligned_buf;
+  std::vector<CANParser*> parsers;
+  std::array<std::vector<CANParser*>, 256> bus_parsers; // indexed by src
+
+public:
+  CANParserGroup();
+  void add(CANParser *parser);
+  #ifndef DYNAMIC_CAPNP
+  void update_string(const std::string &data, bool sendcan);
+  void UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Reader& cans);
+  #endif
+};
+
+// One signal of a CANPackPlan, with the masks precomputed for a classic frame.
+// CAN FD frames are packed byte by byte from b1 and b2, as in Signal.
+struct CANPackSlot {
+  bool is_little_endian = false;
+  uint64_t shift = 0;
+  uint64_t mask = 0;       // field mask before shifting
+  uint64_t frame_mask = 0; // bits of the packed value the field covers
+  double factor = 1.0, offset = 0.0;
+  int b1 = 0, b2 = 0;
+};
+
+// A message and an ordered list of its signals, resolved once by
+// CANPacker::compile. pack() then takes one value per slot and does no
+// string or map lookups; COUNTER and CHECKSUM are filled in from the plan.
+// Plans of CAN FD messages (over 8 bytes) only pack through pack_vector.
+struct CANPackPlan {
+  uint32_t address = 0;
+  unsigned int size = 0;
+  std::vector<CANPackSlot> slots;
+
+  bool has_counter = false;
+  CANPackSlot counter;
+  SignalType checksum_type = SignalType::DEFAULT;
+  CANPackSlot checksum;
 };
 
 class CANPacker {
@@ -81,5 +210,11 @@ private:
 public:
   CANPacker(const std::string& dbc_name);
   uint64_t pack(uint32_t address, const std::vector<SignalPackValue> &values, int counter);
-  Msg* lookup_message(uint32_t address);
+  std::vector<uint8_t> pack_vector(uint32_t address, const std::vector<SignalPackValue> &values, int counter);
+
+  CANPackPlan compile(uint32_t address, const std::vector<std::string> &names) const;
+  uint64_t pack(const CANPackPlan &plan, const double *values, int counter) const;
+  std::vector<uint8_t> pack_vector(const CANPackPlan &plan, const double *values, int counter) const;
+
+  const Msg* lookup_message(uint32_t address) const;
 };
@@ -1,7 +1,7 @@
 # distutils: language = c++
 #cython: language_level=3
 
-from libc.stdint cimport uint32_t, uint64_t, uint16_t
+from libc.stdint cimport uint8_t, uint32_t, uint64_t, uint16_t
 from libcpp.vector cimport vector
 from libcpp.map cimport map
 from libcpp.string cimport string
@@ -59,6 +59,10 @@ cdef extern from "common_dbc.h":
     uint32_t address
     int check_frequency
 
+  cdef struct SignalInfo:
+    uint32_t address
+    const char* name
+
   cdef struct SignalValue:
     uint32_t address
     uint16_t ts
@@ -73,12 +77,36 @@ cdef extern from "common_dbc.h":
 cdef extern from "common.h":
   cdef const DBC* dbc_lookup(const string);
 
+  cdef struct SignalChanges:
+    size_t num_values
+    vector[uint32_t] address
+    vector[uint32_t] sig_index
+    vector[double] value
+    vector[uint16_t] ts
+    size_t num_messages
+    vector[uint32_t] msg_address
+    vector[uint16_t] msg_ts
+
   cdef cppclass CANParser:
     bool can_valid
     CANParser(int, string, vector[MessageParseOptions], vector[SignalParseOptions])
     void update_string(string, bool)
     vector[SignalValue] query_latest()
+    const SignalChanges& query_changes()
+    const vector[SignalInfo]& signals()
+
+  cdef cppclass CANParserGroup:
+    CANParserGroup()
+    void add(CANParser *)
+    void update_string(string, bool)
+
+  cdef cppclass CANPackPlan:
+    pass
 
   cdef cppclass CANPacker:
    CANPacker(string)
    uint64_t pack(uint32_t, vector[SignalPackValue], int counter)
+   vector[uint8_t] pack_vector(uint32_t, vector[SignalPackValue], int counter)
+   CANPackPlan compile(uint32_t, vector[string])
+   uint64_t pack(const CANPackPlan&, const double*, int counter)
+   vector[uint8_t] pack_vector(const CANPackPlan&, const double*, int counter)
@@ -23,6 +23,11 @@ struct MessageParseOptions {
   int check_frequency;
 };
 
+struct SignalInfo {
+  uint32_t address;
+  const char* name;
+};
+
 struct SignalValue {
   uint32_t address;
   uint16_t ts;
@@ -20,10 +20,15 @@ uint64_t ReverseBytes(uint64_t x) {
           ((x & 0x00000000000000ffull) << 56);
 }
 
+// shifting a 1 by 64 is undefined, full width signals are all ones
+static inline uint64_t field_mask(int size) {
+  return size >= 64 ? ~0ULL : (1ULL << size) - 1;
+}
+
 static uint64_t set_value(uint64_t ret, const Signal& sig, int64_t ival) {
   int shift = sig.is_little_endian? sig.b1 : sig.bo;
-  uint64_t mask = ((1ULL << sig.b2)-1) << shift;
-  uint64_t dat = (ival & ((1ULL << sig.b2)-1)) << shift;
+  uint64_t mask = field_mask(sig.b2) << shift;
+  uint64_t dat = (ival & field_mask(sig.b2)) << shift;
   if (sig.is_little_endian) {
     dat = ReverseBytes(dat);
     mask = ReverseBytes(mask);
@@ -33,6 +38,85 @@ static uint64_t set_value(uint64_t ret, const Signal& sig, int64_t ival) {
   return ret;
 }
 
+// sets a field in a payload of any length, one byte at a time. b1 and b2 as
+// in Signal
+static void set_bits(std::vector<uint8_t> &msg, int b1, int b2, bool is_little_endian, int64_t ival) {
+  // lsb position in DBC numbering, b1 is the msb for big endian signals
+  int lsb = b1;
+  if (!is_little_endian) {
+    const int q = b1 + b2 - 1;
+    lsb = (q / 8) * 8 + 7 - (q % 8);
+  }
+
+  uint64_t v = ival & field_mask(b2);
+  int i = lsb / 8;
+  int shift = lsb % 8;
+  int bits = b2;
+  while (bits > 0 && i >= 0 && i < (int)msg.size()) {
+    const int size = std::min(bits, 8 - shift);
+    const uint8_t mask = ((1U << size) - 1) << shift;
+    msg[i] = (msg[i] & ~mask) | ((v << shift) & mask);
+    v >>= size;
+    bits -= size;
+    shift = 0;
+    i += is_little_endian ? 1 : -1;
+  }
+}
+
+static void set_value(std::vector<uint8_t> &msg, const Signal &sig, int64_t ival) {
+  set_bits(msg, sig.b1, sig.b2, sig.is_little_endian, ival);
+}
+
+static int64_t pack_raw(const Signal &sig, double value) {
+  int64_t ival = (int64_t)(round((value - sig.offset) / sig.factor));
+  // a negative 64 bit value already is its two's complement
+  if (ival < 0 && sig.b2 < 64) {
+    ival = (1ULL << sig.b2) + ival;
+  }
+  return ival;
+}
+
+static inline uint64_t set_slot(uint64_t ret, const CANPackSlot &slot, uint64_t ival) {
+  uint64_t dat = (ival & slot.mask) << slot.shift;
+  if (slot.is_little_endian) {
+    dat = ReverseBytes(dat);
+  }
+  return (ret & ~slot.frame_mask) | dat;
+}
+
+static CANPackSlot make_slot(const Signal &sig, bool fd) {
+  CANPackSlot slot = {
+    .is_little_endian = sig.is_little_endian,
+    .factor = sig.factor,
+    .offset = sig.offset,
+    .b1 = sig.b1,
+    .b2 = sig.b2,
+  };
+  // CAN FD fields don't fit the uint64_t masks
+  if (fd) return slot;
+
+  slot.shift = sig.is_little_endian ? sig.b1 : sig.bo;
+  slot.mask = field_mask(sig.b2);
+  slot.frame_mask = slot.mask << slot.shift;
+  if (slot.is_little_endian) {
+    slot.frame_mask = ReverseBytes(slot.frame_mask);
+  }
+  return slot;
+}
+
+// CHECKSUM of a packed classic frame, -1 if type isn't a checksum
+static int compute_checksum(SignalType type, uint32_t address, uint64_t ret, unsigned int size) {
+  const ChecksumFamily *checksum = checksum_family(type);
+  if (!checksum) {
+    //WARN("CHECKSUM signal type not valid\n");
+    return -1;
+  }
+  // FIXME: Hackish fix for an endianness issue. The message is in reverse byte order
+  // until later in the pack process. Checksums can be run backwards, CRCs not so much.
+  // The correct fix is unclear but this works for the moment.
+  return checksum->calc(address, checksum->little_endian ? ReverseBytes(ret) : ret, size);
+}
+
 CANPacker::CANPacker(const std::string& dbc_name) {
   dbc = dbc_lookup(dbc_name);
   assert(dbc);
@@ -45,7 +129,6 @@ CANPacker::CANPacker(const std::string& dbc_name) {
       signal_lookup[std::make_pair(msg->address, std::string(sig->name))] = *sig;
     }
   }
-  init_crc_lookup_tables();
 }
 
 uint64_t CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &signals, int counter) {
@@ -61,12 +144,7 @@ uint64_t CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &s
     }
     const auto& sig = sig_it->second;
 
-    int64_t ival = (int64_t)(round((value - sig.offset) / sig.factor));
-    if (ival < 0) {
-      ival = (1ULL << sig.b2) + ival;
-    }
-
-    ret = set_value(ret, sig, ival);
+    ret = set_value(ret, sig, pack_raw(sig, value));
   }
 
   if (counter >= 0){
@@ -85,34 +163,141 @@ uint64_t CANPacker::pack(uint32_t address, const std::vector<SignalPackValue> &s
   }
 
   auto sig_it_checksum = signal_lookup.find(std::make_pair(address, "CHECKSUM"));
-  if (sig_it_checksum != signal_lookup.end()) {
+  auto msg_it = message_lookup.find(address);
+  if (sig_it_checksum != signal_lookup.end() && msg_it != message_lookup.end()) {
     const auto& sig = sig_it_checksum->second;
-    if (sig.type == SignalType::HONDA_CHECKSUM) {
-      unsigned int chksm = honda_checksum(address, ret, message_lookup[address].size);
-      ret = set_value(ret, sig, chksm);
-    } else if (sig.type == SignalType::TOYOTA_CHECKSUM) {
-      unsigned int chksm = toyota_checksum(address, ret, message_lookup[address].size);
-      ret = set_value(ret, sig, chksm);
-    } else if (sig.type == SignalType::VOLKSWAGEN_CHECKSUM) {
-      // FIXME: Hackish fix for an endianness issue. The message is in reverse byte order
-      // until later in the pack process. Checksums can be run backwards, CRCs not so much.
-      // The correct fix is unclear but this works for the moment.
-      unsigned int chksm = volkswagen_crc(address, ReverseBytes(ret), message_lookup[address].size);
-      ret = set_value(ret, sig, chksm);
-    } else if (sig.type == SignalType::SUBARU_CHECKSUM) {
-      unsigned int chksm = subaru_checksum(address, ret, message_lookup[address].size);
+    const int chksm = compute_checksum(sig.type, address, ret, msg_it->second.size);
+    if (chksm >= 0) {
       ret = set_value(ret, sig, chksm);
-    } else if (sig.type == SignalType::CHRYSLER_CHECKSUM) {
-      unsigned int chksm = chrysler_checksum(address, ReverseBytes(ret), message_lookup[address].size);
-      ret = set_value(ret, sig, chksm);
-    } else {
-      //WARN("CHECKSUM signal type not valid\n");
     }
   }
 
   return ret;
 }
 
-Msg* CANPacker::lookup_message(uint32_t address) {
-  return &message_lookup[address];
+CANPackPlan CANPacker::compile(uint32_t address, const std::vector<std::string> &names) const {
+  CANPackPlan plan;
+  plan.address = address;
+
+  auto msg_it = message_lookup.find(address);
+  if (msg_it == message_lookup.end()) {
+    WARN("undefined message %d\n", address);
+    return plan;
+  }
+  plan.size = msg_it->second.size;
+
+  for (const auto& name : names) {
+    auto sig_it = signal_lookup.find(std::make_pair(address, name));
+    if (sig_it == signal_lookup.end()) {
+      // an all zero slot packs nothing, same as skipping the value
+      WARN("undefined signal %s - %d\n", name.c_str(), address);
+      plan.slots.push_back({.factor = 1.0});
+      continue;
+    }
+    plan.slots.push_back(make_slot(sig_it->second, plan.size > 8));
+  }
+
+  auto counter_it = signal_lookup.find(std::make_pair(address, "COUNTER"));
+  if (counter_it != signal_lookup.end()) {
+    plan.has_counter = true;
+    plan.counter = make_slot(counter_it->second, plan.size > 8);
+  }
+
+  auto checksum_it = signal_lookup.find(std::make_pair(address, "CHECKSUM"));
+  if (checksum_it != signal_lookup.end()) {
+    plan.checksum_type = checksum_it->second.type;
+    plan.checksum = make_slot(checksum_it->second, plan.size > 8);
+  }
+
+  return plan;
+}
+
+uint64_t CANPacker::pack(const CANPackPlan &plan, const double *values, int counter) const {
+  if (plan.size > 8) {
+    WARN("message %d is CAN FD, pack it with pack_vector\n", plan.address);
+    return 0;
+  }
+
+  uint64_t ret = 0;
+  for (size_t i = 0; i < plan.slots.size(); i++) {
+    const CANPackSlot &slot = plan.slots[i];
+    ret = set_slot(ret, slot, (int64_t)round((values[i] - slot.offset) / slot.factor));
+  }
+
+  if (counter >= 0 && plan.has_counter) {
+    ret = set_slot(ret, plan.counter, counter);
+  }
+
+  const int chksm = compute_checksum(plan.checksum_type, plan.address, ret, plan.size);
+  if (chksm >= 0) {
+    ret = set_slot(ret, plan.checksum, chksm);
+  }
+
+  return ret;
+}
+
+std::vector<uint8_t> CANPacker::pack_vector(uint32_t address, const std::vector<SignalPackValue> &signals, int counter) {
+  auto msg_it = message_lookup.find(address);
+  if (msg_it == message_lookup.end()) {
+    WARN("undefined message %d\n", address);
+    return {};
+  }
+  const Msg &msg = msg_it->second;
+
+  std::vector<uint8_t> ret(msg.size, 0);
+  if (msg.size <= 8) {
+    const uint64_t dat = pack(address, signals, counter);
+    for (int i = 0; i < msg.size; i++) {
+      ret[i] = dat >> (56 - 8 * i);
+    }
+    return ret;
+  }
+
+  for (const auto& sigval : signals) {
+    auto sig_it = signal_lookup.find(std::make_pair(address, std::string(sigval.name)));
+    if (sig_it == signal_lookup.end()) {
+      WARN("undefined signal %s - %d\n", sigval.name, address);
+      continue;
+    }
+    set_value(ret, sig_it->second, pack_raw(sig_it->second, sigval.value));
+  }
+
+  if (counter >= 0) {
+    auto sig_it = signal_lookup.find(std::make_pair(address, "COUNTER"));
+    if (sig_it == signal_lookup.end()) {
+      WARN("COUNTER not defined\n");
+      return ret;
+    }
+    set_value(ret, sig_it->second, counter);
+  }
+
+  // none of the CHECKSUM types are defined for CAN FD payloads
+  return ret;
+}
+
+std::vector<uint8_t> CANPacker::pack_vector(const CANPackPlan &plan, const double *values, int counter) const {
+  std::vector<uint8_t> ret(plan.size, 0);
+  if (plan.size <= 8) {
+    const uint64_t dat = pack(plan, values, counter);
+    for (size_t i = 0; i < plan.size; i++) {
+      ret[i] = dat >> (56 - 8 * i);
+    }
+    return ret;
+  }
+
+  for (size_t i = 0; i < plan.slots.size(); i++) {
+    const CANPackSlot &slot = plan.slots[i];
+    set_bits(ret, slot.b1, slot.b2, slot.is_little_endian, (int64_t)round((values[i] - slot.offset) / slot.factor));
+  }
+  if (counter >= 0 && plan.has_counter) {
+    set_bits(ret, plan.counter.b1, plan.counter.b2, plan.counter.is_little_endian, counter);
+  }
+
+  // none of the CHECKSUM types are defined for CAN FD payloads
+  return ret;
+}
+
+const Msg* CANPacker::lookup_message(uint32_t address) const {
+  auto msg_it = message_lookup.find(address);
+  return msg_it != message_lookup.end() ? &msg_it->second : nullptr;
 }
@@ -1,7 +1,7 @@
 # distutils: language = c++
 # cython: c_string_encoding=ascii, language_level=3
 
-from libc.stdint cimport uint32_t, uint64_t
+from libc.stdint cimport uint8_t, uint32_t, uint64_t
 from libcpp.vector cimport vector
 from libcpp.map cimport map
 from libcpp.string cimport string
@@ -9,7 +9,8 @@ from libcpp cimport bool
 from posix.dlfcn cimport dlopen, dlsym, RTLD_LAZY
 
 from .common cimport CANPacker as cpp_CANPacker
-from .common cimport dbc_lookup, SignalPackValue, DBC
+from .common cimport CANPackPlan
+from .common cimport dbc_lookup, DBC
 
 
 cdef class CANPacker:
@@ -18,6 +19,8 @@ cdef class CANPacker:
     const DBC *dbc
     map[string, (int, int)] name_to_address_and_size
     map[int, int] address_to_size
+    vector[CANPackPlan] plans
+    dict plan_index
 
   def __init__(self, dbc_name):
     self.dbc = dbc_lookup(dbc_name)
@@ -25,27 +28,34 @@ cdef class CANPacker:
       raise RuntimeError(f"Can't lookup {dbc_name}")
 
     self.packer = new cpp_CANPacker(dbc_name)
+    self.plan_index = {}
     num_msgs = self.dbc[0].num_msgs
     for i in range(num_msgs):
       msg = self.dbc[0].msgs[i]
       self.name_to_address_and_size[string(msg.name)] = (msg.address, msg.size)
       self.address_to_size[msg.address] = msg.size
 
-  cdef uint64_t pack(self, addr, values, counter):
-    cdef vector[SignalPackValue] values_thing
-    cdef SignalPackValue spv
-
-    names = []
+  cdef int plan(self, addr, values):
+    # plans are cached per message and signal order, after the first call
+    # only the values are converted
+    key = (addr, tuple(values))
+    plan_idx = self.plan_index.get(key)
+    if plan_idx is None:
+      plan_idx = self.plans.size()
+      self.plans.push_back(self.packer.compile(addr, [name.encode('utf8') for name in values]))
+      self.plan_index[key] = plan_idx
+    return plan_idx
 
-    for name, value in values.iteritems():
-      n = name.encode('utf8')
-      names.append(n) # TODO: find better way to keep reference to temp string around
-
-      spv.name = n
-      spv.value = value
-      values_thing.push_back(spv)
+  cdef uint64_t pack(self, addr, values, counter):
+    cdef int plan_idx = self.plan(addr, values)
+    cdef vector[double] values_thing = list(values.values())
+    return self.packer.pack(self.plans[plan_idx], values_thing.data(), counter)
 
-    return self.packer.pack(addr, values_thing, counter)
+  cdef bytes pack_fd(self, addr, values, counter):
+    cdef int plan_idx = self.plan(addr, values)
+    cdef vector[double] values_thing = list(values.values())
+    cdef vector[uint8_t] dat = self.packer.pack_vector(self.plans[plan_idx], values_thing.data(), counter)
+    return (<char *>dat.data())[:dat.size()]
 
   cdef inline uint64_t ReverseBytes(self, uint64_t x):
     return (((x & 0xff00000000000000ull) >> 56) |
@@ -64,6 +74,8 @@ cdef class CANPacker:
       size = self.address_to_size[name_or_addr]
     else:
       addr, size = self.name_to_address_and_size[name_or_addr.encode('utf8')]
+    if size > 8:
+      return [addr, 0, self.pack_fd(addr, values, counter), bus]
     cdef uint64_t val = self.pack(addr, values, counter)
     val = self.ReverseBytes(val)
     return [addr, 0, (<char *>&val)[:size], bus]
@@ -6,6 +6,7 @@
 #include <sys/stat.h>
 #include <sys/mman.h>
 #include <algorithm>
+#include <numeric>
 
 #include "common.h"
 
@@ -13,79 +14,175 @@
 // #define DEBUG printf
 #define INFO printf
 
-bool MessageState::parse(uint64_t sec, uint16_t ts_, uint8_t * dat) {
-  uint64_t dat_le = read_u64_le(dat);
-  uint64_t dat_be = read_u64_be(dat);
+// parse() copies frames into a zero padded buffer, so 64-bit windows and
+// spill bytes can be read anywhere in a CAN FD payload without bounds checks
+#define FRAME_BUF_SIZE (CANFD_MAX_DLC + 8)
 
-  for (int i=0; i < parse_sigs.size(); i++) {
-    auto& sig = parse_sigs[i];
-    int64_t tmp;
+static inline int64_t sign_extend(uint64_t raw, uint64_t sign) {
+  // xor/sub sign extends when sign is the top bit of the field, and is a no-op when it is 0
+  return (int64_t)((raw ^ sign) - sign);
+}
+
+static inline int64_t decode_raw(uint64_t dat, uint64_t shift, uint64_t mask, uint64_t sign) {
+  return sign_extend((dat >> shift) & mask, sign);
+}
 
-    if (sig.is_little_endian){
-      tmp = (dat_le >> sig.b1) & ((1ULL << sig.b2)-1);
+static inline int64_t decode_fd(const uint8_t *dat, uint64_t window, uint32_t i, const SignalDecodePlan &plan) {
+  const uint64_t raw = (window >> plan.shift[i]) | ((uint64_t)dat[plan.spill_byte[i]] << plan.spill_shift[i]);
+  return sign_extend(raw & plan.mask[i], plan.sign[i]);
+}
+
+void MessageState::compile() {
+  // stable partition keeps the DBC order within each endianness group
+  std::vector<size_t> order(parse_sigs.size());
+  std::iota(order.begin(), order.end(), 0);
+  auto le_end = std::stable_partition(order.begin(), order.end(), [&](size_t i) {
+    return parse_sigs[i].is_little_endian;
+  });
+
+  std::vector<Signal> sigs;
+  std::vector<double> defaults;
+  for (size_t i : order) {
+    sigs.push_back(parse_sigs[i]);
+    defaults.push_back(vals[i]);
+  }
+  parse_sigs = std::move(sigs);
+  vals = std::move(defaults);
+
+  plan = SignalDecodePlan();
+  plan.fd = size > 8;
+  plan.num_le = le_end - order.begin();
+  checks.clear();
+  // everything counts as changed until the first query, so defaults get reported
+  changed.assign(parse_sigs.size(), 1);
+  updated = true;
+
+  std::vector<SignalCheck> counters;
+  for (uint32_t i = 0; i < parse_sigs.size(); i++) {
+    const Signal &sig = parse_sigs[i];
+    if (!plan.fd) {
+      plan.shift.push_back(sig.is_little_endian ? sig.b1 : sig.bo);
     } else {
-      tmp = (dat_be >> sig.bo) & ((1ULL << sig.b2)-1);
+      // b1 is the lsb for little endian signals and the msb, counted from
+      // the start of the frame, for big endian signals
+      int start, shift;
+      if (sig.is_little_endian) {
+        start = sig.b1 / 8;
+        shift = sig.b1 % 8;
+      } else {
+        const int end = (sig.b1 + sig.b2 - 1) / 8;
+        start = std::max(0, end - 7);
+        shift = 8 * (start + 8) - (sig.b1 + sig.b2);
+      }
+      const bool spill = shift + sig.b2 > 64;
+      plan.byte.push_back(start);
+      plan.shift.push_back(shift);
+      plan.spill_byte.push_back(!spill ? CANFD_MAX_DLC : sig.is_little_endian ? start + 8 : start - 1);
+      plan.spill_shift.push_back(spill ? 64 - shift : 0);
     }
-
-    if (sig.is_signed) {
-      tmp -= (tmp >> (sig.b2-1)) ? (1ULL << sig.b2) : 0; //signed
+    plan.mask.push_back(sig.b2 >= 64 ? ~0ULL : (1ULL << sig.b2) - 1);
+    plan.sign.push_back(sig.is_signed ? 1ULL << (sig.b2 - 1) : 0);
+    plan.factor.push_back(sig.factor);
+    plan.offset.push_back(sig.offset);
+
+    if (const ChecksumFamily *checksum = checksum_family(sig.type)) {
+      // these algorithms are only defined for classic 8 byte frames
+      if (!ignore_checksum && !plan.fd) {
+        checks.push_back({checksum, i});
+      } else if (!ignore_checksum && !plan.unchecked_checksum) {
+        fprintf(stderr, "CANParser: can't check checksum %s of CAN FD message 0x%X, dropping its frames\n",
+                sig.name, address);
+        plan.unchecked_checksum = true;
+      }
+    } else if (sig.type == SignalType::HONDA_COUNTER || sig.type == SignalType::PEDAL_COUNTER ||
+               sig.type == SignalType::VOLKSWAGEN_COUNTER) {
+      if (!ignore_counter) counters.push_back({nullptr, i});
     }
+  }
+  // a frame with a bad checksum must not advance the counter
+  checks.insert(checks.end(), counters.begin(), counters.end());
+}
 
-    DEBUG("parse 0x%X %s -> %lld\n", address, sig.name, tmp);
+int64_t MessageState::raw_value(uint32_t i, const uint8_t *dat, uint64_t dat_le, uint64_t dat_be) const {
+  if (!plan.fd) {
+    return decode_raw(i < plan.num_le ? dat_le : dat_be, plan.shift[i], plan.mask[i], plan.sign[i]);
+  }
+  const uint64_t window = i < plan.num_le ? read_u64_le(dat + plan.byte[i]) : read_u64_be(dat + plan.byte[i]);
+  return decode_fd(dat, window, i, plan);
+}
 
-    if (!ignore_checksum) {
-      if (sig.type == SignalType::HONDA_CHECKSUM) {
-        if (honda_checksum(address, dat_be, size) != tmp) {
-          INFO("0x%X CHECKSUM FAIL\n", address);
-          return false;
-        }
-      } else if (sig.type == SignalType::TOYOTA_CHECKSUM) {
-        if (toyota_checksum(address, dat_be, size) != tmp) {
-          INFO("0x%X CHECKSUM FAIL\n", address);
-          return false;
-        }
-      } else if (sig.type == SignalType::VOLKSWAGEN_CHECKSUM) {
-        if (volkswagen_crc(address, dat_le, size) != tmp) {
-          INFO("0x%X CRC FAIL\n", address);
-          return false;
-        }
-      } else if (sig.type == SignalType::SUBARU_CHECKSUM) {
-        if (subaru_checksum(address, dat_be, size) != tmp) {
-          INFO("0x%X CHECKSUM FAIL\n", address);
-          return false;
-        }
-      } else if (sig.type == SignalType::CHRYSLER_CHECKSUM) {
-        if (chrysler_checksum(address, dat_le, size) != tmp) {
-          INFO("0x%X CHECKSUM FAIL\n", address);
-          return false;
-        }
-      } else if (sig.type == SignalType::PEDAL_CHECKSUM) {
-        if (pedal_checksum(dat_be, size) != tmp) {
-          INFO("0x%X PEDAL CHECKSUM FAIL\n", address);
-          return false;
-        }
-      }
-    }
-    if (!ignore_counter) {
-      if (sig.type == SignalType::HONDA_COUNTER) {
-        if (!update_counter_generic(tmp, sig.b2)) {
-          return false;
-        }
-      } else if (sig.type == SignalType::VOLKSWAGEN_COUNTER) {
-          if (!update_counter_generic(tmp, sig.b2)) {
-          return false;
-        }
-      } else if (sig.type == SignalType::PEDAL_COUNTER) {
-        if (!update_counter_generic(tmp, sig.b2)) {
-          return false;
-        }
+bool MessageState::parse(uint64_t sec, uint16_t ts_, const uint8_t *data, size_t len) {
+  // longer classic frames don't match the DBC, drop them like bad checksums
+  if (len > (plan.fd ? CANFD_MAX_DLC : 8) || plan.unchecked_checksum) return false;
+
+  // classic frames only ever read the first word, keep their copy constant size
+  uint8_t dat[FRAME_BUF_SIZE];
+  if (!plan.fd) {
+    memset(dat, 0, 8);
+    memcpy(dat, data, len);
+  } else {
+    memset(dat, 0, sizeof(dat));
+    memcpy(dat, data, len);
+  }
+
+  const uint64_t dat_le = read_u64_le(dat);
+  const uint64_t dat_be = read_u64_be(dat);
+
+  for (const auto &check : checks) {
+    const uint32_t i = check.idx;
+    const int64_t tmp = raw_value(i, dat, dat_le, dat_be);
+
+    if (check.checksum) {
+      const uint64_t d = check.checksum->little_endian ? dat_le : dat_be;
+      if (check.checksum->calc(address, d, size) != tmp) {
+        INFO("0x%X %s FAIL\n", address, check.checksum->name);
+        return false;
       }
+    } else if (!update_counter_generic(tmp, parse_sigs[i].b2)) {
+      return false;
     }
+  }
 
-    vals[i] = tmp * sig.factor + sig.offset;
+  // no branches from here on, each group is a straight loop over the plan arrays
+  const size_t num_sigs = parse_sigs.size();
+  const size_t num_le = plan.num_le;
+  const uint64_t *shift = plan.shift.data();
+  const uint64_t *mask = plan.mask.data();
+  const uint64_t *sign = plan.sign.data();
+  const double *factor = plan.factor.data();
+  const double *offset = plan.offset.data();
+  double *out = vals.data();
+
+  uint8_t *dirty = changed.data();
+
+  if (!plan.fd) {
+    for (size_t i = 0; i < num_le; i++) {
+      const double v = decode_raw(dat_le, shift[i], mask[i], sign[i]) * factor[i] + offset[i];
+      dirty[i] |= out[i] != v;
+      out[i] = v;
+    }
+    for (size_t i = num_le; i < num_sigs; i++) {
+      const double v = decode_raw(dat_be, shift[i], mask[i], sign[i]) * factor[i] + offset[i];
+      dirty[i] |= out[i] != v;
+      out[i] = v;
+    }
+  } else {
+    const uint32_t *byte = plan.byte.data();
+    for (size_t i = 0; i < num_le; i++) {
+      const double v = decode_fd(dat, read_u64_le(dat + byte[i]), i, plan) * factor[i] + offset[i];
+      dirty[i] |= out[i] != v;
+      out[i] = v;
+    }
+    for (size_t i = num_le; i < num_sigs; i++) {
+      const double v = decode_fd(dat, read_u64_be(dat + byte[i]), i, plan) * factor[i] + offset[i];
+      dirty[i] |= out[i] != v;
+      out[i] = v;
+    }
   }
+
   ts = ts_;
   seen = sec;
+  updated = true;
 
   return true;
 }
@@ -116,10 +213,10 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
 
   dbc = dbc_lookup(dbc_name);
   assert(dbc);
-  init_crc_lookup_tables();
 
+  std::map<uint32_t, MessageState> states;
   for (const auto& op : options) {
-    MessageState &state = message_states[op.address];
+    MessageState &state = states[op.address];
     state.address = op.address;
     // state.check_frequency = op.check_frequency,
 
@@ -166,6 +263,8 @@ CANParser::CANParser(int abus, const std::string& dbc_name,
       }
     }
   }
+
+  build_index(states);
 }
 
 CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum, bool ignore_counter)
@@ -174,8 +273,8 @@ CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum
 
   dbc = dbc_lookup(dbc_name);
   assert(dbc);
-  init_crc_lookup_tables();
 
+  std::map<uint32_t, MessageState> states;
   for (int i = 0; i < dbc->num_msgs; i++) {
     const Msg* msg = &dbc->msgs[i];
     MessageState state = {
@@ -191,8 +290,57 @@ CANParser::CANParser(int abus, const std::string& dbc_name, bool ignore_checksum
       state.vals.push_back(0);
     }
 
-    message_states[state.address] = state;
+    states[state.address] = state;
   }
+
+  build_index(states);
+}
+
+void CANParser::build_index(std::map<uint32_t, MessageState> &states) {
+  assert(states.size() < NO_STATE);
+
+  message_states.clear();
+  message_states.reserve(states.size());
+  std_index.fill(NO_STATE);
+  ext_index.clear();
+  signal_infos.clear();
+
+  // map iteration is sorted by address, so ext_index comes out sorted too
+  for (auto &kv : states) {
+    const uint16_t idx = message_states.size();
+    kv.second.compile();
+    kv.second.sig_base = signal_infos.size();
+    for (const auto &sig : kv.second.parse_sigs) {
+      signal_infos.push_back({kv.first, sig.name});
+    }
+    message_states.push_back(std::move(kv.second));
+
+    if (kv.first < CAN_STD_ADDRESSES) {
+      std_index[kv.first] = idx;
+    } else {
+      ext_index.push_back({kv.first, idx});
+    }
+  }
+
+  changes.address.resize(signal_infos.size());
+  changes.sig_index.resize(signal_infos.size());
+  changes.value.resize(signal_infos.size());
+  changes.ts.resize(signal_infos.size());
+  changes.msg_address.resize(message_states.size());
+  changes.msg_ts.resize(message_states.size());
+}
+
+MessageState *CANParser::find_state(uint32_t address) {
+  uint16_t idx = NO_STATE;
+  if (address < CAN_STD_ADDRESSES) {
+    idx = std_index[address];
+  } else {
+    auto it = std::lower_bound(ext_index.begin(), ext_index.end(), std::make_pair(address, (uint16_t)0));
+    if (it != ext_index.end() && it->first == address) {
+      idx = it->second;
+    }
+  }
+  return idx == NO_STATE ? nullptr : &message_states[idx];
 }
 
 #ifndef DYNAMIC_CAPNP
@@ -228,17 +376,59 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Rea
       // DEBUG("skip %d: wrong bus\n", cmsg.getAddress());
       continue;
     }
-    auto state_it = message_states.find(cmsg.getAddress());
-    if (state_it == message_states.end()) {
+    MessageState *state = find_state(cmsg.getAddress());
+    if (!state) {
       // DEBUG("skip %d: not specified\n", cmsg.getAddress());
       continue;
     }
 
-    if (cmsg.getDat().size() > 8) continue; //shouldn't ever happen
-    uint8_t dat[8] = {0};
-    memcpy(dat, cmsg.getDat().begin(), cmsg.getDat().size());
+    state->parse(sec, cmsg.getBusTime(), cmsg.getDat().begin(), cmsg.getDat().size());
+  }
+}
+#endif
 
-    state_it->second.parse(sec, cmsg.getBusTime(), dat);
+CANParserGroup::CANParserGroup() : aligned_buf(kj::heapArray<capnp::word>(1024)) {}
+
+void CANParserGroup::add(CANParser *parser) {
+  assert(parser->bus >= 0 && parser->bus < bus_parsers.size());
+  parsers.push_back(parser);
+  bus_parsers[parser->bus].push_back(parser);
+}
+
+#ifndef DYNAMIC_CAPNP
+void CANParserGroup::update_string(const std::string &data, bool sendcan) {
+  // same as CANParser::update_string, once for all parsers
+  const size_t buf_size = (data.length() / sizeof(capnp::word)) + 1;
+  if (aligned_buf.size() < buf_size) {
+    aligned_buf = kj::heapArray<capnp::word>(buf_size);
+  }
+  memcpy(aligned_buf.begin(), data.data(), data.length());
+
+  capnp::FlatArrayMessageReader cmsg(aligned_buf.slice(0, buf_size));
+  cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+
+  const uint64_t sec = event.getLogMonoTime();
+
+  UpdateCans(sec, sendcan ? event.getSendcan() : event.getCan());
+
+  for (CANParser *parser : parsers) {
+    parser->last_sec = sec;
+    parser->UpdateValid(sec);
+  }
+}
+
+void CANParserGroup::UpdateCans(uint64_t sec, const capnp::List<cereal::CanData>::Reader& cans) {
+  for (const auto cmsg : cans) {
+    const auto &targets = bus_parsers[cmsg.getSrc()];
+    if (targets.empty()) continue;
+
+    const auto dat = cmsg.getDat();
+    for (CANParser *parser : targets) {
+      MessageState *state = parser->find_state(cmsg.getAddress());
+      if (state) {
+        state->parse(sec, cmsg.getBusTime(), dat.begin(), dat.size());
+      }
+    }
   }
 }
 #endif
@@ -252,23 +442,19 @@ void CANParser::UpdateCans(uint64_t sec, const capnp::DynamicStruct::Reader& cms
     return;
   }
 
-  auto state_it = message_states.find(cmsg.get("address").as<uint32_t>());
-  if (state_it == message_states.end()) {
+  MessageState *state = find_state(cmsg.get("address").as<uint32_t>());
+  if (!state) {
     DEBUG("skip %d: not specified\n", cmsg.get("address").as<uint32_t>());
     return;
   }
 
   auto dat = cmsg.get("dat").as<capnp::Data>();
-  if (dat.size() > 8) return; //shouldn't ever happen
-  uint8_t data[8] = {0};
-  memcpy(data, dat.begin(), dat.size());
-  state_it->second.parse(sec, cmsg.get("busTime").as<uint16_t>(), data);
+  state->parse(sec, cmsg.get("busTime").as<uint16_t>(), dat.begin(), dat.size());
 }
 
 void CANParser::UpdateValid(uint64_t sec) {
   can_valid = true;
-  for (const auto& kv : message_states) {
-    const auto& state = kv.second;
+  for (const auto& state : message_states) {
     if (state.check_threshold > 0 && (sec - state.seen) > state.check_threshold) {
       if (state.seen > 0) {
         DEBUG("0x%X TIMEOUT\n", state.address);
@@ -283,8 +469,7 @@ void CANParser::UpdateValid(uint64_t sec) {
 std::vector<SignalValue> CANParser::query_latest() {
   std::vector<SignalValue> ret;
 
-  for (const auto& kv : message_states) {
-    const auto& state = kv.second;
+  for (const auto& state : message_states) {
     if (last_sec != 0 && state.seen != last_sec) continue;
 
     for (int i=0; i<state.parse_sigs.size(); i++) {
@@ -300,3 +485,30 @@ std::vector<SignalValue> CANParser::query_latest() {
 
   return ret;
 }
+
+const SignalChanges &CANParser::query_changes() {
+  changes.num_values = 0;
+  changes.num_messages = 0;
+
+  for (auto &state : message_states) {
+    if (!state.updated) continue;
+    state.updated = false;
+
+    changes.msg_address[changes.num_messages] = state.address;
+    changes.msg_ts[changes.num_messages] = state.ts;
+    changes.num_messages++;
+
+    for (uint32_t i = 0; i < state.parse_sigs.size(); i++) {
+      if (!state.changed[i]) continue;
+      state.changed[i] = 0;
+
+      const size_t n = changes.num_values++;
+      changes.address[n] = state.address;
+      changes.sig_index[n] = state.sig_base + i;
+      changes.value[n] = state.vals[i];
+      changes.ts[n] = state.ts;
+    }
+  }
+
+  return changes;
+}
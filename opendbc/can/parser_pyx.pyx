@@ -9,7 +9,8 @@ from libcpp.map cimport map
 from libcpp cimport bool
 
 from .common cimport CANParser as cpp_CANParser
-from .common cimport SignalParseOptions, MessageParseOptions, dbc_lookup, SignalValue, DBC
+from .common cimport CANParserGroup as cpp_CANParserGroup
+from .common cimport SignalParseOptions, MessageParseOptions, dbc_lookup, SignalValue, SignalInfo, SignalChanges, DBC
 
 import os
 import numbers
@@ -25,6 +26,9 @@ cdef class CANParser:
     map[uint32_t, string] address_to_msg_name
     vector[SignalValue] can_values
     bool test_mode_enabled
+    list sig_names
+    list sig_vl
+    dict msg_sig_names
 
   cdef readonly:
     string dbc_name
@@ -54,10 +58,11 @@ cdef class CANParser:
 
       self.msg_name_to_address[name] = msg.address
       self.address_to_msg_name[msg.address] = name
+      # both keys share one dict, so updates only need to touch one of them
       self.vl[msg.address] = {}
-      self.vl[name] = {}
+      self.vl[name] = self.vl[msg.address]
       self.ts[msg.address] = {}
-      self.ts[name] = {}
+      self.ts[name] = self.ts[msg.address]
 
     # Convert message names into addresses
     for i in range(len(signals)):
@@ -101,13 +106,26 @@ cdef class CANParser:
       message_options_v.push_back(mpo)
 
     self.can = new cpp_CANParser(bus, dbc_name, message_options_v, signal_options_v)
+
+    # resolve signal names once, query_changes only hands out indices
+    self.sig_names = []
+    self.sig_vl = []
+    self.msg_sig_names = defaultdict(list)
+    cdef SignalInfo info
+    for info in self.can.signals():
+      sig_name = <unicode>info.name
+      self.sig_names.append(sig_name)
+      self.sig_vl.append(self.vl[info.address])
+      self.msg_sig_names[info.address].append(sig_name)
+
     self.update_vl()
 
   cdef unordered_set[uint32_t] update_vl(self):
-    cdef string sig_name
     cdef unordered_set[uint32_t] updated_val
+    cdef const SignalChanges *changes = &self.can.query_changes()
+    cdef size_t i
+    cdef uint32_t idx
 
-    can_values = self.can.query_latest()
     valid = self.can.can_valid
 
     # Update invalid flag
@@ -116,18 +134,18 @@ cdef class CANParser:
         self.can_invalid_cnt = 0
     self.can_valid = self.can_invalid_cnt < CAN_INVALID_CNT
 
-    for cv in can_values:
-      # Cast char * directly to unicode
-      name = <unicode>self.address_to_msg_name[cv.address].c_str()
-      cv_name = <unicode>cv.name
+    for i in range(changes.num_values):
+      idx = changes.sig_index[i]
+      self.sig_vl[idx][self.sig_names[idx]] = changes.value[i]
 
-      self.vl[cv.address][cv_name] = cv.value
-      self.ts[cv.address][cv_name] = cv.ts
+    for i in range(changes.num_messages):
+      address = changes.msg_address[i]
+      ts = changes.msg_ts[i]
+      msg_ts = self.ts[address]
+      for sig_name in self.msg_sig_names[address]:
+        msg_ts[sig_name] = ts
 
-      self.vl[name][cv_name] = cv.value
-      self.ts[name][cv_name] = cv.ts
-
-      updated_val.insert(cv.address)
+      updated_val.insert(changes.msg_address[i])
 
     return updated_val
 
@@ -144,6 +162,32 @@ cdef class CANParser:
 
     return updated_vals
 
+cdef class CANParserGroup:
+  """Updates several CANParsers, usually one per bus, from a single pass over each can event."""
+  cdef:
+    cpp_CANParserGroup *group
+    list parsers
+
+  def __cinit__(self, *parsers):
+    self.group = new cpp_CANParserGroup()
+    self.parsers = [p for p in parsers if p is not None]
+    for p in self.parsers:
+      self.group.add((<CANParser>p).can)
+
+  def __dealloc__(self):
+    del self.group
+
+  def update_strings(self, strings, sendcan=False):
+    cdef CANParser p
+    updated_vals = [set() for _ in self.parsers]
+
+    for s in strings:
+      self.group.update_string(s, sendcan)
+      for i, p in enumerate(self.parsers):
+        updated_vals[i].update(p.update_vl())
+
+    return updated_vals
+
 cdef class CANDefine():
   cdef:
     const DBC *dbc
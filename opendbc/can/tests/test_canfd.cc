@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "opendbc/can/common.h"
+
+// Signals as process_dbc generates them from:
+//
+// BO_ 256 FD_MSG: 64 XXX
+//  SG_ LE_CROSS : 124|16@1- (0.5,-10) [0|0] "" XXX
+//  SG_ BE_CROSS : 59|12@0+ (1,0) [0|0] "" XXX
+//  SG_ LE_WIDE : 141|62@1+ (1,0) [0|0] "" XXX
+//  SG_ BE_WIDE : 253|64@0+ (1,0) [0|0] "" XXX
+//  SG_ LE_TAIL : 500|12@1- (0.1,0) [0|0] "" XXX
+//  SG_ BE_HEAD : 7|8@0+ (1,0) [0|0] "" XXX
+//  SG_ COUNTER : 488|4@1+ (1,0) [0|0] "" XXX
+// BO_ 257 CLASSIC_MSG: 8 XXX
+//  SG_ LE_SIG : 3|20@1- (0.01,0) [0|0] "" XXX
+//  SG_ BE_SIG : 39|16@0+ (1,5) [0|0] "" XXX
+// BO_ 258 FD_CHECKSUM_MSG: 16 XXX
+//  SG_ CHECKSUM : 127|8@0+ (1,0) [0|0] "" XXX
+//  SG_ VALUE : 0|16@1+ (1,0) [0|0] "" XXX
+// BO_ 259 FD_FULL_MSG: 16 XXX
+//  SG_ LE_FULL : 64|64@1- (1,0) [0|0] "" XXX
+// BO_ 260 CLASSIC_FULL_MSG: 8 XXX
+//  SG_ FULL : 0|64@1- (1,0) [0|0] "" XXX
+namespace {
+
+const Signal sigs_256[] = {
+  {.name = "COUNTER", .b1 = 488, .b2 = 4, .bo = 64 - (488 + 4), .is_signed = false, .factor = 1, .offset = 0, .is_little_endian = true, .type = SignalType::DEFAULT},
+  {.name = "LE_CROSS", .b1 = 124, .b2 = 16, .bo = 64 - (124 + 16), .is_signed = true, .factor = 0.5, .offset = -10, .is_little_endian = true, .type = SignalType::DEFAULT},
+  {.name = "BE_CROSS", .b1 = 60, .b2 = 12, .bo = 64 - (60 + 12), .is_signed = false, .factor = 1, .offset = 0, .is_little_endian = false, .type = SignalType::DEFAULT},
+  {.name = "LE_WIDE", .b1 = 141, .b2 = 62, .bo = 64 - (141 + 62), .is_signed = false, .factor = 1, .offset = 0, .is_little_endian = true, .type = SignalType::DEFAULT},
+  {.name = "BE_WIDE", .b1 = 250, .b2 = 64, .bo = 64 - (250 + 64), .is_signed = false, .factor = 1, .offset = 0, .is_little_endian = false, .type = SignalType::DEFAULT},
+  {.name = "LE_TAIL", .b1 = 500, .b2 = 12, .bo = 64 - (500 + 12), .is_signed = true, .factor = 0.1, .offset = 0, .is_little_endian = true, .type = SignalType::DEFAULT},
+  {.name = "BE_HEAD", .b1 = 0, .b2 = 8, .bo = 56, .is_signed = false, .factor = 1, .offset = 0, .is_little_endian = false, .type = SignalType::DEFAULT},
+};
+
+const Signal sigs_257[] = {
+  {.name = "LE_SIG", .b1 = 3, .b2 = 20, .bo = 41, .is_signed = true, .factor = 0.01, .offset = 0, .is_little_endian = true, .type = SignalType::DEFAULT},
+  {.name = "BE_SIG", .b1 = 32, .b2 = 16, .bo = 16, .is_signed = false, .factor = 1, .offset = 5, .is_little_endian = false, .type = SignalType::DEFAULT},
+};
+
+const Signal sigs_258[] = {
+  {.name = "CHECKSUM", .b1 = 120, .b2 = 8, .bo = 64 - (120 + 8), .is_signed = false, .factor = 1, .offset = 0, .is_little_endian = false, .type = SignalType::TOYOTA_CHECKSUM},
+  {.name = "VALUE", .b1 = 0, .b2 = 16, .bo = 48, .is_signed = false, .factor = 1, .offset = 0, .is_little_endian = true, .type = SignalType::DEFAULT},
+};
+
+const Signal sigs_259[] = {
+  {.name = "LE_FULL", .b1 = 64, .b2 = 64, .bo = 64 - (64 + 64), .is_signed = true, .factor = 1, .offset = 0, .is_little_endian = true, .type = SignalType::DEFAULT},
+};
+
+const Signal sigs_260[] = {
+  {.name = "FULL", .b1 = 0, .b2 = 64, .bo = 0, .is_signed = true, .factor = 1, .offset = 0, .is_little_endian = true, .type = SignalType::DEFAULT},
+};
+
+const Msg msgs[] = {
+  {.name = "FD_MSG", .address = 0x100, .size = 64, .num_sigs = ARRAYSIZE(sigs_256), .sigs = sigs_256},
+  {.name = "CLASSIC_MSG", .address = 0x101, .size = 8, .num_sigs = ARRAYSIZE(sigs_257), .sigs = sigs_257},
+  {.name = "FD_CHECKSUM_MSG", .address = 0x102, .size = 16, .num_sigs = ARRAYSIZE(sigs_258), .sigs = sigs_258},
+  {.name = "FD_FULL_MSG", .address = 0x103, .size = 16, .num_sigs = ARRAYSIZE(sigs_259), .sigs = sigs_259},
+  {.name = "CLASSIC_FULL_MSG", .address = 0x104, .size = 8, .num_sigs = ARRAYSIZE(sigs_260), .sigs = sigs_260},
+};
+
+}
+
+const DBC test_canfd = {
+  .name = "test_canfd",
+  .num_msgs = ARRAYSIZE(msgs),
+  .msgs = msgs,
+  .vals = nullptr,
+  .num_vals = 0,
+};
+
+dbc_init(test_canfd)
+
+// bit by bit reference, walking the signal from its msb
+static int64_t reference_raw(const Signal &sig, const std::vector<uint8_t> &dat) {
+  uint64_t v = 0;
+  for (int k = 0; k < sig.b2; k++) {
+    int byte, bit;
+    if (sig.is_little_endian) {
+      const int p = sig.b1 + sig.b2 - 1 - k;
+      byte = p / 8;
+      bit = p % 8;
+    } else {
+      const int q = sig.b1 + k;
+      byte = q / 8;
+      bit = 7 - q % 8;
+    }
+    v = (v << 1) | ((dat[byte] >> bit) & 1);
+  }
+  if (sig.is_signed && sig.b2 < 64 && ((v >> (sig.b2 - 1)) & 1)) {
+    v |= ~0ULL << sig.b2;
+  }
+  return (int64_t)v;
+}
+
+static std::string make_event(uint32_t address, const std::vector<uint8_t> &dat, uint64_t mono_time) {
+  capnp::MallocMessageBuilder msg;
+  auto event = msg.initRoot<cereal::Event>();
+  event.setLogMonoTime(mono_time);
+  auto cans = event.initCan(1);
+  cans[0].setAddress(address);
+  cans[0].setSrc(0);
+  cans[0].setDat(kj::arrayPtr(dat.data(), dat.size()));
+  auto words = capnp::messageToFlatArray(msg);
+  auto bytes = words.asBytes();
+  return std::string(bytes.begin(), bytes.end());
+}
+
+// values of address the last update set
+static size_t num_updated(CANParser &parser, uint32_t address) {
+  const auto values = parser.query_latest();
+  return std::count_if(values.begin(), values.end(), [&](const SignalValue &sv) { return sv.address == address; });
+}
+
+static void check_values(CANParser &parser, const Msg &msg, const std::vector<uint8_t> &dat) {
+  size_t checked = 0;
+  for (const auto &sv : parser.query_latest()) {
+    if (sv.address != msg.address) continue;
+    for (int i = 0; i < msg.num_sigs; i++) {
+      const Signal &sig = msg.sigs[i];
+      if (strcmp(sig.name, sv.name) != 0) continue;
+      INFO(sig.name);
+      REQUIRE(sv.value == reference_raw(sig, dat) * sig.factor + sig.offset);
+      checked++;
+    }
+  }
+  REQUIRE(checked == msg.num_sigs);
+}
+
+TEST_CASE("CAN FD decode matches bit by bit reference") {
+  std::mt19937 rng(1234);
+  CANParser parser(0, "test_canfd", true, true);
+
+  for (const Msg &msg : msgs) {
+    if (msg.address == 0x102) continue;
+    for (int n = 0; n < 200; n++) {
+      std::vector<uint8_t> dat(msg.size);
+      for (auto &b : dat) b = rng();
+
+      parser.update_string(make_event(msg.address, dat, n + 1), false);
+      check_values(parser, msg, dat);
+    }
+  }
+}
+
+TEST_CASE("CAN FD frames shorter than the DBC size are zero padded") {
+  CANParser parser(0, "test_canfd", true, true);
+  std::vector<uint8_t> dat(48, 0xFF);
+  parser.update_string(make_event(0x100, dat, 1), false);
+
+  dat.resize(64, 0);
+  check_values(parser, msgs[0], dat);
+}
+
+TEST_CASE("Classic frames longer than 8 bytes are dropped") {
+  CANParser parser(0, "test_canfd", true, true);
+  std::vector<uint8_t> dat(8, 0x55);
+  parser.update_string(make_event(0x101, dat, 1), false);
+  REQUIRE(num_updated(parser, 0x101) == 2);
+
+  dat.resize(9, 0x55);
+  parser.update_string(make_event(0x101, dat, 2), false);
+  REQUIRE(num_updated(parser, 0x101) == 0);
+}
+
+TEST_CASE("CAN FD frames with a checksum are dropped unless checksums are ignored") {
+  std::vector<uint8_t> dat(16, 0);
+  dat[0] = 0x34;
+  dat[1] = 0x12;
+
+  CANParser checked(0, "test_canfd", false, true);
+  checked.update_string(make_event(0x102, dat, 1), false);
+  REQUIRE(num_updated(checked, 0x102) == 0);
+
+  CANParser unchecked(0, "test_canfd", true, true);
+  unchecked.update_string(make_event(0x102, dat, 1), false);
+  REQUIRE(num_updated(unchecked, 0x102) == 2);
+  check_values(unchecked, msgs[2], dat);
+}
+
+TEST_CASE("CAN FD pack round trip") {
+  CANPacker packer("test_canfd");
+  CANParser parser(0, "test_canfd", true, true);
+
+  const std::vector<SignalPackValue> values = {
+    {"LE_CROSS", -1000.5},
+    {"BE_CROSS", 0xABC},
+    {"LE_WIDE", 0x123456789ABC},
+    {"BE_WIDE", 0xFEDCBA987654},
+    {"LE_TAIL", -12.3},
+    {"BE_HEAD", 0xA5},
+  };
+  const std::vector<uint8_t> dat = packer.pack_vector(0x100, values, 9);
+  REQUIRE(dat.size() == 64);
+
+  parser.update_string(make_event(0x100, dat, 1), false);
+  check_values(parser, msgs[0], dat);
+
+  for (const auto &sv : parser.query_latest()) {
+    if (sv.address != 0x100) continue;
+    if (strcmp(sv.name, "COUNTER") == 0) {
+      REQUIRE(sv.value == 9);
+      continue;
+    }
+    auto it = std::find_if(values.begin(), values.end(), [&](const SignalPackValue &v) { return strcmp(v.name, sv.name) == 0; });
+    REQUIRE(it != values.end());
+    REQUIRE(sv.value == Approx(it->value));
+  }
+}
+
+TEST_CASE("64 bit signals pack and parse") {
+  CANPacker packer("test_canfd");
+  CANParser parser(0, "test_canfd", true, true);
+
+  // packing a negative value used to shift a 1 by 64
+  for (auto [address, name] : {std::pair{0x103, "LE_FULL"}, {0x104, "FULL"}}) {
+    for (double value : {-2., -123456789., 987654321.}) {
+      const std::vector<uint8_t> dat = packer.pack_vector(address, {{name, value}}, -1);
+      parser.update_string(make_event(address, dat, 1), false);
+      REQUIRE(num_updated(parser, address) == 1);
+      for (const auto &sv : parser.query_latest()) {
+        if (sv.address == (uint32_t)address) REQUIRE(sv.value == value);
+      }
+    }
+  }
+}
+
+TEST_CASE("CAN FD plans pack the same as pack_vector") {
+  CANPacker packer("test_canfd");
+  const std::vector<SignalPackValue> values = {
+    {"LE_CROSS", -1000.5},
+    {"BE_CROSS", 0xABC},
+    {"LE_WIDE", 0x123456789ABC},
+    {"BE_WIDE", 0xFEDCBA987654},
+    {"LE_TAIL", -12.3},
+    {"BE_HEAD", 0xA5},
+    {"NOT_A_SIGNAL", 1},
+  };
+  std::vector<std::string> names;
+  std::vector<double> plan_values;
+  for (auto &v : values) {
+    names.push_back(v.name);
+    plan_values.push_back(v.value);
+  }
+
+  const CANPackPlan plan = packer.compile(0x100, names);
+  REQUIRE(plan.size == 64);
+  REQUIRE(packer.pack_vector(plan, plan_values.data(), 9) == packer.pack_vector(0x100, values, 9));
+  // the uint64_t pack only holds classic frames
+  REQUIRE(packer.pack(plan, plan_values.data(), 9) == 0);
+
+  const CANPackPlan classic = packer.compile(0x101, {"LE_SIG", "BE_SIG"});
+  REQUIRE(packer.pack_vector(classic, plan_values.data(), -1) ==
+          packer.pack_vector(0x101, {{"LE_SIG", plan_values[0]}, {"BE_SIG", plan_values[1]}}, -1));
+}
+
+TEST_CASE("Classic frames pack the same through pack_vector") {
+  CANPacker packer("test_canfd");
+  const std::vector<SignalPackValue> values = {{"LE_SIG", -1234.56}, {"BE_SIG", 40000}};
+
+  const uint64_t packed = packer.pack(0x101, values, -1);
+  const std::vector<uint8_t> dat = packer.pack_vector(0x101, values, -1);
+  REQUIRE(dat.size() == 8);
+  for (int i = 0; i < 8; i++) {
+    REQUIRE(dat[i] == (uint8_t)(packed >> (56 - 8 * i)));
+  }
+}
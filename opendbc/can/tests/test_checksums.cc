@@ -0,0 +1,119 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "opendbc/can/common.h"
+
+static const std::pair<SignalType, const char *> CHECKSUM_TYPES[] = {
+  {SignalType::HONDA_CHECKSUM, "honda"},
+  {SignalType::TOYOTA_CHECKSUM, "toyota"},
+  {SignalType::SUBARU_CHECKSUM, "subaru"},
+  {SignalType::CHRYSLER_CHECKSUM, "chrysler"},
+  {SignalType::VOLKSWAGEN_CHECKSUM, "volkswagen"},
+  {SignalType::PEDAL_CHECKSUM, "pedal"},
+};
+
+// addresses volkswagen_crc has a padding byte for
+static const uint32_t VOLKSWAGEN_ADDRESSES[] = {
+  0x86, 0x9F, 0xAD, 0xFD, 0x106, 0x117, 0x120, 0x121, 0x122,
+  0x126, 0x12B, 0x187, 0x30C, 0x30F, 0x324, 0x3C0, 0x65D,
+};
+
+static unsigned int scalar_checksum(SignalType type, uint32_t address, uint64_t d, int l) {
+  switch (type) {
+    case SignalType::HONDA_CHECKSUM: return honda_checksum(address, d, l);
+    case SignalType::TOYOTA_CHECKSUM: return toyota_checksum(address, d, l);
+    case SignalType::SUBARU_CHECKSUM: return subaru_checksum(address, d, l);
+    case SignalType::CHRYSLER_CHECKSUM: return chrysler_checksum(address, d, l);
+    case SignalType::VOLKSWAGEN_CHECKSUM: return volkswagen_crc(address, d, l);
+    case SignalType::PEDAL_CHECKSUM: return pedal_checksum(d, l);
+    default: return -1;
+  }
+}
+
+struct Frames {
+  std::vector<uint32_t> address;
+  std::vector<uint64_t> dat;
+  std::vector<uint8_t> size;
+};
+
+// random zero padded classic frames, as the parser reads them
+static Frames make_frames(const ChecksumFamily &family, size_t n, int min_size = 1) {
+  std::mt19937_64 rng(n + family.type);
+  Frames frames;
+  for (size_t i = 0; i < n; i++) {
+    uint32_t address = rng() & (i % 3 == 0 ? 0x1FFFFFFF : 0x7FF);
+    if (family.type == SignalType::VOLKSWAGEN_CHECKSUM) {
+      address = VOLKSWAGEN_ADDRESSES[i % ARRAYSIZE(VOLKSWAGEN_ADDRESSES)];
+    }
+    const int size = min_size + i % (9 - min_size);
+
+    uint8_t dat[8] = {};
+    const uint64_t r = rng();
+    memcpy(dat, &r, size);
+
+    frames.address.push_back(address);
+    frames.dat.push_back(family.little_endian ? read_u64_le(dat) : read_u64_be(dat));
+    frames.size.push_back(size);
+  }
+  return frames;
+}
+
+TEST_CASE("Every checksum type is registered") {
+  for (const auto &it : CHECKSUM_TYPES) {
+    const ChecksumFamily *family = checksum_family(it.first);
+    REQUIRE(family != nullptr);
+    REQUIRE(family->type == it.first);
+  }
+  REQUIRE(checksum_family(SignalType::DEFAULT) == nullptr);
+  REQUIRE(checksum_family(SignalType::HONDA_COUNTER) == nullptr);
+}
+
+TEST_CASE("Checksums match the scalar versions") {
+  init_crc_lookup_tables();
+
+  for (const auto &it : CHECKSUM_TYPES) {
+    const SignalType type = it.first;
+    const std::string type_name = it.second;
+    const ChecksumFamily &family = *checksum_family(type);
+    const Frames frames = make_frames(family, 4096);
+
+    std::vector<uint8_t> batch(frames.dat.size());
+    family.calc_batch(frames.dat.size(), frames.address.data(), frames.dat.data(), frames.size.data(), batch.data());
+
+    for (size_t i = 0; i < frames.dat.size(); i++) {
+      INFO(type_name << " 0x" << std::hex << frames.address[i] << " " << frames.dat[i] << " " << (int)frames.size[i]);
+      const unsigned int expected = scalar_checksum(type, frames.address[i], frames.dat[i], frames.size[i]);
+      REQUIRE(family.calc(frames.address[i], frames.dat[i], frames.size[i]) == expected);
+      REQUIRE(batch[i] == expected);
+    }
+  }
+}
+
+TEST_CASE("Checksum", "[.][benchmark]") {
+  init_crc_lookup_tables();
+
+  for (const auto &it : CHECKSUM_TYPES) {
+    const SignalType type = it.first;
+    const std::string type_name = it.second;
+    const ChecksumFamily &family = *checksum_family(type);
+    // full frames, like every message that carries one of these checksums
+    const Frames frames = make_frames(family, 1024, 8);
+    const size_t n = frames.dat.size();
+    std::vector<uint8_t> out(n);
+
+    BENCHMARK(type_name + " scalar") {
+      for (size_t i = 0; i < n; i++) {
+        out[i] = scalar_checksum(type, frames.address[i], frames.dat[i], frames.size[i]);
+      }
+      return out[n - 1];
+    };
+    BENCHMARK(type_name + " batch") {
+      family.calc_batch(n, frames.address.data(), frames.dat.data(), frames.size.data(), out.data());
+      return out[n - 1];
+    };
+  }
+}
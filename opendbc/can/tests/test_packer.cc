@@ -0,0 +1,131 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "opendbc/can/common.h"
+
+static const char *CLASSIC_DBCS[] = {
+  "honda_civic_touring_2016_can_generated",
+  "toyota_corolla_2017_pt_generated",
+  "hyundai_kia_generic",
+  "vw_mqb_2010",
+  "subaru_global_2017_generated",
+  "chrysler_pacifica_2017_hybrid",
+};
+
+// what the car controllers send every 10 ms tick
+static const std::pair<const char *, std::vector<const char *>> SENDCAN_FRAMES[] = {
+  {"hyundai_kia_generic", {"LKAS11", "CLU11", "MDPS12", "SCC11", "SCC12", "SCC13", "SCC14", "FCA11", "FCA12", "LFAHDA_MFC"}},
+  {"toyota_nodsu_pt_generated", {"STEERING_LKA", "STEERING_LTA", "ACC_CONTROL", "PCM_CRUISE", "LKAS_HUD", "ACC_HUD"}},
+};
+
+static double test_value(const Signal &sig, int i, int j) {
+  const int bits = std::min(sig.is_signed ? sig.b2 - 1 : sig.b2, 32);
+  return ((i * 37 + j * 11 + 1) & ((1ULL << bits) - 1)) * sig.factor + sig.offset;
+}
+
+static const Msg *find_msg(const DBC *dbc, const char *name) {
+  for (int i = 0; i < dbc->num_msgs; i++) {
+    if (strcmp(dbc->msgs[i].name, name) == 0) return &dbc->msgs[i];
+  }
+  return nullptr;
+}
+
+// messages the packer fills a counter into
+static bool has_counter(const Msg &msg) {
+  for (int i = 0; i < msg.num_sigs; i++) {
+    const Signal &sig = msg.sigs[i];
+    if (strcmp(sig.name, "COUNTER") == 0) {
+      return sig.type == SignalType::HONDA_COUNTER || sig.type == SignalType::VOLKSWAGEN_COUNTER;
+    }
+  }
+  return false;
+}
+
+TEST_CASE("Pack plans match name based pack") {
+  for (const char *dbc_name : CLASSIC_DBCS) {
+    const DBC *dbc = dbc_lookup(dbc_name);
+    REQUIRE(dbc != nullptr);
+    CANPacker packer(dbc_name);
+
+    for (int i = 0; i < dbc->num_msgs; i++) {
+      const Msg &msg = dbc->msgs[i];
+      if (msg.size > 8) continue;
+
+      std::vector<SignalPackValue> values;
+      std::vector<std::string> names;
+      std::vector<double> plan_values;
+      for (int j = 0; j < msg.num_sigs; j++) {
+        const Signal &sig = msg.sigs[j];
+        if (sig.b2 >= 64) continue;
+        values.push_back({sig.name, test_value(sig, i, j)});
+        names.push_back(sig.name);
+        plan_values.push_back(values.back().value);
+      }
+
+      const int counter = has_counter(msg) ? i % 4 : -1;
+      const CANPackPlan plan = packer.compile(msg.address, names);
+
+      INFO(dbc_name << " " << msg.name);
+      REQUIRE(packer.pack(plan, plan_values.data(), counter) == packer.pack(msg.address, values, counter));
+    }
+  }
+}
+
+TEST_CASE("Pack plan ignores unknown signals") {
+  CANPacker packer("toyota_corolla_2017_pt_generated");
+  const Msg *msg = find_msg(dbc_lookup("toyota_corolla_2017_pt_generated"), "STEERING_LKA");
+  REQUIRE(msg != nullptr);
+
+  const CANPackPlan plan = packer.compile(msg->address, {"STEER_TORQUE_CMD", "NOT_A_SIGNAL", "SET_ME_1"});
+  const double values[] = {-200, 12345, 1};
+  REQUIRE(packer.pack(plan, values, -1) == packer.pack(msg->address, {{"STEER_TORQUE_CMD", -200}, {"SET_ME_1", 1}}, -1));
+
+  REQUIRE(packer.lookup_message(0xFFFFFF) == nullptr);
+}
+
+TEST_CASE("Pack", "[.][benchmark]") {
+  for (const auto &[dbc_name, msg_names] : SENDCAN_FRAMES) {
+    const DBC *dbc = dbc_lookup(dbc_name);
+    REQUIRE(dbc != nullptr);
+    CANPacker packer(dbc_name);
+
+    struct Frame {
+      uint32_t address;
+      int counter;
+      std::vector<SignalPackValue> values;
+      std::vector<double> plan_values;
+      CANPackPlan plan;
+    };
+    std::vector<Frame> frames;
+    for (const char *msg_name : msg_names) {
+      const Msg *msg = find_msg(dbc, msg_name);
+      REQUIRE(msg != nullptr);
+
+      Frame f = {msg->address, has_counter(*msg) ? 1 : -1};
+      std::vector<std::string> names;
+      for (int j = 0; j < msg->num_sigs; j++) {
+        const Signal &sig = msg->sigs[j];
+        if (strcmp(sig.name, "CHECKSUM") == 0 || strcmp(sig.name, "COUNTER") == 0) continue;
+        f.values.push_back({sig.name, test_value(sig, frames.size(), j)});
+        f.plan_values.push_back(f.values.back().value);
+        names.push_back(sig.name);
+      }
+      f.plan = packer.compile(msg->address, names);
+      frames.push_back(f);
+    }
+
+    BENCHMARK(std::string(dbc_name) + " by name") {
+      uint64_t ret = 0;
+      for (const auto &f : frames) ret ^= packer.pack(f.address, f.values, f.counter);
+      return ret;
+    };
+    BENCHMARK(std::string(dbc_name) + " pack plan") {
+      uint64_t ret = 0;
+      for (const auto &f : frames) ret ^= packer.pack(f.plan, f.plan_values.data(), f.counter);
+      return ret;
+    };
+  }
+}
@@ -0,0 +1,229 @@
+#define CATCH_CONFIG_ENABLE_BENCHMARKING
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "opendbc/can/common.h"
+
+static const char *BENCHMARK_DBCS[] = {
+  "honda_civic_touring_2016_can_generated",
+  "toyota_corolla_2017_pt_generated",
+  "hyundai_kia_generic",
+};
+
+struct Frame {
+  uint32_t address;
+  uint8_t src;
+  std::vector<uint8_t> dat;
+};
+
+static bool packable(const Msg &msg) {
+  // values only round trip through the packer when signals don't overlap,
+  // names are unique and no pedal checksum has to be generated
+  uint64_t used = 0;
+  std::set<std::string> names;
+  for (int i = 0; i < msg.num_sigs; i++) {
+    const Signal &sig = msg.sigs[i];
+    if (sig.type == SignalType::PEDAL_CHECKSUM || sig.b2 >= 64) return false;
+
+    const uint64_t mask = ((1ULL << sig.b2) - 1) << (sig.is_little_endian ? sig.b1 : sig.bo);
+    const uint64_t bits = sig.is_little_endian ? __builtin_bswap64(mask) : mask;
+    if ((used & bits) || !names.insert(sig.name).second) return false;
+    used |= bits;
+  }
+  return true;
+}
+
+// deterministic raw value for signal j of message i, kept positive for signed signals
+static double test_value(const Signal &sig, int i, int j) {
+  const int bits = sig.is_signed ? sig.b2 - 1 : sig.b2;
+  const uint64_t mask = bits >= 64 ? ~0ULL : (1ULL << bits) - 1;
+  return ((i * 37 + j * 11 + 1) & mask) * sig.factor + sig.offset;
+}
+
+static std::vector<Frame> make_frames(const DBC *dbc, uint8_t src, std::map<std::pair<uint32_t, std::string>, double> *expected = nullptr) {
+  CANPacker packer(dbc->name);
+  std::vector<Frame> frames;
+  for (int i = 0; i < dbc->num_msgs; i++) {
+    const Msg &msg = dbc->msgs[i];
+    if (!packable(msg)) continue;
+
+    std::vector<SignalPackValue> values;
+    for (int j = 0; j < msg.num_sigs; j++) {
+      const Signal &sig = msg.sigs[j];
+      if (sig.type == SignalType::HONDA_CHECKSUM || sig.type == SignalType::TOYOTA_CHECKSUM ||
+          sig.type == SignalType::VOLKSWAGEN_CHECKSUM || sig.type == SignalType::SUBARU_CHECKSUM ||
+          sig.type == SignalType::CHRYSLER_CHECKSUM) {
+        continue;
+      }
+      values.push_back({sig.name, test_value(sig, i, j)});
+      if (expected) (*expected)[{msg.address, sig.name}] = values.back().value;
+    }
+
+    const uint64_t packed = packer.pack(msg.address, values, -1);
+    Frame f = {msg.address, src, std::vector<uint8_t>(msg.size)};
+    for (int k = 0; k < msg.size; k++) {
+      f.dat[k] = packed >> (56 - 8 * k);
+    }
+    frames.push_back(f);
+  }
+  return frames;
+}
+
+static std::string make_event(const std::vector<Frame> &frames, uint64_t mono_time) {
+  capnp::MallocMessageBuilder msg;
+  auto event = msg.initRoot<cereal::Event>();
+  event.setLogMonoTime(mono_time);
+  auto cans = event.initCan(frames.size());
+  for (int i = 0; i < frames.size(); i++) {
+    cans[i].setAddress(frames[i].address);
+    cans[i].setSrc(frames[i].src);
+    cans[i].setDat(kj::arrayPtr(frames[i].dat.data(), frames[i].dat.size()));
+  }
+  auto words = capnp::messageToFlatArray(msg);
+  auto bytes = words.asBytes();
+  return std::string(bytes.begin(), bytes.end());
+}
+
+TEST_CASE("Decode packed frames") {
+  for (const char *dbc_name : BENCHMARK_DBCS) {
+    const DBC *dbc = dbc_lookup(dbc_name);
+    REQUIRE(dbc != nullptr);
+
+    std::map<std::pair<uint32_t, std::string>, double> expected;
+    CANParser parser(0, dbc_name, false, true);
+    parser.update_string(make_event(make_frames(dbc, 0, &expected), 1), false);
+
+    size_t checked = 0;
+    for (const auto &sv : parser.query_latest()) {
+      auto it = expected.find({sv.address, sv.name});
+      if (it == expected.end()) continue;
+      INFO(dbc_name << " 0x" << std::hex << sv.address << " " << sv.name);
+      REQUIRE(sv.value == Approx(it->second));
+      checked++;
+    }
+    REQUIRE(checked == expected.size());
+  }
+}
+
+TEST_CASE("Change sets") {
+  const char *dbc_name = "toyota_corolla_2017_pt_generated";
+  const DBC *dbc = dbc_lookup(dbc_name);
+  auto frames = make_frames(dbc, 0);
+  CANParser parser(0, dbc_name, false, true);
+
+  // defaults of every tracked signal are reported once
+  const SignalChanges &changes = parser.query_changes();
+  REQUIRE(changes.num_values == parser.signals().size());
+  REQUIRE(parser.query_changes().num_values == 0);
+
+  parser.update_string(make_event(frames, 1), false);
+  parser.query_changes();
+
+  // same frames again: every message is received, no value changes
+  parser.update_string(make_event(frames, 2), false);
+  parser.query_changes();
+  REQUIRE(changes.num_messages == frames.size());
+  REQUIRE(changes.num_values == 0);
+
+  // invert a message without checksum, all of its signals change
+  auto no_checksum = [&](const Frame &f) {
+    const Msg *msg = std::find_if(dbc->msgs, dbc->msgs + dbc->num_msgs, [&](const Msg &m) { return m.address == f.address; });
+    return std::all_of(msg->sigs, msg->sigs + msg->num_sigs, [](const Signal &sig) { return sig.type == SignalType::DEFAULT; });
+  };
+  auto it = std::find_if(frames.begin(), frames.end(), no_checksum);
+  REQUIRE(it != frames.end());
+  for (auto &b : it->dat) b ^= 0xFF;
+
+  parser.update_string(make_event(frames, 3), false);
+  parser.query_changes();
+  REQUIRE(changes.num_values > 0);
+  for (int i = 0; i < changes.num_values; i++) {
+    REQUIRE(changes.address[i] == it->address);
+    REQUIRE(parser.signals()[changes.sig_index[i]].address == it->address);
+  }
+}
+
+TEST_CASE("Parser group matches separate parsers") {
+  const char *dbc_name = "honda_civic_touring_2016_can_generated";
+  const DBC *dbc = dbc_lookup(dbc_name);
+
+  std::vector<Frame> frames;
+  for (uint8_t bus = 0; bus < 3; bus++) {
+    auto bus_frames = make_frames(dbc, bus);
+    // drop a different message on each bus so the results differ per bus
+    bus_frames.erase(bus_frames.begin() + bus);
+    frames.insert(frames.end(), bus_frames.begin(), bus_frames.end());
+  }
+  const std::string event = make_event(frames, 1);
+
+  std::vector<CANParser> separate, grouped;
+  separate.reserve(3);
+  grouped.reserve(3);
+  CANParserGroup group;
+  for (int bus = 0; bus < 3; bus++) {
+    separate.emplace_back(bus, dbc_name, false, true);
+    grouped.emplace_back(bus, dbc_name, false, true);
+    group.add(&grouped.back());
+  }
+
+  group.update_string(event, false);
+  for (int bus = 0; bus < 3; bus++) {
+    separate[bus].update_string(event, false);
+
+    auto expected = separate[bus].query_latest();
+    auto values = grouped[bus].query_latest();
+    REQUIRE(values.size() == expected.size());
+    for (int i = 0; i < values.size(); i++) {
+      REQUIRE(values[i].address == expected[i].address);
+      REQUIRE(std::string(values[i].name) == expected[i].name);
+      REQUIRE(values[i].value == expected[i].value);
+    }
+    REQUIRE(grouped[bus].can_valid == separate[bus].can_valid);
+  }
+}
+
+TEST_CASE("Decode", "[.][benchmark]") {
+  for (const char *dbc_name : BENCHMARK_DBCS) {
+    const DBC *dbc = dbc_lookup(dbc_name);
+    REQUIRE(dbc != nullptr);
+
+    // every message of the DBC on three buses, the way a car port sees pt, radar and cam
+    std::vector<Frame> frames;
+    for (uint8_t bus = 0; bus < 3; bus++) {
+      auto bus_frames = make_frames(dbc, bus);
+      frames.insert(frames.end(), bus_frames.begin(), bus_frames.end());
+    }
+    const std::string event = make_event(frames, 1);
+
+    std::vector<CANParser> parsers;
+    parsers.reserve(3);
+    for (int bus = 0; bus < 3; bus++) {
+      parsers.emplace_back(bus, dbc_name, false, true);
+    }
+
+    CANParserGroup group;
+    std::vector<CANParser> grouped;
+    grouped.reserve(3);
+    for (int bus = 0; bus < 3; bus++) {
+      grouped.emplace_back(bus, dbc_name, false, true);
+      group.add(&grouped.back());
+    }
+
+    WARN(dbc_name << ": " << frames.size() << " frames per event");
+    BENCHMARK(std::string(dbc_name) + " separate parsers") {
+      for (auto &parser : parsers) {
+        parser.update_string(event, false);
+      }
+      return parsers[0].can_valid;
+    };
+    BENCHMARK(std::string(dbc_name) + " parser group") {
+      group.update_string(event, false);
+      return grouped[0].can_valid;
+    };
+  }
+}
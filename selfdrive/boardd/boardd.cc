@@ -26,6 +26,8 @@
 #include "selfdrive/hardware/hw.h"
 #include "selfdrive/locationd/ublox_msg.h"
 
+#include "selfdrive/boardd/can_encoder.h"
+#include "selfdrive/boardd/can_send_queue.h"
 #include "selfdrive/boardd/panda.h"
 #include "selfdrive/boardd/pigeon.h"
 
@@ -179,11 +181,14 @@ void usb_retry_connect() {
   LOGW("connected to board");
 }
 
-void can_recv(PubMaster &pm) {
-  kj::Array<capnp::word> can_data;
-  panda->can_receive(can_data);
-  auto bytes = can_data.asBytes();
-  pm.send("can", bytes.begin(), bytes.size());
+void can_recv(PubMaster &pm, const CanEventEncoder &encoder, uint64_t deadline) {
+  // encoded from the USB buffers straight into the queue, no copy in between
+  const std::vector<CanRecords> &reads = panda->can_receive(deadline);
+  const size_t size = encoder.size(reads.data(), reads.size());
+  char *buf = pm.reserve("can", size);
+  if (buf == nullptr) return;
+  encoder.encode((uint8_t *)buf, reads.data(), reads.size(), nanos_since_boot(), panda->comms_healthy);
+  pm.commit("can");
 }
 
 void can_send_thread() {
@@ -195,9 +200,18 @@ void can_send_thread() {
   assert(subscriber != NULL);
   subscriber->setTimeout(100);
 
+  CanSendQueue &queue = panda->can_send_queue;
+  auto flush = [&]() {
+    if (fake_send) {
+      queue.clear();
+    } else {
+      panda->can_send();
+    }
+  };
+
   // run as fast as messages come in
   while (!do_exit && panda->connected) {
-    Message * msg = subscriber->receive();
+    Message * msg = subscriber->receiveView();
 
     if (!msg) {
       if (errno == EINTR) {
@@ -206,17 +220,32 @@ void can_send_thread() {
       continue;
     }
 
-    capnp::FlatArrayMessageReader cmsg(aligned_buf.align(msg));
-    cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
-
-    //Dont send if older than 1 second
-    if (nanos_since_boot() - event.getLogMonoTime() < 1e9) {
-      if (!fake_send) {
-        panda->can_send(event.getSendcan());
+    // whatever else is waiting, from any publisher, goes out with it in as few transfers as possible
+    do {
+      // read in place, the frames are only copied once into the send queue. Whatever was
+      // queued from the message is thrown away again if the writer overwrote it meanwhile
+      size_t queued = queue.frames();
+      try {
+        capnp::FlatArrayMessageReader cmsg(aligned_buf.view(msg));
+        cereal::Event::Reader event = cmsg.getRoot<cereal::Event>();
+        auto frames = event.getSendcan();
+        for (size_t i = 0; i < frames.size();) {
+          // dropped if older than 1 second
+          i += queue.push(frames, i, event.getLogMonoTime(), nanos_since_boot());
+          if (queue.full()) {
+            if (!msg->valid()) break;
+            flush();
+            queued = 0;
+          }
+        }
+      } catch (const kj::Exception &) {
+        if (msg->valid()) throw;
       }
-    }
+      if (!msg->valid()) queue.truncate(queued);
+      delete msg;
+    } while ((msg = subscriber->receiveView(true)));
 
-    delete msg;
+    flush();
   }
 
   delete subscriber;
@@ -228,26 +257,12 @@ void can_recv_thread() {
 
   // can = 8006
   PubMaster pm({"can"});
+  const CanEventEncoder encoder;
 
-  // run at 100hz
-  const uint64_t dt = 10000000ULL;
-  uint64_t next_frame_time = nanos_since_boot() + dt;
-
+  // published as soon as a read with frames completes, see CanReceiver. While
+  // the bus is quiet an empty message still goes out every 10 ms
   while (!do_exit && panda->connected) {
-    can_recv(pm);
-
-    uint64_t cur_time = nanos_since_boot();
-    int64_t remaining = next_frame_time - cur_time;
-    if (remaining > 0) {
-      std::this_thread::sleep_for(std::chrono::nanoseconds(remaining));
-    } else {
-      if (ignition) {
-        LOGW("missed cycles (%d) %lld", (int)-1*remaining/dt, remaining);
-      }
-      next_frame_time = cur_time;
-    }
-
-    next_frame_time += dt;
+    can_recv(pm, encoder, nanos_since_boot() + CAN_RECV_MAX_POLL_INTERVAL);
   }
 }
 
@@ -382,6 +397,14 @@ void panda_state_thread() {
     ps.setHeartbeatLost((bool)(pandaState.heartbeat_lost));
     ps.setHarnessStatus(cereal::PandaState::HarnessStatus(pandaState.car_harness_status));
 
+    auto can_send_latency = ps.initCanSendLatency();
+    can_send_latency.setBoundsUs(kj::arrayPtr(can_send_latency_bounds, std::size(can_send_latency_bounds)));
+    auto latency_counts = can_send_latency.initCounts(CAN_SEND_LATENCY_BUCKETS);
+    for (int b = 0; b < CAN_SEND_LATENCY_BUCKETS; b++) {
+      latency_counts.set(b, panda->can_send_queue.latency_count(b));
+    }
+    can_send_latency.setDropped(panda->can_send_queue.dropped_count());
+
     // Convert faults bitset to capnp list
     std::bitset<sizeof(pandaState.faults) * 8> fault_bits(pandaState.faults);
     auto faults = ps.initFaults(fault_bits.count());
@@ -0,0 +1,136 @@
+#include "selfdrive/boardd/can_encoder.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#include <capnp/schema.h>
+
+#include "cereal/gen/cpp/log.capnp.h"
+
+// capnp pointer encoding, offsets are in words from the end of the pointer
+#define STRUCT_POINTER(offset, data_words, pointers) \
+  ((uint64_t)(uint32_t)((offset) << 2) | ((uint64_t)(data_words) << 32) | ((uint64_t)(pointers) << 48))
+#define LIST_POINTER(offset, element_size, count) \
+  ((uint64_t)(uint32_t)(((offset) << 2) | 1) | ((uint64_t)(element_size) << 32) | ((uint64_t)(count) << 35))
+#define ELEMENT_SIZE_BYTE 2
+#define ELEMENT_SIZE_INLINE_COMPOSITE 7
+
+static inline void write_word(uint8_t *segment, size_t word, uint64_t v) {
+  memcpy(segment + word * sizeof(uint64_t), &v, sizeof(v));
+}
+
+static inline size_t dat_len(uint32_t info) {
+  // a record has room for 8 bytes
+  return std::min<size_t>(info & 0xF, 8);
+}
+
+static inline size_t dat_words(uint32_t info) {
+  return (dat_len(info) + 7) / 8;
+}
+
+static capnp::schema::Field::Slot::Reader field_slot(capnp::StructSchema schema, const char *name) {
+  return schema.getFieldByName(name).getProto().getSlot();
+}
+
+CanEventEncoder::CanEventEncoder() {
+  const auto event = capnp::Schema::from<cereal::Event>();
+  const auto event_struct = event.getProto().getStruct();
+  event_data_words = event_struct.getDataWordCount();
+  event_pointers = event_struct.getPointerCount();
+  discriminant_offset = event_struct.getDiscriminantOffset();
+
+  log_mono_time_offset = field_slot(event, "logMonoTime").getOffset();
+  valid_bit = field_slot(event, "valid").getOffset();
+  valid_default = field_slot(event, "valid").getDefaultValue().getBool();
+
+  const auto can = event.getFieldByName("can").getProto();
+  can_discriminant = can.getDiscriminantValue();
+  can_pointer = can.getSlot().getOffset();
+
+  const auto can_data = capnp::Schema::from<cereal::CanData>();
+  const auto can_data_struct = can_data.getProto().getStruct();
+  data_words = can_data_struct.getDataWordCount();
+  pointers = can_data_struct.getPointerCount();
+  assert(data_words == 1);
+
+  // slot offsets are in multiples of the field size, defaults are all 0
+  address_shift = field_slot(can_data, "address").getOffset() * 32;
+  bus_time_shift = field_slot(can_data, "busTime").getOffset() * 16;
+  src_shift = field_slot(can_data, "src").getOffset() * 8;
+  dat_pointer = field_slot(can_data, "dat").getOffset();
+  assert(address_shift < 64 && bus_time_shift < 64 && src_shift < 64);
+}
+
+size_t CanEventEncoder::segment_words(const CanRecords *spans, size_t num_spans, size_t *num_records) const {
+  // root pointer, event, list tag and elements, then the dat blobs
+  size_t words = 0, records = 0;
+  for (size_t s = 0; s < num_spans; s++) {
+    for (size_t i = 0; i < spans[s].num_records; i++) {
+      words += dat_words(spans[s].records[i*4+1]);
+    }
+    records += spans[s].num_records;
+  }
+  *num_records = records;
+  return words + 1 + event_data_words + event_pointers + 1 + records * (data_words + pointers);
+}
+
+size_t CanEventEncoder::size(const CanRecords *spans, size_t num_spans) const {
+  // single segment, its table is one word
+  size_t num_records;
+  return (1 + segment_words(spans, num_spans, &num_records)) * sizeof(uint64_t);
+}
+
+void CanEventEncoder::encode(uint8_t *buf, const CanRecords *spans, size_t num_spans, uint64_t log_mono_time, bool valid) const {
+  size_t num_records;
+  const uint32_t segment_table[2] = {0, (uint32_t)segment_words(spans, num_spans, &num_records)};
+  memcpy(buf, segment_table, sizeof(segment_table));
+  uint8_t *segment = buf + sizeof(segment_table);
+
+  // objects are laid out in the order MessageBuilder allocates them
+  const size_t event_start = 1;
+  const size_t list_start = event_start + event_data_words + event_pointers;
+  const size_t element_words = data_words + pointers;
+  size_t blob_start = list_start + 1 + num_records * element_words;
+
+  write_word(segment, 0, STRUCT_POINTER(0, event_data_words, event_pointers));
+
+  uint8_t *event = segment + event_start * sizeof(uint64_t);
+  memset(event, 0, (event_data_words + event_pointers) * sizeof(uint64_t));
+  memcpy(event + log_mono_time_offset * sizeof(uint64_t), &log_mono_time, sizeof(log_mono_time));
+  if (valid != valid_default) {
+    event[valid_bit / 8] |= 1 << (valid_bit % 8);
+  }
+  memcpy(event + discriminant_offset * sizeof(uint16_t), &can_discriminant, sizeof(can_discriminant));
+
+  const size_t can_pointer_word = event_start + event_data_words + can_pointer;
+  write_word(segment, can_pointer_word, LIST_POINTER(list_start - (can_pointer_word + 1), ELEMENT_SIZE_INLINE_COMPOSITE,
+                                                     num_records * element_words));
+  write_word(segment, list_start, STRUCT_POINTER(num_records, data_words, pointers));
+
+  size_t element = list_start + 1;
+  for (size_t s = 0; s < num_spans; s++) {
+    for (size_t i = 0; i < spans[s].num_records; i++, element += element_words) {
+      const uint32_t *record = &spans[s].records[i*4];
+      const uint32_t address = (record[0] & 4) ? record[0] >> 3 : record[0] >> 21;
+      const uint64_t bus_time = record[1] >> 16;
+      const uint64_t src = (record[1] >> 4) & 0xff;
+      const size_t len = dat_len(record[1]);
+
+      write_word(segment, element, ((uint64_t)address << address_shift) | (bus_time << bus_time_shift) | (src << src_shift));
+      for (size_t p = 0; p < pointers; p++) {
+        write_word(segment, element + data_words + p, 0);
+      }
+
+      // an empty blob still points at where it would have been allocated
+      const size_t dat_word = element + data_words + dat_pointer;
+      write_word(segment, dat_word, LIST_POINTER(blob_start - (dat_word + 1), ELEMENT_SIZE_BYTE, len));
+      if (len > 0) {
+        uint64_t dat = 0;
+        memcpy(&dat, &record[2], len);
+        write_word(segment, blob_start, dat);
+        blob_start += 1;
+      }
+    }
+  }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// panda CAN records, 4 words each, e.g. what one USB read returned
+struct CanRecords {
+  const uint32_t *records;
+  size_t num_records;
+};
+
+// Serializes panda CAN records (4 words each, as read from the panda) into a
+// `can` Event, byte for byte what filling a MessageBuilder and serializing it
+// produces, without building the message first. The struct layout comes from
+// the compiled in schema once, encode() is a single pass over the records, so
+// the event can be written straight into a reserved PubSocket buffer. The
+// records can be spread over several buffers, they're encoded in order.
+class CanEventEncoder {
+ public:
+  CanEventEncoder();
+
+  // serialized size of the event, in bytes
+  size_t size(const CanRecords *spans, size_t num_spans) const;
+  // buf must hold size() bytes
+  void encode(uint8_t *buf, const CanRecords *spans, size_t num_spans, uint64_t log_mono_time, bool valid) const;
+
+  size_t size(const uint32_t *records, size_t num_records) const {
+    const CanRecords span = {records, num_records};
+    return size(&span, 1);
+  }
+  void encode(uint8_t *buf, const uint32_t *records, size_t num_records, uint64_t log_mono_time, bool valid) const {
+    const CanRecords span = {records, num_records};
+    encode(buf, &span, 1, log_mono_time, valid);
+  }
+
+ private:
+  size_t segment_words(const CanRecords *spans, size_t num_spans, size_t *num_records) const;
+
+  // Event
+  uint16_t event_data_words, event_pointers;
+  uint32_t log_mono_time_offset; // in 64-bit units
+  uint32_t valid_bit;
+  bool valid_default;
+  uint32_t discriminant_offset; // in 16-bit units
+  uint16_t can_discriminant;
+  uint32_t can_pointer;
+
+  // CanData, all fields fit in its first data word
+  uint16_t data_words, pointers;
+  uint32_t address_shift, bus_time_shift, src_shift;
+  uint32_t dat_pointer;
+};
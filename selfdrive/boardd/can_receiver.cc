@@ -0,0 +1,120 @@
+#include "selfdrive/boardd/can_receiver.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+
+CanReceiver::CanReceiver(SubmitFn submit, int max_in_flight, ClockFn clock)
+  : submit(submit), clock(clock), max_in_flight(max_in_flight), buffers(2 * max_in_flight) {
+  assert(max_in_flight > 0);
+  for (auto &buf : buffers) {
+    buf.data.resize(RECV_SIZE);
+  }
+}
+
+void CanReceiver::complete(int idx, int length) {
+  std::lock_guard lk(lock);
+  Buffer &buf = buffers[idx];
+  assert(buf.state == BufferState::IN_FLIGHT);
+  // records are 16 bytes, drop anything partial
+  buf.length = std::clamp(length, 0, RECV_SIZE) & ~0xF;
+  buf.state = BufferState::DONE;
+  done.push_back(idx);
+  in_flight--;
+  cv.notify_all();
+}
+
+void CanReceiver::submit_locked(std::unique_lock<std::mutex> &lk, int idx, bool poll) {
+  Buffer &buf = buffers[idx];
+  buf.state = BufferState::IN_FLIGHT;
+  buf.poll = poll;
+  in_flight++;
+
+  // the backend may complete the read before submit returns
+  lk.unlock();
+  const bool ok = submit(idx, buf.data.data(), RECV_SIZE);
+  lk.lock();
+
+  if (!ok) {
+    // back to polling, so a failing backend isn't retried in a loop
+    buf.state = BufferState::IDLE;
+    in_flight--;
+    backlog = false;
+    cv.notify_all();
+  }
+}
+
+const std::vector<CanRecords> &CanReceiver::receive(uint64_t deadline) {
+  std::unique_lock lk(lock);
+
+  // the caller is done with what the last call returned
+  for (auto &buf : buffers) {
+    if (buf.state == BufferState::HELD) buf.state = BufferState::IDLE;
+  }
+  held = 0;
+  received.clear();
+
+  uint64_t batch_end = 0;
+  while (!stopped) {
+    while (!done.empty()) {
+      Buffer &buf = buffers[done.front()];
+      done.pop_front();
+
+      if (buf.length > 0) {
+        if (received.empty()) {
+          batch_end = clock() + CAN_RECV_MAX_BATCH;
+        }
+        received.push_back({(const uint32_t *)buf.data.data(), (size_t)buf.length / 0x10});
+        buf.state = BufferState::HELD;
+        held++;
+      } else {
+        buf.state = BufferState::IDLE;
+      }
+
+      if (buf.poll) {
+        interval = buf.length > 0 ? std::max<uint64_t>(CAN_RECV_MIN_POLL_INTERVAL, interval / 2)
+                                  : std::min<uint64_t>(CAN_RECV_MAX_POLL_INTERVAL, interval * 2);
+      }
+      backlog = buf.length == RECV_SIZE;
+    }
+
+    const uint64_t now = clock();
+    const bool idle = in_flight < max_in_flight && in_flight + held < buffers.size();
+    if (idle && (backlog || (in_flight == 0 && now >= next_poll))) {
+      const bool poll = !backlog;
+      if (poll) {
+        next_poll = now + interval;
+      }
+      for (int i = 0; i < buffers.size() && in_flight < max_in_flight; i++) {
+        if (buffers[i].state == BufferState::IDLE) {
+          submit_locked(lk, i, poll);
+          // a poll is a single read, a backlog gets all of them
+          if (poll || !done.empty()) break;
+        }
+      }
+      continue;
+    }
+
+    // the reads that are due are queued, they go on while the caller publishes
+    if (!received.empty() && (!backlog || now >= batch_end)) break;
+    // nothing can be read before the caller gives buffers back
+    if (now >= deadline || (!idle && in_flight == 0)) break;
+    uint64_t wake = in_flight > 0 ? deadline : std::min(deadline, next_poll);
+    if (!received.empty()) {
+      wake = std::min(wake, batch_end);
+    }
+    cv.wait_for(lk, std::chrono::nanoseconds(wake - now));
+  }
+  return received;
+}
+
+void CanReceiver::stop() {
+  std::unique_lock lk(lock);
+  stopped = true;
+  cv.wait(lk, [&]() { return in_flight == 0; });
+}
+
+uint64_t CanReceiver::poll_interval() {
+  std::lock_guard lk(lock);
+  return interval;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+#include "selfdrive/boardd/can_encoder.h"
+#include "selfdrive/common/timing.h"
+
+// double the FIFO size
+#define RECV_SIZE (0x1000)
+
+#define CAN_RECV_BUFFERS 4
+#define CAN_RECV_MIN_POLL_INTERVAL 1000000ULL  // 1 ms
+#define CAN_RECV_MAX_POLL_INTERVAL 10000000ULL // 10 ms
+#define CAN_RECV_MAX_BATCH 1000000ULL          // 1 ms
+
+// Reads panda CAN records with asynchronous bulk IN transfers. The panda
+// answers a read with whatever its CAN FIFO holds, so the bus is polled: one
+// read per poll interval, which shrinks while polls return data and grows
+// back to 10 ms while the bus is quiet. A read that comes back full means the
+// FIFO has a backlog, then every buffer is kept queued until a read comes
+// back short. The backend does the USB part, see Panda and the mock in
+// tests/test_can_receiver.cc.
+//
+// receive() returns as soon as a read with records completes. A backlog is
+// collected until it's drained, for up to CAN_RECV_MAX_BATCH after its first
+// read, so a busy bus goes out in fewer, larger batches and a quiet one at the
+// latency of a single read. Completed reads are handed out in the buffers
+// they were read into, so the records can be encoded without another copy.
+// There are two buffers per read in flight, the reads go on in the second set
+// while the first one is out.
+class CanReceiver {
+ public:
+  // queue a read of up to length bytes into data, the backend calls
+  // complete(idx, ...) once it finished. false if it couldn't be queued
+  typedef std::function<bool(int idx, uint8_t *data, int length)> SubmitFn;
+  // the time in nanoseconds, the tests step their own
+  typedef std::function<uint64_t()> ClockFn;
+
+  // at most max_in_flight reads are queued at once
+  CanReceiver(SubmitFn submit, int max_in_flight = CAN_RECV_BUFFERS, ClockFn clock = nanos_since_boot);
+
+  // backend side, from any thread: the read into buffer idx is done. length
+  // is 0 for reads that failed or were cancelled
+  void complete(int idx, int length);
+
+  // polls until records arrived or deadline (on clock) passed, returns the
+  // reads that completed in bus order. Their buffers aren't read into again
+  // until the next receive(), it returns early once every buffer is held like
+  // that. With a deadline that passed, it only takes what's done and queues
+  // the reads that are due
+  const std::vector<CanRecords> &receive(uint64_t deadline);
+
+  // no more reads are queued after this, waits for the ones in flight
+  void stop();
+
+  uint64_t poll_interval();
+  // buffer indices passed to submit are below this
+  int num_buffers() const { return buffers.size(); }
+
+ private:
+  enum class BufferState { IDLE, IN_FLIGHT, DONE, HELD };
+
+  struct Buffer {
+    std::vector<uint8_t> data;
+    int length = 0;
+    bool poll = false; // this read was a poll, not part of draining a backlog
+    BufferState state = BufferState::IDLE;
+  };
+
+  void submit_locked(std::unique_lock<std::mutex> &lk, int idx, bool poll);
+
+  SubmitFn submit;
+  ClockFn clock;
+  const int max_in_flight;
+  std::vector<Buffer> buffers;
+
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<int> done; // completion order, which is bus order
+  std::vector<CanRecords> received;
+  int in_flight = 0;
+  int held = 0;
+  bool backlog = false;
+  bool stopped = false;
+  uint64_t next_poll = 0;
+  uint64_t interval = CAN_RECV_MIN_POLL_INTERVAL;
+};
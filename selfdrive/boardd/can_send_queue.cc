@@ -0,0 +1,53 @@
+#include "selfdrive/boardd/can_send_queue.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+
+const uint32_t can_send_latency_bounds[CAN_SEND_LATENCY_BUCKETS - 1] = {250, 500, 1000, 2000, 4000, 8000, 16000};
+
+CanSendQueue::CanSendQueue(size_t capacity) : capacity(capacity), buf(capacity * 4), enqueue_times(capacity) {
+  assert(capacity > 0);
+}
+
+size_t CanSendQueue::push(capnp::List<cereal::CanData>::Reader frames, size_t start, uint64_t enqueue_time, uint64_t now) {
+  const size_t remaining = frames.size() - std::min<size_t>(start, frames.size());
+  if (now - enqueue_time >= CAN_SEND_MAX_AGE) {
+    num_dropped += remaining;
+    return remaining;
+  }
+
+  const size_t count = std::min(remaining, capacity - num_frames);
+
+  for (size_t i = 0; i < count; i++) {
+    auto cmsg = frames[start + i];
+    uint32_t *send = &buf[num_frames * 4];
+    if (cmsg.getAddress() >= 0x800) { // extended
+      send[0] = (cmsg.getAddress() << 3) | 5;
+    } else { // normal
+      send[0] = (cmsg.getAddress() << 21) | 1;
+    }
+    // frames can come from a sendcan view that is overwritten while it's read, those are
+    // truncated again by the caller. Don't trust the length until then
+    auto can_data = cmsg.getDat();
+    const size_t len = std::min<size_t>(can_data.size(), 8);
+    send[1] = len | (cmsg.getSrc() << 4);
+    send[2] = send[3] = 0;
+    memcpy(&send[2], can_data.begin(), len);
+
+    enqueue_times[num_frames] = enqueue_time;
+    num_frames++;
+  }
+  return count;
+}
+
+void CanSendQueue::sent(uint64_t wire_time, size_t num_sent) {
+  num_sent = std::min(num_sent, num_frames);
+  for (size_t i = 0; i < num_sent; i++) {
+    const uint64_t latency_us = (wire_time - std::min(wire_time, enqueue_times[i])) / 1000;
+    const auto bound = std::upper_bound(std::begin(can_send_latency_bounds), std::end(can_send_latency_bounds), latency_us);
+    latency_counts[bound - std::begin(can_send_latency_bounds)]++;
+  }
+  num_dropped += num_frames - num_sent;
+  num_frames = 0;
+}
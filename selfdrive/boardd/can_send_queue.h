@@ -0,0 +1,58 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "cereal/gen/cpp/log.capnp.h"
+
+#define CAN_SEND_QUEUE_SIZE 256 // frames, 4 kB
+#define CAN_SEND_MAX_AGE 1000000000ULL // 1 s
+
+// enqueue to wire latency histogram, upper bounds in us. The last bucket
+// counts everything slower
+#define CAN_SEND_LATENCY_BUCKETS 8
+extern const uint32_t can_send_latency_bounds[CAN_SEND_LATENCY_BUCKETS - 1];
+
+// Packs sendcan frames into a preallocated buffer in the panda's format, so
+// bursts from several sendcan messages go out in a single bulk transfer.
+// Every frame keeps the time it was enqueued at (the logMonoTime of its
+// sendcan message), once the buffer is written the latencies are added to a
+// histogram that can be read from any thread.
+class CanSendQueue {
+ public:
+  CanSendQueue(size_t capacity = CAN_SEND_QUEUE_SIZE);
+
+  // packs frames[start:] until the queue is full, returns how many were
+  // consumed. Frames older than CAN_SEND_MAX_AGE at now are dropped instead
+  size_t push(capnp::List<cereal::CanData>::Reader frames, size_t start, uint64_t enqueue_time, uint64_t now);
+
+  size_t frames() const { return num_frames; }
+  bool empty() const { return num_frames == 0; }
+  bool full() const { return num_frames == capacity; }
+  uint8_t *data() { return (uint8_t *)buf.data(); }
+  size_t size() const { return num_frames * 0x10; }
+
+  // the first num_sent frames were on the wire at wire_time, the rest are
+  // dropped. Clears the queue
+  void sent(uint64_t wire_time, size_t num_sent);
+  // clears the queue without counting anything
+  void clear() { num_frames = 0; }
+  // drops everything after the first n frames
+  void truncate(size_t n) { num_frames = std::min(num_frames, n); }
+
+  // from any thread
+  uint32_t latency_count(int bucket) const { return latency_counts[bucket]; }
+  uint32_t dropped_count() const { return num_dropped; }
+
+ private:
+  const size_t capacity;
+  size_t num_frames = 0;
+  std::vector<uint32_t> buf;
+  std::vector<uint64_t> enqueue_times;
+
+  std::atomic<uint32_t> latency_counts[CAN_SEND_LATENCY_BUCKETS] = {};
+  std::atomic<uint32_t> num_dropped = 0;
+};
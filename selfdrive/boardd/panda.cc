@@ -2,6 +2,7 @@
 
 #include <unistd.h>
 
+#include <algorithm>
 #include <cassert>
 #include <stdexcept>
 #include <vector>
@@ -9,6 +10,7 @@
 #include "cereal/messaging/messaging.h"
 #include "selfdrive/common/gpio.h"
 #include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/timing.h"
 #include "selfdrive/common/util.h"
 
 Panda::Panda() {
@@ -45,6 +47,15 @@ Panda::Panda() {
   has_rtc = (hw_type == cereal::PandaState::PandaType::UNO) ||
             (hw_type == cereal::PandaState::PandaType::DOS);
 
+  can_receiver = std::make_unique<CanReceiver>([this](int idx, uint8_t *data, int length) {
+    return can_recv_submit(idx, data, length);
+  });
+  for (int i = 0; i < can_receiver->num_buffers(); i++) {
+    can_recv_transfers.push_back(libusb_alloc_transfer(0));
+  }
+  usb_events_running = true;
+  usb_event_thread = std::thread(&Panda::handle_usb_events, this);
+
   return;
 
 fail:
@@ -59,6 +70,24 @@ Panda::~Panda() {
 }
 
 void Panda::cleanup() {
+  if (can_receiver) {
+    // callbacks of cancelled reads still run on the event thread
+    for (auto transfer : can_recv_transfers) {
+      libusb_cancel_transfer(transfer);
+    }
+    can_receiver->stop();
+  }
+
+  if (usb_event_thread.joinable()) {
+    usb_events_running = false;
+    usb_event_thread.join();
+  }
+
+  for (auto transfer : can_recv_transfers) {
+    libusb_free_transfer(transfer);
+  }
+  can_recv_transfers.clear();
+
   if (dev_handle) {
     libusb_release_interface(dev_handle, 0);
     libusb_close(dev_handle);
@@ -78,6 +107,56 @@ void Panda::handle_usb_issue(int err, const char func[]) {
   // TODO: check other errors, is simply retrying okay?
 }
 
+void Panda::handle_usb_events() {
+  while (usb_events_running) {
+    struct timeval tv = {.tv_sec = 0, .tv_usec = 100000};
+    int err = libusb_handle_events_timeout_completed(ctx, &tv, NULL);
+    if (err != 0) handle_usb_issue(err, __func__);
+  }
+}
+
+bool Panda::can_recv_submit(int idx, uint8_t *data, int length) {
+  if (!connected) {
+    return false;
+  }
+
+  libusb_transfer *transfer = can_recv_transfers[idx];
+  libusb_fill_bulk_transfer(transfer, dev_handle, 0x81, data, length, can_recv_callback, this, TIMEOUT);
+  int err = libusb_submit_transfer(transfer);
+  if (err != 0) {
+    handle_usb_issue(err, __func__);
+    return false;
+  }
+  return true;
+}
+
+void LIBUSB_CALL Panda::can_recv_callback(libusb_transfer *transfer) {
+  Panda *panda = (Panda *)transfer->user_data;
+  auto &transfers = panda->can_recv_transfers;
+  const int idx = std::find(transfers.begin(), transfers.end(), transfer) - transfers.begin();
+
+  int length = 0;
+  switch (transfer->status) {
+    case LIBUSB_TRANSFER_COMPLETED:
+      length = transfer->actual_length;
+      break;
+    case LIBUSB_TRANSFER_CANCELLED:
+      break;
+    case LIBUSB_TRANSFER_OVERFLOW:
+      panda->comms_healthy = false;
+      LOGE_100("overflow got 0x%x", transfer->actual_length);
+      break;
+    case LIBUSB_TRANSFER_NO_DEVICE:
+      LOGE("lost connection");
+      panda->connected = false;
+      break;
+    default:
+      LOGE_100("usb transfer error %d in %s", transfer->status, __func__);
+      break;
+  }
+  panda->can_receiver->complete(idx, length);
+}
+
 int Panda::usb_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned int timeout) {
   int err;
   const uint8_t bmRequestType = LIBUSB_ENDPOINT_OUT | LIBUSB_REQUEST_TYPE_VENDOR | LIBUSB_RECIPIENT_DEVICE;
@@ -263,60 +342,13 @@ void Panda::send_heartbeat() {
   usb_write(0xf3, 1, 0);
 }
 
-void Panda::can_send(capnp::List<cereal::CanData>::Reader can_data_list) {
-  static std::vector<uint32_t> send;
-  const int msg_count = can_data_list.size();
-
-  send.resize(msg_count*0x10);
+void Panda::can_send() {
+  if (can_send_queue.empty()) return;
 
-  for (int i = 0; i < msg_count; i++) {
-    auto cmsg = can_data_list[i];
-    if (cmsg.getAddress() >= 0x800) { // extended
-      send[i*4] = (cmsg.getAddress() << 3) | 5;
-    } else { // normal
-      send[i*4] = (cmsg.getAddress() << 21) | 1;
-    }
-    auto can_data = cmsg.getDat();
-    assert(can_data.size() <= 8);
-    send[i*4+1] = can_data.size() | (cmsg.getSrc() << 4);
-    memcpy(&send[i*4+2], can_data.begin(), can_data.size());
-  }
-
-  usb_bulk_write(3, (unsigned char*)send.data(), send.size(), 5);
+  const int transferred = usb_bulk_write(3, can_send_queue.data(), can_send_queue.size(), 5);
+  can_send_queue.sent(nanos_since_boot(), transferred / 0x10);
 }
 
-int Panda::can_receive(kj::Array<capnp::word>& out_buf) {
-  uint32_t data[RECV_SIZE/4];
-  int recv = usb_bulk_read(0x81, (unsigned char*)data, RECV_SIZE);
-
-  // Not sure if this can happen
-  if (recv < 0) recv = 0;
-
-  if (recv == RECV_SIZE) {
-    LOGW("Receive buffer full");
-  }
-
-  size_t num_msg = recv / 0x10;
-  MessageBuilder msg;
-  auto evt = msg.initEvent();
-  evt.setValid(comms_healthy);
-
-  // populate message
-  auto canData = evt.initCan(num_msg);
-  for (int i = 0; i < num_msg; i++) {
-    if (data[i*4] & 4) {
-      // extended
-      canData[i].setAddress(data[i*4] >> 3);
-      //printf("got extended: %x\n", data[i*4] >> 3);
-    } else {
-      // normal
-      canData[i].setAddress(data[i*4] >> 21);
-    }
-    canData[i].setBusTime(data[i*4+1] >> 16);
-    int len = data[i*4+1]&0xF;
-    canData[i].setDat(kj::arrayPtr((uint8_t*)&data[i*4+2], len));
-    canData[i].setSrc((data[i*4+1] >> 4) & 0xff);
-  }
-  out_buf = capnp::messageToFlatArray(msg);
-  return recv;
+const std::vector<CanRecords> &Panda::can_receive(uint64_t deadline) {
+  return can_receiver->receive(deadline);
 }
@@ -3,17 +3,20 @@
 #include <atomic>
 #include <cstdint>
 #include <ctime>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <thread>
 #include <vector>
 
 #include <libusb-1.0/libusb.h>
 
 #include "cereal/gen/cpp/car.capnp.h"
 #include "cereal/gen/cpp/log.capnp.h"
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/boardd/can_receiver.h"
+#include "selfdrive/boardd/can_send_queue.h"
 
-// double the FIFO size
-#define RECV_SIZE (0x1000)
 #define TIMEOUT 0
 
 // copied from panda/board/main.c
@@ -48,6 +51,16 @@ class Panda {
   void handle_usb_issue(int err, const char func[]);
   void cleanup();
 
+  // CAN is received with async transfers, completed by usb_event_thread.
+  // They don't take usb_lock, so control transfers can't hold up CAN
+  std::atomic<bool> usb_events_running = false;
+  std::thread usb_event_thread;
+  std::vector<libusb_transfer *> can_recv_transfers;
+  std::unique_ptr<CanReceiver> can_receiver;
+  void handle_usb_events();
+  bool can_recv_submit(int idx, uint8_t *data, int length);
+  static void LIBUSB_CALL can_recv_callback(libusb_transfer *transfer);
+
  public:
   Panda();
   ~Panda();
@@ -57,6 +70,8 @@ class Panda {
   cereal::PandaState::PandaType hw_type = cereal::PandaState::PandaType::UNKNOWN;
   bool is_pigeon = false;
   bool has_rtc = false;
+  // filled by can_send_thread, can_send() writes it out
+  CanSendQueue can_send_queue;
 
   // HW communication
   int usb_write(uint8_t bRequest, uint16_t wValue, uint16_t wIndex, unsigned int timeout=TIMEOUT);
@@ -80,6 +95,7 @@ class Panda {
   void set_power_saving(bool power_saving);
   void set_usb_power_mode(cereal::PandaState::UsbPowerMode power_mode);
   void send_heartbeat();
-  void can_send(capnp::List<cereal::CanData>::Reader can_data_list);
-  int can_receive(kj::Array<capnp::word>& out_buf);
+  void can_send();
+  // raw CAN records, 4 words each, valid until the next call
+  const std::vector<CanRecords> &can_receive(uint64_t deadline);
 };
@@ -0,0 +1,246 @@
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "selfdrive/boardd/can_receiver.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+
+// USB turnaround, what the mock's clock advances per step
+const uint64_t STEP = 100000ULL;
+
+// Stands in for libusb and the panda, on a clock the test steps: each step the
+// frames that arrived on the bus since the last one go into the FIFO, the
+// reads queued before it are answered like the panda firmware does, with
+// whatever the FIFO holds right then, and the receiver takes what completed
+class MockPanda {
+ public:
+  MockPanda(std::vector<uint32_t> records, double frames_per_sec, size_t fifo_size = 0x1000, uint64_t bus_start = 0)
+    : receiver([this](int idx, uint8_t *data, int length) {
+        reads.push_back({idx, data, length});
+        submit_times.push_back(now);
+        max_reads = std::max(max_reads, reads.size());
+        return true;
+      }, CAN_RECV_BUFFERS, [this]() { return now; }),
+      records(records), frames_per_sec(frames_per_sec), fifo_size(fifo_size), bus_start(bus_start) {}
+
+  CanReceiver receiver;
+
+  void step(std::vector<uint32_t> &out) {
+    now += STEP;
+    const double elapsed = now > bus_start ? (now - bus_start) * 1e-9 : 0;
+    const size_t arrived = std::min(num_frames(), (size_t)(elapsed * frames_per_sec));
+    for (; next_frame < arrived; next_frame++) {
+      if (fifo.size() < fifo_size) {
+        fifo.push_back(next_frame);
+      } else {
+        dropped++;
+      }
+    }
+
+    std::deque<Read> queued;
+    queued.swap(reads);
+    for (auto &read : queued) {
+      int length = 0;
+      while (!fifo.empty() && length + 0x10 <= read.length) {
+        memcpy(read.data + length, &records[fifo.front() * 4], 0x10);
+        fifo.pop_front();
+        length += 0x10;
+      }
+      receiver.complete(read.idx, length);
+    }
+    for (auto &read : receiver.receive(now)) {
+      out.insert(out.end(), read.records, read.records + read.num_records * 4);
+    }
+  }
+
+  size_t num_frames() { return records.size() / 4; }
+
+  size_t dropped = 0;
+  size_t max_reads = 0;              // most reads queued at once
+  std::vector<uint64_t> submit_times; // of every read
+  uint64_t now = 0;
+
+ private:
+  struct Read {
+    int idx;
+    uint8_t *data;
+    int length;
+  };
+
+  std::vector<uint32_t> records;
+  double frames_per_sec;
+  size_t fifo_size;
+  uint64_t bus_start;
+  size_t next_frame = 0;
+  std::deque<size_t> fifo;
+  std::deque<Read> reads;
+};
+
+// panda formatted records, the payload carries the frame number
+static std::vector<uint32_t> make_records(size_t n) {
+  const uint32_t addresses[] = {0x1d0, 0x1d2, 0x224, 0x260, 0x2e4, 0x343, 0x3bc, 0x18ff1234};
+  std::vector<uint32_t> records;
+  for (size_t i = 0; i < n; i++) {
+    const uint32_t address = addresses[i % std::size(addresses)];
+    records.push_back(address >= 0x800 ? (address << 3) | 5 : (address << 21) | 1);
+    records.push_back(8 | ((i % 3) << 4) | ((i & 0xFFFF) << 16));
+    records.push_back(i);
+    records.push_back(~i);
+  }
+  return records;
+}
+
+TEST_CASE("CanReceiver delivers every frame in order") {
+  const int rate = GENERATE(100, 2000, 8000);
+  MockPanda panda(make_records(rate / 4), rate);
+
+  std::vector<uint32_t> out;
+  while (panda.now < 400000000ULL) {
+    panda.step(out);
+  }
+
+  REQUIRE(panda.dropped == 0);
+  REQUIRE(out.size() == panda.num_frames() * 4);
+  for (size_t i = 0; i < panda.num_frames(); i++) {
+    REQUIRE(out[i * 4 + 2] == i);
+    REQUIRE(out[i * 4 + 3] == ~(uint32_t)i);
+  }
+}
+
+TEST_CASE("CanReceiver queues every buffer to drain a backlog") {
+  // more than four full reads are on the panda at the first poll
+  MockPanda panda(make_records(1100), 1e12, 0x2000);
+
+  std::vector<uint32_t> out;
+  // submit the poll, it comes back full, then all four reads together
+  for (int i = 0; i < 3; i++) {
+    panda.step(out);
+  }
+  REQUIRE(panda.max_reads == CAN_RECV_BUFFERS);
+  REQUIRE(out.size() == panda.num_frames() * 4);
+
+  // the last read was short, so it's back to a single read per poll
+  while (panda.submit_times.size() == 1 + CAN_RECV_BUFFERS) {
+    panda.step(out);
+  }
+  REQUIRE(panda.submit_times.back() - panda.submit_times.front() == CAN_RECV_MIN_POLL_INTERVAL);
+  panda.step(out);
+  REQUIRE(panda.submit_times.size() == 2 + CAN_RECV_BUFFERS);
+}
+
+TEST_CASE("CanReceiver polls less while the bus is quiet") {
+  const uint64_t ms = 1000000ULL, bus_start = 100 * ms;
+  MockPanda panda(make_records(2000), 8000, 0x1000, bus_start);
+
+  std::vector<uint32_t> out;
+  std::vector<uint64_t> intervals = {panda.receiver.poll_interval()};
+  while (panda.now < bus_start + 40 * ms) {
+    panda.step(out);
+    if (panda.receiver.poll_interval() != intervals.back()) {
+      intervals.push_back(panda.receiver.poll_interval());
+    }
+  }
+
+  // doubles on every empty poll up to 10 ms, then halves while they return data
+  const std::vector<uint64_t> expected = {1 * ms, 2 * ms, 4 * ms, 8 * ms, 10 * ms,
+                                          5 * ms, 2500000, 1250000, 1 * ms};
+  REQUIRE(intervals == expected);
+
+  // a poll is due an interval after the one before
+  std::vector<uint64_t> gaps;
+  for (size_t i = 1; i < panda.submit_times.size() && panda.submit_times[i] < bus_start; i++) {
+    gaps.push_back(panda.submit_times[i] - panda.submit_times[i - 1]);
+  }
+  const std::vector<uint64_t> quiet_gaps = {1 * ms, 2 * ms, 4 * ms, 8 * ms, 10 * ms, 10 * ms, 10 * ms};
+  REQUIRE(gaps.size() >= quiet_gaps.size());
+  REQUIRE(std::vector<uint64_t>(gaps.begin(), gaps.begin() + quiet_gaps.size()) == quiet_gaps);
+}
+
+TEST_CASE("CanReceiver doesn't read into buffers it handed out") {
+  std::vector<std::pair<int, uint8_t *>> queued;
+  CanReceiver receiver([&](int idx, uint8_t *data, int length) {
+    queued.push_back({idx, data});
+    return true;
+  }, CAN_RECV_BUFFERS, []() { return 0; });
+
+  for (int round = 0; round < 10; round++) {
+    // a backlog, every read comes back full
+    const auto completed = queued;
+    queued.clear();
+    for (auto &[idx, data] : completed) {
+      receiver.complete(idx, RECV_SIZE);
+    }
+
+    const auto &reads = receiver.receive(0);
+    REQUIRE(reads.size() == completed.size());
+    REQUIRE(queued.size() == (round == 0 ? 1 : CAN_RECV_BUFFERS));
+    for (size_t i = 0; i < reads.size(); i++) {
+      REQUIRE(reads[i].records == (const uint32_t *)completed[i].second);
+      REQUIRE(reads[i].num_records == RECV_SIZE / 0x10);
+      for (auto &[idx, data] : queued) {
+        REQUIRE(data != completed[i].second);
+      }
+    }
+  }
+}
+
+TEST_CASE("CanReceiver returns as soon as records arrive") {
+  // every read is answered right away, full ones for a backlog of num_full reads
+  const int num_full = GENERATE(0, 3, 100);
+  int reads = 0;
+  CanReceiver *receiver = nullptr;
+  CanReceiver r([&](int idx, uint8_t *data, int length) {
+    receiver->complete(idx, reads++ < num_full ? RECV_SIZE : 0x20);
+    return true;
+  });
+  receiver = &r;
+
+  const uint64_t start = nanos_since_boot();
+  const auto &received = receiver->receive(start + 1000000000ULL);
+  REQUIRE(nanos_since_boot() - start < 100000000ULL);
+
+  size_t num_records = 0;
+  for (auto &read : received) {
+    num_records += read.num_records;
+  }
+  if (num_full == 0) {
+    REQUIRE(received.size() == 1);
+    REQUIRE(num_records == 2);
+  } else if (num_full == 3) {
+    // the backlog goes out in one batch
+    REQUIRE(received.size() == 4);
+    REQUIRE(num_records == 3 * RECV_SIZE / 0x10 + 2);
+  } else {
+    // one that doesn't end is cut off
+    REQUIRE(received.size() > 0);
+    REQUIRE(received.size() <= 2 * CAN_RECV_BUFFERS);
+    REQUIRE(num_records == received.size() * RECV_SIZE / 0x10);
+  }
+}
+
+TEST_CASE("CanReceiver stop waits for reads in flight") {
+  std::vector<int> queued;
+  CanReceiver receiver([&](int idx, uint8_t *data, int length) {
+    queued.push_back(idx);
+    return true;
+  });
+  receiver.receive(nanos_since_boot() + 5000000ULL);
+  REQUIRE(queued.size() == 1);
+
+  std::atomic<bool> stopped = false;
+  std::thread stop_thread([&]() {
+    receiver.stop();
+    stopped = true;
+  });
+  util::sleep_for(20);
+  REQUIRE(!stopped);
+
+  receiver.complete(queued[0], 0);
+  stop_thread.join();
+  REQUIRE(stopped);
+}
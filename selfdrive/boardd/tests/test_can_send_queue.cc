@@ -0,0 +1,102 @@
+#include <cstring>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/boardd/can_send_queue.h"
+
+static capnp::List<cereal::CanData>::Reader build_sendcan(MessageBuilder &msg, size_t n) {
+  auto frames = msg.initEvent().initSendcan(n);
+  for (size_t i = 0; i < n; i++) {
+    frames[i].setAddress(i % 2 ? 0x18DAF110 + i : 0x200 + i);
+    frames[i].setSrc(i % 3);
+    uint8_t dat[8];
+    for (int j = 0; j < 8; j++) dat[j] = i + j;
+    frames[i].setDat(kj::arrayPtr(dat, i % 9));
+  }
+  return frames.asReader();
+}
+
+TEST_CASE("CanSendQueue packs frames like the panda expects") {
+  MessageBuilder msg;
+  auto frames = build_sendcan(msg, 20);
+
+  CanSendQueue queue;
+  REQUIRE(queue.push(frames, 0, 1000, 2000) == frames.size());
+  REQUIRE(queue.size() == frames.size() * 0x10);
+
+  const uint32_t *send = (const uint32_t *)queue.data();
+  for (size_t i = 0; i < frames.size(); i++) {
+    const uint32_t address = frames[i].getAddress();
+    REQUIRE(send[i*4] == (address >= 0x800 ? (address << 3) | 5 : (address << 21) | 1));
+    REQUIRE(send[i*4+1] == (frames[i].getDat().size() | (frames[i].getSrc() << 4)));
+
+    uint8_t dat[8] = {};
+    memcpy(dat, frames[i].getDat().begin(), frames[i].getDat().size());
+    REQUIRE(memcmp(&send[i*4+2], dat, 8) == 0);
+  }
+}
+
+TEST_CASE("CanSendQueue fills up to its capacity") {
+  MessageBuilder msg;
+  auto frames = build_sendcan(msg, 25);
+
+  CanSendQueue queue(10);
+  size_t pushed = 0, transfers = 0;
+  while (pushed < frames.size()) {
+    pushed += queue.push(frames, pushed, 0, 0);
+    if (queue.full()) {
+      queue.sent(0, queue.frames());
+      transfers++;
+    }
+  }
+  REQUIRE(transfers == 2);
+  REQUIRE(queue.frames() == 5);
+}
+
+TEST_CASE("CanSendQueue truncates to what was queued before a torn message") {
+  MessageBuilder msg;
+  auto frames = build_sendcan(msg, 8);
+
+  CanSendQueue queue;
+  queue.push(frames, 0, 0, 0);
+  queue.push(frames, 0, 0, 0);
+  queue.truncate(8);
+  REQUIRE(queue.frames() == 8);
+  REQUIRE(queue.size() == 8 * 0x10);
+  queue.truncate(10);
+  REQUIRE(queue.frames() == 8);
+}
+
+TEST_CASE("CanSendQueue drops old frames") {
+  MessageBuilder msg;
+  auto frames = build_sendcan(msg, 4);
+
+  CanSendQueue queue;
+  REQUIRE(queue.push(frames, 1, 0, CAN_SEND_MAX_AGE) == 3);
+  REQUIRE(queue.empty());
+  REQUIRE(queue.dropped_count() == 3);
+}
+
+TEST_CASE("CanSendQueue latency histogram") {
+  MessageBuilder msg;
+  auto frames = build_sendcan(msg, 1);
+
+  CanSendQueue queue;
+  const uint64_t latencies_us[] = {0, 249, 250, 900, 15999, 16000, 500000};
+  for (auto latency : latencies_us) {
+    queue.push(frames, 0, 1e9, 1e9);
+    queue.sent(1e9 + latency * 1000, 1);
+  }
+  const uint32_t expected[CAN_SEND_LATENCY_BUCKETS] = {2, 1, 1, 0, 0, 0, 1, 2};
+  for (int b = 0; b < CAN_SEND_LATENCY_BUCKETS; b++) {
+    REQUIRE(queue.latency_count(b) == expected[b]);
+  }
+
+  // a short write drops the rest
+  for (int i = 0; i < 3; i++) queue.push(frames, 0, 1e9, 1e9);
+  queue.sent(1e9, 1);
+  REQUIRE(queue.empty());
+  REQUIRE(queue.latency_count(0) == 3);
+  REQUIRE(queue.dropped_count() == 2);
+}
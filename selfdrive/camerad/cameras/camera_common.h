@@ -27,7 +27,9 @@
 #define CAMERA_ID_MAX 9
 
 #define UI_BUF_COUNT 4
-#define YUV_COUNT 100
+// buffers held by clients aren't reused, these are for loggerd's backlog:
+// frames it gets to after they were overwritten are dropped
+#define YUV_COUNT 40
 #define LOG_CAMERA_ID_FCAMERA 0
 #define LOG_CAMERA_ID_DCAMERA 1
 #define LOG_CAMERA_ID_ECAMERA 2
@@ -11,6 +11,7 @@ from selfdrive.controls.lib.drive_helpers import V_CRUISE_MAX
 from selfdrive.controls.lib.events import Events
 from selfdrive.controls.lib.vehicle_model import VehicleModel
 from common.params import Params
+from opendbc.can.parser import CANParserGroup
 
 GearShifter = car.CarState.GearShifter
 EventName = car.CarEvent.EventName
@@ -37,6 +38,7 @@ class CarInterfaceBase():
       self.cp = self.CS.get_can_parser(CP)
       self.cp_cam = self.CS.get_cam_can_parser(CP)
       self.cp_body = self.CS.get_body_can_parser(CP)
+      self.can_parsers = CANParserGroup(self.cp, self.cp_cam, self.cp_body)
 
     self.CC = None
     if CarController is not None:
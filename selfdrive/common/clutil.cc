@@ -58,9 +58,12 @@ void cl_print_build_errors(cl_program program, cl_device_id device) {
 
 }  // namespace
 
-cl_device_id cl_get_device_id(cl_device_type device_type) {
+cl_device_id cl_find_device_id(cl_device_type device_type) {
   cl_uint num_platforms = 0;
-  CL_CHECK(clGetPlatformIDs(0, NULL, &num_platforms));
+  if (clGetPlatformIDs(0, NULL, &num_platforms) != CL_SUCCESS || num_platforms == 0) {
+    std::cout << "No openCL platform found" << std::endl;
+    return nullptr;
+  }
   std::unique_ptr<cl_platform_id[]> platform_ids = std::make_unique<cl_platform_id[]>(num_platforms);
   CL_CHECK(clGetPlatformIDs(num_platforms, &platform_ids[0], NULL));
 
@@ -73,10 +76,15 @@ cl_device_id cl_get_device_id(cl_device_type device_type) {
     }
   }
   std::cout << "No valid openCL platform found" << std::endl;
-  assert(0);
   return nullptr;
 }
 
+cl_device_id cl_get_device_id(cl_device_type device_type) {
+  cl_device_id device_id = cl_find_device_id(device_type);
+  assert(device_id);
+  return device_id;
+}
+
 cl_program cl_program_from_file(cl_context ctx, cl_device_id device_id, const char* path, const char* args) {
   std::string src = util::read_file(path);
   assert(src.length() > 0);
@@ -23,5 +23,7 @@
   })
 
 cl_device_id cl_get_device_id(cl_device_type device_type);
+// like cl_get_device_id, NULL if there's none
+cl_device_id cl_find_device_id(cl_device_type device_type);
 cl_program cl_program_from_file(cl_context ctx, cl_device_id device_id, const char* path, const char* args);
 const char* cl_get_error_string(int err);
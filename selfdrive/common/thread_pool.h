@@ -0,0 +1,81 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of threads for splitting loops. parallel_for calls fn(thread, begin, end)
+// on a band of [0, n) on every thread, the calling thread being thread 0, and
+// returns when they're all done
+class ThreadPool {
+ public:
+  ThreadPool(int num_threads) : num_threads(std::max(num_threads, 1)) {
+    for (int i = 1; i < this->num_threads; i++) {
+      threads.emplace_back(&ThreadPool::worker, this, i);
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard lk(lock);
+      exit = true;
+    }
+    cv.notify_all();
+    for (auto &t : threads) t.join();
+  }
+
+  int size() const { return num_threads; }
+
+  void parallel_for(int n, const std::function<void(int, int, int)> &fn) {
+    if (num_threads == 1 || n <= 1) {
+      fn(0, 0, n);
+      return;
+    }
+    {
+      std::lock_guard lk(lock);
+      job = &fn;
+      job_n = n;
+      pending = num_threads - 1;
+      generation++;
+    }
+    cv.notify_all();
+
+    fn(0, 0, n / num_threads);
+
+    std::unique_lock lk(lock);
+    done_cv.wait(lk, [&] { return pending == 0; });
+  }
+
+ private:
+  void worker(int idx) {
+    uint64_t seen = 0;
+    std::unique_lock lk(lock);
+    while (true) {
+      cv.wait(lk, [&] { return exit || generation != seen; });
+      if (exit) break;
+      seen = generation;
+
+      const auto &fn = *job;
+      const int n = job_n;
+      lk.unlock();
+      fn(idx, n * idx / num_threads, n * (idx + 1) / num_threads);
+      lk.lock();
+
+      if (--pending == 0) done_cv.notify_one();
+    }
+  }
+
+  const int num_threads;
+  std::vector<std::thread> threads;
+  std::mutex lock;
+  std::condition_variable cv, done_cv;
+  const std::function<void(int, int, int)> *job = nullptr;
+  int job_n = 0;
+  int pending = 0;
+  uint64_t generation = 0;
+  bool exit = false;
+};
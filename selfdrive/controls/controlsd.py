@@ -782,7 +782,8 @@ class Controls:
   def controlsd_thread(self):
     while True:
       self.step()
-      self.rk.monitor_time()
+      # can is published as it's received, step at 100hz on what arrived meanwhile
+      self.rk.keep_time()
       self.prof.display()
 
 def main(sm=None, pm=None, logcan=None):
@@ -414,7 +414,7 @@ void Localizer::handle_msg(const cereal::Event::Reader& log) {
   this->update_reset_tracker();
 }
 
-kj::ArrayPtr<capnp::byte> Localizer::get_message_bytes(MessageBuilder& msg_builder, uint64_t logMonoTime,
+void Localizer::build_message(MessageBuilder& msg_builder, uint64_t logMonoTime,
   bool inputsOK, bool sensorsOK, bool gpsOK)
 {
   cereal::Event::Builder evt = msg_builder.initEvent();
@@ -424,7 +424,6 @@ kj::ArrayPtr<capnp::byte> Localizer::get_message_bytes(MessageBuilder& msg_build
   liveLoc.setInputsOK(inputsOK);
   liveLoc.setSensorsOK(sensorsOK);
   liveLoc.setGpsOK(gpsOK);
-  return msg_builder.toBytes();
 }
 
 int Localizer::locationd_thread() {
@@ -450,9 +449,9 @@ int Localizer::locationd_thread() {
       bool sensorsOK = sm.alive("sensorEvents") && sm.valid("sensorEvents");
       bool gpsOK = (logMonoTime / 1e9) - this->last_gps_fix < 1.0;
 
-      MessageBuilder msg_builder;
-      kj::ArrayPtr<capnp::byte> bytes = this->get_message_bytes(msg_builder, logMonoTime, inputsOK, sensorsOK, gpsOK);
-      pm.send("liveLocationKalman", bytes.begin(), bytes.size());
+      MessageBuilder msg_builder("liveLocationKalman");
+      this->build_message(msg_builder, logMonoTime, inputsOK, sensorsOK, gpsOK);
+      pm.send("liveLocationKalman", msg_builder);
 
       if (sm.frame % 1200 == 0 && gpsOK) {  // once a minute
         VectorXd posGeo = this->get_position_geodetic();
@@ -0,0 +1,260 @@
+#include "selfdrive/loggerd/av_encoder.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+
+extern "C" {
+#include <libavutil/imgutils.h>
+#include <libavutil/opt.h>
+}
+
+#include "libyuv.h"
+
+#include "selfdrive/common/swaglog.h"
+#include "selfdrive/common/util.h"
+
+// only the software encoders, avcodec_find_encoder can return a hardware one
+// (nvenc, vaapi) that needs a device to open
+static const AVCodec *find_codec(bool h265) {
+  return avcodec_find_encoder_by_name(h265 ? "libx265" : "libx264");
+}
+
+bool AvEncoder::available(bool h265) {
+  const AVCodec *codec = find_codec(h265);
+  if (!codec) return false;
+
+  // libav can be built with the encoder while the library isn't there, so open one
+  AVCodecContext *ctx = avcodec_alloc_context3(codec);
+  assert(ctx);
+  ctx->width = ctx->height = 64;
+  ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  ctx->time_base = (AVRational){ 1, 20 };
+  ctx->thread_count = 1;
+  if (h265) {
+    av_opt_set(ctx->priv_data, "x265-params", "log-level=error:pools=1", 0);
+  }
+  int err = avcodec_open2(ctx, codec, NULL);
+  avcodec_free_context(&ctx);
+  return err >= 0;
+}
+
+AvEncoder::AvEncoder(const char* filename, int width, int height, int fps, int bitrate, bool h265, bool downscale)
+  : filename(filename), width(width), height(height), fps(fps), bitrate(bitrate), downscale(downscale) {
+  codec = find_codec(h265);
+  assert(codec);
+
+  // x264/x265 take about one and a half threads per core by default, for each
+  // encoder, and there's one per camera
+  threads = downscale ? 1 : std::clamp((int)std::thread::hardware_concurrency() / 4, 1, 4);
+
+  const char *p = getenv("LOGGERD_PRESET");
+  preset = p ? p : "veryfast";
+
+  const size_t frame_size = width * height * 3 / 2;
+  for (int i = 0; i < AV_ENCODER_QUEUE_SIZE; i++) {
+    frames.push_back(std::make_unique<Frame>());
+    frames.back()->yuv.resize(frame_size);
+    free_frames.push(frames.back().get());
+  }
+
+  av_frame = av_frame_alloc();
+  assert(av_frame);
+  av_frame->format = AV_PIX_FMT_YUV420P;
+  av_frame->width = width;
+  av_frame->height = height;
+  av_frame->linesize[0] = width;
+  av_frame->linesize[1] = width/2;
+  av_frame->linesize[2] = width/2;
+
+  pkt = av_packet_alloc();
+  assert(pkt);
+
+  thread = std::thread(&AvEncoder::worker, this);
+}
+
+AvEncoder::~AvEncoder() {
+  assert(!is_open);
+  jobs.push({.type = Job::EXIT});
+  thread.join();
+
+  av_packet_free(&pkt);
+  av_frame_free(&av_frame);
+}
+
+void AvEncoder::encoder_open(const char* path) {
+  // create camera lock file
+  lock_path = util::string_format("%s/%s.lock", path, filename);
+  int lock_fd = open(lock_path.c_str(), O_RDWR | O_CREAT, 0777);
+  assert(lock_fd >= 0);
+  close(lock_fd);
+
+  jobs.push({.type = Job::OPEN, .path = util::string_format("%s/%s", path, filename)});
+  is_open = true;
+  counter = 0;
+}
+
+void AvEncoder::encoder_close() {
+  if (!is_open) return;
+
+  jobs.push({.type = Job::CLOSE, .path = lock_path});
+  is_open = false;
+}
+
+int AvEncoder::encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
+                            int in_width, int in_height, uint64_t ts) {
+  if (!is_open) {
+    return -1;
+  }
+
+  Frame *frame;
+  if (!free_frames.try_pop(frame)) {
+    // the worker is behind, don't hold up the camera
+    if (dropped++ % 100 == 0) {
+      LOGW("%s encoder behind, %d frames dropped", filename, dropped);
+    }
+    return -1;
+  }
+
+  uint8_t *y = frame->yuv.data(), *u = y + width * height, *v = u + width * height / 4;
+  if (downscale) {
+    libyuv::I420Scale(y_ptr, in_width,
+                      u_ptr, in_width/2,
+                      v_ptr, in_width/2,
+                      in_width, in_height,
+                      y, width,
+                      u, width/2,
+                      v, width/2,
+                      width, height,
+                      libyuv::kFilterNone);
+  } else {
+    assert(in_width == width && in_height == height);
+    memcpy(y, y_ptr, width * height);
+    memcpy(u, u_ptr, width * height / 4);
+    memcpy(v, v_ptr, width * height / 4);
+  }
+  // frames are numbered from the start of the segment, like the file's frames
+  frame->pts = counter;
+
+  jobs.push({.type = Job::FRAME, .frame = frame});
+  return counter++;
+}
+
+void AvEncoder::worker() {
+  set_thread_name("av_encoder");
+
+  while (true) {
+    Job job = jobs.pop();
+    if (job.type == Job::OPEN) {
+      open_file(job.path);
+    } else if (job.type == Job::FRAME) {
+      if (codec_ctx) {
+        Frame *frame = job.frame;
+        av_frame->data[0] = frame->yuv.data();
+        av_frame->data[1] = av_frame->data[0] + width * height;
+        av_frame->data[2] = av_frame->data[1] + width * height / 4;
+        av_frame->pts = frame->pts;
+        write_frame(av_frame);
+      }
+      free_frames.push(job.frame);
+    } else if (job.type == Job::CLOSE) {
+      close_file(job.path);
+    } else {
+      break;
+    }
+  }
+}
+
+void AvEncoder::open_file(const std::string &vid_path) {
+  // a fresh encoder per file, so every file starts with a keyframe
+  codec_ctx = avcodec_alloc_context3(codec);
+  assert(codec_ctx);
+  codec_ctx->width = width;
+  codec_ctx->height = height;
+  codec_ctx->pix_fmt = AV_PIX_FMT_YUV420P;
+  codec_ctx->time_base = (AVRational){ 1, fps };
+  codec_ctx->framerate = (AVRational){ fps, 1 };
+  codec_ctx->bit_rate = bitrate;
+  codec_ctx->gop_size = fps;
+  // one packet per frame in order, so the frame ids from encode_frame are the file's
+  codec_ctx->max_b_frames = 0;
+  codec_ctx->thread_count = threads;
+  av_opt_set(codec_ctx->priv_data, "preset", preset.c_str(), 0);
+  if (codec->id == AV_CODEC_ID_HEVC) {
+    // libx265 doesn't use thread_count, its pool is set here
+    const std::string params = util::string_format("log-level=error:pools=%d", threads);
+    av_opt_set(codec_ctx->priv_data, "x265-params", params.c_str(), 0);
+  }
+
+  format_ctx = NULL;
+  avformat_alloc_output_context2(&format_ctx, NULL, NULL, vid_path.c_str());
+  assert(format_ctx);
+  if (format_ctx->oformat->flags & AVFMT_GLOBALHEADER) {
+    codec_ctx->flags |= AV_CODEC_FLAG_GLOBAL_HEADER;
+  }
+
+  int err = avcodec_open2(codec_ctx, codec, NULL);
+  if (err < 0) {
+    // frames are dropped until the next segment
+    LOGE("%s encoder open failed %d", filename, err);
+    avformat_free_context(format_ctx);
+    format_ctx = NULL;
+    avcodec_free_context(&codec_ctx);
+    return;
+  }
+
+  stream = avformat_new_stream(format_ctx, NULL);
+  assert(stream);
+  stream->id = 0;
+  stream->time_base = codec_ctx->time_base;
+  err = avcodec_parameters_from_context(stream->codecpar, codec_ctx);
+  assert(err >= 0);
+
+  err = avio_open(&format_ctx->pb, vid_path.c_str(), AVIO_FLAG_WRITE);
+  assert(err >= 0);
+
+  err = avformat_write_header(format_ctx, NULL);
+  assert(err >= 0);
+
+  LOGD("%s encoder_open %s %s preset %s, %d threads", filename, vid_path.c_str(), codec->name, preset.c_str(), threads);
+}
+
+// encodes av_frame, NULL flushes the encoder
+void AvEncoder::write_frame(AVFrame *frame) {
+  int err = avcodec_send_frame(codec_ctx, frame);
+  if (err < 0) {
+    LOGE("%s encoding error %d", filename, err);
+    return;
+  }
+
+  while (avcodec_receive_packet(codec_ctx, pkt) == 0) {
+    av_packet_rescale_ts(pkt, codec_ctx->time_base, stream->time_base);
+    pkt->stream_index = stream->index;
+    err = av_interleaved_write_frame(format_ctx, pkt);
+    if (err < 0) {
+      LOGE("%s encoder writer error %d", filename, err);
+    }
+    av_packet_unref(pkt);
+  }
+}
+
+void AvEncoder::close_file(const std::string &lock_file) {
+  if (codec_ctx) {
+    write_frame(NULL);
+
+    int err = av_write_trailer(format_ctx);
+    assert(err == 0);
+    err = avio_closep(&format_ctx->pb);
+    assert(err == 0);
+    avformat_free_context(format_ctx);
+    format_ctx = NULL;
+    stream = NULL;
+
+    avcodec_free_context(&codec_ctx);
+  }
+  unlink(lock_file.c_str());
+}
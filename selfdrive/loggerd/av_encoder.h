@@ -0,0 +1,76 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+extern "C" {
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+}
+
+#include "selfdrive/common/queue.h"
+#include "selfdrive/loggerd/encoder.h"
+
+// frames queued for the worker, encode_frame drops frames when they're all in use
+#define AV_ENCODER_QUEUE_SIZE 8
+
+// AvEncoder, lossy software h264/hevc through libavcodec (x264/x265), for PC.
+// encode_frame only copies the frame, it's encoded on a worker thread. Opens
+// and closes are queued in between the frames, so rotating never waits on the
+// encoder either. The lock file is there until the worker closed the file.
+// LOGGERD_PRESET sets the x264/x265 preset, veryfast by default
+class AvEncoder : public VideoEncoder {
+public:
+  // whether libx265 (h265) or libx264 is there and opens
+  static bool available(bool h265);
+  AvEncoder(const char* filename, int width, int height, int fps, int bitrate, bool h265, bool downscale);
+  ~AvEncoder();
+  int encode_frame(const uint8_t *y_ptr, const uint8_t *u_ptr, const uint8_t *v_ptr,
+                   int in_width, int in_height, uint64_t ts);
+  void encoder_open(const char* path);
+  void encoder_close();
+
+private:
+  struct Frame {
+    std::vector<uint8_t> yuv; // I420 at the output size
+    int64_t pts;
+  };
+  struct Job {
+    enum Type { OPEN, FRAME, CLOSE, EXIT } type;
+    Frame *frame = nullptr;
+    std::string path; // OPEN: the video, CLOSE: the lock file
+  };
+
+  void worker();
+  void open_file(const std::string &vid_path);
+  void write_frame(AVFrame *av_frame);
+  void close_file(const std::string &lock_file);
+
+  const char* filename;
+  int width, height, fps, bitrate;
+  bool downscale;
+  const AVCodec *codec = nullptr;
+  std::string preset;
+  int threads;
+
+  // encoder thread
+  bool is_open = false;
+  int counter = 0;
+  std::string lock_path;
+  int dropped = 0;
+
+  std::vector<std::unique_ptr<Frame>> frames;
+  SafeQueue<Frame *> free_frames;
+  SafeQueue<Job> jobs;
+  std::thread thread;
+
+  // worker
+  AVCodecContext *codec_ctx = nullptr;
+  AVFormatContext *format_ctx = nullptr;
+  AVStream *stream = nullptr;
+  AVFrame *av_frame = nullptr;
+  AVPacket *pkt = nullptr;
+};
@@ -0,0 +1,329 @@
+#include "selfdrive/loggerd/log_writer.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#include <bzlib.h>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "selfdrive/common/swaglog.h"
+
+#define RING_HEADER_SIZE 8
+#define RING_COMMITTED (1u << 31)
+#define RING_PAD (1u << 30)
+#define RING_SIZE_MASK (RING_PAD - 1)
+
+namespace {
+
+// Compressor threads, shared by every LogWriter. Half the cores, the rest of
+// openpilot runs on the others
+class CompressPool {
+ public:
+  static CompressPool &instance() {
+    static CompressPool pool;
+    return pool;
+  }
+
+  void run(std::function<void()> job) {
+    std::lock_guard lk(lock);
+    jobs.push_back(std::move(job));
+    cv.notify_one();
+  }
+
+ private:
+  CompressPool() {
+    const int num_threads = std::clamp((int)std::thread::hardware_concurrency() / 2, 1, 4);
+    for (int i = 0; i < num_threads; i++) {
+      threads.emplace_back(&CompressPool::worker, this);
+    }
+  }
+
+  ~CompressPool() {
+    {
+      std::lock_guard lk(lock);
+      exit = true;
+      cv.notify_all();
+    }
+    for (auto &t : threads) t.join();
+  }
+
+  void worker() {
+    std::unique_lock lk(lock);
+    while (true) {
+      cv.wait(lk, [&]() { return exit || !jobs.empty(); });
+      if (jobs.empty()) return;
+
+      auto job = std::move(jobs.front());
+      jobs.pop_front();
+      lk.unlock();
+      job();
+      lk.lock();
+    }
+  }
+
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<std::function<void()>> jobs;
+  std::vector<std::thread> threads;
+  bool exit = false;
+};
+
+inline std::atomic<uint32_t> *ring_header(uint8_t *record) {
+  return reinterpret_cast<std::atomic<uint32_t> *>(record);
+}
+
+inline size_t ring_record_size(size_t size) {
+  return RING_HEADER_SIZE + ((size + 7) & ~(size_t)7);
+}
+
+}  // namespace
+
+const char *log_extension(LogCompression compression) {
+  return compression == LogCompression::ZSTD ? "zst" : "bz2";
+}
+
+LogWriter::LogWriter(const char *path, LogCompression compression) : compression(compression) {
+#ifndef USE_ZSTD
+  assert(compression == LogCompression::BZ2);
+#endif
+  file = fopen(path, "wb");
+  assert(file != nullptr);
+  cur = std::make_unique<Chunk>();
+  cur->input.reserve(LOG_CHUNK_SIZE);
+  ring = std::make_unique<uint8_t[]>(LOG_RING_SIZE);
+}
+
+LogWriter::~LogWriter() {
+  if (!closing) {
+    close(nullptr);
+  }
+  std::unique_lock lk(lock);
+  cv.wait(lk, [&]() { return file == nullptr; });
+}
+
+void LogWriter::close(std::function<void()> closed) {
+  // nobody writes anymore, the flag is free
+  drain();
+
+  // an empty log is still a valid (empty) stream
+  if (!cur->input.empty() || !submitted) {
+    submit();
+  }
+
+  std::lock_guard lk(lock);
+  closing = true;
+  on_closed = std::move(closed);
+  if (pending.empty()) {
+    // everything is written already, still close it on a compressor
+    CompressPool::instance().run([this]() {
+      std::unique_lock lk(lock);
+      finish(lk);
+    });
+  }
+}
+
+// with the lock, once the last chunk is written. Doesn't touch the writer
+// after calling on_closed
+void LogWriter::finish(std::unique_lock<std::mutex> &lk) {
+#ifdef USE_ZSTD
+  if (compression == LogCompression::ZSTD) {
+    const std::vector<uint8_t> footer = log_index_footer(blocks);
+    fwrite(footer.data(), 1, footer.size(), file);
+  }
+#endif
+  int err = fclose(file);
+  assert(err == 0);
+  file = nullptr;
+  cv.notify_all();
+
+  auto closed = std::move(on_closed);
+  lk.unlock();
+  if (closed) closed();
+}
+
+void LogWriter::write(void *data, size_t size) {
+  const uint8_t *src = (const uint8_t *)data;
+  const size_t record_size = ring_record_size(size);
+  if (record_size > LOG_RING_SIZE) {
+    // doesn't fit the ring, become the drainer and append it directly
+    while (draining.exchange(true)) {
+      std::this_thread::yield();
+    }
+    // after everything reserved before it, some may still be copying in
+    const uint64_t head = ring_head.load(std::memory_order_relaxed);
+    consume();
+    while (ring_tail.load(std::memory_order_relaxed) < head) {
+      std::this_thread::yield();
+      consume();
+    }
+    append(src, size);
+    draining = false;
+    drain();
+    return;
+  }
+
+  // reserve, with a padding record if it would wrap around the end
+  uint64_t pos = ring_head.load(std::memory_order_relaxed);
+  size_t pad = 0;
+  while (true) {
+    const size_t offset = pos % LOG_RING_SIZE;
+    pad = offset + record_size > LOG_RING_SIZE ? LOG_RING_SIZE - offset : 0;
+    if (pos + pad + record_size - ring_tail.load(std::memory_order_acquire) > LOG_RING_SIZE) {
+      // full, the drainer is waiting on the compressors
+      drain();
+      std::this_thread::yield();
+      pos = ring_head.load(std::memory_order_relaxed);
+      continue;
+    }
+    if (ring_head.compare_exchange_weak(pos, pos + pad + record_size, std::memory_order_relaxed)) break;
+  }
+
+  if (pad > 0) {
+    ring_header(&ring[pos % LOG_RING_SIZE])->store(RING_PAD | pad, std::memory_order_release);
+    pos += pad;
+  }
+  uint8_t *record = &ring[pos % LOG_RING_SIZE];
+  memcpy(record + RING_HEADER_SIZE, src, size);
+  ring_header(record)->store(RING_COMMITTED | size, std::memory_order_release);
+  ring_commits++;
+  drain();
+}
+
+// Moves committed records into the chunk if no other writer is doing it. The
+// flag and the commit count are seq_cst, so a writer that commits while the
+// drainer is leaving either is consumed or sees the flag free and drains
+// itself. Once the flag is free the ring may be reused, so the drainer only
+// looks at the count then
+void LogWriter::drain() {
+  while (!draining.exchange(true)) {
+    const uint64_t commits = ring_commits.load();
+    consume();
+    draining = false;
+    if (ring_commits.load() == commits) break;
+  }
+}
+
+// needs the drainer flag
+void LogWriter::consume() {
+  uint64_t pos = ring_tail.load(std::memory_order_relaxed);
+  while (true) {
+    uint8_t *record = &ring[pos % LOG_RING_SIZE];
+    const uint32_t header = ring_header(record)->load(std::memory_order_acquire);
+    if (header == 0) break;
+
+    const size_t size = header & RING_SIZE_MASK;
+    const size_t record_size = (header & RING_PAD) ? size : ring_record_size(size);
+    if (header & RING_COMMITTED) {
+      append(record + RING_HEADER_SIZE, size);
+    }
+    ring_header(record)->store(0, std::memory_order_relaxed);
+    memset(record + RING_HEADER_SIZE, 0, record_size - RING_HEADER_SIZE);
+    pos += record_size;
+    ring_tail.store(pos, std::memory_order_release);
+  }
+}
+
+// needs the drainer flag
+void LogWriter::append(const uint8_t *src, size_t size) {
+  if (compression == LogCompression::ZSTD) {
+    // blocks are whole messages, so each can be decoded on its own
+    if (!cur->input.empty() && cur->input.size() + size > LOG_CHUNK_SIZE) {
+      submit();
+    }
+    cur->input.insert(cur->input.end(), src, src + size);
+    if (cur->input.size() >= LOG_CHUNK_SIZE) {
+      submit();
+    }
+    return;
+  }
+
+  while (size > 0) {
+    const size_t n = std::min(size, LOG_CHUNK_SIZE - cur->input.size());
+    cur->input.insert(cur->input.end(), src, src + n);
+    src += n;
+    size -= n;
+    if (cur->input.size() == LOG_CHUNK_SIZE) {
+      submit();
+    }
+  }
+}
+
+void LogWriter::submit() {
+  Chunk *chunk = cur.get();
+  {
+    std::unique_lock lk(lock);
+    // the compressors are behind, hold up the writer rather than buffering more
+    cv.wait(lk, [&]() { return pending.size() < LOG_MAX_PENDING_CHUNKS; });
+    pending.push_back(std::move(cur));
+
+    if (!free_chunks.empty()) {
+      cur = std::move(free_chunks.back());
+      free_chunks.pop_back();
+    } else {
+      cur = std::make_unique<Chunk>();
+      cur->input.reserve(LOG_CHUNK_SIZE);
+    }
+  }
+  submitted = true;
+
+  CompressPool::instance().run([this, chunk]() { compress(chunk); });
+}
+
+void LogWriter::compress(Chunk *chunk) {
+  int ret = 0;
+  if (compression == LogCompression::BZ2) {
+    // bzip2's worst case, 1% plus 600 bytes
+    unsigned int size = chunk->input.size() + chunk->input.size() / 100 + 600;
+    chunk->output.resize(size);
+    ret = BZ2_bzBuffToBuffCompress((char *)chunk->output.data(), &size, (char *)chunk->input.data(),
+                                   chunk->input.size(), LOG_BZ2_LEVEL, 0, 30);
+    chunk->output.resize(ret == BZ_OK ? size : 0);
+  } else {
+#ifdef USE_ZSTD
+    chunk->output.resize(ZSTD_compressBound(chunk->input.size()));
+    size_t size = ZSTD_compress(chunk->output.data(), chunk->output.size(), chunk->input.data(),
+                                chunk->input.size(), LOG_ZSTD_LEVEL);
+    ret = ZSTD_isError(size) ? -1 : 0;
+    chunk->output.resize(ZSTD_isError(size) ? 0 : size);
+    chunk->index = log_index_block(chunk->input.data(), chunk->input.size());
+#endif
+  }
+
+  std::unique_lock lk(lock);
+  if (ret != 0 && !error_logged) {
+    LOGE("log compression error %d", ret);
+    error_logged = true;
+  }
+  chunk->done = true;
+
+  // the chunks ahead of this one may still be compressing
+  while (!pending.empty() && pending.front()->done) {
+    auto &head = pending.front();
+    if (fwrite(head->output.data(), 1, head->output.size(), file) != head->output.size() && !error_logged) {
+      LOGE("log write error %d", errno);
+      error_logged = true;
+    }
+    if (compression == LogCompression::ZSTD) {
+      LogBlockIndex &block = blocks.emplace_back(std::move(head->index));
+      block.offset = file_offset;
+      block.compressed_size = head->output.size();
+    }
+    file_offset += head->output.size();
+
+    head->input.clear();
+    head->done = false;
+    free_chunks.push_back(std::move(head));
+    pending.pop_front();
+  }
+  cv.notify_all();
+
+  if (closing && pending.empty()) {
+    finish(lk);
+  }
+}
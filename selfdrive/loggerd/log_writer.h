@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <capnp/common.h>
+#include <kj/array.h>
+
+#include "selfdrive/loggerd/seekable_log.h"
+
+#define LOG_CHUNK_SIZE (1024 * 1024)
+// chunks a file may have queued before write() waits for the compressors
+#define LOG_MAX_PENDING_CHUNKS 8
+#define LOG_BZ2_LEVEL 9
+#define LOG_ZSTD_LEVEL 10
+// writes are queued here until a writer gets to move them into the chunk,
+// bigger ones skip it. A power of two
+#define LOG_RING_SIZE (1024 * 1024)
+
+enum class LogCompression {
+  BZ2,
+  // seekable, zstd frames with an index, see seekable_log.h
+  ZSTD,
+};
+
+// "bz2" or "zst"
+const char *log_extension(LogCompression compression);
+
+// Writes a compressed log without compressing on the caller's thread.
+// write() only copies into a LOG_CHUNK_SIZE chunk. Full chunks are compressed
+// in parallel on a worker pool shared by all files, each into a stream of its
+// own, and are written out in order as they finish. For bz2 the file is a
+// sequence of bz2 streams, which bzip2 and python's bz2.decompress decode
+// like a single one. For zstd chunks end on message boundaries and are
+// indexed, so the log can be read a block at a time with SeekableLogReader.
+//
+// write() is safe to call from several threads and takes no lock: a write
+// reserves its place in a lock-free ring, copies itself in and marks itself
+// committed. Whichever writer then finds the drainer flag free moves the
+// committed writes, in ring order, into the chunk; the others return right
+// away. Writes from one thread stay in order.
+class LogWriter {
+ public:
+  LogWriter(const char *path, LogCompression compression = LogCompression::BZ2);
+  // waits for the compressors to close the file, if close() didn't already
+  ~LogWriter();
+
+  // Closes the file without waiting: once the last chunk is written the
+  // compressor that wrote it closes the file and calls closed, from which the
+  // writer may be deleted. Nothing may be written after
+  void close(std::function<void()> closed);
+
+  // with ZSTD, data must be whole messages
+  void write(void *data, size_t size);
+  inline void write(kj::ArrayPtr<capnp::byte> array) { write(array.begin(), array.size()); }
+
+ private:
+  struct Chunk {
+    std::vector<uint8_t> input, output;
+    LogBlockIndex index;
+    bool done = false;
+  };
+
+  void drain();
+  void consume();
+  void append(const uint8_t *src, size_t size);
+  void submit();
+  void compress(Chunk *chunk);
+  void finish(std::unique_lock<std::mutex> &lk);
+
+  FILE *file = nullptr;
+  const LogCompression compression;
+  bool error_logged = false;
+  bool submitted = false;
+  std::unique_ptr<Chunk> cur; // only touched by the drainer
+
+  // records: u32 size and flags, u32 unused, data padded to 8 bytes. The
+  // drainer zeroes what it consumed, so a zero header is one not committed yet
+  std::unique_ptr<uint8_t[]> ring;
+  alignas(64) std::atomic<uint64_t> ring_head = 0; // reserved up to
+  alignas(64) std::atomic<uint64_t> ring_tail = 0; // consumed up to
+  std::atomic<uint64_t> ring_commits = 0; // records committed so far
+  std::atomic<bool> draining = false;
+
+  std::mutex lock;
+  std::condition_variable cv;
+  std::deque<std::unique_ptr<Chunk>> pending; // file order
+  std::vector<std::unique_ptr<Chunk>> free_chunks;
+  bool closing = false;
+  std::function<void()> on_closed;
+  uint64_t file_offset = 0;
+  std::vector<LogBlockIndex> blocks;
+};
@@ -149,6 +149,12 @@ void logger_init(LoggerState *s, const char* log_name, bool has_qlog) {
 
   s->part = -1;
   s->has_qlog = has_qlog;
+  s->compression = LogCompression::BZ2;
+#ifdef USE_ZSTD
+  if (getenv("LOGGERD_ZSTD")) {
+    s->compression = LogCompression::ZSTD;
+  }
+#endif
   s->route_name = logger_get_route_name();
   snprintf(s->log_name, sizeof(s->log_name), "%s", log_name);
   s->init_data = logger_build_init_data();
@@ -159,7 +165,7 @@ static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
 
   LoggerHandle *h = NULL;
   for (int i=0; i<LOGGER_MAX_HANDLES; i++) {
-    if (s->handles[i].refcnt == 0) {
+    if (!s->handles[i].open.load(std::memory_order_acquire)) {
       h = &s->handles[i];
       break;
     }
@@ -169,8 +175,9 @@ static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
   snprintf(h->segment_path, sizeof(h->segment_path),
           "%s/%s--%d", root_path, s->route_name.c_str(), s->part);
 
-  snprintf(h->log_path, sizeof(h->log_path), "%s/%s.bz2", h->segment_path, s->log_name);
-  snprintf(h->qlog_path, sizeof(h->qlog_path), "%s/qlog.bz2", h->segment_path);
+  const char *ext = log_extension(s->compression);
+  snprintf(h->log_path, sizeof(h->log_path), "%s/%s.%s", h->segment_path, s->log_name, ext);
+  snprintf(h->qlog_path, sizeof(h->qlog_path), "%s/qlog.%s", h->segment_path, ext);
   snprintf(h->lock_path, sizeof(h->lock_path), "%s.lock", h->log_path);
 
   err = logger_mkpath(h->log_path);
@@ -180,13 +187,13 @@ static LoggerHandle* logger_open(LoggerState *s, const char* root_path) {
   if (lock_file == NULL) return NULL;
   fclose(lock_file);
 
-  h->log = std::make_unique<BZFile>(h->log_path);
+  h->log = std::make_unique<LogWriter>(h->log_path, s->compression);
   if (s->has_qlog) {
-    h->q_log = std::make_unique<BZFile>(h->qlog_path);
+    h->q_log = std::make_unique<LogWriter>(h->qlog_path, s->compression);
   }
 
-  pthread_mutex_init(&h->lock, NULL);
-  h->refcnt++;
+  h->open = true;
+  h->refcnt.store(1, std::memory_order_release);
   return h;
 }
 
@@ -205,10 +212,10 @@ int logger_next(LoggerState *s, const char* root_path,
     return -1;
   }
 
-  if (s->cur_handle) {
-    lh_close(s->cur_handle);
+  LoggerHandle* prev_h = s->cur_handle.exchange(next_h);
+  if (prev_h) {
+    lh_close(prev_h);
   }
-  s->cur_handle = next_h;
 
   if (out_segment_path) {
     snprintf(out_segment_path, out_segment_path_len, "%s", next_h->segment_path);
@@ -226,23 +233,27 @@ int logger_next(LoggerState *s, const char* root_path,
 }
 
 LoggerHandle* logger_get_handle(LoggerState *s) {
-  pthread_mutex_lock(&s->lock);
-  LoggerHandle* h = s->cur_handle;
-  if (h) {
-    pthread_mutex_lock(&h->lock);
-    h->refcnt++;
-    pthread_mutex_unlock(&h->lock);
+  while (true) {
+    LoggerHandle* h = s->cur_handle.load();
+    if (!h) return NULL;
+
+    // a reference only while it's still open
+    int refcnt = h->refcnt.load(std::memory_order_relaxed);
+    while (refcnt > 0 && !h->refcnt.compare_exchange_weak(refcnt, refcnt + 1, std::memory_order_acquire)) {}
+    if (refcnt > 0) {
+      // the slot may have been rotated out and reused by a handle that isn't current yet
+      if (s->cur_handle.load() == h) return h;
+      lh_close(h);
+    }
   }
-  pthread_mutex_unlock(&s->lock);
-  return h;
 }
 
 void logger_log(LoggerState *s, uint8_t* data, size_t data_size, bool in_qlog) {
-  pthread_mutex_lock(&s->lock);
-  if (s->cur_handle) {
-    lh_log(s->cur_handle, data, data_size, in_qlog);
+  LoggerHandle* h = logger_get_handle(s);
+  if (h) {
+    lh_log(h, data, data_size, in_qlog);
+    lh_close(h);
   }
-  pthread_mutex_unlock(&s->lock);
 }
 
 void logger_close(LoggerState *s, ExitHandler *exit_handler) {
@@ -250,33 +261,47 @@ void logger_close(LoggerState *s, ExitHandler *exit_handler) {
   log_sentinel(s, cereal::Sentinel::SentinelType::END_OF_ROUTE, signal);
 
   pthread_mutex_lock(&s->lock);
-  if (s->cur_handle) {
-    lh_close(s->cur_handle);
+  LoggerHandle* h = s->cur_handle.exchange(NULL);
+  if (h) {
+    lh_close(h);
   }
   pthread_mutex_unlock(&s->lock);
+
+  // wait for the files to be finished
+  for (auto &handle : s->handles) {
+    while (handle.open.load(std::memory_order_acquire)) {
+      util::sleep_for(1);
+    }
+  }
 }
 
 void lh_log(LoggerHandle* h, uint8_t* data, size_t data_size, bool in_qlog) {
-  pthread_mutex_lock(&h->lock);
   assert(h->refcnt > 0);
   h->log->write(data, data_size);
   if (in_qlog && h->q_log) {
     h->q_log->write(data, data_size);
   }
-  pthread_mutex_unlock(&h->lock);
 }
 
 void lh_close(LoggerHandle* h) {
-  pthread_mutex_lock(&h->lock);
-  assert(h->refcnt > 0);
-  h->refcnt--;
-  if (h->refcnt == 0) {
-    h->log.reset(nullptr);
-    h->q_log.reset(nullptr);
-    unlink(h->lock_path);
-    pthread_mutex_unlock(&h->lock);
-    pthread_mutex_destroy(&h->lock);
-    return;
+  int refcnt = h->refcnt.fetch_sub(1, std::memory_order_acq_rel);
+  assert(refcnt > 0);
+  if (refcnt == 1) {
+    // the last chunks are still compressing, whoever drops the last reference
+    // is logging, so the compressors finish the files. The last one to close
+    // removes the lock file and frees the slot
+    h->writers_open = h->q_log ? 2 : 1;
+    auto closed = [h]() {
+      if (h->writers_open.fetch_sub(1) == 1) {
+        h->log.reset(nullptr);
+        h->q_log.reset(nullptr);
+        unlink(h->lock_path);
+        h->open.store(false, std::memory_order_release);
+      }
+    };
+    h->log->close(closed);
+    if (h->q_log) {
+      h->q_log->close(closed);
+    }
   }
-  pthread_mutex_unlock(&h->lock);
 }
@@ -3,17 +3,18 @@
 #include <cassert>
 #include <pthread.h>
 
+#include <atomic>
 #include <cstdint>
 #include <cstdio>
 #include <memory>
 
-#include <bzlib.h>
 #include <capnp/serialize.h>
 #include <kj/array.h>
 
 #include "selfdrive/common/util.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/hardware/hw.h"
+#include "selfdrive/loggerd/log_writer.h"
 
 const std::string DEFAULT_LOG_ROOT =
     Hardware::PC() ? util::getenv_default("HOME", "/.comma/media/0/realdata", "/data/media/0/realdata")
@@ -23,60 +24,32 @@ const std::string LOG_ROOT = util::getenv_default("LOG_ROOT", "", DEFAULT_LOG_RO
 
 #define LOGGER_MAX_HANDLES 16
 
-class BZFile {
- public:
-  BZFile(const char* path) {
-    file = fopen(path, "wb");
-    assert(file != nullptr);
-    int bzerror;
-    bz_file = BZ2_bzWriteOpen(&bzerror, file, 9, 0, 30);
-    assert(bzerror == BZ_OK);
-  }
-  ~BZFile() {
-    int bzerror;
-    BZ2_bzWriteClose(&bzerror, bz_file, 0, nullptr, nullptr);
-    if (bzerror != BZ_OK) {
-      LOGE("BZ2_bzWriteClose error, bzerror=%d", bzerror);
-    }
-    int err = fclose(file);
-    assert(err == 0);
-  }
-  inline void write(void* data, size_t size) {
-    int bzerror;
-    BZ2_bzWrite(&bzerror, bz_file, data, size);
-    if (bzerror != BZ_OK && !error_logged) {
-      LOGE("BZ2_bzWrite error, bzerror=%d", bzerror);
-      error_logged = true;
-    }
-  }
-  inline void write(kj::ArrayPtr<capnp::byte> array) { write(array.begin(), array.size()); }
-
- private:
-  bool error_logged = false;
-  FILE* file = nullptr;
-  BZFILE* bz_file = nullptr;
-};
-
+// A handle is used only while holding a reference. LoggerState holds one on
+// the current handle, logger_get_handle only takes one while the handle is
+// current, and the last lh_close closes it. Logging takes no lock. The files
+// are finished on LogWriter's compressors after that, logger_close waits for them
 typedef struct LoggerHandle {
-  pthread_mutex_t lock;
-  int refcnt;
+  std::atomic<int> refcnt;
+  std::atomic<bool> open; // until the files are closed
+  std::atomic<int> writers_open;
   char segment_path[4096];
   char log_path[4096];
   char qlog_path[4096];
   char lock_path[4096];
-  std::unique_ptr<BZFile> log, q_log;
+  std::unique_ptr<LogWriter> log, q_log;
 } LoggerHandle;
 
 typedef struct LoggerState {
-  pthread_mutex_t lock;
+  pthread_mutex_t lock; // rotation
   int part;
   kj::Array<capnp::word> init_data;
   std::string route_name;
   char log_name[64];
   bool has_qlog;
+  LogCompression compression;
 
   LoggerHandle handles[LOGGER_MAX_HANDLES];
-  LoggerHandle* cur_handle;
+  std::atomic<LoggerHandle*> cur_handle;
 } LoggerState;
 
 int logger_mkpath(char* file_path);
@@ -29,12 +29,12 @@
 
 #include "selfdrive/loggerd/encoder.h"
 #include "selfdrive/loggerd/logger.h"
+#include "selfdrive/loggerd/service_stats.h"
 #if defined(QCOM) || defined(QCOM2)
 #include "selfdrive/loggerd/omx_encoder.h"
-#define Encoder OmxEncoder
 #else
+#include "selfdrive/loggerd/av_encoder.h"
 #include "selfdrive/loggerd/raw_logger.h"
-#define Encoder RawLogger
 #endif
 
 namespace {
@@ -45,6 +45,7 @@ const int MAX_CAM_IDX = Hardware::TICI() ? LOG_CAMERA_ID_ECAMERA : LOG_CAMERA_ID
 const int DCAM_BITRATE = Hardware::TICI() ? MAIN_BITRATE : 2500000;
 
 #define NO_CAMERA_PATIENCE 500 // fall back to time-based rotation if all cameras are dead
+#define STATS_INTERVAL 1000 // ms between loggerdStats
 
 const int SEGMENT_LENGTH = getenv("LOGGERD_TEST") ? atoi(getenv("LOGGERD_SEGMENT_LENGTH")) : 60;
 
@@ -92,6 +93,21 @@ LogCameraInfo cameras_logged[LOG_CAMERA_ID_MAX] = {
   },
 };
 
+VideoEncoder *create_encoder(const LogCameraInfo &info, int width, int height) {
+#if defined(QCOM) || defined(QCOM2)
+  return new OmxEncoder(info.filename, width, height, info.fps, info.bitrate, info.is_h265, info.downscale);
+#else
+  // LOGGERD_RAW: lossless, but much bigger
+  if (!getenv("LOGGERD_RAW")) {
+    if (AvEncoder::available(info.is_h265)) {
+      return new AvEncoder(info.filename, width, height, info.fps, info.bitrate, info.is_h265, info.downscale);
+    }
+    LOGW("%s: %s not available, logging raw frames", info.filename, info.is_h265 ? "libx265" : "libx264");
+  }
+  return new RawLogger(info.filename, width, height, info.fps, info.bitrate, info.is_h265, info.downscale);
+#endif
+}
+
 class RotateState {
 public:
   SubSocket* fpkt_sock;
@@ -168,7 +184,7 @@ void encoder_thread(int cam_idx) {
 
   int cnt = 0;
   LoggerHandle *lh = NULL;
-  std::vector<Encoder *> encoders;
+  std::vector<VideoEncoder *> encoders;
   VisionIpcClient vipc_client = VisionIpcClient("camerad", cam_info.stream_type, false);
 
   while (!do_exit) {
@@ -183,15 +199,12 @@ void encoder_thread(int cam_idx) {
       LOGD("encoder init %dx%d", buf_info.width, buf_info.height);
 
       // main encoder
-      encoders.push_back(new Encoder(cam_info.filename, buf_info.width, buf_info.height,
-                                     cam_info.fps, cam_info.bitrate, cam_info.is_h265, cam_info.downscale));
+      encoders.push_back(create_encoder(cam_info, buf_info.width, buf_info.height));
 
       // qcamera encoder
       if (cam_info.has_qcamera) {
         LogCameraInfo &qcam_info = cameras_logged[LOG_CAMERA_ID_QCAMERA];
-        encoders.push_back(new Encoder(qcam_info.filename,
-                                       qcam_info.frame_width, qcam_info.frame_height,
-                                       qcam_info.fps, qcam_info.bitrate, qcam_info.is_h265, qcam_info.downscale));
+        encoders.push_back(create_encoder(qcam_info, qcam_info.frame_width, qcam_info.frame_height));
       }
     }
 
@@ -199,6 +212,9 @@ void encoder_thread(int cam_idx) {
       VisionIpcBufExtra extra;
       VisionBuf* buf = vipc_client.recv(&extra);
       if (buf == nullptr) {
+        if (extra.dropped) {
+          LOGW("%s: frame %d dropped, overwritten before it was received", cam_info.filename, extra.frame_id);
+        }
         continue;
       }
 
@@ -327,6 +343,7 @@ int main(int argc, char** argv) {
   s.ctx = Context::create();
   Poller * poller = Poller::create();
   std::vector<SubSocket*> socks;
+  ServiceStats service_stats;
 
   // subscribe to all socks
   for (const auto& it : services) {
@@ -336,6 +353,7 @@ int main(int argc, char** argv) {
     assert(sock != NULL);
     poller->registerSocket(sock);
     socks.push_back(sock);
+    service_stats.add(sock, it.name);
 
     for (int cid=0; cid<=MAX_CAM_IDX; cid++) {
       if (std::string(it.name) == cameras_logged[cid].frame_packet_name) {
@@ -345,6 +363,7 @@ int main(int argc, char** argv) {
     qlog_states[sock] = {.counter = 0, .freq = it.decimation};
   }
 
+  PubMaster pm({"loggerdStats"});
   Params params;
 
   // init logger
@@ -375,13 +394,18 @@ int main(int argc, char** argv) {
   double start_ts = seconds_since_boot();
   double last_rotate_tms = millis_since_boot();
   double last_camera_seen_tms = millis_since_boot();
+  double last_stats_tms = millis_since_boot();
   while (!do_exit) {
     // TODO: fix msgs from the first poll getting dropped
-    // poll for new messages on all sockets
-    for (auto sock : poller->poll(1000)) {
+    // poll for new messages on all sockets, drain the ones closest to being lapped first
+    std::vector<SubSocket*> ready = poller->poll(1000);
+    service_stats.prioritize(ready);
+    for (auto sock : ready) {
 
       // drain socket
       Message * last_msg = nullptr;
+      uint32_t sock_msgs = 0;
+      uint64_t sock_bytes = 0;
       while (!do_exit) {
         Message * msg = sock->receive(true);
         if (!msg) {
@@ -396,12 +420,15 @@ int main(int argc, char** argv) {
           qs.counter = (qs.counter + 1) % qs.freq;
         }
 
+        sock_msgs++;
+        sock_bytes += msg->getSize();
         bytes_count += msg->getSize();
         if ((++msg_count % 1000) == 0) {
           double ts = seconds_since_boot();
           LOGD("%lu messages, %.2f msg/sec, %.2f KB/sec", msg_count, msg_count * 1.0 / (ts - start_ts), bytes_count * 0.001 / (ts - start_ts));
         }
       }
+      service_stats.logged(sock, sock_msgs, sock_bytes);
 
       if (last_msg) {
         int fpkt_id = -1;
@@ -430,6 +457,15 @@ int main(int argc, char** argv) {
       delete last_msg;
     }
 
+    // published like any other service, so it's logged too
+    double stats_tms = millis_since_boot();
+    if (stats_tms - last_stats_tms >= STATS_INTERVAL) {
+      MessageBuilder msg;
+      service_stats.fill(msg.initEvent().initLoggerdStats(), (stats_tms - last_stats_tms) / 1000.);
+      pm.send("loggerdStats", msg);
+      last_stats_tms = stats_tms;
+    }
+
     bool new_segment = s.logger.part == -1;
     if (s.logger.part > -1) {
       double tms = millis_since_boot();
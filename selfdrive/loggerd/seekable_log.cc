@@ -0,0 +1,254 @@
+#include "selfdrive/loggerd/seekable_log.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <capnp/schema.h>
+#include <capnp/serialize.h>
+#include <zstd.h>
+
+#define ZSTD_INDEX_MAGIC (ZSTD_SKIPPABLE_MAGIC + 1)
+
+namespace {
+
+void put(std::vector<uint8_t> &out, uint64_t v, int size) {
+  for (int i = 0; i < size; i++) {
+    out.push_back(v >> (i * 8));
+  }
+}
+
+// bounds checked little endian reads
+struct Cursor {
+  const uint8_t *p, *end;
+  bool ok = true;
+
+  uint64_t get(int size) {
+    if (end - p < size) {
+      ok = false;
+      return 0;
+    }
+    uint64_t v = 0;
+    for (int i = 0; i < size; i++) {
+      v |= (uint64_t)p[i] << (i * 8);
+    }
+    p += size;
+    return v;
+  }
+  std::string str(size_t size) {
+    if ((size_t)(end - p) < size) {
+      ok = false;
+      return "";
+    }
+    std::string s((const char *)p, size);
+    p += size;
+    return s;
+  }
+};
+
+// Event union discriminant -> service name
+const std::map<uint16_t, std::string> &service_names() {
+  static const std::map<uint16_t, std::string> names = []() {
+    std::map<uint16_t, std::string> names;
+    for (auto field : capnp::Schema::from<cereal::Event>().getUnionFields()) {
+      names[field.getProto().getDiscriminantValue()] = field.getProto().getName().cStr();
+    }
+    return names;
+  }();
+  return names;
+}
+
+}  // namespace
+
+uint32_t LogBlockIndex::count(uint16_t service) const {
+  for (auto &[s, n] : service_counts) {
+    if (s == service) return n;
+  }
+  return 0;
+}
+
+LogBlockIndex log_index_block(const uint8_t *data, size_t size) {
+  LogBlockIndex block;
+  block.decompressed_size = size;
+
+  std::map<uint16_t, uint32_t> counts;
+  kj::ArrayPtr<const capnp::word> words((const capnp::word *)data, size / sizeof(capnp::word));
+  try {
+    while (words.size() > 0) {
+      capnp::FlatArrayMessageReader reader(words);
+      auto event = reader.getRoot<cereal::Event>();
+      const uint64_t t = event.getLogMonoTime();
+      block.min_mono_time = std::min(block.min_mono_time, t);
+      block.max_mono_time = std::max(block.max_mono_time, t);
+      block.num_messages++;
+      counts[event.which()]++;
+      words = kj::arrayPtr(reader.getEnd(), words.end());
+    }
+  } catch (const kj::Exception &) {
+    // what was indexed so far is still right, the rest isn't findable
+  }
+
+  block.service_counts.assign(counts.begin(), counts.end());
+  return block;
+}
+
+std::vector<uint8_t> log_index_footer(const std::vector<LogBlockIndex> &blocks) {
+  std::map<uint16_t, std::string> services;
+  for (auto &block : blocks) {
+    for (auto &[service, count] : block.service_counts) {
+      auto it = service_names().find(service);
+      services[service] = it != service_names().end() ? it->second : "";
+    }
+  }
+
+  std::vector<uint8_t> index;
+  put(index, LOG_INDEX_VERSION, 4);
+  put(index, services.size(), 4);
+  for (auto &[service, name] : services) {
+    put(index, service, 2);
+    put(index, name.size(), 2);
+    index.insert(index.end(), name.begin(), name.end());
+  }
+  put(index, blocks.size(), 4);
+  for (auto &block : blocks) {
+    put(index, block.offset, 8);
+    put(index, block.compressed_size, 4);
+    put(index, block.decompressed_size, 4);
+    put(index, block.min_mono_time, 8);
+    put(index, block.max_mono_time, 8);
+    put(index, block.num_messages, 4);
+    put(index, block.service_counts.size(), 2);
+    for (auto &[service, count] : block.service_counts) {
+      put(index, service, 2);
+      put(index, count, 4);
+    }
+  }
+
+  std::vector<uint8_t> footer;
+  put(footer, ZSTD_INDEX_MAGIC, 4);
+  put(footer, index.size() + 8, 4);
+  footer.insert(footer.end(), index.begin(), index.end());
+  put(footer, index.size(), 4);
+  put(footer, LOG_INDEX_MAGIC, 4);
+
+  // seek table, without checksums
+  put(footer, ZSTD_SKIPPABLE_MAGIC, 4);
+  put(footer, blocks.size() * 8 + 9, 4);
+  for (auto &block : blocks) {
+    put(footer, block.compressed_size, 4);
+    put(footer, block.decompressed_size, 4);
+  }
+  put(footer, blocks.size(), 4);
+  put(footer, 0, 1);
+  put(footer, ZSTD_SEEKABLE_MAGIC, 4);
+  return footer;
+}
+
+SeekableLogReader::~SeekableLogReader() {
+  if (file) fclose(file);
+}
+
+bool SeekableLogReader::read_at(uint64_t offset, void *data, size_t size) {
+  return fseeko(file, offset, SEEK_SET) == 0 && fread(data, 1, size, file) == size;
+}
+
+bool SeekableLogReader::open(const std::string &path) {
+  if (file) fclose(file);
+  blocks_.clear();
+  services.clear();
+
+  file = fopen(path.c_str(), "rb");
+  if (!file || fseeko(file, 0, SEEK_END) != 0) return false;
+  const uint64_t file_size = ftello(file);
+
+  // seek table footer: frames, descriptor, magic
+  uint8_t buf[9];
+  if (file_size < sizeof(buf) || !read_at(file_size - sizeof(buf), buf, sizeof(buf))) return false;
+  Cursor footer{buf, buf + sizeof(buf)};
+  const uint64_t num_frames = footer.get(4);
+  const int entry_size = (footer.get(1) & 0x80) ? 12 : 8;
+  if (footer.get(4) != ZSTD_SEEKABLE_MAGIC) return false;
+
+  // the index frame ends where the seek table starts
+  const uint64_t seek_table_size = 8 + num_frames * entry_size + 9;
+  if (file_size < seek_table_size + 8) return false;
+  const uint64_t index_end = file_size - seek_table_size;
+  if (!read_at(index_end - 8, buf, 8)) return false;
+  Cursor trailer{buf, buf + 8};
+  const uint64_t index_size = trailer.get(4);
+  if (trailer.get(4) != LOG_INDEX_MAGIC || index_end < index_size + 8) return false;
+
+  std::vector<uint8_t> index(index_size);
+  if (!read_at(index_end - 8 - index_size, index.data(), index_size)) return false;
+  Cursor c{index.data(), index.data() + index.size()};
+  if (c.get(4) != LOG_INDEX_VERSION) return false;
+
+  const uint32_t num_services = c.get(4);
+  for (uint32_t i = 0; i < num_services && c.ok; i++) {
+    const uint16_t service = c.get(2);
+    services[c.str(c.get(2))] = service;
+  }
+
+  const uint32_t num_blocks = c.get(4);
+  for (uint32_t i = 0; i < num_blocks && c.ok; i++) {
+    LogBlockIndex &block = blocks_.emplace_back();
+    block.offset = c.get(8);
+    block.compressed_size = c.get(4);
+    block.decompressed_size = c.get(4);
+    block.min_mono_time = c.get(8);
+    block.max_mono_time = c.get(8);
+    block.num_messages = c.get(4);
+    const uint16_t num_counts = c.get(2);
+    for (uint16_t j = 0; j < num_counts && c.ok; j++) {
+      const uint16_t service = c.get(2);
+      block.service_counts.push_back({service, (uint32_t)c.get(4)});
+    }
+  }
+  return c.ok;
+}
+
+int SeekableLogReader::service(const std::string &name) const {
+  auto it = services.find(name);
+  return it != services.end() ? it->second : -1;
+}
+
+kj::Array<capnp::word> SeekableLogReader::read_block(size_t idx) {
+  const LogBlockIndex &block = blocks_.at(idx);
+  std::vector<uint8_t> compressed(block.compressed_size);
+  if (!read_at(block.offset, compressed.data(), compressed.size())) return nullptr;
+
+  auto words = kj::heapArray<capnp::word>((block.decompressed_size + sizeof(capnp::word) - 1) / sizeof(capnp::word));
+  const size_t size = ZSTD_decompress(words.begin(), block.decompressed_size, compressed.data(), compressed.size());
+  if (ZSTD_isError(size) || size != block.decompressed_size) return nullptr;
+  return words;
+}
+
+size_t SeekableLogReader::read_events(uint64_t start, uint64_t end, const char *service_name,
+                                      std::function<void(cereal::Event::Reader)> fn) {
+  int s = service_name ? service(service_name) : -1;
+  if (service_name && s < 0) return 0;
+
+  size_t decompressed = 0;
+  for (size_t i = 0; i < blocks_.size(); i++) {
+    const LogBlockIndex &block = blocks_[i];
+    if (!block.overlaps(start, end) || (s >= 0 && block.count(s) == 0)) continue;
+
+    kj::Array<capnp::word> data = read_block(i);
+    decompressed++;
+
+    kj::ArrayPtr<const capnp::word> words = data;
+    try {
+      while (words.size() > 0) {
+        capnp::FlatArrayMessageReader reader(words);
+        auto event = reader.getRoot<cereal::Event>();
+        const uint64_t t = event.getLogMonoTime();
+        if ((s < 0 || event.which() == s) && t >= start && t <= end) {
+          fn(event);
+        }
+        words = kj::arrayPtr(reader.getEnd(), words.end());
+      }
+    } catch (const kj::Exception &) {
+      // like the index, the rest of the block isn't readable, go on with the next
+    }
+  }
+  return decompressed;
+}
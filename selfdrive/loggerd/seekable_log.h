@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <kj/array.h>
+
+#include "cereal/gen/cpp/log.capnp.h"
+
+// Seekable logs (LogCompression::ZSTD) are a sequence of zstd frames, one per
+// block of whole messages, followed by two skippable frames:
+//   index frame: magic 0x184D2A5F, size, index, index size, LOG_INDEX_MAGIC
+//   seek table:  zstd's seekable format, contrib/seekable_format in zstd
+// zstd itself skips both, `zstd -d rlog.zst` gives back the plain log.
+//
+// The index, all integers little endian:
+//   u32 version
+//   u32 number of services, then per service: u16 Event union discriminant, u16 name length, name
+//   u32 number of blocks, then per block:
+//     u64 offset of its frame, u32 compressed size, u32 decompressed size,
+//     u64 first and u64 last logMonoTime, u32 messages,
+//     u16 number of services in it, then per service: u16 discriminant, u32 messages
+#define LOG_INDEX_MAGIC 0x58444E49 // "INDX"
+#define LOG_INDEX_VERSION 1
+#define ZSTD_SKIPPABLE_MAGIC 0x184D2A5E
+#define ZSTD_SEEKABLE_MAGIC 0x8F92EAB1
+
+struct LogBlockIndex {
+  uint64_t offset = 0;
+  uint32_t compressed_size = 0, decompressed_size = 0;
+  uint64_t min_mono_time = UINT64_MAX, max_mono_time = 0;
+  uint32_t num_messages = 0;
+  std::vector<std::pair<uint16_t, uint32_t>> service_counts; // discriminant, messages
+
+  bool overlaps(uint64_t start, uint64_t end) const { return num_messages > 0 && min_mono_time <= end && max_mono_time >= start; }
+  uint32_t count(uint16_t service) const;
+};
+
+// indexes a block of serialized Events, the block must be word aligned
+LogBlockIndex log_index_block(const uint8_t *data, size_t size);
+// the index and seek table frames that end a seekable log
+std::vector<uint8_t> log_index_footer(const std::vector<LogBlockIndex> &blocks);
+
+// Reads seekable logs a block at a time, only the blocks that are asked for
+// are read and decompressed
+class SeekableLogReader {
+ public:
+  ~SeekableLogReader();
+  // false if path isn't a seekable log
+  bool open(const std::string &path);
+
+  const std::vector<LogBlockIndex> &blocks() const { return blocks_; }
+  // the Event union discriminant of a service, -1 if the log has none of it
+  int service(const std::string &name) const;
+
+  // decompressed block, empty on read errors
+  kj::Array<capnp::word> read_block(size_t idx);
+
+  // calls fn for the messages of service (nullptr for all) with start <= logMonoTime <= end,
+  // in log order. A block stops at the first message that doesn't parse.
+  // Returns how many blocks were decompressed for it
+  size_t read_events(uint64_t start, uint64_t end, const char *service, std::function<void(cereal::Event::Reader)> fn);
+
+ private:
+  bool read_at(uint64_t offset, void *data, size_t size);
+
+  FILE *file = nullptr;
+  std::vector<LogBlockIndex> blocks_;
+  std::map<std::string, uint16_t> services;
+};
@@ -0,0 +1,51 @@
+#include "selfdrive/loggerd/service_stats.h"
+
+#include <algorithm>
+
+void ServiceStats::add(SubSocket *sock, const std::string &name) {
+  socks.push_back(sock);
+  services[sock] = {.name = name, .lapped = sock->lapped()};
+}
+
+void ServiceStats::prioritize(std::vector<SubSocket *> &ready) {
+  for (auto sock : ready) {
+    Service &s = services.at(sock);
+    const size_t size = sock->bufferSize();
+    s.lag = size > 0 ? std::min(1.0, (double)sock->lag() / size) : 0;
+    s.max_lag = std::max(s.max_lag, s.lag);
+  }
+  std::stable_sort(ready.begin(), ready.end(), [&](SubSocket *a, SubSocket *b) {
+    return services.at(a).lag > services.at(b).lag;
+  });
+}
+
+void ServiceStats::logged(SubSocket *sock, uint32_t messages, uint64_t bytes) {
+  Service &s = services.at(sock);
+  s.messages += messages;
+  s.bytes += bytes;
+}
+
+void ServiceStats::fill(cereal::LoggerdStats::Builder stats, double seconds) {
+  auto lservices = stats.initServices(socks.size());
+  for (size_t i = 0; i < socks.size(); i++) {
+    Service &s = services.at(socks[i]);
+    const uint64_t lapped = socks[i]->lapped();
+    if (lapped != s.lapped) {
+      // the lap was caught up on before it could be sampled
+      s.max_lag = 1;
+    }
+
+    auto l = lservices[i];
+    l.setName(s.name);
+    l.setLag(s.lag);
+    l.setMaxLag(s.max_lag);
+    l.setLapped(lapped - s.lapped);
+    l.setMessages(s.messages);
+    l.setBytesPerSecond(seconds > 0 ? s.bytes / seconds : 0);
+
+    s.max_lag = 0;
+    s.lapped = lapped;
+    s.messages = 0;
+    s.bytes = 0;
+  }
+}
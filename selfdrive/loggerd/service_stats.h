@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "cereal/messaging/messaging.h"
+
+// How loggerd keeps up with each service: how far behind the publisher its
+// queue is when drained, how often the publisher lapped it (messages that
+// never made it into the log) and what was logged. Also decides the drain
+// order, the queues closest to being lapped go first.
+class ServiceStats {
+ public:
+  void add(SubSocket *sock, const std::string &name);
+
+  // samples the lag of the ready sockets and sorts them most behind first
+  void prioritize(std::vector<SubSocket *> &socks);
+  // after draining sock
+  void logged(SubSocket *sock, uint32_t messages, uint64_t bytes);
+
+  // everything since the last call, seconds is the time since then
+  void fill(cereal::LoggerdStats::Builder stats, double seconds);
+
+ private:
+  struct Service {
+    std::string name;
+    float lag = 0, max_lag = 0;
+    uint64_t lapped = 0; // the socket's count at the last fill
+    uint32_t messages = 0;
+    uint64_t bytes = 0;
+  };
+
+  std::vector<SubSocket *> socks; // in the order they were added
+  std::map<SubSocket *, Service> services;
+};
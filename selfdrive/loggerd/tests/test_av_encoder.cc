@@ -0,0 +1,110 @@
+#include <sys/stat.h>
+
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+extern "C" {
+#include <libavformat/avformat.h>
+}
+
+#include "catch2/catch.hpp"
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/av_encoder.h"
+
+static int count_frames(const std::string &path) {
+  AVFormatContext *ctx = NULL;
+  REQUIRE(avformat_open_input(&ctx, path.c_str(), NULL, NULL) == 0);
+  REQUIRE(avformat_find_stream_info(ctx, NULL) >= 0);
+  REQUIRE(ctx->nb_streams == 1);
+
+  int frames = 0;
+  AVPacket *pkt = av_packet_alloc();
+  while (av_read_frame(ctx, pkt) == 0) {
+    frames++;
+    av_packet_unref(pkt);
+  }
+  av_packet_free(&pkt);
+  avformat_close_input(&ctx);
+  return frames;
+}
+
+// loggerd logs raw frames without the codecs, so their tests are skipped
+static bool available(bool h265) {
+  const bool ok = AvEncoder::available(h265);
+  if (!ok) WARN((h265 ? "libx265" : "libx264") << " not available, skipping");
+  return ok;
+}
+
+TEST_CASE("AvEncoder rotates between segments") {
+  if (!available(true) || !available(false)) return;
+
+  const int width = 320, height = 240, num_frames = 30;
+  char root[] = "/tmp/test_av_encoder_XXXXXX";
+  REQUIRE(mkdtemp(root) != nullptr);
+
+  std::vector<uint8_t> yuv(width * height * 3 / 2);
+  const uint8_t *y = yuv.data(), *u = y + width * height, *v = u + width * height / 4;
+
+  {
+    AvEncoder road("fcamera.hevc", width, height, 20, 1000000, true, false);
+    AvEncoder qcam("qcamera.ts", width / 2, height / 2, 20, 256000, false, true);
+    for (int seg = 0; seg < 2; seg++) {
+      const std::string path = util::string_format("%s/%d", root, seg);
+      REQUIRE(mkdir(path.c_str(), 0777) == 0);
+      road.encoder_open(path.c_str());
+      qcam.encoder_open(path.c_str());
+      REQUIRE(util::file_exists(path + "/fcamera.hevc.lock"));
+
+      for (int i = 0; i < num_frames; i++) {
+        for (size_t j = 0; j < yuv.size(); j++) {
+          yuv[j] = (j + i * 4) & 0xFF;
+        }
+        for (AvEncoder *e : {&road, &qcam}) {
+          // only full when the worker is behind, the frame wasn't taken
+          int id;
+          while ((id = e->encode_frame(y, u, v, width, height, i * 50000000ULL)) == -1) {
+            util::sleep_for(1);
+          }
+          REQUIRE(id == i);
+        }
+      }
+      road.encoder_close();
+      qcam.encoder_close();
+    }
+  }
+
+  for (int seg = 0; seg < 2; seg++) {
+    const std::string path = util::string_format("%s/%d", root, seg);
+    REQUIRE(count_frames(path + "/fcamera.hevc") == num_frames);
+    REQUIRE(count_frames(path + "/qcamera.ts") == num_frames);
+    REQUIRE(!util::file_exists(path + "/fcamera.hevc.lock"));
+    REQUIRE(!util::file_exists(path + "/qcamera.ts.lock"));
+  }
+  REQUIRE(system((std::string("rm -rf ") + root).c_str()) == 0);
+}
+
+TEST_CASE("AvEncoder drops the segment when the encoder doesn't open") {
+  if (!available(false)) return;
+
+  // x264 only takes even sizes
+  const int width = 321, height = 241;
+  char root[] = "/tmp/test_av_encoder_XXXXXX";
+  REQUIRE(mkdtemp(root) != nullptr);
+
+  std::vector<uint8_t> yuv(width * height * 3 / 2);
+  const uint8_t *y = yuv.data(), *u = y + width * height, *v = u + width * height / 4;
+  {
+    AvEncoder e("qcamera.ts", width, height, 20, 256000, false, false);
+    e.encoder_open(root);
+    for (int i = 0; i < 5; i++) {
+      while (e.encode_frame(y, u, v, width, height, i * 50000000ULL) == -1) {
+        util::sleep_for(1);
+      }
+    }
+    e.encoder_close();
+  }
+  REQUIRE(!util::file_exists(std::string(root) + "/qcamera.ts"));
+  REQUIRE(!util::file_exists(std::string(root) + "/qcamera.ts.lock"));
+  REQUIRE(system((std::string("rm -rf ") + root).c_str()) == 0);
+}
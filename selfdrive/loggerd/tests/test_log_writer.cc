@@ -0,0 +1,226 @@
+#include <sys/resource.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <bzlib.h>
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "catch2/catch.hpp"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/log_writer.h"
+
+// compressible like a log: repeated records with a few changing fields
+static std::string make_log(size_t size) {
+  std::mt19937 rng(42);
+  std::string log;
+  uint64_t t = 0;
+  while (log.size() < size) {
+    char record[96];
+    int n = snprintf(record, sizeof(record), "logMonoTime %llu can %u %08x %08x\n", (unsigned long long)t,
+                     (unsigned)(rng() % 64), (unsigned)rng() & 0xFF00FF, (unsigned)(rng() % 16));
+    log.append(record, n);
+    t += 10000000 + rng() % 1000;
+  }
+  log.resize(size);
+  return log;
+}
+
+std::string decompress_bz2(const std::string &compressed) {
+  std::string out;
+  bz_stream strm = {};
+  REQUIRE(BZ2_bzDecompressInit(&strm, 0, 0) == BZ_OK);
+  strm.next_in = (char *)compressed.data();
+  strm.avail_in = compressed.size();
+
+  char buf[64 * 1024];
+  while (true) {
+    strm.next_out = buf;
+    strm.avail_out = sizeof(buf);
+    int ret = BZ2_bzDecompress(&strm);
+    REQUIRE((ret == BZ_OK || ret == BZ_STREAM_END));
+    out.append(buf, sizeof(buf) - strm.avail_out);
+
+    if (ret == BZ_STREAM_END) {
+      // the next stream starts right after
+      if (strm.avail_in == 0) break;
+      char *next_in = strm.next_in;
+      unsigned int avail_in = strm.avail_in;
+      BZ2_bzDecompressEnd(&strm);
+      REQUIRE(BZ2_bzDecompressInit(&strm, 0, 0) == BZ_OK);
+      strm.next_in = next_in;
+      strm.avail_in = avail_in;
+    }
+  }
+  BZ2_bzDecompressEnd(&strm);
+  return out;
+}
+
+static std::string write_log(const std::string &path, const std::string &log, LogCompression compression) {
+  {
+    LogWriter writer(path.c_str(), compression);
+    // odd sized writes, so they straddle the chunks
+    for (size_t pos = 0; pos < log.size(); pos += 12345) {
+      writer.write((void *)&log[pos], std::min<size_t>(12345, log.size() - pos));
+    }
+  }
+  std::string compressed = util::read_file(path);
+  remove(path.c_str());
+  return compressed;
+}
+
+TEST_CASE("LogWriter bz2 round trip") {
+  const size_t size = GENERATE(0, 1000, LOG_CHUNK_SIZE, 5 * LOG_CHUNK_SIZE + 777);
+  const std::string log = make_log(size);
+  const std::string compressed = write_log("/tmp/test_log_writer.bz2", log, LogCompression::BZ2);
+
+  REQUIRE(compressed.size() > 0);
+  REQUIRE(compressed.size() < std::max<size_t>(log.size(), 100));
+  REQUIRE(decompress_bz2(compressed) == log);
+}
+
+TEST_CASE("LogWriter::close finishes the file on the compressors") {
+  const size_t size = GENERATE(0, 3 * LOG_CHUNK_SIZE + 777);
+  const std::string path = "/tmp/test_log_writer_close.bz2";
+  const std::string log = make_log(size);
+
+  std::mutex lock;
+  std::condition_variable cv;
+  bool closed = false;
+  LogWriter *writer = new LogWriter(path.c_str(), LogCompression::BZ2);
+  writer->write((void *)log.data(), log.size());
+  writer->close([&]() {
+    // like logger.cc, the writer is freed from here
+    delete writer;
+    std::lock_guard lk(lock);
+    closed = true;
+    cv.notify_one();
+  });
+  {
+    std::unique_lock lk(lock);
+    REQUIRE(cv.wait_for(lk, std::chrono::seconds(30), [&]() { return closed; }));
+  }
+
+  REQUIRE(decompress_bz2(util::read_file(path)) == log);
+  remove(path.c_str());
+}
+
+TEST_CASE("LogWriter writes from several threads") {
+  const int num_threads = 4, num_writes = 20000;
+  const std::string path = "/tmp/test_log_writer_threads.bz2";
+  {
+    LogWriter writer(path.c_str(), LogCompression::BZ2);
+    std::vector<std::thread> threads;
+    for (int t = 0; t < num_threads; t++) {
+      threads.emplace_back([&writer, t]() {
+        std::vector<uint32_t> record;
+        for (int i = 0; i < num_writes; i++) {
+          // thread, number, size, then filler of all sizes. Now and then one too big for the ring
+          const uint32_t size = (t == 0 && i % 5000 == 4999) ? LOG_RING_SIZE : (i * 7 + t) % 301;
+          record.assign(3 + size / 4, t);
+          record[1] = i;
+          record[2] = size / 4;
+          writer.write(record.data(), record.size() * sizeof(uint32_t));
+        }
+      });
+    }
+    for (auto &t : threads) t.join();
+  }
+
+  const std::string log = decompress_bz2(util::read_file(path));
+  remove(path.c_str());
+  std::vector<uint32_t> next(num_threads);
+  size_t pos = 0;
+  while (pos < log.size()) {
+    uint32_t header[3];
+    REQUIRE(pos + sizeof(header) <= log.size());
+    memcpy(header, &log[pos], sizeof(header));
+    REQUIRE(header[0] < num_threads);
+    REQUIRE(header[1] == next[header[0]]++);
+    pos += sizeof(header) + header[2] * sizeof(uint32_t);
+  }
+  REQUIRE(pos == log.size());
+  for (auto n : next) {
+    REQUIRE(n == num_writes);
+  }
+}
+
+#ifdef USE_ZSTD
+static uint32_t read_u32(const std::string &s, size_t pos) {
+  return (uint8_t)s[pos] | ((uint8_t)s[pos + 1] << 8) | ((uint8_t)s[pos + 2] << 16) | ((uint32_t)(uint8_t)s[pos + 3] << 24);
+}
+
+TEST_CASE("LogWriter zstd round trip and seek table") {
+  const size_t size = GENERATE(0, 1000, 3 * LOG_CHUNK_SIZE + 777);
+  const std::string log = make_log(size);
+  const std::string compressed = write_log("/tmp/test_log_writer.zst", log, LogCompression::ZSTD);
+
+  // plain zstd decodes it, the seek table is skipped
+  std::string out(size, '\0');
+  REQUIRE(ZSTD_decompress(out.data(), out.size(), compressed.data(), compressed.size()) == size);
+  REQUIRE(out == log);
+
+  // footer: number of frames, descriptor, seekable magic. Blocks end on write boundaries
+  REQUIRE(read_u32(compressed, compressed.size() - 4) == 0x8F92EAB1);
+  const uint32_t num_frames = read_u32(compressed, compressed.size() - 9);
+  const size_t block_size = LOG_CHUNK_SIZE / 12345 * 12345;
+  REQUIRE(num_frames == std::max<size_t>(1, (size + block_size - 1) / block_size));
+
+  // the entries add up to the file and the log, the index frame is in between
+  const size_t table_start = compressed.size() - 9 - num_frames * 8;
+  REQUIRE(read_u32(compressed, table_start - 8) == 0x184D2A5E);
+  REQUIRE(read_u32(compressed, table_start - 12) == LOG_INDEX_MAGIC);
+  const size_t index_frame_size = read_u32(compressed, table_start - 16) + 16;
+  size_t compressed_total = 0, decompressed_total = 0;
+  for (uint32_t i = 0; i < num_frames; i++) {
+    compressed_total += read_u32(compressed, table_start + i * 8);
+    decompressed_total += read_u32(compressed, table_start + i * 8 + 4);
+  }
+  REQUIRE(compressed_total + index_frame_size == table_start - 8);
+  REQUIRE(decompressed_total == size);
+}
+#endif
+
+static double cpu_time() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+}
+
+// LOGGER_BENCHMARK_RLOG: an uncompressed rlog to compress, a synthetic one otherwise
+TEST_CASE("LogWriter throughput", "[.][benchmark]") {
+  const char *rlog = getenv("LOGGER_BENCHMARK_RLOG");
+  const std::string log = rlog ? util::read_file(rlog) : make_log(32 * LOG_CHUNK_SIZE);
+  REQUIRE(log.size() > 0);
+  const double mb = log.size() / 1e6;
+
+  auto report = [&](const char *name, auto fn) {
+    const double cpu_start = cpu_time(), start = millis_since_boot();
+    const size_t compressed_size = fn();
+    const double cpu = cpu_time() - cpu_start, elapsed = millis_since_boot() - start;
+    printf("%-14s %7.1f MB/s %7.1f ms cpu/MB  ratio %.2f\n", name, mb / elapsed * 1e3, cpu * 1e3 / mb,
+           (double)log.size() / compressed_size);
+  };
+
+  // what BZFile did, on the logging thread
+  report("bz2 inline", [&]() {
+    unsigned int size = log.size() + log.size() / 100 + 600;
+    std::vector<char> out(size);
+    REQUIRE(BZ2_bzBuffToBuffCompress(out.data(), &size, (char *)log.data(), log.size(), 9, 0, 30) == BZ_OK);
+    return (size_t)size;
+  });
+  report("LogWriter bz2", [&]() { return write_log("/tmp/bench_log_writer.bz2", log, LogCompression::BZ2).size(); });
+#ifdef USE_ZSTD
+  report("LogWriter zstd", [&]() { return write_log("/tmp/bench_log_writer.zst", log, LogCompression::ZSTD).size(); });
+#endif
+}
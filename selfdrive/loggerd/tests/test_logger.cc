@@ -0,0 +1,139 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/loggerd/logger.h"
+
+// test_log_writer.cc
+std::string decompress_bz2(const std::string &compressed);
+
+const int ENCODER_THREADS = 3;
+
+struct LoggerRun {
+  std::string root;
+  int segments = 0;
+  std::string route_name;
+  double main_ms = 0, encoder_ms = 0; // logging, not counting the close
+};
+
+// The main loop logs clocks and rotates, the encoder threads log their encode
+// index on a handle they swap for the current one now and then, like loggerd
+static LoggerRun run_logger(int main_messages, int encoder_threads, int encoder_messages, int rotate_every) {
+  char root[] = "/tmp/test_logger_XXXXXX";
+  REQUIRE(mkdtemp(root) != nullptr);
+
+  static LoggerState logger = {};
+  logger_init(&logger, "rlog", true);
+  REQUIRE(logger_next(&logger, root, nullptr, 0, nullptr) == 0);
+
+  LoggerRun run = {root};
+  std::vector<double> encoder_ms(encoder_threads + 1);
+  std::vector<std::thread> encoders;
+  for (int t = 1; t <= encoder_threads; t++) {
+    encoders.emplace_back([&, t]() {
+      const double start = millis_since_boot();
+      LoggerHandle *lh = nullptr;
+      for (int i = 0; i < encoder_messages; i++) {
+        if (i % 100 == 0) {
+          if (lh) lh_close(lh);
+          lh = logger_get_handle(&logger);
+        }
+        MessageBuilder msg;
+        auto eidx = msg.initEvent().initRoadEncodeIdx();
+        eidx.setEncodeId(t);
+        eidx.setFrameId(i);
+        auto bytes = msg.toBytes();
+        lh_log(lh, bytes.begin(), bytes.size(), true);
+      }
+      lh_close(lh);
+      encoder_ms[t] = millis_since_boot() - start;
+    });
+  }
+
+  const double start = millis_since_boot();
+  run.segments = 1;
+  for (int i = 0; i < main_messages; i++) {
+    if (rotate_every > 0 && i > 0 && i % rotate_every == 0) {
+      REQUIRE(logger_next(&logger, root, nullptr, 0, nullptr) == 0);
+      run.segments++;
+    }
+    MessageBuilder msg;
+    msg.initEvent().initClocks().setBootTimeNanos(i);
+    auto bytes = msg.toBytes();
+    logger_log(&logger, bytes.begin(), bytes.size(), i % 10 == 0);
+  }
+  run.main_ms = millis_since_boot() - start;
+
+  for (auto &t : encoders) t.join();
+  run.encoder_ms = *std::max_element(encoder_ms.begin(), encoder_ms.end());
+  logger_close(&logger);
+  run.route_name = logger.route_name;
+  return run;
+}
+
+static void remove_root(const std::string &root) {
+  REQUIRE(system(("rm -rf " + root).c_str()) == 0);
+}
+
+TEST_CASE("logger_log and lh_log from several threads across rotations") {
+  const int main_messages = 20000, encoder_messages = 5000;
+  const LoggerRun run = run_logger(main_messages, ENCODER_THREADS, encoder_messages, 2500);
+  REQUIRE(run.segments == 8);
+
+  // per source, the next number it logged
+  std::map<int, int> next;
+  for (int seg = 0; seg < run.segments; seg++) {
+    const std::string path = util::string_format("%s/%s--%d/rlog.bz2", run.root.c_str(), run.route_name.c_str(), seg);
+    const std::string log = decompress_bz2(util::read_file(path));
+    REQUIRE(log.size() % sizeof(capnp::word) == 0);
+
+    auto words = kj::heapArray<capnp::word>(log.size() / sizeof(capnp::word));
+    memcpy(words.begin(), log.data(), log.size());
+    kj::ArrayPtr<const capnp::word> remaining = words;
+    int init_data = 0;
+    while (remaining.size() > 0) {
+      capnp::FlatArrayMessageReader reader(remaining);
+      auto event = reader.getRoot<cereal::Event>();
+      if (event.isInitData()) {
+        init_data++;
+      } else if (event.isClocks()) {
+        REQUIRE((int)event.getClocks().getBootTimeNanos() == next[0]++);
+      } else if (event.isRoadEncodeIdx()) {
+        auto eidx = event.getRoadEncodeIdx();
+        REQUIRE((int)eidx.getFrameId() == next[eidx.getEncodeId()]++);
+      }
+      remaining = kj::arrayPtr(reader.getEnd(), remaining.end());
+    }
+    REQUIRE(init_data == 1);
+    REQUIRE(!util::file_exists(path + ".lock"));
+  }
+
+  REQUIRE(next[0] == main_messages);
+  for (int t = 1; t <= ENCODER_THREADS; t++) {
+    REQUIRE(next[t] == encoder_messages);
+  }
+  remove_root(run.root);
+}
+
+// before the compressors hold it up: each writer buffers 8 chunks
+TEST_CASE("logger_log contention", "[.][benchmark]") {
+  const int main_messages = 50000, encoder_messages = 20000;
+  for (int encoders : {0, ENCODER_THREADS}) {
+    const LoggerRun run = run_logger(main_messages, encoders, encoder_messages, 0);
+    std::string result = util::string_format("main loop + %d encoder threads: main loop %.0f ns per message",
+                                             encoders, run.main_ms * 1e6 / main_messages);
+    if (encoders) {
+      result += util::string_format(", encoder threads %.0f ns per message", run.encoder_ms * 1e6 / encoder_messages);
+    }
+    WARN(result);
+    remove_root(run.root);
+  }
+}
@@ -0,0 +1,162 @@
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/loggerd/log_writer.h"
+#include "selfdrive/loggerd/seekable_log.h"
+
+const uint64_t SEGMENT_START = 1000000000000ULL;
+const char *SEGMENT_PATH = "/tmp/test_seekable_log.zst";
+
+struct LoggedEvent {
+  uint64_t log_mono_time;
+  cereal::Event::Which which;
+};
+
+// a minute of carState and can at 100 Hz, deviceState at 2 Hz
+static std::vector<LoggedEvent> write_segment() {
+  std::vector<LoggedEvent> logged;
+  LogWriter writer(SEGMENT_PATH, LogCompression::ZSTD);
+  auto log = [&](MessageBuilder &msg) {
+    auto bytes = msg.toBytes();
+    writer.write(bytes.begin(), bytes.size());
+    auto event = msg.getRoot<cereal::Event>();
+    logged.push_back({event.getLogMonoTime(), event.which()});
+  };
+
+  for (int i = 0; i < 6000; i++) {
+    const uint64_t t = SEGMENT_START + i * 10000000ULL;
+    {
+      MessageBuilder msg;
+      auto can = msg.initEvent().initCan(30);
+      msg.getRoot<cereal::Event>().setLogMonoTime(t);
+      for (int j = 0; j < can.size(); j++) {
+        uint8_t dat[8] = {(uint8_t)i, (uint8_t)j, 1, 2, 3, 4, 5, 6};
+        can[j].setAddress(0x100 + j);
+        can[j].setDat(kj::arrayPtr(dat, 8));
+      }
+      log(msg);
+    }
+    {
+      MessageBuilder msg;
+      auto cs = msg.initEvent().initCarState();
+      msg.getRoot<cereal::Event>().setLogMonoTime(t + 1000);
+      cs.setVEgo(i * 0.01);
+      log(msg);
+    }
+    if (i % 50 == 0) {
+      MessageBuilder msg;
+      msg.initEvent().initDeviceState().setFreeSpacePercent(50);
+      msg.getRoot<cereal::Event>().setLogMonoTime(t + 2000);
+      log(msg);
+    }
+  }
+  return logged;
+}
+
+TEST_CASE("SeekableLogReader round trips a segment") {
+  const auto logged = write_segment();
+  SeekableLogReader reader;
+  REQUIRE(reader.open(SEGMENT_PATH));
+
+  const auto &blocks = reader.blocks();
+  REQUIRE(blocks.size() > 4);
+  REQUIRE(reader.service("carState") == cereal::Event::CAR_STATE);
+  REQUIRE(reader.service("can") == cereal::Event::CAN);
+  REQUIRE(reader.service("deviceState") == cereal::Event::DEVICE_STATE);
+  REQUIRE(reader.service("sendcan") == -1);
+
+  SECTION("index") {
+    std::map<int, uint32_t> counts;
+    uint32_t num_messages = 0;
+    for (size_t i = 0; i < blocks.size(); i++) {
+      if (i > 0) {
+        REQUIRE(blocks[i].offset == blocks[i-1].offset + blocks[i-1].compressed_size);
+        REQUIRE(blocks[i].min_mono_time >= blocks[i-1].max_mono_time);
+      }
+      REQUIRE(blocks[i].decompressed_size <= LOG_CHUNK_SIZE);
+      num_messages += blocks[i].num_messages;
+      for (auto &[service, count] : blocks[i].service_counts) {
+        counts[service] += count;
+      }
+    }
+    REQUIRE(num_messages == logged.size());
+    REQUIRE(counts[cereal::Event::CAN] == 6000);
+    REQUIRE(counts[cereal::Event::CAR_STATE] == 6000);
+    REQUIRE(counts[cereal::Event::DEVICE_STATE] == 120);
+  }
+
+  SECTION("every message in order") {
+    size_t i = 0;
+    const size_t decompressed = reader.read_events(0, UINT64_MAX, nullptr, [&](cereal::Event::Reader event) {
+      REQUIRE(i < logged.size());
+      REQUIRE(event.getLogMonoTime() == logged[i].log_mono_time);
+      REQUIRE(event.which() == logged[i].which);
+      i++;
+    });
+    REQUIRE(i == logged.size());
+    REQUIRE(decompressed == blocks.size());
+  }
+
+  SECTION("one service in a time range") {
+    const uint64_t start = SEGMENT_START + 45000000000ULL, end = SEGMENT_START + 46000000000ULL;
+    std::vector<float> v_ego;
+    const size_t decompressed = reader.read_events(start, end, "carState", [&](cereal::Event::Reader event) {
+      REQUIRE(event.which() == cereal::Event::CAR_STATE);
+      REQUIRE(event.getLogMonoTime() >= start);
+      REQUIRE(event.getLogMonoTime() <= end);
+      v_ego.push_back(event.getCarState().getVEgo());
+    });
+    REQUIRE(v_ego.size() == 100);
+    REQUIRE(v_ego[0] == Approx(45.0));
+    REQUIRE(decompressed <= 2);
+  }
+
+  remove(SEGMENT_PATH);
+}
+
+TEST_CASE("SeekableLogReader stops a block at a broken message") {
+  const std::string path = "/tmp/test_seekable_log_broken.zst";
+  {
+    LogWriter writer(path.c_str(), LogCompression::ZSTD);
+    for (int i = 0; i < 20; i++) {
+      if (i == 10) {
+        // a segment table that runs past the end of the block
+        const uint8_t broken[8] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+        writer.write((void *)broken, sizeof(broken));
+      }
+      MessageBuilder msg;
+      msg.initEvent().initCarState().setVEgo(i);
+      msg.getRoot<cereal::Event>().setLogMonoTime(SEGMENT_START + i);
+      auto bytes = msg.toBytes();
+      writer.write(bytes.begin(), bytes.size());
+    }
+  }
+  SeekableLogReader reader;
+  REQUIRE(reader.open(path));
+  REQUIRE(reader.blocks().size() == 1);
+  REQUIRE(reader.blocks()[0].num_messages == 10);
+
+  std::vector<uint64_t> times;
+  REQUIRE(reader.read_events(0, UINT64_MAX, "carState", [&](cereal::Event::Reader event) {
+    times.push_back(event.getLogMonoTime());
+  }) == 1);
+  REQUIRE(times.size() == 10);
+  REQUIRE(times.back() == SEGMENT_START + 9);
+  remove(path.c_str());
+}
+
+TEST_CASE("SeekableLogReader rejects other files") {
+  const std::string path = "/tmp/test_seekable_log.bz2";
+  {
+    LogWriter writer(path.c_str(), LogCompression::BZ2);
+    writer.write((void *)"not seekable", 12);
+  }
+  SeekableLogReader reader;
+  REQUIRE(!reader.open(path));
+  REQUIRE(!reader.open("/tmp/does_not_exist.zst"));
+  remove(path.c_str());
+}
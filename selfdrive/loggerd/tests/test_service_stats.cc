@@ -0,0 +1,70 @@
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "cereal/messaging/messaging.h"
+#include "selfdrive/loggerd/service_stats.h"
+
+class FakeSubSocket : public SubSocket {
+ public:
+  size_t fake_lag = 0;
+  uint64_t fake_lapped = 0;
+
+  int connect(Context *context, std::string endpoint, std::string address, bool conflate, bool check_endpoint) { return 0; }
+  void setTimeout(int timeout) {}
+  Message *receive(bool non_blocking) { return nullptr; }
+  void *getRawSocket() { return nullptr; }
+  size_t lag() { return fake_lag; }
+  size_t bufferSize() { return 1000; }
+  uint64_t lapped() { return fake_lapped; }
+};
+
+TEST_CASE("ServiceStats") {
+  FakeSubSocket can, carState, deviceState;
+  can.fake_lapped = 3; // from before loggerd started
+  ServiceStats stats;
+  stats.add(&can, "can");
+  stats.add(&carState, "carState");
+  stats.add(&deviceState, "deviceState");
+
+  SECTION("drains the most lagged first") {
+    can.fake_lag = 100;
+    carState.fake_lag = 800;
+    deviceState.fake_lag = 100;
+    std::vector<SubSocket *> ready = {&can, &carState, &deviceState};
+    stats.prioritize(ready);
+    REQUIRE(ready == std::vector<SubSocket *>{&carState, &can, &deviceState});
+  }
+
+  SECTION("reports since the last stats") {
+    std::vector<SubSocket *> ready = {&can, &carState};
+    can.fake_lag = 500;
+    stats.prioritize(ready);
+    can.fake_lag = 250;
+    stats.prioritize(ready);
+    stats.logged(&can, 100, 10000);
+    stats.logged(&can, 100, 10000);
+    carState.fake_lapped = 2;
+
+    MessageBuilder msg;
+    auto lstats = msg.initEvent().initLoggerdStats();
+    stats.fill(lstats, 2.0);
+    auto services = lstats.getServices();
+    REQUIRE(services.size() == 3);
+    REQUIRE(std::string(services[0].getName()) == "can");
+    REQUIRE(services[0].getLag() == Approx(0.25));
+    REQUIRE(services[0].getMaxLag() == Approx(0.5));
+    REQUIRE(services[0].getLapped() == 0);
+    REQUIRE(services[0].getMessages() == 200);
+    REQUIRE(services[0].getBytesPerSecond() == Approx(10000));
+    REQUIRE(services[1].getMaxLag() == 1);
+    REQUIRE(services[1].getLapped() == 2);
+    REQUIRE(services[2].getMessages() == 0);
+
+    stats.fill(lstats, 1.0);
+    services = lstats.getServices();
+    REQUIRE(services[0].getMaxLag() == 0);
+    REQUIRE(services[0].getMessages() == 0);
+    REQUIRE(services[1].getLapped() == 0);
+  }
+}
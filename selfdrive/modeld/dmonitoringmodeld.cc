@@ -18,7 +18,10 @@ void run_model(DMonitoringModelState &model, VisionIpcClient &vipc_client) {
   while (!do_exit) {
     VisionIpcBufExtra extra = {};
     VisionBuf *buf = vipc_client.recv(&extra);
-    if (buf == nullptr) continue;
+    if (buf == nullptr) {
+      if (extra.dropped) LOGW("frame %d dropped, overwritten before it was received", extra.frame_id);
+      continue;
+    }
 
     double t1 = millis_since_boot();
     DMonitoringResult res = dmonitoring_eval_frame(&model, buf->addr, buf->width, buf->height);
@@ -1,6 +1,8 @@
 #include <cstdio>
 #include <cstdlib>
 #include <mutex>
+#include <thread>
+#include <vector>
 
 #include <eigen3/Eigen/Dense>
 
@@ -8,6 +10,7 @@
 #include "cereal/visionipc/visionipc_client.h"
 #include "selfdrive/common/clutil.h"
 #include "selfdrive/common/params.h"
+#include "selfdrive/common/queue.h"
 #include "selfdrive/common/swaglog.h"
 #include "selfdrive/common/util.h"
 #include "selfdrive/hardware/hw.h"
@@ -83,7 +86,10 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client) {
   while (!do_exit) {
     VisionIpcBufExtra extra = {};
     VisionBuf *buf = vipc_client.recv(&extra);
-    if (buf == nullptr) continue;
+    if (buf == nullptr) {
+      if (extra.dropped) LOGW("frame %d dropped, overwritten before it was received", extra.frame_id);
+      continue;
+    }
 
     transform_lock.lock();
     mat3 model_transform = cur_transform;
@@ -104,8 +110,7 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client) {
       }
 
       double mt1 = millis_since_boot();
-      ModelDataRaw model_buf = model_eval_frame(&model, buf->buf_cl, buf->width, buf->height,
-                                                model_transform, vec_desire);
+      ModelDataRaw model_buf = model_eval_frame(&model, buf, model_transform, vec_desire);
       double mt2 = millis_since_boot();
       float model_execution_time = (mt2 - mt1) / 1000.0;
 
@@ -130,6 +135,145 @@ void run_model(ModelState &model, VisionIpcClient &vipc_client) {
   }
 }
 
+// Pipelined run_model: the frames are prepared on their own thread, so the
+// next one is ready as soon as the network is done with the last one, and the
+// outputs are parsed and published on another
+struct PreparedFrame {
+  VisionIpcBufExtra extra;
+  uint32_t frame_id;
+  float vec_desire[DESIRE_LEN];
+  float *net_input;
+};
+
+struct ExecutedFrame {
+  VisionIpcBufExtra extra;
+  uint32_t frame_id;
+  float model_execution_time;
+  std::vector<float> output;
+};
+
+// one PreparedFrame is prepared while the network runs on the other. When a
+// newer frame comes before the network took the last one, it's prepared in
+// its place: the network always gets the newest frame, and the one it ran
+// last as the previous. The ring in ModelFrame never has more than three
+// frames in use
+void prepare_thread(ModelState &model, VisionIpcClient &vipc_client,
+                    SafeQueue<PreparedFrame *> &free_prepared, SafeQueue<PreparedFrame *> &prepared) {
+  set_thread_name("modeld_prepare");
+  SubMaster sm({"lateralPlan", "roadCameraState"});
+
+  while (!do_exit) {
+    VisionIpcBufExtra extra = {};
+    VisionBuf *buf = vipc_client.recv(&extra);
+    if (buf == nullptr) {
+      if (extra.dropped) LOGW("frame %d dropped, overwritten before it was received", extra.frame_id);
+      continue;
+    }
+
+    transform_lock.lock();
+    mat3 model_transform = cur_transform;
+    const bool run_model_this_iter = live_calib_seen;
+    transform_lock.unlock();
+
+    if (!run_model_this_iter) continue;
+
+    PreparedFrame *f = nullptr;
+    const bool replace_last = prepared.try_pop(f);
+    while (!do_exit && f == nullptr) {
+      free_prepared.try_pop(f, 100);
+    }
+    if (f == nullptr) break;
+
+    sm.update(0);
+    int desire = ((int)sm["lateralPlan"].getLateralPlan().getDesire());
+    f->extra = extra;
+    f->frame_id = sm["roadCameraState"].getRoadCameraState().getFrameId();
+    std::fill_n(f->vec_desire, DESIRE_LEN, 0);
+    if (desire >= 0 && desire < DESIRE_LEN) {
+      f->vec_desire[desire] = 1.0;
+    }
+
+    f->net_input = model_prepare_frame(&model, buf, model_transform, replace_last);
+    // done with the camera frame, don't hold it while waiting for the network
+    vipc_client.release();
+    prepared.push(f);
+  }
+}
+
+void publish_thread(SafeQueue<ExecutedFrame *> &free_executed, SafeQueue<ExecutedFrame *> &executed) {
+  set_thread_name("modeld_publish");
+  PubMaster pm({"modelV2", "cameraOdometry"});
+
+  // setup filter to track dropped frames
+  FirstOrderFilter frame_dropped_filter(0., 10., 1. / MODEL_FREQ);
+
+  uint32_t last_vipc_frame_id = 0;
+  uint32_t run_count = 0;
+
+  while (!do_exit) {
+    ExecutedFrame *f;
+    if (!executed.try_pop(f, 100)) continue;
+    run_count++;
+
+    // tracked dropped frames
+    uint32_t vipc_dropped_frames = f->extra.frame_id - last_vipc_frame_id - 1;
+    float frames_dropped = frame_dropped_filter.update((float)std::min(vipc_dropped_frames, 10U));
+    if (run_count < 10) { // let frame drops warm up
+      frame_dropped_filter.reset(0);
+      frames_dropped = 0.;
+    }
+
+    float frame_drop_ratio = frames_dropped / (1 + frames_dropped);
+
+    ModelDataRaw model_buf = model_outputs(f->output.data());
+    model_publish(pm, f->extra.frame_id, f->frame_id, frame_drop_ratio, model_buf, f->extra.timestamp_eof, f->model_execution_time,
+                  kj::ArrayPtr<const float>(f->output.data(), f->output.size()));
+    posenet_publish(pm, f->extra.frame_id, vipc_dropped_frames, model_buf, f->extra.timestamp_eof);
+
+    last_vipc_frame_id = f->extra.frame_id;
+    free_executed.push(f);
+  }
+}
+
+void run_model_pipelined(ModelState &model, VisionIpcClient &vipc_client) {
+  PreparedFrame prepared_frames[2];
+  SafeQueue<PreparedFrame *> free_prepared, prepared;
+  for (auto &f : prepared_frames) free_prepared.push(&f);
+
+  ExecutedFrame executed_frames[2];
+  SafeQueue<ExecutedFrame *> free_executed, executed;
+  for (auto &f : executed_frames) {
+    f.output.resize(model.output.size());
+    free_executed.push(&f);
+  }
+
+  std::thread prepare(prepare_thread, std::ref(model), std::ref(vipc_client), std::ref(free_prepared), std::ref(prepared));
+  std::thread publish(publish_thread, std::ref(free_executed), std::ref(executed));
+
+  while (!do_exit) {
+    PreparedFrame *p;
+    if (!prepared.try_pop(p, 100)) continue;
+
+    ExecutedFrame *e = nullptr;
+    while (!do_exit && !free_executed.try_pop(e, 100)) {}
+    if (e == nullptr) break;
+
+    double mt1 = millis_since_boot();
+    model_execute(&model, p->net_input, p->vec_desire);
+    double mt2 = millis_since_boot();
+
+    e->extra = p->extra;
+    e->frame_id = p->frame_id;
+    e->model_execution_time = (mt2 - mt1) / 1000.0;
+    std::copy(model.output.begin(), model.output.end(), e->output.begin());
+    free_prepared.push(p);
+    executed.push(e);
+  }
+
+  prepare.join();
+  publish.join();
+}
+
 int main(int argc, char **argv) {
   set_realtime_priority(54);
 
@@ -143,9 +287,14 @@ int main(int argc, char **argv) {
   // start calibration thread
   std::thread thread = std::thread(calibration_thread, wide_camera);
 
-  // cl init
-  cl_device_id device_id = cl_get_device_id(CL_DEVICE_TYPE_DEFAULT);
-  cl_context context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+  // cl init, without OpenCL (or with MODELD_CPU_TRANSFORM set) the frames are prepared on the CPU
+  cl_device_id device_id = getenv("MODELD_CPU_TRANSFORM") ? nullptr : cl_find_device_id(CL_DEVICE_TYPE_DEFAULT);
+  cl_context context = nullptr;
+  if (device_id) {
+    context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+  } else {
+    LOGW("preparing frames on the CPU");
+  }
 
   // init the models
   ModelState model;
@@ -162,12 +311,19 @@ int main(int argc, char **argv) {
   if (vipc_client.connected) {
     const VisionBuf *b = &vipc_client.buffers[0];
     LOGW("connected with buffer size: %d (%d x %d)", b->len, b->width, b->height);
-    run_model(model, vipc_client);
+    if (getenv("MODELD_PIPELINED")) {
+      LOGW("running pipelined");
+      run_model_pipelined(model, vipc_client);
+    } else {
+      run_model(model, vipc_client);
+    }
   }
 
   model_free(&model);
   LOG("joining calibration thread");
   thread.join();
-  CL_CHECK(clReleaseContext(context));
+  if (context) {
+    CL_CHECK(clReleaseContext(context));
+  }
   return 0;
 }
@@ -10,7 +10,15 @@
 #include "selfdrive/common/timing.h"
 
 ModelFrame::ModelFrame(cl_device_id device_id, cl_context context) {
-  input_frames = std::make_unique<float[]>(buf_size);
+  input_frames = std::make_unique<float[]>(MODEL_FRAME_SLOTS * MODEL_FRAME_SIZE);
+
+  if (!device_id) {
+    transform_cpu = std::make_unique<TransformCPU>();
+    y_cpu = std::make_unique<uint8_t[]>(MODEL_WIDTH * MODEL_HEIGHT);
+    u_cpu = std::make_unique<uint8_t[]>((MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2));
+    v_cpu = std::make_unique<uint8_t[]>((MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2));
+    return;
+  }
 
   q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
   y_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_WIDTH * MODEL_HEIGHT, NULL, &err));
@@ -22,19 +30,36 @@ ModelFrame::ModelFrame(cl_device_id device_id, cl_context context) {
   loadyuv_init(&loadyuv, context, device_id, MODEL_WIDTH, MODEL_HEIGHT);
 }
 
-float* ModelFrame::prepare(cl_mem yuv_cl, int frame_width, int frame_height, const mat3 &transform) {
+float* ModelFrame::prepare(const VisionBuf *buf, const mat3 &transform, bool replace_last) {
+  // the frames are written one slot further each time, the network gets the
+  // newest two as one buffer. Only when it wraps the newest is copied back to
+  // the start, instead of moving the history every frame
+  if (!replace_last && ++newest == MODEL_FRAME_SLOTS) {
+    std::memcpy(&input_frames[0], &input_frames[(MODEL_FRAME_SLOTS - 1) * MODEL_FRAME_SIZE], sizeof(float) * MODEL_FRAME_SIZE);
+    newest = 1;
+  }
+  float *frame = &input_frames[newest * MODEL_FRAME_SIZE];
+
+  if (transform_cpu) {
+    transform_cpu->warp(buf->y, buf->width, buf->height,
+                        y_cpu.get(), u_cpu.get(), v_cpu.get(), MODEL_WIDTH, MODEL_HEIGHT, transform);
+    transform_cpu->loadyuv(y_cpu.get(), u_cpu.get(), v_cpu.get(), MODEL_WIDTH, MODEL_HEIGHT, frame);
+    return frame - MODEL_FRAME_SIZE;
+  }
+
   transform_queue(&this->transform, q,
-                  yuv_cl, frame_width, frame_height,
+                  buf->buf_cl, buf->width, buf->height,
                   y_cl, u_cl, v_cl, MODEL_WIDTH, MODEL_HEIGHT, transform);
   loadyuv_queue(&loadyuv, q, y_cl, u_cl, v_cl, net_input_cl);
 
-  std::memmove(&input_frames[0], &input_frames[MODEL_FRAME_SIZE], sizeof(float) * MODEL_FRAME_SIZE);
-  clEnqueueReadBuffer(q, net_input_cl, CL_TRUE, 0, MODEL_FRAME_SIZE * sizeof(float), &input_frames[MODEL_FRAME_SIZE], 0, nullptr, nullptr);
+  clEnqueueReadBuffer(q, net_input_cl, CL_TRUE, 0, MODEL_FRAME_SIZE * sizeof(float), frame, 0, nullptr, nullptr);
   clFinish(q);
-  return &input_frames[0];
+  return frame - MODEL_FRAME_SIZE;
 }
 
 ModelFrame::~ModelFrame() {
+  if (transform_cpu) return;
+
   transform_destroy(&transform);
   loadyuv_destroy(&loadyuv);
   CL_CHECK(clReleaseMemObject(net_input_cl));
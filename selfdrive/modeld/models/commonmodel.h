@@ -12,13 +12,17 @@
 #include <CL/cl.h>
 #endif
 
+#include "cereal/visionipc/visionbuf.h"
 #include "selfdrive/common/mat.h"
 #include "selfdrive/modeld/transforms/loadyuv.h"
 #include "selfdrive/modeld/transforms/transform.h"
+#include "selfdrive/modeld/transforms/transform_cpu.h"
 
 constexpr int MODEL_WIDTH = 512;
 constexpr int MODEL_HEIGHT = 256;
 constexpr int MODEL_FRAME_SIZE = MODEL_WIDTH * MODEL_HEIGHT * 3 / 2;
+// frames in ModelFrame's input ring
+constexpr int MODEL_FRAME_SLOTS = 8;
 
 const bool send_raw_pred = getenv("SEND_RAW_PRED") != NULL;
 
@@ -28,9 +32,13 @@ float sigmoid(float input);
 
 class ModelFrame {
  public:
+  // without a device_id the frame is prepared on the CPU, see TransformCPU
   ModelFrame(cl_device_id device_id, cl_context context);
   ~ModelFrame();
-  float* prepare(cl_mem yuv_cl, int width, int height, const mat3& transform);
+  // returns the previous and this frame, valid for the next MODEL_FRAME_SLOTS - 3
+  // calls. So a frame can be prepared while the network runs on the last one.
+  // replace_last prepares it in place of the last one, which wasn't run
+  float* prepare(const VisionBuf *buf, const mat3& transform, bool replace_last = false);
 
   const int buf_size = MODEL_FRAME_SIZE * 2;
 
@@ -40,4 +48,8 @@ class ModelFrame {
   cl_command_queue q;
   cl_mem y_cl, u_cl, v_cl, net_input_cl;
   std::unique_ptr<float[]> input_frames;
+  int newest = 0;
+
+  std::unique_ptr<TransformCPU> transform_cpu;
+  std::unique_ptr<uint8_t[]> y_cpu, u_cpu, v_cpu;
 };
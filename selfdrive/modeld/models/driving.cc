@@ -82,8 +82,16 @@ void model_init(ModelState* s, cl_device_id device_id, cl_context context) {
 #endif
 }
 
-ModelDataRaw model_eval_frame(ModelState* s, cl_mem yuv_cl, int width, int height,
+ModelDataRaw model_eval_frame(ModelState* s, const VisionBuf *buf,
                            const mat3 &transform, float *desire_in) {
+  return model_execute(s, model_prepare_frame(s, buf, transform), desire_in);
+}
+
+float *model_prepare_frame(ModelState* s, const VisionBuf *buf, const mat3 &transform, bool replace_last) {
+  return s->frame->prepare(buf, transform, replace_last);
+}
+
+ModelDataRaw model_execute(ModelState* s, float *net_input_buf, float *desire_in) {
 #ifdef DESIRE
   if (desire_in != NULL) {
     for (int i = 1; i < DESIRE_LEN; i++) {
@@ -101,19 +109,21 @@ ModelDataRaw model_eval_frame(ModelState* s, cl_mem yuv_cl, int width, int heigh
 
   //for (int i = 0; i < OUTPUT_SIZE + TEMPORAL_SIZE; i++) { printf("%f ", s->output[i]); } printf("\n");
 
-  auto net_input_buf = s->frame->prepare(yuv_cl, width, height, transform);
   s->m->execute(net_input_buf, s->frame->buf_size);
+  return model_outputs(&s->output[0]);
+}
 
+ModelDataRaw model_outputs(float *output) {
   // net outputs
   ModelDataRaw net_outputs;
-  net_outputs.plan = &s->output[PLAN_IDX];
-  net_outputs.lane_lines = &s->output[LL_IDX];
-  net_outputs.lane_lines_prob = &s->output[LL_PROB_IDX];
-  net_outputs.road_edges = &s->output[RE_IDX];
-  net_outputs.lead = &s->output[LEAD_IDX];
-  net_outputs.lead_prob = &s->output[LEAD_PROB_IDX];
-  net_outputs.meta = &s->output[DESIRE_STATE_IDX];
-  net_outputs.pose = &s->output[POSE_IDX];
+  net_outputs.plan = &output[PLAN_IDX];
+  net_outputs.lane_lines = &output[LL_IDX];
+  net_outputs.lane_lines_prob = &output[LL_PROB_IDX];
+  net_outputs.road_edges = &output[RE_IDX];
+  net_outputs.lead = &output[LEAD_IDX];
+  net_outputs.lead_prob = &output[LEAD_PROB_IDX];
+  net_outputs.meta = &output[DESIRE_STATE_IDX];
+  net_outputs.pose = &output[POSE_IDX];
   return net_outputs;
 }
 
@@ -314,7 +324,7 @@ void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, flo
                    const ModelDataRaw &net_outputs, uint64_t timestamp_eof,
                    float model_execution_time, kj::ArrayPtr<const float> raw_pred) {
   const uint32_t frame_age = (frame_id > vipc_frame_id) ? (frame_id - vipc_frame_id) : 0;
-  MessageBuilder msg;
+  MessageBuilder msg("modelV2");
   auto framed = msg.initEvent().initModelV2();
   framed.setFrameId(vipc_frame_id);
   framed.setFrameAge(frame_age);
@@ -325,6 +335,7 @@ void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, flo
     framed.setRawPredictions(raw_pred.asBytes());
   }
   fill_model(framed, net_outputs);
+  framed.setFrameLatency((int64_t)(nanos_since_boot() - timestamp_eof) / 1e9);
   pm.send("modelV2", msg);
 }
 
@@ -343,7 +354,7 @@ void posenet_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t vipc_droppe
     rot_std_arr[i] = exp(net_outputs.pose[9 + i]);
   }
 
-  MessageBuilder msg;
+  MessageBuilder msg("cameraOdometry");
   auto posenetd = msg.initEvent(vipc_dropped_frames < 1).initCameraOdometry();
   posenetd.setTrans(trans_arr);
   posenetd.setRot(rot_arr);
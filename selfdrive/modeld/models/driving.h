@@ -45,8 +45,13 @@ typedef struct ModelState {
 } ModelState;
 
 void model_init(ModelState* s, cl_device_id device_id, cl_context context);
-ModelDataRaw model_eval_frame(ModelState* s, cl_mem yuv_cl, int width, int height,
+ModelDataRaw model_eval_frame(ModelState* s, const VisionBuf *buf,
                            const mat3 &transform, float *desire_in);
+// model_eval_frame in two steps, to prepare the next frame while the network runs
+float *model_prepare_frame(ModelState* s, const VisionBuf *buf, const mat3 &transform, bool replace_last = false);
+ModelDataRaw model_execute(ModelState* s, float *net_input_buf, float *desire_in);
+// the outputs in a copy of ModelState::output
+ModelDataRaw model_outputs(float *output);
 void model_free(ModelState* s);
 void poly_fit(float *in_pts, float *in_stds, float *out);
 void model_publish(PubMaster &pm, uint32_t vipc_frame_id, uint32_t frame_id, float frame_drop,
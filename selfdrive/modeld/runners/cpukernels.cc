@@ -0,0 +1,355 @@
+#include "selfdrive/modeld/runners/cpukernels.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace {
+
+// micro kernel tile, and the blocks of k and n that are packed at a time
+constexpr int MR = 6;
+constexpr int NR = 16;
+constexpr int KC = 256;
+constexpr int NC = 256;
+
+inline int div_up(int a, int b) {
+  return (a + b - 1) / b;
+}
+
+inline int round_up(int a, int b) {
+  return div_up(a, b) * b;
+}
+
+// c[MR][NR] (+)= a[kc][MR] * b[kc][NR]
+void micro_kernel_scalar(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate) {
+  float t[MR][NR] = {};
+  for (int k = 0; k < kc; k++) {
+    for (int r = 0; r < MR; r++) {
+      for (int j = 0; j < NR; j++) {
+        t[r][j] += a[k * MR + r] * b[k * NR + j];
+      }
+    }
+  }
+  for (int r = 0; r < MR; r++) {
+    for (int j = 0; j < NR; j++) {
+      c[r * ldc + j] = accumulate ? c[r * ldc + j] + t[r][j] : t[r][j];
+    }
+  }
+}
+
+#if defined(__x86_64__)
+
+#define ROW_FMA(r) \
+  a0 = _mm256_broadcast_ss(a + r); \
+  c##r##0 = _mm256_fmadd_ps(a0, b0, c##r##0); \
+  c##r##1 = _mm256_fmadd_ps(a0, b1, c##r##1);
+
+#define ROW_STORE(r) \
+  if (accumulate) { \
+    c##r##0 = _mm256_add_ps(c##r##0, _mm256_loadu_ps(c + r * ldc)); \
+    c##r##1 = _mm256_add_ps(c##r##1, _mm256_loadu_ps(c + r * ldc + 8)); \
+  } \
+  _mm256_storeu_ps(c + r * ldc, c##r##0); \
+  _mm256_storeu_ps(c + r * ldc + 8, c##r##1);
+
+// the 6x16 tile in 12 registers
+__attribute__((target("avx2,fma")))
+void micro_kernel_avx2(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate) {
+  __m256 c00 = _mm256_setzero_ps(), c01 = _mm256_setzero_ps();
+  __m256 c10 = _mm256_setzero_ps(), c11 = _mm256_setzero_ps();
+  __m256 c20 = _mm256_setzero_ps(), c21 = _mm256_setzero_ps();
+  __m256 c30 = _mm256_setzero_ps(), c31 = _mm256_setzero_ps();
+  __m256 c40 = _mm256_setzero_ps(), c41 = _mm256_setzero_ps();
+  __m256 c50 = _mm256_setzero_ps(), c51 = _mm256_setzero_ps();
+  for (int k = 0; k < kc; k++) {
+    const __m256 b0 = _mm256_loadu_ps(b), b1 = _mm256_loadu_ps(b + 8);
+    __m256 a0;
+    ROW_FMA(0) ROW_FMA(1) ROW_FMA(2) ROW_FMA(3) ROW_FMA(4) ROW_FMA(5)
+    a += MR;
+    b += NR;
+  }
+  ROW_STORE(0) ROW_STORE(1) ROW_STORE(2) ROW_STORE(3) ROW_STORE(4) ROW_STORE(5)
+}
+
+#undef ROW_FMA
+#undef ROW_STORE
+
+const bool has_avx2_fma = []() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+}();
+
+#elif defined(__ARM_NEON)
+
+// the 6x16 tile in 24 registers
+void micro_kernel_neon(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate) {
+  float32x4_t t[MR][4];
+  for (int r = 0; r < MR; r++) {
+    for (int j = 0; j < 4; j++) t[r][j] = vdupq_n_f32(0.f);
+  }
+  for (int k = 0; k < kc; k++) {
+    const float32x4_t b0 = vld1q_f32(b), b1 = vld1q_f32(b + 4), b2 = vld1q_f32(b + 8), b3 = vld1q_f32(b + 12);
+    for (int r = 0; r < MR; r++) {
+      t[r][0] = vfmaq_n_f32(t[r][0], b0, a[r]);
+      t[r][1] = vfmaq_n_f32(t[r][1], b1, a[r]);
+      t[r][2] = vfmaq_n_f32(t[r][2], b2, a[r]);
+      t[r][3] = vfmaq_n_f32(t[r][3], b3, a[r]);
+    }
+    a += MR;
+    b += NR;
+  }
+  for (int r = 0; r < MR; r++) {
+    for (int j = 0; j < 4; j++) {
+      float *out = c + r * ldc + j * 4;
+      vst1q_f32(out, accumulate ? vaddq_f32(t[r][j], vld1q_f32(out)) : t[r][j]);
+    }
+  }
+}
+
+#endif
+
+void micro_kernel(int kc, const float *a, const float *b, float *c, int ldc, bool accumulate) {
+#if defined(__x86_64__)
+  if (has_avx2_fma) return micro_kernel_avx2(kc, a, b, c, ldc, accumulate);
+#elif defined(__ARM_NEON)
+  return micro_kernel_neon(kc, a, b, c, ldc, accumulate);
+#endif
+  micro_kernel_scalar(kc, a, b, c, ldc, accumulate);
+}
+
+// rows [k0, k0 + kc) and columns [n0, n0 + nc) of col(in), in panels of NR
+// columns, zero padded to a whole panel
+void pack_input(const ConvShape &s, const float *in, int k0, int kc, int n0, int nc, float *packed) {
+  const int padded = round_up(nc, NR);
+  for (int kk = 0; kk < kc; kk++) {
+    const int k = k0 + kk;
+    const int c = k / (s.kernel_h * s.kernel_w);
+    const int ky = (k / s.kernel_w) % s.kernel_h;
+    const int kx = k % s.kernel_w;
+    const float *plane = in + (size_t)c * s.in_h * s.in_w;
+    // the output columns that read inside the image
+    const int off = kx * s.dilation_w - s.pad_l;
+    const int x0 = off < 0 ? div_up(-off, s.stride_w) : 0;
+    const int x1 = off < s.in_w ? std::min(s.out_w, (s.in_w - 1 - off) / s.stride_w + 1) : 0;
+
+    // in runs that stay on one output row and in one panel
+    int oy = n0 / s.out_w, ox = n0 % s.out_w;
+    for (int j = 0; j < padded;) {
+      float *dst = packed + (size_t)(j / NR) * NR * kc + kk * NR + j % NR;
+      const int cnt = std::min(NR - j % NR, j < nc ? std::min(nc - j, s.out_w - ox) : padded - j);
+      const int iy = oy * s.stride_h - s.pad_t + ky * s.dilation_h;
+      if (j >= nc || iy < 0 || iy >= s.in_h) {
+        std::fill(dst, dst + cnt, 0.f);
+      } else {
+        const float *row = plane + iy * s.in_w + off;
+        const int a = std::clamp(x0, ox, ox + cnt), b = std::clamp(x1, a, ox + cnt);
+        std::fill(dst, dst + a - ox, 0.f);
+        if (s.stride_w == 1) {
+          std::memcpy(dst + a - ox, row + a, (b - a) * sizeof(float));
+        } else {
+          for (int x = a; x < b; x++) dst[x - ox] = row[x * s.stride_w];
+        }
+        std::fill(dst + b - ox, dst + cnt, 0.f);
+      }
+      if (j < nc && (ox += cnt) == s.out_w) {
+        ox = 0;
+        oy++;
+      }
+      j += cnt;
+    }
+  }
+}
+
+}  // namespace
+
+void activate(float *x, size_t n, Activation act, float alpha) {
+  switch (act) {
+    case ACT_RELU:
+      for (size_t i = 0; i < n; i++) x[i] = std::max(x[i], 0.f);
+      break;
+    case ACT_ELU:
+      for (size_t i = 0; i < n; i++) x[i] = x[i] > 0.f ? x[i] : alpha * expm1f(x[i]);
+      break;
+    case ACT_LEAKY_RELU:
+      for (size_t i = 0; i < n; i++) x[i] = x[i] > 0.f ? x[i] : alpha * x[i];
+      break;
+    case ACT_SIGMOID:
+      for (size_t i = 0; i < n; i++) x[i] = 1.f / (1.f + expf(-x[i]));
+      break;
+    case ACT_TANH:
+      for (size_t i = 0; i < n; i++) x[i] = tanhf(x[i]);
+      break;
+    case ACT_NONE:
+      break;
+  }
+}
+
+size_t conv_packed_weights_size(int m, int k) {
+  return (size_t)round_up(m, MR) * k;
+}
+
+// by blocks of KC, each block [m / MR][kc][MR]
+void conv_pack_weights(const float *w, int m, int k, float *packed) {
+  const int mp = round_up(m, MR);
+  for (int k0 = 0; k0 < k; k0 += KC) {
+    const int kc = std::min(KC, k - k0);
+    float *block = packed + (size_t)k0 * mp;
+    for (int i0 = 0; i0 < mp; i0 += MR) {
+      float *panel = block + (size_t)i0 * kc;
+      for (int kk = 0; kk < kc; kk++) {
+        for (int r = 0; r < MR; r++) {
+          panel[kk * MR + r] = (i0 + r < m) ? w[(size_t)(i0 + r) * k + k0 + kk] : 0.f;
+        }
+      }
+    }
+  }
+}
+
+size_t conv_workspace_size(int num_threads) {
+  return (size_t)num_threads * KC * NC;
+}
+
+void conv_gemm(ThreadPool &pool, const float *packed_w, int m, const ConvShape &shape,
+               const float *in, const float *bias, float *out, Activation act, float alpha,
+               float *workspace) {
+  const int k = shape.in_c * shape.kernel_h * shape.kernel_w;
+  const int n = shape.out_h * shape.out_w;
+  const int mp = round_up(m, MR);
+  const int m_panels = mp / MR;
+  const int n_blocks = div_up(n, NC);
+  // the late layers are small images with many channels, split those by rows too
+  const int m_splits = std::min(m_panels, div_up(pool.size(), n_blocks));
+
+  pool.parallel_for(n_blocks * m_splits, [&](int thread, int begin, int end) {
+    float *packed_in = workspace + (size_t)thread * KC * NC;
+    for (int t = begin; t < end; t++) {
+      const int n0 = (t / m_splits) * NC, nc = std::min(NC, n - n0);
+      const int p0 = m_panels * (t % m_splits) / m_splits, p1 = m_panels * (t % m_splits + 1) / m_splits;
+
+      for (int k0 = 0; k0 < k; k0 += KC) {
+        const int kc = std::min(KC, k - k0);
+        pack_input(shape, in, k0, kc, n0, nc, packed_in);
+        const float *block = packed_w + (size_t)k0 * mp;
+
+        for (int p = p0; p < p1; p++) {
+          const int i0 = p * MR, mr = std::min(MR, m - i0);
+          for (int j0 = 0; j0 < nc; j0 += NR) {
+            const int nr = std::min(NR, nc - j0);
+            float *c = out + (size_t)i0 * n + n0 + j0;
+            if (mr == MR && nr == NR) {
+              micro_kernel(kc, block + (size_t)i0 * kc, packed_in + (size_t)j0 * kc, c, n, k0 > 0);
+              continue;
+            }
+
+            // edges go through a whole tile
+            float tile[MR * NR] = {};
+            if (k0 > 0) {
+              for (int r = 0; r < mr; r++) std::memcpy(&tile[r * NR], c + (size_t)r * n, nr * sizeof(float));
+            }
+            micro_kernel(kc, block + (size_t)i0 * kc, packed_in + (size_t)j0 * kc, tile, NR, k0 > 0);
+            for (int r = 0; r < mr; r++) std::memcpy(c + (size_t)r * n, &tile[r * NR], nr * sizeof(float));
+          }
+        }
+      }
+
+      // bias and activation while the block is still in cache
+      for (int i = p0 * MR; i < std::min(p1 * MR, m); i++) {
+        float *row = out + (size_t)i * n + n0;
+        if (bias) {
+          for (int j = 0; j < nc; j++) row[j] += bias[i];
+        }
+        activate(row, nc, act, alpha);
+      }
+    }
+  });
+}
+
+void conv_depthwise(ThreadPool &pool, const float *w, int channels, const ConvShape &s,
+                    const float *in, const float *bias, float *out, Activation act, float alpha) {
+  const int out_size = s.out_h * s.out_w;
+  pool.parallel_for(channels, [&](int, int begin, int end) {
+    for (int c = begin; c < end; c++) {
+      const float *plane = in + (size_t)c * s.in_h * s.in_w;
+      float *o = out + (size_t)c * out_size;
+      std::fill_n(o, out_size, bias ? bias[c] : 0.f);
+
+      // a tap at a time over the whole output, on the columns that read inside the image
+      for (int ky = 0; ky < s.kernel_h; ky++) {
+        for (int kx = 0; kx < s.kernel_w; kx++) {
+          const float wv = w[(c * s.kernel_h + ky) * s.kernel_w + kx];
+          const int off = kx * s.dilation_w - s.pad_l;
+          const int x0 = off < 0 ? div_up(-off, s.stride_w) : 0;
+          const int x1 = off < s.in_w ? std::min(s.out_w, (s.in_w - 1 - off) / s.stride_w + 1) : 0;
+          for (int oy = 0; oy < s.out_h; oy++) {
+            const int iy = oy * s.stride_h - s.pad_t + ky * s.dilation_h;
+            if (iy < 0 || iy >= s.in_h) continue;
+            const float *row = plane + iy * s.in_w + off;
+            float *orow = o + oy * s.out_w;
+            if (s.stride_w == 1) {
+              for (int ox = x0; ox < x1; ox++) orow[ox] += wv * row[ox];
+            } else {
+              for (int ox = x0; ox < x1; ox++) orow[ox] += wv * row[ox * s.stride_w];
+            }
+          }
+        }
+      }
+      activate(o, out_size, act, alpha);
+    }
+  });
+}
+
+void dense(ThreadPool &pool, const float *w, int n, int k, const float *x,
+           const float *bias, float *y, Activation act, float alpha) {
+  auto rows = [&](int, int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      const float *row = w + (size_t)i * k;
+      // 8 sums, so it vectorizes without reordering a single one
+      float acc[8] = {};
+      int j = 0;
+      for (; j + 8 <= k; j += 8) {
+        for (int l = 0; l < 8; l++) acc[l] += row[j + l] * x[j + l];
+      }
+      float sum = 0.f;
+      for (int l = 0; l < 8; l++) sum += acc[l];
+      for (; j < k; j++) sum += row[j] * x[j];
+      y[i] = sum + (bias ? bias[i] : 0.f);
+    }
+    activate(y + begin, end - begin, act, alpha);
+  };
+
+  // the small ones aren't worth waking the threads for
+  if ((size_t)n * k < (1 << 15)) {
+    rows(0, 0, n);
+  } else {
+    pool.parallel_for(n, rows);
+  }
+}
+
+void conv_reference(const float *w, int m, const ConvShape &s, const float *in,
+                    const float *bias, float *out, Activation act, float alpha) {
+  for (int oc = 0; oc < m; oc++) {
+    for (int oy = 0; oy < s.out_h; oy++) {
+      for (int ox = 0; ox < s.out_w; ox++) {
+        double sum = bias ? bias[oc] : 0.0;
+        for (int ic = 0; ic < s.in_c; ic++) {
+          for (int ky = 0; ky < s.kernel_h; ky++) {
+            for (int kx = 0; kx < s.kernel_w; kx++) {
+              const int iy = oy * s.stride_h - s.pad_t + ky * s.dilation_h;
+              const int ix = ox * s.stride_w - s.pad_l + kx * s.dilation_w;
+              if (iy < 0 || iy >= s.in_h || ix < 0 || ix >= s.in_w) continue;
+              sum += (double)w[((oc * s.in_c + ic) * s.kernel_h + ky) * s.kernel_w + kx] * in[(ic * s.in_h + iy) * s.in_w + ix];
+            }
+          }
+        }
+        out[(oc * s.out_h + oy) * s.out_w + ox] = sum;
+      }
+    }
+    activate(out + (size_t)oc * s.out_h * s.out_w, s.out_h * s.out_w, act, alpha);
+  }
+}
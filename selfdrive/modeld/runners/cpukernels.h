@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstddef>
+
+#include "selfdrive/common/thread_pool.h"
+
+// Kernels for CPUModel. Everything is float32, NCHW with a batch of one.
+
+// same values as in cpumodel_convert.py
+enum Activation {
+  ACT_NONE = 0,
+  ACT_RELU = 1,
+  ACT_ELU = 2,
+  ACT_LEAKY_RELU = 3,
+  ACT_SIGMOID = 4,
+  ACT_TANH = 5,
+};
+
+void activate(float *x, size_t n, Activation act, float alpha);
+
+// one group of a convolution, in_c is the group's input channels
+struct ConvShape {
+  int in_c, in_h, in_w;
+  int kernel_h, kernel_w;
+  int stride_h, stride_w;
+  int pad_t, pad_l;
+  int dilation_h, dilation_w;
+  int out_h, out_w;
+};
+
+// The convolutions run as one GEMM per group, out[m, n] = w[m, k] * col[k, n],
+// with the weights packed once at load into panels for the micro kernel and
+// the input read into panels straight from the image, without a full im2col
+// buffer. Blocked so a panel of the weights and the input stay in cache, the
+// blocks are split over the threads. The micro kernel is AVX2/FMA (if the CPU
+// has it) or NEON.
+size_t conv_packed_weights_size(int m, int k);
+void conv_pack_weights(const float *w, int m, int k, float *packed);
+size_t conv_workspace_size(int num_threads);
+
+// out[m, out_h * out_w] = act(w * col(in) + bias), bias can be NULL
+void conv_gemm(ThreadPool &pool, const float *packed_w, int m, const ConvShape &shape,
+               const float *in, const float *bias, float *out, Activation act, float alpha,
+               float *workspace);
+
+// one filter per channel, w is [channels][kernel_h][kernel_w]
+void conv_depthwise(ThreadPool &pool, const float *w, int channels, const ConvShape &shape,
+                    const float *in, const float *bias, float *out, Activation act, float alpha);
+
+// y[n] = act(w[n, k] * x + bias)
+void dense(ThreadPool &pool, const float *w, int n, int k, const float *x,
+           const float *bias, float *y, Activation act, float alpha);
+
+// straightforward versions, what the tests check the fast ones against
+void conv_reference(const float *w, int m, const ConvShape &shape, const float *in,
+                    const float *bias, float *out, Activation act, float alpha);
@@ -0,0 +1,508 @@
+#include "selfdrive/modeld/runners/cpumodel.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <thread>
+
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/modeld/runners/cpukernels.h"
+
+namespace {
+
+// same values as in cpumodel_convert.py
+enum {
+  OP_CONV = 0,
+  OP_DENSE = 1,
+  OP_ADD = 2,
+  OP_SUB = 3,
+  OP_MUL = 4,
+  OP_DIV = 5,
+  OP_ACTIVATION = 6,
+  OP_CONCAT = 7,
+  OP_SLICE = 8,
+  OP_MAXPOOL = 9,
+  OP_AVGPOOL = 10,
+  OP_GLOBAL_AVGPOOL = 11,
+  OP_SOFTMAX = 12,
+};
+
+const char *op_names[] = {"conv", "dense", "add", "sub", "mul", "div", "activation",
+                          "concat", "slice", "maxpool", "avgpool", "global_avgpool", "softmax"};
+
+enum {
+  KIND_ACTIVATION = 0,
+  KIND_WEIGHT = 1,
+  KIND_INPUT = 2,
+  KIND_VIEW = 3,
+};
+
+// conv, dense and activation keep the activation in the last attr
+constexpr int ATTR_ACT = 11;
+
+// in floats, the arena and the offsets in it are kept cache line aligned
+constexpr size_t ARENA_ALIGN = 16;
+
+struct Reader {
+  const char *p, *end;
+
+  template <typename T>
+  T read() {
+    assert(p + sizeof(T) <= end);
+    T v;
+    memcpy(&v, p, sizeof(T));
+    p += sizeof(T);
+    return v;
+  }
+
+  std::string read_string() {
+    const int32_t len = read<int32_t>();
+    assert(len >= 0 && p + len <= end);
+    std::string s(p, len);
+    p += len;
+    return s;
+  }
+};
+
+// modeld, its TransformCPU and dmonitoringmodeld all run on the same cores,
+// so each model only takes a share of them by default
+int default_threads() {
+  const char *env = getenv("CPUMODEL_THREADS");
+  return env ? atoi(env) : std::clamp((int)std::thread::hardware_concurrency() / 3, 1, 4);
+}
+
+// small layers aren't worth waking the threads for
+void parallel_for(ThreadPool &pool, int n, size_t work, const std::function<void(int, int, int)> &fn) {
+  if (work < (1 << 15)) {
+    fn(0, 0, n);
+  } else {
+    pool.parallel_for(n, fn);
+  }
+}
+
+// dims and strides padded to 4 dims, with a stride of 0 on the broadcast ones
+void broadcast_strides(const int *dims, int rank, const int out_dims[4], int strides[4]) {
+  int stride = 1;
+  for (int i = 3; i >= 0; i--) {
+    const int d = i - (4 - rank) >= 0 ? dims[i - (4 - rank)] : 1;
+    strides[i] = (d == 1 && out_dims[i] != 1) ? 0 : stride;
+    stride *= d;
+  }
+}
+
+template <typename F>
+void elementwise(ThreadPool &pool, const float *a, size_t a_size, const int *a_dims, int a_rank,
+                 const float *b, size_t b_size, const int *b_dims, int b_rank,
+                 float *out, size_t out_size, const int *dims, int rank, F f) {
+  if (a_size == out_size && b_size == out_size) {
+    parallel_for(pool, out_size, out_size, [&](int, int begin, int end) {
+      for (int i = begin; i < end; i++) out[i] = f(a[i], b[i]);
+    });
+    return;
+  }
+
+  int out_dims[4], sa[4], sb[4];
+  for (int i = 0; i < 4; i++) out_dims[i] = i - (4 - rank) >= 0 ? dims[i - (4 - rank)] : 1;
+  broadcast_strides(a_dims, a_rank, out_dims, sa);
+  broadcast_strides(b_dims, b_rank, out_dims, sb);
+
+  const int rows = out_dims[0] * out_dims[1] * out_dims[2], len = out_dims[3];
+  parallel_for(pool, rows, out_size, [&](int, int begin, int end) {
+    for (int r = begin; r < end; r++) {
+      const int i2 = r % out_dims[2], i1 = (r / out_dims[2]) % out_dims[1], i0 = r / (out_dims[2] * out_dims[1]);
+      const float *pa = a + i0 * sa[0] + i1 * sa[1] + i2 * sa[2];
+      const float *pb = b + i0 * sb[0] + i1 * sb[1] + i2 * sb[2];
+      float *po = out + (size_t)r * len;
+      for (int j = 0; j < len; j++) po[j] = f(pa[j * sa[3]], pb[j * sb[3]]);
+    }
+  });
+}
+
+}  // namespace
+
+CPUModel::CPUModel(const char *path, float *loutput, size_t loutput_size, int runtime) : pool(default_threads()) {
+  // there's only the one runtime
+  (void)runtime;
+  output = loutput;
+  output_size = loutput_size;
+  profile = getenv("CPUMODEL_PROFILE") != NULL;
+
+  std::string fn = path;
+  fn = fn.substr(0, fn.rfind('.')) + ".cpumodel";
+  load(util::read_file(fn));
+  plan_arena();
+  workspace.resize(conv_workspace_size(pool.size()));
+  layer_time.assign(layers.size(), 0.);
+
+  const Tensor &out = tensors[output_tensor];
+  if (output_size != 0) {
+    assert(output_size == out.size);
+  } else {
+    output_size = out.size;
+  }
+  printf("loaded %s: %zu layers, %zu weights, %zu arena, %d threads\n",
+         fn.c_str(), layers.size(), weights.size(), arena_size, pool.size());
+}
+
+void CPUModel::load(const std::string &model_data) {
+  assert(model_data.size() > 8 && model_data.compare(0, 8, "CPUMODEL") == 0);
+  Reader r = {model_data.data() + 8, model_data.data() + model_data.size()};
+
+  const int version = r.read<int32_t>();
+  assert(version == 1);
+  const int n_tensors = r.read<int32_t>();
+  const int n_layers = r.read<int32_t>();
+  const int n_inputs = r.read<int32_t>();
+  const int n_outputs = r.read<int32_t>();
+  const uint64_t weights_size = r.read<uint64_t>();
+
+  tensors.resize(n_tensors);
+  for (auto &t : tensors) {
+    t.kind = r.read<int32_t>();
+    t.rank = r.read<int32_t>();
+    assert(t.rank >= 1 && t.rank <= 4);
+    t.size = 1;
+    for (int i = 0; i < 4; i++) {
+      t.dims[i] = r.read<int32_t>();
+      if (i < t.rank) t.size *= t.dims[i];
+    }
+    t.base = r.read<int32_t>();
+    t.offset = r.read<uint64_t>();
+  }
+
+  for (int i = 0; i < n_inputs; i++) {
+    const std::string name = r.read_string();
+    const int t = r.read<int32_t>();
+    assert(t >= 0 && t < n_tensors && tensors[t].kind == KIND_INPUT);
+    tensors[t].offset = i;
+    input_tensors.push_back(t);
+    printf("input %d: %s (%zu)\n", i, name.c_str(), tensors[t].size);
+  }
+  input_bufs.assign(n_inputs, NULL);
+
+  assert(n_outputs == 1);
+  output_tensor = r.read<int32_t>();
+  assert(output_tensor >= 0 && output_tensor < n_tensors);
+
+  layers.resize(n_layers);
+  for (auto &l : layers) {
+    l.op = r.read<int32_t>();
+    assert(l.op >= OP_CONV && l.op <= OP_SOFTMAX);
+    l.name = r.read_string();
+    l.ins.resize(r.read<int32_t>());
+    for (int &t : l.ins) {
+      t = r.read<int32_t>();
+      assert(t >= 0 && t < n_tensors);
+    }
+    l.out = r.read<int32_t>();
+    assert(l.out >= 0 && l.out < n_tensors && tensors[l.out].kind == KIND_ACTIVATION);
+    for (auto &a : l.attrs) a = r.read<int32_t>();
+    for (auto &a : l.fattrs) a = r.read<float>();
+    l.depthwise = false;
+    l.packed = 0;
+    l.flops = 0;
+  }
+
+  assert(r.p + weights_size * sizeof(float) == r.end);
+  weights.resize(weights_size);
+  memcpy(weights.data(), r.p, weights_size * sizeof(float));
+
+  for (int i = 0; i < n_tensors; i++) {
+    const Tensor &t = tensors[i];
+    if (t.kind == KIND_WEIGHT) {
+      assert(t.offset + t.size <= weights_size);
+    } else if (t.kind == KIND_VIEW) {
+      assert(t.base >= 0 && t.base < i && tensors[t.base].size == t.size);
+    }
+  }
+
+  // pack the convolution weights for the GEMM, once
+  for (auto &l : layers) {
+    if (l.op == OP_CONV) {
+      const Tensor &in = tensors[l.ins[0]], &w = tensors[l.ins[1]], &out = tensors[l.out];
+      const int *a = l.attrs;
+      const int group = a[8], m = out.dims[1], k = in.dims[1] / group * a[0] * a[1];
+      assert(in.rank == 4 && out.rank == 4 && w.kind == KIND_WEIGHT && w.size == (size_t)m * k);
+      assert(out.dims[2] == (in.dims[2] + a[4] + a[6] - a[9] * (a[0] - 1) - 1) / a[2] + 1);
+      assert(out.dims[3] == (in.dims[3] + a[5] + a[7] - a[10] * (a[1] - 1) - 1) / a[3] + 1);
+
+      l.flops = 2. * m * k * out.dims[2] * out.dims[3];
+      l.depthwise = group > 1 && group == in.dims[1] && group == m;
+      if (!l.depthwise) {
+        l.packed = packed_weights.size();
+        const size_t group_size = conv_packed_weights_size(m / group, k);
+        packed_weights.resize(l.packed + group_size * group);
+        for (int g = 0; g < group; g++) {
+          conv_pack_weights(&weights[w.offset] + (size_t)g * (m / group) * k, m / group, k,
+                            &packed_weights[l.packed + g * group_size]);
+        }
+      }
+    } else if (l.op == OP_DENSE) {
+      assert(tensors[l.ins[1]].size == tensors[l.ins[0]].size * tensors[l.out].size);
+      l.flops = 2. * tensors[l.ins[1]].size;
+    } else if (l.op == OP_CONCAT) {
+      size_t size = 0;
+      for (int t : l.ins) size += tensors[t].size;
+      assert(size == tensors[l.out].size);
+    } else if (l.op == OP_ACTIVATION || l.op == OP_SOFTMAX) {
+      assert(tensors[l.ins[0]].size == tensors[l.out].size);
+    }
+  }
+}
+
+// First fit by lifetime. A layer's output never shares memory with its inputs,
+// and a view keeps what it's a view of alive.
+void CPUModel::plan_arena() {
+  auto root = [&](int t) {
+    while (tensors[t].kind == KIND_VIEW) t = tensors[t].base;
+    return t;
+  };
+
+  const size_t none = SIZE_MAX;
+  std::vector<size_t> first(tensors.size(), none), last(tensors.size(), 0);
+  for (size_t i = 0; i < layers.size(); i++) {
+    for (int t : layers[i].ins) last[root(t)] = std::max(last[root(t)], i);
+    if (first[layers[i].out] == none) first[layers[i].out] = last[layers[i].out] = i;
+  }
+  last[root(output_tensor)] = layers.size();
+
+  struct Block {
+    size_t offset, size;
+    size_t first, last;
+  };
+  std::vector<Block> placed;
+  arena_size = 0;
+  for (size_t i = 0; i < layers.size(); i++) {
+    const int t = layers[i].out;
+    if (first[t] != i) continue;
+    const size_t size = (tensors[t].size + ARENA_ALIGN - 1) / ARENA_ALIGN * ARENA_ALIGN;
+
+    size_t offset = 0;
+    for (bool moved = true; moved;) {
+      moved = false;
+      for (const auto &b : placed) {
+        const bool alive = !(b.last < first[t] || last[t] < b.first);
+        if (alive && offset < b.offset + b.size && b.offset < offset + size) {
+          offset = b.offset + b.size;
+          moved = true;
+        }
+      }
+    }
+    placed.push_back({offset, size, first[t], last[t]});
+    tensors[t].offset = offset;
+    arena_size = std::max(arena_size, offset + size);
+  }
+
+  for (size_t t = 0; t < tensors.size(); t++) {
+    assert(tensors[t].kind != KIND_ACTIVATION || first[t] != none);
+  }
+  // the offsets are multiples of ARENA_ALIGN, so is the size
+  arena.reset((float *)aligned_alloc(ARENA_ALIGN * sizeof(float), std::max(arena_size, ARENA_ALIGN) * sizeof(float)));
+  assert(arena);
+  memset(arena.get(), 0, arena_size * sizeof(float));
+}
+
+float *CPUModel::data(int t) {
+  const Tensor &x = tensors[t];
+  switch (x.kind) {
+    case KIND_ACTIVATION: return &arena[x.offset];
+    case KIND_WEIGHT: return &weights[x.offset];
+    case KIND_INPUT: return input_bufs[x.offset];
+    default: return data(x.base);
+  }
+}
+
+void CPUModel::addRecurrent(float *state, int state_size) {
+  addExtra(state, state_size, 3);
+}
+
+void CPUModel::addTrafficConvention(float *state, int state_size) {
+  addExtra(state, state_size, 2);
+}
+
+void CPUModel::addDesire(float *state, int state_size) {
+  addExtra(state, state_size, 1);
+}
+
+void CPUModel::addExtra(float *state, int state_size, int idx) {
+  assert(idx >= 0 && (size_t)idx < input_tensors.size());
+  assert(tensors[input_tensors[idx]].size == (size_t)state_size);
+  printf("adding index %d\n", idx);
+  input_bufs[idx] = state;
+}
+
+void CPUModel::execute(float *net_input_buf, int buf_size) {
+  assert(tensors[input_tensors[0]].size == (size_t)buf_size);
+  input_bufs[0] = net_input_buf;
+  for (auto p : input_bufs) assert(p != NULL);
+
+  for (size_t i = 0; i < layers.size(); i++) {
+    const uint64_t start = profile ? nanos_since_boot() : 0;
+    run(layers[i]);
+    if (profile) layer_time[i] += nanos_since_boot() - start;
+  }
+
+  // last, the recurrent state is read from the output
+  memcpy(output, data(output_tensor), output_size * sizeof(float));
+
+  if (profile && ++runs == 100) {
+    report();
+    runs = 0;
+    std::fill(layer_time.begin(), layer_time.end(), 0.);
+  }
+}
+
+void CPUModel::run(const Layer &l) {
+  const Tensor &in = tensors[l.ins[0]], &out = tensors[l.out];
+  const float *x = data(l.ins[0]);
+  float *y = data(l.out);
+  const int *a = l.attrs;
+
+  switch (l.op) {
+    case OP_CONV: {
+      const float *bias = l.ins.size() > 2 ? data(l.ins[2]) : NULL;
+      const int group = a[8], m = out.dims[1] / group;
+      const ConvShape shape = {in.dims[1] / group, in.dims[2], in.dims[3], a[0], a[1], a[2], a[3],
+                               a[4], a[5], a[9], a[10], out.dims[2], out.dims[3]};
+      const Activation act = (Activation)a[ATTR_ACT];
+      if (l.depthwise) {
+        conv_depthwise(pool, data(l.ins[1]), group, shape, x, bias, y, act, l.fattrs[0]);
+        break;
+      }
+      const size_t group_size = conv_packed_weights_size(m, shape.in_c * shape.kernel_h * shape.kernel_w);
+      for (int g = 0; g < group; g++) {
+        conv_gemm(pool, &packed_weights[l.packed + g * group_size], m, shape,
+                  x + (size_t)g * shape.in_c * shape.in_h * shape.in_w, bias ? bias + g * m : NULL,
+                  y + (size_t)g * m * shape.out_h * shape.out_w, act, l.fattrs[0], workspace.data());
+      }
+      break;
+    }
+    case OP_DENSE:
+      dense(pool, data(l.ins[1]), out.size, in.size, x, l.ins.size() > 2 ? data(l.ins[2]) : NULL,
+            y, (Activation)a[ATTR_ACT], l.fattrs[0]);
+      break;
+    case OP_ADD:
+    case OP_SUB:
+    case OP_MUL:
+    case OP_DIV: {
+      const Tensor &in2 = tensors[l.ins[1]];
+      const float *x2 = data(l.ins[1]);
+#define ELEMENTWISE(expr) \
+      elementwise(pool, x, in.size, in.dims, in.rank, x2, in2.size, in2.dims, in2.rank, \
+                  y, out.size, out.dims, out.rank, [](float p, float q) { return expr; })
+      if (l.op == OP_ADD) ELEMENTWISE(p + q);
+      else if (l.op == OP_SUB) ELEMENTWISE(p - q);
+      else if (l.op == OP_MUL) ELEMENTWISE(p * q);
+      else ELEMENTWISE(p / q);
+#undef ELEMENTWISE
+      break;
+    }
+    case OP_ACTIVATION:
+      memcpy(y, x, out.size * sizeof(float));
+      activate(y, out.size, (Activation)a[ATTR_ACT], l.fattrs[0]);
+      break;
+    case OP_CONCAT: {
+      // a[0] is the axis
+      size_t outer = 1;
+      for (int i = 0; i < a[0]; i++) outer *= out.dims[i];
+      const size_t out_inner = out.size / outer;
+      size_t pos = 0;
+      for (int t : l.ins) {
+        const size_t inner = tensors[t].size / outer;
+        const float *src = data(t);
+        for (size_t o = 0; o < outer; o++) memcpy(y + o * out_inner + pos, src + o * inner, inner * sizeof(float));
+        pos += inner;
+      }
+      break;
+    }
+    case OP_SLICE: {
+      // axis, start, end, step, start is already clamped
+      size_t outer = 1, inner = 1;
+      for (int i = 0; i < a[0]; i++) outer *= out.dims[i];
+      for (int i = a[0] + 1; i < out.rank; i++) inner *= out.dims[i];
+      const int in_len = in.dims[a[0]], out_len = out.dims[a[0]];
+      for (size_t o = 0; o < outer; o++) {
+        for (int j = 0; j < out_len; j++) {
+          memcpy(y + (o * out_len + j) * inner, x + (o * in_len + a[1] + j * a[3]) * inner, inner * sizeof(float));
+        }
+      }
+      break;
+    }
+    case OP_MAXPOOL:
+    case OP_AVGPOOL: {
+      // kernel_h, kernel_w, stride_h, stride_w, pad_t, pad_l, pad_b, pad_r, count_include_pad
+      const bool is_max = l.op == OP_MAXPOOL;
+      parallel_for(pool, in.dims[1], out.size * a[0] * a[1], [&](int, int begin, int end) {
+        for (int c = begin; c < end; c++) {
+          const float *plane = x + (size_t)c * in.dims[2] * in.dims[3];
+          float *o = y + (size_t)c * out.dims[2] * out.dims[3];
+          for (int oy = 0; oy < out.dims[2]; oy++) {
+            for (int ox = 0; ox < out.dims[3]; ox++) {
+              float acc = is_max ? -INFINITY : 0.f;
+              int count = 0;
+              for (int ky = 0; ky < a[0]; ky++) {
+                const int iy = oy * a[2] - a[4] + ky;
+                if (iy < 0 || iy >= in.dims[2]) continue;
+                for (int kx = 0; kx < a[1]; kx++) {
+                  const int ix = ox * a[3] - a[5] + kx;
+                  if (ix < 0 || ix >= in.dims[3]) continue;
+                  const float v = plane[iy * in.dims[3] + ix];
+                  acc = is_max ? std::max(acc, v) : acc + v;
+                  count++;
+                }
+              }
+              if (!is_max) {
+                const int h = std::min(oy * a[2] - a[4] + a[0], in.dims[2] + a[6]) - (oy * a[2] - a[4]);
+                const int w = std::min(ox * a[3] - a[5] + a[1], in.dims[3] + a[7]) - (ox * a[3] - a[5]);
+                acc /= a[8] ? h * w : count;
+              }
+              o[oy * out.dims[3] + ox] = acc;
+            }
+          }
+        }
+      });
+      break;
+    }
+    case OP_GLOBAL_AVGPOOL: {
+      const int size = in.dims[2] * in.dims[3];
+      for (int c = 0; c < in.dims[1]; c++) {
+        float sum = 0.f;
+        for (int i = 0; i < size; i++) sum += x[(size_t)c * size + i];
+        y[c] = sum / size;
+      }
+      break;
+    }
+    case OP_SOFTMAX: {
+      // over the last axis
+      const int len = out.dims[out.rank - 1];
+      for (size_t r = 0; r < out.size / len; r++) {
+        const float *src = x + r * len;
+        float *dst = y + r * len;
+        const float max = *std::max_element(src, src + len);
+        float sum = 0.f;
+        for (int i = 0; i < len; i++) sum += (dst[i] = expf(src[i] - max));
+        for (int i = 0; i < len; i++) dst[i] /= sum;
+      }
+      break;
+    }
+  }
+}
+
+void CPUModel::report() {
+  double total = 0.;
+  for (double t : layer_time) total += t;
+  printf("cpumodel: %.2f ms per run over %d runs, %d threads\n", total / runs / 1e6, runs, pool.size());
+  printf("  %-40s %-16s %8s %6s %8s\n", "layer", "op", "ms", "%", "GFLOP/s");
+  for (size_t i = 0; i < layers.size(); i++) {
+    const Layer &l = layers[i];
+    printf("  %-40s %-16s %8.3f %5.1f%%", l.name.c_str(), op_names[l.op],
+           layer_time[i] / runs / 1e6, 100. * layer_time[i] / total);
+    if (l.flops > 0 && layer_time[i] > 0) printf(" %8.2f", l.flops * runs / layer_time[i]);
+    printf("\n");
+  }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "selfdrive/common/thread_pool.h"
+#include "selfdrive/modeld/runners/runmodel.h"
+
+// Runs a model on the CPU from a .cpumodel file, which cpumodel_convert.py
+// makes out of the onnx model. Like SNPEModel the inputs are the image, then
+// desire, traffic convention and the recurrent state, and there's one output.
+// The activations all live in one arena that's laid out at load, so execute
+// doesn't allocate. CPUMODEL_THREADS sets the number of threads (by default
+// a third of the cores, up to 4), and CPUMODEL_PROFILE prints the time spent
+// in each layer every 100 runs.
+class CPUModel : public RunModel {
+public:
+  // path can be the .dlc, the .cpumodel next to it is loaded
+  CPUModel(const char *path, float *output, size_t output_size, int runtime);
+  void addRecurrent(float *state, int state_size);
+  void addTrafficConvention(float *state, int state_size);
+  void addDesire(float *state, int state_size);
+  void execute(float *net_input_buf, int buf_size);
+
+private:
+  struct Tensor {
+    int kind;
+    int rank;
+    int dims[4];
+    int base;
+    uint64_t offset;
+    size_t size;
+  };
+
+  struct Layer {
+    int op;
+    std::string name;
+    std::vector<int> ins;
+    int out;
+    int32_t attrs[12];
+    float fattrs[4];
+    // convolutions, set up at load
+    bool depthwise;
+    size_t packed;
+    double flops;
+  };
+
+  void addExtra(float *state, int state_size, int idx);
+  void load(const std::string &model_data);
+  void plan_arena();
+  float *data(int tensor);
+  void run(const Layer &l);
+  void report();
+
+  ThreadPool pool;
+
+  std::vector<Tensor> tensors;
+  std::vector<Layer> layers;
+  std::vector<int> input_tensors;
+  std::vector<float *> input_bufs;
+  int output_tensor;
+
+  std::vector<float> weights;
+  std::vector<float> packed_weights;
+  struct FreeDeleter {
+    void operator()(float *p) const { free(p); }
+  };
+  std::unique_ptr<float[], FreeDeleter> arena; // aligned_alloc'd
+  size_t arena_size = 0;
+  std::vector<float> workspace;
+
+  float *output;
+  size_t output_size;
+
+  bool profile;
+  int runs = 0;
+  std::vector<double> layer_time;
+};
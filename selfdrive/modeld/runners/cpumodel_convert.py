@@ -0,0 +1,310 @@
+#!/usr/bin/env python3
+"""Converts an onnx model to the .cpumodel file that runners/cpumodel.cc runs.
+
+  cpumodel_convert.py models/supercombo.onnx models/supercombo.cpumodel
+
+Batch norms and zero pads are folded into the convolutions, activations and
+biases into the layer before them, and reshapes become views. Anything the
+runner can't do is an error here rather than at runtime.
+"""
+import struct
+import sys
+
+import numpy as np
+import onnx
+from onnx import numpy_helper, shape_inference
+
+# same values as in cpumodel.cc and cpukernels.h
+OP_CONV, OP_DENSE, OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_ACTIVATION, OP_CONCAT, OP_SLICE, \
+  OP_MAXPOOL, OP_AVGPOOL, OP_GLOBAL_AVGPOOL, OP_SOFTMAX = range(13)
+ACT_NONE, ACT_RELU, ACT_ELU, ACT_LEAKY_RELU, ACT_SIGMOID, ACT_TANH = range(6)
+KIND_ACTIVATION, KIND_WEIGHT, KIND_INPUT, KIND_VIEW = range(4)
+ATTR_ACT = 11
+
+ELEMENTWISE = {'Add': OP_ADD, 'Sub': OP_SUB, 'Mul': OP_MUL, 'Div': OP_DIV}
+ACTIVATIONS = {'Relu': ACT_RELU, 'Elu': ACT_ELU, 'LeakyRelu': ACT_LEAKY_RELU,
+               'Sigmoid': ACT_SIGMOID, 'Tanh': ACT_TANH}
+DEFAULT_ALPHA = {'Elu': 1.0, 'LeakyRelu': 0.01}
+VIEWS = ('Reshape', 'Flatten', 'Squeeze', 'Unsqueeze', 'Identity', 'Dropout')
+
+
+class Node:
+  def __init__(self, node):
+    self.op = node.op_type
+    self.name = node.name or node.output[0]
+    self.inputs = list(node.input)
+    self.outputs = list(node.output)
+    self.attrs = {a.name: onnx.helper.get_attribute_value(a) for a in node.attribute}
+
+
+class Converter:
+  def __init__(self, model):
+    model = shape_inference.infer_shapes(model)
+    graph = model.graph
+
+    self.consts = {i.name: numpy_helper.to_array(i).astype(np.float32) for i in graph.initializer}
+    self.shapes = {}
+    for v in list(graph.input) + list(graph.value_info) + list(graph.output):
+      dims = v.type.tensor_type.shape.dim
+      if all(d.HasField('dim_value') for d in dims):
+        self.shapes[v.name] = tuple(d.dim_value for d in dims)
+
+    self.nodes = [Node(n) for n in graph.node]
+    self.graph_inputs = [i.name for i in graph.input if i.name not in self.consts]
+    self.graph_outputs = [o.name for o in graph.output]
+    assert len(self.graph_outputs) == 1, "only one output is supported"
+
+    self.tensors = []  # kind, shape, base, offset
+    self.layers = []   # op, name, ins, out, attrs, fattrs
+    self.weights = []
+    self.weights_size = 0
+    self.ids = {}
+    self.producer = {}
+
+  def shape(self, name):
+    if name in self.consts:
+      return self.consts[name].shape
+    assert name in self.shapes, f"{name} has no static shape"
+    return self.shapes[name]
+
+  def add_tensor(self, kind, shape, base=-1, offset=0):
+    shape = tuple(shape) if len(shape) > 0 else (1,)
+    assert len(shape) <= 4, f"rank {len(shape)} isn't supported"
+    self.tensors.append((kind, shape, base, offset))
+    return len(self.tensors) - 1
+
+  def add_weight(self, arr):
+    arr = np.ascontiguousarray(arr, dtype=np.float32)
+    t = self.add_tensor(KIND_WEIGHT, arr.shape, offset=self.weights_size)
+    self.weights.append(arr.ravel())
+    self.weights_size += arr.size
+    return t
+
+  def ref(self, name):
+    if name not in self.ids:
+      assert name in self.consts, f"{name} isn't produced by anything"
+      self.ids[name] = self.add_weight(self.consts[name])
+    return self.ids[name]
+
+  def add_layer(self, op, name, ins, out_name, attrs=(), fattrs=()):
+    out = self.add_tensor(KIND_ACTIVATION, self.shape(out_name))
+    attrs = list(attrs) + [0] * (12 - len(attrs))
+    fattrs = list(fattrs) + [0.0] * (4 - len(fattrs))
+    self.layers.append([op, name, ins, out, attrs, fattrs])
+    self.ids[out_name] = out
+    self.producer[out] = len(self.layers) - 1
+    return out
+
+  def consumers(self, name):
+    n = sum(i == name for node in self.nodes for i in node.inputs)
+    return n + (name in self.graph_outputs)
+
+  def fusable(self, name, ops):
+    # the single use of the output of a layer in ops
+    t = self.ids.get(name)
+    if t is None or t not in self.producer or self.consumers(name) != 1:
+      return None
+    layer = self.layers[self.producer[t]]
+    return layer if layer[0] in ops else None
+
+  def fold(self):
+    # batch norm into the conv before it, zero pads into the conv after
+    producer = {o: n for n in self.nodes for o in n.outputs}
+    for n in list(self.nodes):
+      if n.op == 'BatchNormalization':
+        conv = producer.get(n.inputs[0])
+        if conv is None or conv.op != 'Conv' or self.consumers(n.inputs[0]) != 1:
+          continue
+        if not all(i in self.consts for i in n.inputs[1:] + conv.inputs[1:]):
+          continue
+        gamma, beta, mean, var = (self.consts[i] for i in n.inputs[1:5])
+        scale = gamma / np.sqrt(var + n.attrs.get('epsilon', 1e-5))
+        w = self.consts[conv.inputs[1]]
+        b = self.consts[conv.inputs[2]] if len(conv.inputs) > 2 else np.zeros(w.shape[0], dtype=np.float32)
+        self.consts[conv.name + '_folded_w'] = w * scale.reshape(-1, 1, 1, 1)
+        self.consts[conv.name + '_folded_b'] = (b - mean) * scale + beta
+        conv.inputs = [conv.inputs[0], conv.name + '_folded_w', conv.name + '_folded_b']
+        conv.outputs = n.outputs
+        producer[n.outputs[0]] = conv
+        self.nodes.remove(n)
+
+      elif n.op == 'Conv':
+        pad = producer.get(n.inputs[0])
+        if pad is None or pad.op != 'Pad' or self.consumers(n.inputs[0]) != 1:
+          continue
+        if pad.attrs.get('mode', b'constant') != b'constant':
+          continue
+        pads = pad.attrs['pads'] if 'pads' in pad.attrs else self.consts.get(pad.inputs[1])
+        value = pad.attrs.get('value', 0.0)
+        if len(pad.inputs) > 2 and pad.inputs[2]:
+          value = float(self.consts[pad.inputs[2]])
+        if pads is None or value != 0.0 or len(pads) != 8 or any(pads[i] != 0 for i in (0, 1, 4, 5)):
+          continue
+        conv_pads = list(n.attrs.get('pads', [0, 0, 0, 0]))
+        n.attrs['pads'] = [conv_pads[0] + int(pads[2]), conv_pads[1] + int(pads[3]),
+                           conv_pads[2] + int(pads[6]), conv_pads[3] + int(pads[7])]
+        n.inputs[0] = pad.inputs[0]
+        self.nodes.remove(pad)
+
+  def convert(self):
+    self.fold()
+    for name in self.graph_inputs:
+      self.ids[name] = self.add_tensor(KIND_INPUT, self.shape(name))
+
+    for n in self.nodes:
+      if n.op == 'Constant':
+        self.consts[n.outputs[0]] = numpy_helper.to_array(n.attrs['value']).astype(np.float32)
+      elif all(i in self.consts for i in n.inputs if i) and n.op in VIEWS:
+        self.consts[n.outputs[0]] = self.consts[n.inputs[0]].reshape(self.shape(n.outputs[0]))
+      elif n.op in VIEWS:
+        base = self.ref(n.inputs[0])
+        self.ids[n.outputs[0]] = self.add_tensor(KIND_VIEW, self.shape(n.outputs[0]), base=base)
+      elif n.op == 'Conv':
+        self.conv(n)
+      elif n.op in ('Gemm', 'MatMul'):
+        self.dense(n)
+      elif n.op in ACTIVATIONS:
+        self.activation(n)
+      elif n.op in ELEMENTWISE:
+        self.elementwise(n)
+      elif n.op == 'Concat':
+        axis = n.attrs['axis'] % len(self.shape(n.outputs[0]))
+        self.add_layer(OP_CONCAT, n.name, [self.ref(i) for i in n.inputs], n.outputs[0], [axis])
+      elif n.op == 'Slice':
+        self.slice(n)
+      elif n.op in ('MaxPool', 'AveragePool'):
+        assert n.attrs.get('auto_pad', b'NOTSET') in (b'NOTSET', b'VALID'), f"{n.name}: auto_pad isn't supported"
+        assert n.attrs.get('ceil_mode', 0) == 0, f"{n.name}: ceil_mode isn't supported"
+        kh, kw = n.attrs['kernel_shape']
+        sh, sw = n.attrs.get('strides', [1, 1])
+        pt, pl, pb, pr = n.attrs.get('pads', [0, 0, 0, 0])
+        op = OP_MAXPOOL if n.op == 'MaxPool' else OP_AVGPOOL
+        self.add_layer(op, n.name, [self.ref(n.inputs[0])], n.outputs[0],
+                       [kh, kw, sh, sw, pt, pl, pb, pr, n.attrs.get('count_include_pad', 0)])
+      elif n.op == 'GlobalAveragePool':
+        self.add_layer(OP_GLOBAL_AVGPOOL, n.name, [self.ref(n.inputs[0])], n.outputs[0])
+      elif n.op == 'Softmax':
+        rank = len(self.shape(n.inputs[0]))
+        axis = n.attrs.get('axis', -1) % rank
+        assert axis == rank - 1, f"{n.name}: softmax is only supported over the last axis"
+        self.add_layer(OP_SOFTMAX, n.name, [self.ref(n.inputs[0])], n.outputs[0])
+      else:
+        raise NotImplementedError(f"{n.name}: {n.op} isn't supported")
+
+    assert all(name in self.ids for name in self.graph_outputs), "the output is a constant"
+
+  def conv(self, n):
+    assert n.attrs.get('auto_pad', b'NOTSET') in (b'NOTSET', b'VALID'), f"{n.name}: auto_pad isn't supported"
+    w = self.consts[n.inputs[1]]
+    assert w.ndim == 4, f"{n.name}: only 2d convolutions are supported"
+    kh, kw = w.shape[2:]
+    sh, sw = n.attrs.get('strides', [1, 1])
+    pt, pl, pb, pr = n.attrs.get('pads', [0, 0, 0, 0])
+    dh, dw = n.attrs.get('dilations', [1, 1])
+    ins = [self.ref(n.inputs[0]), self.add_weight(w)]
+    if len(n.inputs) > 2 and n.inputs[2]:
+      ins.append(self.ref(n.inputs[2]))
+    self.add_layer(OP_CONV, n.name, ins, n.outputs[0],
+                   [kh, kw, sh, sw, pt, pl, pb, pr, n.attrs.get('group', 1), dh, dw, ACT_NONE])
+
+  def dense(self, n):
+    a, b = n.inputs[0], n.inputs[1]
+    assert a not in self.consts and b in self.consts, f"{n.name}: only activation x weight is supported"
+    assert np.prod(self.shape(a)[:-1]) == 1, f"{n.name}: only a batch of one is supported"
+    w = self.consts[b]
+    bias = None
+    if n.op == 'Gemm':
+      assert not n.attrs.get('transA', 0), f"{n.name}: transA isn't supported"
+      w = w if n.attrs.get('transB', 0) else w.T
+      w = w * n.attrs.get('alpha', 1.0)
+      if len(n.inputs) > 2 and n.inputs[2]:
+        bias = (self.consts[n.inputs[2]] * n.attrs.get('beta', 1.0)).reshape(-1)
+        bias = np.broadcast_to(bias, (w.shape[0],))
+    else:
+      w = w.T
+    ins = [self.ref(a), self.add_weight(w)]
+    if bias is not None:
+      ins.append(self.add_weight(bias))
+    self.add_layer(OP_DENSE, n.name, ins, n.outputs[0], [0] * ATTR_ACT + [ACT_NONE])
+
+  def activation(self, n):
+    act = ACTIVATIONS[n.op]
+    alpha = n.attrs.get('alpha', DEFAULT_ALPHA.get(n.op, 0.0))
+    layer = self.fusable(n.inputs[0], (OP_CONV, OP_DENSE))
+    if layer is not None and layer[4][ATTR_ACT] == ACT_NONE:
+      layer[4][ATTR_ACT] = act
+      layer[5][0] = alpha
+      self.ids[n.outputs[0]] = layer[3]
+      return
+    self.add_layer(OP_ACTIVATION, n.name, [self.ref(n.inputs[0])], n.outputs[0],
+                   [0] * ATTR_ACT + [act], [alpha])
+
+  def elementwise(self, n):
+    # a bias after a MatMul
+    if n.op == 'Add':
+      for x, b in (n.inputs, n.inputs[::-1]):
+        layer = self.fusable(x, (OP_DENSE,))
+        if layer is not None and b in self.consts and len(layer[2]) == 2 and layer[4][ATTR_ACT] == ACT_NONE \
+           and self.consts[b].size == self.tensors[layer[3]][1][-1] and self.shape(n.outputs[0]) == self.shape(x):
+          layer[2].append(self.add_weight(self.consts[b].reshape(-1)))
+          self.ids[n.outputs[0]] = layer[3]
+          return
+    self.add_layer(ELEMENTWISE[n.op], n.name, [self.ref(i) for i in n.inputs], n.outputs[0])
+
+  def slice(self, n):
+    shape = self.shape(n.inputs[0])
+    if 'starts' in n.attrs:
+      starts, ends = n.attrs['starts'], n.attrs['ends']
+      axes = n.attrs.get('axes', range(len(starts)))
+      steps = [1] * len(starts)
+    else:
+      starts, ends = self.consts[n.inputs[1]].astype(np.int64), self.consts[n.inputs[2]].astype(np.int64)
+      axes = self.consts[n.inputs[3]].astype(np.int64) if len(n.inputs) > 3 and n.inputs[3] else range(len(starts))
+      steps = self.consts[n.inputs[4]].astype(np.int64) if len(n.inputs) > 4 and n.inputs[4] else [1] * len(starts)
+
+    # one layer per axis
+    x = self.ref(n.inputs[0])
+    axes = [int(a) % len(shape) for a in axes]
+    for i, (axis, start, end, step) in enumerate(zip(axes, starts, ends, steps)):
+      start, end, step = slice(int(start), int(end), int(step)).indices(shape[axis])
+      out_shape = list(shape)
+      out_shape[axis] = len(range(start, end, step))
+      if i == len(axes) - 1:
+        out_name = n.outputs[0]
+      else:
+        out_name = f"{n.outputs[0]}_{i}"
+        self.shapes[out_name] = tuple(out_shape)
+      x = self.add_layer(OP_SLICE, n.name, [x], out_name, [axis, start, 0, step])
+      shape = tuple(out_shape)
+
+  def serialize(self):
+    out = bytearray(b'CPUMODEL')
+    out += struct.pack('<5iQ', 1, len(self.tensors), len(self.layers), len(self.graph_inputs), 1, self.weights_size)
+    for kind, shape, base, offset in self.tensors:
+      dims = list(shape) + [0] * (4 - len(shape))
+      out += struct.pack('<7iQ', kind, len(shape), *dims, base, offset)
+    for name in self.graph_inputs:
+      out += struct.pack('<i', len(name.encode())) + name.encode() + struct.pack('<i', self.ids[name])
+    out += struct.pack('<i', self.ids[self.graph_outputs[0]])
+    for op, name, ins, t, attrs, fattrs in self.layers:
+      out += struct.pack('<2i', op, len(name.encode())) + name.encode()
+      out += struct.pack(f'<i{len(ins)}ii', len(ins), *ins, t)
+      out += struct.pack('<12i4f', *attrs, *fattrs)
+    for w in self.weights:
+      out += w.astype('<f4').tobytes()
+    return bytes(out)
+
+
+def convert(onnx_path, out_path):
+  c = Converter(onnx.load(onnx_path))
+  c.convert()
+  with open(out_path, 'wb') as f:
+    f.write(c.serialize())
+  print(f"{onnx_path}: {len(c.layers)} layers, {c.weights_size} weights -> {out_path}")
+
+
+if __name__ == "__main__":
+  if len(sys.argv) != 3:
+    print(f"usage: {sys.argv[0]} <model.onnx> <model.cpumodel>")
+    sys.exit(1)
+  convert(sys.argv[1], sys.argv[2])
@@ -3,7 +3,10 @@
 #include "runmodel.h"
 #include "snpemodel.h"
 
-#if defined(QCOM) || defined(QCOM2)
+#ifdef USE_CPU_MODEL
+#include "cpumodel.h"
+#define DefaultRunModel CPUModel
+#elif defined(QCOM) || defined(QCOM2)
 #include "thneedmodel.h"
 #define DefaultRunModel SNPEModel
 #else
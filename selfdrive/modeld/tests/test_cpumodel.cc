@@ -0,0 +1,256 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/modeld/runners/cpukernels.h"
+#include "selfdrive/modeld/runners/cpumodel.h"
+
+static std::vector<float> random_vector(size_t size, int seed) {
+  std::mt19937 gen(seed);
+  std::uniform_real_distribution<float> dist(-1.f, 1.f);
+  std::vector<float> v(size);
+  for (auto &x : v) x = dist(gen);
+  return v;
+}
+
+static void require_close(const std::vector<float> &out, const std::vector<float> &expected) {
+  REQUIRE(out.size() == expected.size());
+  for (size_t i = 0; i < out.size(); i++) {
+    INFO("at " << i);
+    REQUIRE(out[i] == Approx(expected[i]).margin(1e-4));
+  }
+}
+
+static ConvShape conv_shape(int in_c, int in_h, int in_w, int kernel, int stride, int pad, int dilation) {
+  const int out_h = (in_h + 2 * pad - dilation * (kernel - 1) - 1) / stride + 1;
+  const int out_w = (in_w + 2 * pad - dilation * (kernel - 1) - 1) / stride + 1;
+  return {in_c, in_h, in_w, kernel, kernel, stride, stride, pad, pad, dilation, dilation, out_h, out_w};
+}
+
+TEST_CASE("conv_gemm matches conv_reference") {
+  ThreadPool pool(3);
+  // in_c, in_h, in_w, out_c, kernel, stride, pad, dilation, partial tiles and more than one k block
+  const int cases[][8] = {
+    {3, 32, 64, 16, 3, 2, 1, 1},
+    {16, 17, 23, 7, 3, 1, 1, 1},
+    {300, 8, 16, 13, 1, 1, 0, 1},
+    {64, 16, 16, 32, 3, 1, 2, 2},
+    {32, 9, 9, 40, 5, 2, 2, 1},
+    {8, 4, 4, 1, 1, 1, 0, 1},
+  };
+  int seed = 0;
+  for (auto &c : cases) {
+    const ConvShape shape = conv_shape(c[0], c[1], c[2], c[4], c[5], c[6], c[7]);
+    const int m = c[3], k = c[0] * c[4] * c[4];
+    const auto w = random_vector((size_t)m * k, seed++);
+    const auto bias = random_vector(m, seed++);
+    const auto in = random_vector((size_t)c[0] * c[1] * c[2], seed++);
+
+    std::vector<float> packed(conv_packed_weights_size(m, k)), workspace(conv_workspace_size(pool.size()));
+    conv_pack_weights(w.data(), m, k, packed.data());
+    for (Activation act : {ACT_NONE, ACT_RELU, ACT_ELU}) {
+      std::vector<float> out((size_t)m * shape.out_h * shape.out_w), expected(out.size());
+      conv_reference(w.data(), m, shape, in.data(), bias.data(), expected.data(), act, 1.f);
+      conv_gemm(pool, packed.data(), m, shape, in.data(), bias.data(), out.data(), act, 1.f, workspace.data());
+      require_close(out, expected);
+    }
+  }
+}
+
+TEST_CASE("conv_depthwise matches conv_reference per channel") {
+  ThreadPool pool(2);
+  // channels, in_h, in_w, kernel, stride, pad, dilation
+  const int cases[][7] = {
+    {8, 16, 32, 3, 1, 1, 1},
+    {5, 15, 17, 3, 2, 1, 1},
+    {4, 12, 12, 5, 1, 4, 2},
+    {3, 7, 9, 3, 3, 0, 1},
+  };
+  int seed = 100;
+  for (auto &c : cases) {
+    const int channels = c[0], kernel = c[3];
+    ConvShape shape = conv_shape(1, c[1], c[2], kernel, c[4], c[5], c[6]);
+    const auto w = random_vector((size_t)channels * kernel * kernel, seed++);
+    const auto bias = random_vector(channels, seed++);
+    const auto in = random_vector((size_t)channels * c[1] * c[2], seed++);
+    const size_t plane = shape.out_h * shape.out_w;
+
+    std::vector<float> out(channels * plane), expected(out.size());
+    for (int ch = 0; ch < channels; ch++) {
+      conv_reference(&w[ch * kernel * kernel], 1, shape, &in[(size_t)ch * c[1] * c[2]], &bias[ch],
+                     &expected[ch * plane], ACT_LEAKY_RELU, 0.1f);
+    }
+    conv_depthwise(pool, w.data(), channels, shape, in.data(), bias.data(), out.data(), ACT_LEAKY_RELU, 0.1f);
+    require_close(out, expected);
+  }
+}
+
+TEST_CASE("dense matches a plain matrix vector product") {
+  ThreadPool pool(4);
+  for (auto [n, k] : {std::pair{10, 7}, {512, 1024}, {33, 2049}}) {
+    const auto w = random_vector((size_t)n * k, n);
+    const auto x = random_vector(k, k);
+    const auto bias = random_vector(n, n + k);
+    std::vector<float> y(n), expected(n);
+    for (int i = 0; i < n; i++) {
+      double sum = bias[i];
+      for (int j = 0; j < k; j++) sum += (double)w[(size_t)i * k + j] * x[j];
+      expected[i] = tanh(sum);
+    }
+    dense(pool, w.data(), n, k, x.data(), bias.data(), y.data(), ACT_TANH, 0.f);
+    require_close(y, expected);
+  }
+}
+
+// writes a .cpumodel like cpumodel_convert.py does
+class ModelWriter {
+public:
+  int tensor(int kind, std::vector<int> dims, int base = -1, std::vector<float> w = {}) {
+    tensors.push_back({kind, dims, base, weights.size()});
+    weights.insert(weights.end(), w.begin(), w.end());
+    return tensors.size() - 1;
+  }
+
+  void layer(int op, std::vector<int> ins, int out, std::vector<int> attrs = {}, float alpha = 0.f) {
+    attrs.resize(12);
+    layers.push_back({op, ins, out, attrs, alpha});
+  }
+
+  void write(const std::string &fn, const std::vector<int> &inputs, int output) {
+    std::string s = "CPUMODEL";
+    put<int32_t>(s, {1, (int)tensors.size(), (int)layers.size(), (int)inputs.size(), 1});
+    put<uint64_t>(s, {weights.size()});
+    for (auto &t : tensors) {
+      std::vector<int> dims = t.dims;
+      dims.resize(4);
+      put<int32_t>(s, {t.kind, (int)t.dims.size(), dims[0], dims[1], dims[2], dims[3], t.base});
+      put<uint64_t>(s, {t.offset});
+    }
+    for (int i : inputs) {
+      const std::string name = "input_" + std::to_string(i);
+      put<int32_t>(s, {(int)name.size()});
+      s += name;
+      put<int32_t>(s, {i});
+    }
+    put<int32_t>(s, {output});
+    for (auto &l : layers) {
+      put<int32_t>(s, {l.op, 5});
+      s += "layer";
+      put<int32_t>(s, {(int)l.ins.size()});
+      put<int32_t>(s, l.ins);
+      put<int32_t>(s, {l.out});
+      put<int32_t>(s, l.attrs);
+      put<float>(s, {l.alpha, 0.f, 0.f, 0.f});
+    }
+    put<float>(s, weights);
+
+    FILE *f = fopen(fn.c_str(), "wb");
+    REQUIRE(f != NULL);
+    fwrite(s.data(), 1, s.size(), f);
+    fclose(f);
+  }
+
+private:
+  template <typename T>
+  static void put(std::string &s, const std::vector<T> &v) {
+    s.append((const char *)v.data(), v.size() * sizeof(T));
+  }
+
+  struct T {
+    int kind;
+    std::vector<int> dims;
+    int base;
+    uint64_t offset;
+  };
+  struct L {
+    int op;
+    std::vector<int> ins;
+    int out;
+    std::vector<int> attrs;
+    float alpha;
+  };
+  std::vector<T> tensors;
+  std::vector<L> layers;
+  std::vector<float> weights;
+};
+
+TEST_CASE("CPUModel runs a model file with the extra inputs bound") {
+  // image -> conv 3x3 + relu -> flatten, concat with desire, traffic convention
+  // and the recurrent state -> dense + tanh, the last 4 outputs are the state
+  const int C = 2, H = 6, W = 6, M = 3, DESIRE = 8, TRAFFIC = 2, STATE = 4, OUT = 10;
+  const int FEATURES = M * H * W + DESIRE + TRAFFIC + STATE;
+  const auto conv_w = random_vector(M * C * 9, 1), conv_b = random_vector(M, 2);
+  const auto dense_w = random_vector(OUT * FEATURES, 3), dense_b = random_vector(OUT, 4);
+
+  ModelWriter writer;
+  const int image = writer.tensor(2, {1, C, H, W});
+  const int desire = writer.tensor(2, {1, DESIRE});
+  const int traffic = writer.tensor(2, {1, TRAFFIC});
+  const int state = writer.tensor(2, {1, STATE});
+  const int cw = writer.tensor(1, {M, C, 3, 3}, -1, conv_w);
+  const int cb = writer.tensor(1, {M}, -1, conv_b);
+  const int conv = writer.tensor(0, {1, M, H, W});
+  const int flat = writer.tensor(3, {1, M * H * W}, conv);
+  const int features = writer.tensor(0, {1, FEATURES});
+  const int dw = writer.tensor(1, {OUT, FEATURES}, -1, dense_w);
+  const int db = writer.tensor(1, {OUT}, -1, dense_b);
+  const int out = writer.tensor(0, {1, OUT});
+  writer.layer(0, {image, cw, cb}, conv, {3, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, ACT_RELU});
+  writer.layer(7, {flat, desire, traffic, state}, features, {1});
+  writer.layer(1, {features, dw, db}, out, {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, ACT_TANH});
+  writer.write("/tmp/test_cpumodel.cpumodel", {image, desire, traffic, state}, out);
+
+  std::vector<float> output(OUT), desire_in(DESIRE), traffic_in = {1.f, 0.f};
+  desire_in[3] = 1.f;
+  CPUModel model("/tmp/test_cpumodel.dlc", output.data(), OUT, 0);
+  model.addRecurrent(&output[OUT - STATE], STATE);
+  model.addDesire(desire_in.data(), DESIRE);
+  model.addTrafficConvention(traffic_in.data(), TRAFFIC);
+
+  const auto input = random_vector(C * H * W, 5);
+  std::vector<float> expected(OUT);
+  for (int run = 0; run < 2; run++) {
+    // the state is what the run before left in the output
+    std::vector<float> x(FEATURES);
+    const ConvShape shape = conv_shape(C, H, W, 3, 1, 1, 1);
+    conv_reference(conv_w.data(), M, shape, input.data(), conv_b.data(), x.data(), ACT_RELU, 0.f);
+    std::copy(desire_in.begin(), desire_in.end(), &x[M * H * W]);
+    std::copy(traffic_in.begin(), traffic_in.end(), &x[M * H * W + DESIRE]);
+    std::copy(expected.end() - STATE, expected.end(), &x[M * H * W + DESIRE + TRAFFIC]);
+    for (int i = 0; i < OUT; i++) {
+      double sum = dense_b[i];
+      for (int j = 0; j < FEATURES; j++) sum += (double)dense_w[i * FEATURES + j] * x[j];
+      expected[i] = tanh(sum);
+    }
+
+    model.execute((float *)input.data(), input.size());
+    require_close(output, expected);
+  }
+}
+
+TEST_CASE("conv_gemm speed", "[.][benchmark]") {
+  // about the size of the middle of the vision model
+  const ConvShape shape = conv_shape(64, 32, 64, 3, 1, 1, 1);
+  const int m = 64, k = 64 * 9, runs = 20;
+  const auto w = random_vector((size_t)m * k, 1), in = random_vector((size_t)64 * 32 * 64, 2);
+  std::vector<float> packed(conv_packed_weights_size(m, k)), out((size_t)m * 32 * 64);
+  conv_pack_weights(w.data(), m, k, packed.data());
+  const double flops = 2. * m * k * 32 * 64;
+
+  for (int threads : {1, 2, 4}) {
+    ThreadPool pool(threads);
+    std::vector<float> workspace(conv_workspace_size(threads));
+    const double start = millis_since_boot();
+    for (int i = 0; i < runs; i++) {
+      conv_gemm(pool, packed.data(), m, shape, in.data(), NULL, out.data(), ACT_RELU, 0.f, workspace.data());
+    }
+    const double ms = (millis_since_boot() - start) / runs;
+    WARN(util::string_format("64x32x64 conv 3x3 to 64, %d threads: %.3f ms, %.1f GFLOP/s", threads, ms, flops / ms / 1e6));
+  }
+}
@@ -0,0 +1,173 @@
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "catch2/catch.hpp"
+#include "selfdrive/common/clutil.h"
+#include "selfdrive/common/timing.h"
+#include "selfdrive/common/util.h"
+#include "selfdrive/modeld/models/commonmodel.h"
+#include "selfdrive/modeld/transforms/loadyuv.h"
+#include "selfdrive/modeld/transforms/transform.h"
+#include "selfdrive/modeld/transforms/transform_cpu.h"
+
+// camera sized I420 frame of noise with some gradients
+static std::vector<uint8_t> make_frame(int width, int height) {
+  std::vector<uint8_t> yuv(width * height * 3 / 2);
+  std::mt19937 gen(1234);
+  std::uniform_int_distribution<int> noise(0, 63);
+  for (size_t i = 0; i < yuv.size(); i++) {
+    yuv[i] = (i % width) / 8 + (i / width) % 128 + noise(gen);
+  }
+  return yuv;
+}
+
+// model frame from camera frame, as from calibration: scaled, sheared and in perspective
+static const mat3 projections[] = {
+  {{1.0, 0.0, 0.0, 0.0, 1.0, 0.0, 0.0, 0.0, 1.0}},
+  {{0.9, 0.0, 200.5, 0.0, 0.9, 250.25, 0.0, 0.0, 1.0}},
+  {{1.1, 0.04, 280.0, -0.02, 1.2, 180.0, 0.00002, 0.0004, 1.0}},
+  // mostly outside of the frame
+  {{2.0, 0.3, 900.0, 0.1, 2.5, -300.0, 0.0, 0.001, 1.0}},
+};
+
+TEST_CASE("warp_rows matches the scalar version") {
+  const int width = 1164, height = 874;
+  const std::vector<uint8_t> frame = make_frame(width, height);
+  std::vector<uint8_t> out(MODEL_WIDTH * MODEL_HEIGHT), expected(out.size());
+
+  for (const mat3 &projection : projections) {
+    warp_rows_scalar(frame.data(), width, height, expected.data(), MODEL_WIDTH, 0, MODEL_HEIGHT, projection.v);
+    warp_rows(frame.data(), width, height, out.data(), MODEL_WIDTH, 0, MODEL_HEIGHT, projection.v);
+    REQUIRE(out == expected);
+  }
+}
+
+TEST_CASE("TransformCPU on threads matches warp_rows_scalar and the loadyuv layout") {
+  const int width = 1928, height = 1208;
+  const std::vector<uint8_t> frame = make_frame(width, height);
+  const int uv_size = (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2);
+  std::vector<uint8_t> y(MODEL_WIDTH * MODEL_HEIGHT), u(uv_size), v(uv_size);
+  std::vector<float> out(MODEL_FRAME_SIZE);
+
+  TransformCPU transform(4);
+  for (const mat3 &projection : projections) {
+    transform.warp(frame.data(), width, height, y.data(), u.data(), v.data(), MODEL_WIDTH, MODEL_HEIGHT, projection);
+
+    std::vector<uint8_t> expected_y(y.size()), expected_u(uv_size), expected_v(uv_size);
+    const mat3 projection_uv = transform_scale_buffer(projection, 0.5);
+    warp_rows_scalar(frame.data(), width, height, expected_y.data(), MODEL_WIDTH, 0, MODEL_HEIGHT, projection.v);
+    warp_rows_scalar(frame.data() + width * height, width / 2, height / 2, expected_u.data(), MODEL_WIDTH / 2, 0, MODEL_HEIGHT / 2, projection_uv.v);
+    warp_rows_scalar(frame.data() + width * height * 5 / 4, width / 2, height / 2, expected_v.data(), MODEL_WIDTH / 2, 0, MODEL_HEIGHT / 2, projection_uv.v);
+    REQUIRE(y == expected_y);
+    REQUIRE(u == expected_u);
+    REQUIRE(v == expected_v);
+  }
+
+  transform.loadyuv(y.data(), u.data(), v.data(), MODEL_WIDTH, MODEL_HEIGHT, out.data());
+  for (int r = 0; r < MODEL_HEIGHT; r++) {
+    for (int c = 0; c < MODEL_WIDTH; c++) {
+      // 02
+      // 13
+      const int plane = (r & 1) + (c & 1) * 2;
+      REQUIRE(out[plane * uv_size + (r / 2) * (MODEL_WIDTH / 2) + c / 2] == y[r * MODEL_WIDTH + c]);
+    }
+  }
+  for (int i = 0; i < uv_size; i++) {
+    REQUIRE(out[uv_size * 4 + i] == u[i]);
+    REQUIRE(out[uv_size * 5 + i] == v[i]);
+  }
+}
+
+// Only runs where there's an OpenCL device, from selfdrive/modeld for the kernels.
+// The GPU may round the coordinates differently, so a few pixels are off by one
+TEST_CASE("TransformCPU matches the OpenCL kernels") {
+  cl_device_id device_id = cl_find_device_id(CL_DEVICE_TYPE_DEFAULT);
+  if (!device_id) {
+    WARN("no OpenCL device, not compared");
+    return;
+  }
+  cl_context context = CL_CHECK_ERR(clCreateContext(NULL, 1, &device_id, NULL, NULL, &err));
+  cl_command_queue q = CL_CHECK_ERR(clCreateCommandQueue(context, device_id, 0, &err));
+
+  const int width = 1164, height = 874;
+  std::vector<uint8_t> frame = make_frame(width, height);
+  cl_mem frame_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, frame.size(), frame.data(), &err));
+  const int uv_size = (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2);
+  cl_mem y_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_WIDTH * MODEL_HEIGHT, NULL, &err));
+  cl_mem u_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, uv_size, NULL, &err));
+  cl_mem v_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, uv_size, NULL, &err));
+  cl_mem out_cl = CL_CHECK_ERR(clCreateBuffer(context, CL_MEM_READ_WRITE, MODEL_FRAME_SIZE * sizeof(float), NULL, &err));
+
+  Transform transform_cl;
+  LoadYUVState loadyuv_cl;
+  transform_init(&transform_cl, context, device_id);
+  loadyuv_init(&loadyuv_cl, context, device_id, MODEL_WIDTH, MODEL_HEIGHT);
+
+  TransformCPU transform(4);
+  std::vector<uint8_t> y(MODEL_WIDTH * MODEL_HEIGHT), u(uv_size), v(uv_size);
+  std::vector<float> out(MODEL_FRAME_SIZE), out_cl_host(MODEL_FRAME_SIZE);
+  for (const mat3 &projection : projections) {
+    transform_queue(&transform_cl, q, frame_cl, width, height, y_cl, u_cl, v_cl, MODEL_WIDTH, MODEL_HEIGHT, projection);
+    loadyuv_queue(&loadyuv_cl, q, y_cl, u_cl, v_cl, out_cl);
+    CL_CHECK(clEnqueueReadBuffer(q, out_cl, CL_TRUE, 0, out_cl_host.size() * sizeof(float), out_cl_host.data(), 0, nullptr, nullptr));
+
+    transform.warp(frame.data(), width, height, y.data(), u.data(), v.data(), MODEL_WIDTH, MODEL_HEIGHT, projection);
+    transform.loadyuv(y.data(), u.data(), v.data(), MODEL_WIDTH, MODEL_HEIGHT, out.data());
+
+    int max_diff = 0, diffs = 0;
+    for (int i = 0; i < MODEL_FRAME_SIZE; i++) {
+      const int diff = std::abs((int)out[i] - (int)out_cl_host[i]);
+      max_diff = std::max(max_diff, diff);
+      diffs += diff != 0;
+    }
+    INFO("max diff " << max_diff << ", " << diffs << " values differ");
+    REQUIRE(max_diff <= 1);
+    REQUIRE(diffs <= MODEL_FRAME_SIZE / 1000);
+  }
+
+  transform_destroy(&transform_cl);
+  loadyuv_destroy(&loadyuv_cl);
+  for (cl_mem m : {frame_cl, y_cl, u_cl, v_cl, out_cl}) {
+    CL_CHECK(clReleaseMemObject(m));
+  }
+  CL_CHECK(clReleaseCommandQueue(q));
+  CL_CHECK(clReleaseContext(context));
+}
+
+TEST_CASE("TransformCPU speed", "[.][benchmark]") {
+  const int width = 1928, height = 1208, runs = 100;
+  const std::vector<uint8_t> frame = make_frame(width, height);
+  const mat3 &projection = projections[2];
+  const int uv_size = (MODEL_WIDTH / 2) * (MODEL_HEIGHT / 2);
+  std::vector<uint8_t> y(MODEL_WIDTH * MODEL_HEIGHT), u(uv_size), v(uv_size);
+  std::vector<float> out(MODEL_FRAME_SIZE);
+
+  double start = millis_since_boot();
+  for (int i = 0; i < runs; i++) {
+    warp_rows_scalar(frame.data(), width, height, y.data(), MODEL_WIDTH, 0, MODEL_HEIGHT, projection.v);
+  }
+  const double scalar_ms = (millis_since_boot() - start) / runs;
+  start = millis_since_boot();
+  for (int i = 0; i < runs; i++) {
+    warp_rows(frame.data(), width, height, y.data(), MODEL_WIDTH, 0, MODEL_HEIGHT, projection.v);
+  }
+  WARN(util::string_format("%dx%d from %dx%d, y plane: scalar %.3f ms, vectorized %.3f ms", MODEL_WIDTH, MODEL_HEIGHT,
+                           width, height, scalar_ms, (millis_since_boot() - start) / runs));
+
+  for (int threads : {1, 2, 4}) {
+    TransformCPU transform(threads);
+    start = millis_since_boot();
+    for (int i = 0; i < runs; i++) {
+      transform.warp(frame.data(), width, height, y.data(), u.data(), v.data(), MODEL_WIDTH, MODEL_HEIGHT, projection);
+    }
+    const double warp_ms = (millis_since_boot() - start) / runs;
+    start = millis_since_boot();
+    for (int i = 0; i < runs; i++) {
+      transform.loadyuv(y.data(), u.data(), v.data(), MODEL_WIDTH, MODEL_HEIGHT, out.data());
+    }
+    WARN(util::string_format("%d threads: warp %.3f ms, loadyuv %.3f ms", threads, warp_ms, (millis_since_boot() - start) / runs));
+  }
+}
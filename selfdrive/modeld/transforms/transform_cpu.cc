@@ -0,0 +1,342 @@
+#include "selfdrive/modeld/transforms/transform_cpu.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// the vectorized coordinates have to round like the scalar ones
+#pragma STDC FP_CONTRACT OFF
+
+#define INTER_BITS 5
+#define INTER_TAB_SIZE (1 << INTER_BITS)
+#define INTER_REMAP_COEF_BITS 15
+#define INTER_REMAP_COEF_SCALE (1 << INTER_REMAP_COEF_BITS)
+
+namespace {
+
+inline int sat_short(int v) {
+  return std::clamp(v, SHRT_MIN, SHRT_MAX);
+}
+
+// rint, saturated like the kernel's float to int conversion
+inline int sat_rint(float v) {
+  float r = rintf(v);
+  if (!(r > (float)INT_MIN)) return INT_MIN;
+  if (r >= (float)INT_MAX) return INT_MAX;
+  return (int)r;
+}
+
+// itab0..3 of the kernel, by ay * INTER_TAB_SIZE + ax
+struct InterTab {
+  int16_t w[INTER_TAB_SIZE * INTER_TAB_SIZE][4];
+  InterTab() {
+    for (int ay = 0; ay < INTER_TAB_SIZE; ay++) {
+      for (int ax = 0; ax < INTER_TAB_SIZE; ax++) {
+        const float taby = 1.f/INTER_TAB_SIZE*ay;
+        const float tabx = 1.f/INTER_TAB_SIZE*ax;
+        int16_t *t = w[ay * INTER_TAB_SIZE + ax];
+        t[0] = sat_short(rintf((1.0f-taby)*(1.0f-tabx) * INTER_REMAP_COEF_SCALE));
+        t[1] = sat_short(rintf((1.0f-taby)*tabx * INTER_REMAP_COEF_SCALE));
+        t[2] = sat_short(rintf(taby*(1.0f-tabx) * INTER_REMAP_COEF_SCALE));
+        t[3] = sat_short(rintf(taby*tabx * INTER_REMAP_COEF_SCALE));
+      }
+    }
+  }
+};
+const InterTab inter_tab;
+
+inline void warp_coords(const float M[9], int dx, int dy, int *X, int *Y) {
+  const float X0 = M[0] * dx + M[1] * dy + M[2];
+  const float Y0 = M[3] * dx + M[4] * dy + M[5];
+  float W = M[6] * dx + M[7] * dy + M[8];
+  W = W != 0.0f ? INTER_TAB_SIZE / W : 0.0f;
+  *X = sat_rint(X0 * W);
+  *Y = sat_rint(Y0 * W);
+}
+
+// bilinear sample at X, Y in 1/INTER_TAB_SIZE pixels, 0 outside of src
+inline uint8_t warp_sample(const uint8_t *src, int cols, int rows, int X, int Y) {
+  const int sx = sat_short(X >> INTER_BITS);
+  const int sy = sat_short(Y >> INTER_BITS);
+  const int ay = Y & (INTER_TAB_SIZE - 1);
+  const int ax = X & (INTER_TAB_SIZE - 1);
+
+  auto px = [&](int x, int y) -> int {
+    return (x >= 0 && x < cols && y >= 0 && y < rows) ? src[y * cols + x] : 0;
+  };
+  const int16_t *w = inter_tab.w[ay * INTER_TAB_SIZE + ax];
+  const int val = px(sx, sy) * w[0] + px(sx+1, sy) * w[1] + px(sx, sy+1) * w[2] + px(sx+1, sy+1) * w[3];
+  return std::clamp((val + (1 << (INTER_REMAP_COEF_BITS-1))) >> INTER_REMAP_COEF_BITS, 0, 255);
+}
+
+#if defined(__x86_64__)
+
+// itab of the kernel from the a and b factors, like InterTab
+__attribute__((target("avx2")))
+inline __m256i coef_avx2(__m256 a, __m256 b) {
+  const __m256 c = _mm256_mul_ps(_mm256_mul_ps(a, b), _mm256_set1_ps(INTER_REMAP_COEF_SCALE));
+  const __m256i itab = _mm256_cvtps_epi32(_mm256_round_ps(c, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+  return _mm256_min_epi32(itab, _mm256_set1_epi32(SHRT_MAX));
+}
+
+// 8 pixels at a time. Where all 8 are far enough from the edges to read
+// their neighbours without bounds checks, they're sampled with gathers,
+// the rest falls back to warp_sample
+__attribute__((target("avx2")))
+void warp_rows_avx2(const uint8_t *src, int cols, int rows, uint8_t *dst, int dst_width,
+                    int y0, int y1, const float M[9]) {
+  const __m256 m0 = _mm256_set1_ps(M[0]), m3 = _mm256_set1_ps(M[3]), m6 = _mm256_set1_ps(M[6]);
+  const __m256 tab_size = _mm256_set1_ps(INTER_TAB_SIZE), zero = _mm256_setzero_ps();
+  const __m256 inv_tab = _mm256_set1_ps(1.f/INTER_TAB_SIZE), one = _mm256_set1_ps(1.0f);
+  const __m256i tab_mask = _mm256_set1_epi32(INTER_TAB_SIZE - 1), byte_mask = _mm256_set1_epi32(0xff);
+  const __m256i max_x = _mm256_set1_epi32(cols - 2), max_y = _mm256_set1_epi32(rows - 3);
+  const __m256i round = _mm256_set1_epi32(1 << (INTER_REMAP_COEF_BITS-1));
+  const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), low_dwords = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+
+  for (int dy = y0; dy < y1; dy++) {
+    uint8_t *out = dst + dy * dst_width;
+    const __m256 row_x = _mm256_set1_ps(M[1] * dy), row_y = _mm256_set1_ps(M[4] * dy), row_w = _mm256_set1_ps(M[7] * dy);
+    int dx = 0;
+    for (; dx + 8 <= dst_width; dx += 8) {
+      const __m256 vdx = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(dx), lanes));
+      const __m256 X0 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m0, vdx), row_x), _mm256_set1_ps(M[2]));
+      const __m256 Y0 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m3, vdx), row_y), _mm256_set1_ps(M[5]));
+      __m256 W = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(m6, vdx), row_w), _mm256_set1_ps(M[8]));
+      W = _mm256_and_ps(_mm256_div_ps(tab_size, W), _mm256_cmp_ps(W, zero, _CMP_NEQ_UQ));
+      // out of int range comes out as INT_MIN, which fails the range check below
+      const __m256i X = _mm256_cvtps_epi32(_mm256_round_ps(_mm256_mul_ps(X0, W), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+      const __m256i Y = _mm256_cvtps_epi32(_mm256_round_ps(_mm256_mul_ps(Y0, W), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC));
+      const __m256i sx = _mm256_srai_epi32(X, INTER_BITS), sy = _mm256_srai_epi32(Y, INTER_BITS);
+
+      // sx in [0, cols - 2] and sy in [0, rows - 3]: the 4 byte reads at
+      // (sx, sy) and (sx, sy + 1) stay in src
+      const __m256i outside = _mm256_or_si256(
+          _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), sx), _mm256_cmpgt_epi32(sx, max_x)),
+          _mm256_or_si256(_mm256_cmpgt_epi32(_mm256_setzero_si256(), sy), _mm256_cmpgt_epi32(sy, max_y)));
+      if (!_mm256_testz_si256(outside, outside)) {
+        for (int i = 0; i < 8; i++) {
+          int x, y;
+          warp_coords(M, dx + i, dy, &x, &y);
+          out[dx + i] = warp_sample(src, cols, rows, x, y);
+        }
+        continue;
+      }
+
+      const __m256i idx = _mm256_add_epi32(_mm256_mullo_epi32(sy, _mm256_set1_epi32(cols)), sx);
+      const __m256i top = _mm256_i32gather_epi32((const int *)src, idx, 1);
+      const __m256i bottom = _mm256_i32gather_epi32((const int *)(src + cols), idx, 1);
+      const __m256i v0 = _mm256_and_si256(top, byte_mask), v1 = _mm256_and_si256(_mm256_srli_epi32(top, 8), byte_mask);
+      const __m256i v2 = _mm256_and_si256(bottom, byte_mask), v3 = _mm256_and_si256(_mm256_srli_epi32(bottom, 8), byte_mask);
+
+      const __m256 taby = _mm256_mul_ps(inv_tab, _mm256_cvtepi32_ps(_mm256_and_si256(Y, tab_mask)));
+      const __m256 tabx = _mm256_mul_ps(inv_tab, _mm256_cvtepi32_ps(_mm256_and_si256(X, tab_mask)));
+      const __m256 ity = _mm256_sub_ps(one, taby), itx = _mm256_sub_ps(one, tabx);
+      __m256i val = _mm256_mullo_epi32(v0, coef_avx2(ity, itx));
+      val = _mm256_add_epi32(val, _mm256_mullo_epi32(v1, coef_avx2(ity, tabx)));
+      val = _mm256_add_epi32(val, _mm256_mullo_epi32(v2, coef_avx2(taby, itx)));
+      val = _mm256_add_epi32(val, _mm256_mullo_epi32(v3, coef_avx2(taby, tabx)));
+      val = _mm256_srai_epi32(_mm256_add_epi32(val, round), INTER_REMAP_COEF_BITS);
+
+      // 32 -> 8 bits, saturated, the first 4 bytes of each 128 bit lane
+      __m256i px = _mm256_packus_epi16(_mm256_packus_epi32(val, val), _mm256_setzero_si256());
+      px = _mm256_permutevar8x32_epi32(px, low_dwords);
+      _mm_storel_epi64((__m128i *)(out + dx), _mm256_castsi256_si128(px));
+    }
+    for (; dx < dst_width; dx++) {
+      int X, Y;
+      warp_coords(M, dx, dy, &X, &Y);
+      out[dx] = warp_sample(src, cols, rows, X, Y);
+    }
+  }
+}
+
+__attribute__((target("avx2")))
+void deinterleave_row_avx2(const uint8_t *in, int width, float *even, float *odd) {
+  const __m256i split = _mm256_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15,
+                                         0, 2, 4, 6, 8, 10, 12, 14, 1, 3, 5, 7, 9, 11, 13, 15);
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    __m256i v = _mm256_shuffle_epi8(_mm256_loadu_si256((const __m256i *)(in + x)), split);
+    // evens, then odds
+    v = _mm256_permute4x64_epi64(v, _MM_SHUFFLE(3, 1, 2, 0));
+    const __m128i e = _mm256_castsi256_si128(v), o = _mm256_extracti128_si256(v, 1);
+    _mm256_storeu_ps(even + x/2, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(e)));
+    _mm256_storeu_ps(even + x/2 + 8, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(e, 8))));
+    _mm256_storeu_ps(odd + x/2, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(o)));
+    _mm256_storeu_ps(odd + x/2 + 8, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_srli_si128(o, 8))));
+  }
+  for (; x < width; x += 2) {
+    even[x/2] = in[x];
+    odd[x/2] = in[x+1];
+  }
+}
+
+__attribute__((target("avx2")))
+void convert_row_avx2(const uint8_t *in, int width, float *out) {
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    _mm256_storeu_ps(out + x, _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(in + x)))));
+  }
+  for (; x < width; x++) {
+    out[x] = in[x];
+  }
+}
+
+const bool has_avx2 = []() {
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}();
+
+#elif defined(__ARM_NEON)
+
+// the coordinates 4 at a time, sampled one by one
+void warp_rows_neon(const uint8_t *src, int cols, int rows, uint8_t *dst, int dst_width,
+                    int y0, int y1, const float M[9]) {
+  const float32x4_t tab_size = vdupq_n_f32(INTER_TAB_SIZE);
+  const float32x4_t lanes = {0.f, 1.f, 2.f, 3.f};
+  for (int dy = y0; dy < y1; dy++) {
+    uint8_t *out = dst + dy * dst_width;
+    const float32x4_t row_x = vdupq_n_f32(M[1] * dy), row_y = vdupq_n_f32(M[4] * dy), row_w = vdupq_n_f32(M[7] * dy);
+    int dx = 0;
+    for (; dx + 4 <= dst_width; dx += 4) {
+      const float32x4_t vdx = vaddq_f32(vdupq_n_f32(dx), lanes);
+      const float32x4_t X0 = vaddq_f32(vaddq_f32(vmulq_n_f32(vdx, M[0]), row_x), vdupq_n_f32(M[2]));
+      const float32x4_t Y0 = vaddq_f32(vaddq_f32(vmulq_n_f32(vdx, M[3]), row_y), vdupq_n_f32(M[5]));
+      float32x4_t W = vaddq_f32(vaddq_f32(vmulq_n_f32(vdx, M[6]), row_w), vdupq_n_f32(M[8]));
+      const uint32x4_t nonzero = vmvnq_u32(vceqq_f32(W, vdupq_n_f32(0.f)));
+      W = vreinterpretq_f32_u32(vandq_u32(vreinterpretq_u32_f32(vdivq_f32(tab_size, W)), nonzero));
+      // vcvtnq rounds to nearest even and saturates, like sat_rint
+      int32_t X[4], Y[4];
+      vst1q_s32(X, vcvtnq_s32_f32(vmulq_f32(X0, W)));
+      vst1q_s32(Y, vcvtnq_s32_f32(vmulq_f32(Y0, W)));
+      for (int i = 0; i < 4; i++) {
+        out[dx + i] = warp_sample(src, cols, rows, X[i], Y[i]);
+      }
+    }
+    for (; dx < dst_width; dx++) {
+      int X, Y;
+      warp_coords(M, dx, dy, &X, &Y);
+      out[dx] = warp_sample(src, cols, rows, X, Y);
+    }
+  }
+}
+
+void deinterleave_row_neon(const uint8_t *in, int width, float *even, float *odd) {
+  auto store = [](float *out, uint8x16_t v) {
+    const uint16x8_t lo = vmovl_u8(vget_low_u8(v)), hi = vmovl_u8(vget_high_u8(v));
+    vst1q_f32(out, vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))));
+    vst1q_f32(out + 4, vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))));
+    vst1q_f32(out + 8, vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))));
+    vst1q_f32(out + 12, vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))));
+  };
+  int x = 0;
+  for (; x + 32 <= width; x += 32) {
+    const uint8x16x2_t v = vld2q_u8(in + x);
+    store(even + x/2, v.val[0]);
+    store(odd + x/2, v.val[1]);
+  }
+  for (; x < width; x += 2) {
+    even[x/2] = in[x];
+    odd[x/2] = in[x+1];
+  }
+}
+
+void convert_row_neon(const uint8_t *in, int width, float *out) {
+  int x = 0;
+  for (; x + 8 <= width; x += 8) {
+    const uint16x8_t v = vmovl_u8(vld1_u8(in + x));
+    vst1q_f32(out + x, vcvtq_f32_u32(vmovl_u16(vget_low_u16(v))));
+    vst1q_f32(out + x + 4, vcvtq_f32_u32(vmovl_u16(vget_high_u16(v))));
+  }
+  for (; x < width; x++) {
+    out[x] = in[x];
+  }
+}
+
+#endif
+
+void deinterleave_row(const uint8_t *in, int width, float *even, float *odd) {
+#if defined(__x86_64__)
+  if (has_avx2) return deinterleave_row_avx2(in, width, even, odd);
+#elif defined(__ARM_NEON)
+  return deinterleave_row_neon(in, width, even, odd);
+#endif
+  for (int x = 0; x < width; x += 2) {
+    even[x/2] = in[x];
+    odd[x/2] = in[x+1];
+  }
+}
+
+void convert_row(const uint8_t *in, int width, float *out) {
+#if defined(__x86_64__)
+  if (has_avx2) return convert_row_avx2(in, width, out);
+#elif defined(__ARM_NEON)
+  return convert_row_neon(in, width, out);
+#endif
+  for (int x = 0; x < width; x++) {
+    out[x] = in[x];
+  }
+}
+
+}  // namespace
+
+void warp_rows_scalar(const uint8_t *src, int src_width, int src_height,
+                      uint8_t *dst, int dst_width, int y0, int y1, const float M[9]) {
+  for (int dy = y0; dy < y1; dy++) {
+    for (int dx = 0; dx < dst_width; dx++) {
+      int X, Y;
+      warp_coords(M, dx, dy, &X, &Y);
+      dst[dy * dst_width + dx] = warp_sample(src, src_width, src_height, X, Y);
+    }
+  }
+}
+
+void warp_rows(const uint8_t *src, int src_width, int src_height,
+               uint8_t *dst, int dst_width, int y0, int y1, const float M[9]) {
+#if defined(__x86_64__)
+  if (has_avx2) return warp_rows_avx2(src, src_width, src_height, dst, dst_width, y0, y1, M);
+#elif defined(__ARM_NEON)
+  return warp_rows_neon(src, src_width, src_height, dst, dst_width, y0, y1, M);
+#endif
+  warp_rows_scalar(src, src_width, src_height, dst, dst_width, y0, y1, M);
+}
+
+TransformCPU::TransformCPU(int num_threads) : pool(num_threads) {}
+
+void TransformCPU::warp(const uint8_t *in_yuv, int in_width, int in_height,
+                        uint8_t *out_y, uint8_t *out_u, uint8_t *out_v,
+                        int out_width, int out_height, const mat3 &projection) {
+  // sampled using pixel center origin, uv is half the size of y. See transform_queue
+  const mat3 projection_uv = transform_scale_buffer(projection, 0.5);
+  const uint8_t *in_u = in_yuv + in_width * in_height;
+  const uint8_t *in_v = in_u + (in_width/2) * (in_height/2);
+
+  // the uv planes are done with the matching y rows
+  pool.parallel_for(out_height / 2, [&](int, int begin, int end) {
+    warp_rows(in_yuv, in_width, in_height, out_y, out_width, begin * 2, end * 2, projection.v);
+    warp_rows(in_u, in_width/2, in_height/2, out_u, out_width/2, begin, end, projection_uv.v);
+    warp_rows(in_v, in_width/2, in_height/2, out_v, out_width/2, begin, end, projection_uv.v);
+  });
+}
+
+void TransformCPU::loadyuv(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+                           int width, int height, float *out) {
+  // y is split in four by row and column parity:
+  // 02
+  // 13
+  const int uv_width = width/2, uv_size = (width/2) * (height/2);
+  pool.parallel_for(height / 2, [&](int, int begin, int end) {
+    for (int r = begin; r < end; r++) {
+      deinterleave_row(y + (2*r) * width, width, out + r * uv_width, out + uv_size*2 + r * uv_width);
+      deinterleave_row(y + (2*r + 1) * width, width, out + uv_size + r * uv_width, out + uv_size*3 + r * uv_width);
+      convert_row(u + r * uv_width, uv_width, out + uv_size*4 + r * uv_width);
+      convert_row(v + r * uv_width, uv_width, out + uv_size*5 + r * uv_width);
+    }
+  });
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+
+#include "selfdrive/common/mat.h"
+#include "selfdrive/common/thread_pool.h"
+
+// warpPerspective (transform.cl) and loadys/loaduv (loadyuv.cl) on the CPU,
+// for machines without OpenCL. Same fixed point math as the kernels, so the
+// output only differs where the GPU rounds the coordinates differently. Rows
+// are split over the threads, and vectorized with AVX2 (if the CPU has it)
+// or NEON.
+class TransformCPU {
+ public:
+  TransformCPU(int num_threads = 4);
+
+  // like transform_queue, in_yuv is a whole I420 frame
+  void warp(const uint8_t *in_yuv, int in_width, int in_height,
+            uint8_t *out_y, uint8_t *out_u, uint8_t *out_v,
+            int out_width, int out_height, const mat3 &projection);
+
+  // like loadyuv_queue, out holds width * height * 3 / 2 floats
+  void loadyuv(const uint8_t *y, const uint8_t *u, const uint8_t *v,
+               int width, int height, float *out);
+
+ private:
+  ThreadPool pool;
+};
+
+// one plane, rows [y0, y1) of dst. The reference the vectorized version
+// is tested against
+void warp_rows_scalar(const uint8_t *src, int src_width, int src_height,
+                      uint8_t *dst, int dst_width, int y0, int y1, const float M[9]);
+void warp_rows(const uint8_t *src, int src_width, int src_height,
+               uint8_t *dst, int dst_width, int y0, int y1, const float M[9]);
@@ -207,11 +207,14 @@ void CameraViewWidget::updateFrame() {
   }
 
   if (vipc_client->connected) {
-    VisionBuf *buf = vipc_client->recv();
+    VisionIpcBufExtra extra = {};
+    VisionBuf *buf = vipc_client->recv(&extra);
     if (buf != nullptr) {
       latest_frame = buf;
       update();
       emit frameUpdated();
+    } else if (extra.dropped) {
+      LOGW("visionIPC frame %d dropped, overwritten before it was received", extra.frame_id);
     } else {
       LOGE("visionIPC receive timeout");
     }
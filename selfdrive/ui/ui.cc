@@ -364,9 +364,12 @@ static void update_vision(UIState *s) {
   }
 
   if (s->vipc_client->connected) {
-    VisionBuf * buf = s->vipc_client->recv();
+    VisionIpcBufExtra extra = {};
+    VisionBuf * buf = s->vipc_client->recv(&extra);
     if (buf != nullptr) {
       s->last_frame = buf;
+    } else if (extra.dropped) {
+      LOGW("visionIPC frame %d dropped, overwritten before it was received", extra.frame_id);
     } else if (!Hardware::PC()) {
       LOGE("visionIPC receive timeout");
     }